@@ -0,0 +1,1280 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file acl.c
+ * @brief Per-interface IPv4 access control lists for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c.  Every interface can have an ingress
+ * and an egress ACL.  A rule matches on source and destination
+ * prefix, protocol, source and destination port ranges and DSCP, and
+ * the matching rule with the lowest priority number decides.
+ * Packets that match no rule are permitted, so an ACL that should
+ * only let some traffic through ends in a catch-all "deny".  Ports
+ * can only be matched for TCP and UDP; non-initial fragments have
+ * port 0.
+ *
+ * Rules are compiled for tuple space search.  Port ranges are split
+ * into prefixes, and every combination of a rule with one source and
+ * one destination port prefix goes into the hash table of its tuple,
+ * the set of masks for all fields (protocol and DSCP are either
+ * exact or wildcard).  A packet is classified by masking its header
+ * fields with the masks of a tuple and doing one exact-match lookup
+ * per tuple.  Tuples are sorted by the best rule they contain, so
+ * the search stops as soon as no remaining tuple can beat the match
+ * found so far.  The memory accesses per packet are thus bounded by
+ * the number of distinct tuples, which stays small even for
+ * thousands of rules, not by the number of rules.  The tables are
+ * rebuilt on every change; as control messages are processed between
+ * frames, packets never see a half-built classifier.
+ */
+
+
+/**
+ * Maximum number of rules in one ACL.
+ */
+#define ACL_MAX_RULES 65536
+
+/**
+ * Port prefix lengths are rounded up to multiples of this many bits.
+ */
+#define ACL_PORT_STRIDE 4
+
+/**
+ * Maximum number of prefixes a 16-bit port range splits into: at
+ * most 2 * (2^#ACL_PORT_STRIDE - 1) per prefix length.
+ */
+#define ACL_MAX_PORT_PREFIXES 128
+
+
+/**
+ * A rule of an ACL.
+ */
+struct AclRule
+{
+  /**
+   * Number of packets that matched this rule.
+   */
+  uint64_t hits;
+
+  /**
+   * Source network (masked).
+   */
+  struct in_addr src;
+
+  /**
+   * Destination network (masked).
+   */
+  struct in_addr dst;
+
+  /**
+   * Priority, lower numbers are evaluated first.  Unique in an ACL.
+   */
+  uint32_t prio;
+
+  /**
+   * Source port range (inclusive), 0-65535 for any.
+   */
+  uint16_t sport_lo;
+  uint16_t sport_hi;
+
+  /**
+   * Destination port range (inclusive), 0-65535 for any.
+   */
+  uint16_t dport_lo;
+  uint16_t dport_hi;
+
+  /**
+   * Prefix lengths of @e src and @e dst.
+   */
+  uint8_t src_len;
+  uint8_t dst_len;
+
+  /**
+   * IP protocol, only if @e match_proto.
+   */
+  uint8_t proto;
+
+  /**
+   * DSCP, only if @e match_dscp.
+   */
+  uint8_t dscp;
+
+  /**
+   * Does the rule match on @e proto?
+   */
+  bool match_proto;
+
+  /**
+   * Does the rule match on @e dscp?
+   */
+  bool match_dscp;
+
+  /**
+   * Drop matching packets (otherwise, forward them).
+   */
+  bool deny;
+};
+
+
+/**
+ * Header fields a packet is classified by, also used for the
+ * masks of a tuple.  Must not have implicit padding, as keys
+ * are compared with memcmp().
+ */
+struct AclKey
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t proto;
+  uint8_t dscp;
+  uint16_t zero;
+};
+
+
+/**
+ * Slot in the hash table of a tuple.
+ */
+struct AclEntry
+{
+  /**
+   * Masked header fields.
+   */
+  struct AclKey key;
+
+  /**
+   * Index of the rule in `struct Acl` plus one, 0 for a free slot.
+   */
+  uint32_t rule;
+};
+
+
+/**
+ * Rules that share the same masks.
+ */
+struct AclTuple
+{
+  /**
+   * Masks to apply to the fields of a packet.
+   */
+  struct AclKey mask;
+
+  /**
+   * Open-addressing hash table (load factor at most 1/2).
+   */
+  struct AclEntry *entries;
+
+  /**
+   * Number of slots in @e entries minus one (a power of two minus one).
+   */
+  uint32_t slot_mask;
+
+  /**
+   * Number of rule combinations in this tuple.
+   */
+  uint32_t count;
+
+  /**
+   * Index of the best (lowest priority number) rule in this tuple.
+   */
+  uint32_t best;
+};
+
+
+/**
+ * An access control list.
+ */
+struct Acl
+{
+  /**
+   * The rules, sorted by priority.
+   */
+  struct AclRule *rules;
+
+  /**
+   * Compiled classifier, sorted by @e best.
+   */
+  struct AclTuple *tuples;
+
+  /**
+   * Number of entries in @e rules.
+   */
+  unsigned int num_rules;
+
+  /**
+   * Number of entries in @e tuples.
+   */
+  unsigned int num_tuples;
+
+  /**
+   * Index into @e tuples by mask, only used while compiling.
+   * Slots hold the tuple's offset plus one, 0 for free.
+   */
+  uint32_t *tuple_index;
+
+  /**
+   * Number of slots in @e tuple_index minus one, 0 if none.
+   */
+  uint32_t tuple_index_mask;
+
+  /**
+   * Number of packets that matched no rule.
+   */
+  uint64_t unmatched;
+};
+
+
+/**
+ * Hash @a key.
+ *
+ * @param key masked header fields
+ * @return hash of @a key
+ */
+static uint32_t
+acl_hash (const struct AclKey *key)
+{
+  uint64_t a = key->src | ((uint64_t) key->dst << 32);
+  uint64_t b = key->sport | ((uint32_t) key->dport << 16)
+    | ((uint64_t) key->proto << 32) | ((uint64_t) key->dscp << 40);
+  uint64_t h;
+
+  h = a * 0x9E3779B97F4A7C15LLU ^ b;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDLLU;
+  h ^= h >> 33;
+  return (uint32_t) h;
+}
+
+
+/**
+ * Apply @a mask to @a pkt.
+ *
+ * @param pkt header fields of a packet
+ * @param mask masks of a tuple
+ * @param key[out] set to the masked fields
+ */
+static void
+acl_mask (const struct AclKey *pkt,
+          const struct AclKey *mask,
+          struct AclKey *key)
+{
+  key->src = pkt->src & mask->src;
+  key->dst = pkt->dst & mask->dst;
+  key->sport = pkt->sport & mask->sport;
+  key->dport = pkt->dport & mask->dport;
+  key->proto = pkt->proto & mask->proto;
+  key->dscp = pkt->dscp & mask->dscp;
+  key->zero = 0;
+}
+
+
+/**
+ * Split the port range @a lo to @a hi into prefixes.  Prefix lengths
+ * are rounded up to multiples of #ACL_PORT_STRIDE (controlled prefix
+ * expansion), so port ranges add at most five distinct masks per
+ * port to the tuples, no matter how many ranges there are.
+ *
+ * @param lo first port of the range
+ * @param hi last port of the range, at least @a lo
+ * @param values[out] set to the (masked) prefix values
+ * @param masks[out] set to the prefix masks
+ * @return number of prefixes, at most #ACL_MAX_PORT_PREFIXES
+ */
+static unsigned int
+acl_split_range (uint16_t lo,
+                 uint16_t hi,
+                 uint16_t values[ACL_MAX_PORT_PREFIXES],
+                 uint16_t masks[ACL_MAX_PORT_PREFIXES])
+{
+  uint32_t start = lo;
+  unsigned int n = 0;
+
+  while (start <= hi)
+  {
+    unsigned int bits = (0 == start)
+      ? 16
+      : __builtin_ctz (start);
+    uint32_t size;
+
+    while (start + (1U << bits) - 1 > hi)
+      bits--;
+    size = 1U << (bits - bits % ACL_PORT_STRIDE);
+    for (uint32_t end = start + (1U << bits); start < end; start += size)
+    {
+      values[n] = (uint16_t) start;
+      masks[n] = (uint16_t) ~(size - 1);
+      n++;
+    }
+  }
+  return n;
+}
+
+
+/**
+ * Free the compiled classifier of @a acl.
+ *
+ * @param acl ACL to clear the tuples of
+ */
+static void
+acl_free_tuples (struct Acl *acl)
+{
+  for (unsigned int i = 0; i < acl->num_tuples; i++)
+    free (acl->tuples[i].entries);
+  free (acl->tuples);
+  acl->tuples = NULL;
+  acl->num_tuples = 0;
+  free (acl->tuple_index);
+  acl->tuple_index = NULL;
+  acl->tuple_index_mask = 0;
+}
+
+
+/**
+ * Find the tuple of @a acl with @a mask, adding it if needed.
+ *
+ * @param acl ACL being compiled
+ * @param mask masks of the tuple
+ * @return NULL on out of memory
+ */
+static struct AclTuple *
+acl_get_tuple (struct Acl *acl,
+               const struct AclKey *mask)
+{
+  struct AclTuple *t;
+  uint32_t idx;
+
+  if (2 * acl->num_tuples >= acl->tuple_index_mask)
+  {
+    uint32_t slots = 2 * (acl->tuple_index_mask + 1);
+    uint32_t *index;
+
+    if (slots < 64)
+      slots = 64;
+    index = calloc (slots,
+                    sizeof (uint32_t));
+    if (NULL == index)
+      return NULL;
+    free (acl->tuple_index);
+    acl->tuple_index = index;
+    acl->tuple_index_mask = slots - 1;
+    for (uint32_t i = 0; i < acl->num_tuples; i++)
+    {
+      for (idx = acl_hash (&acl->tuples[i].mask) & acl->tuple_index_mask;
+           0 != index[idx];
+           idx = (idx + 1) & acl->tuple_index_mask)
+        ;
+      index[idx] = i + 1;
+    }
+  }
+  for (idx = acl_hash (mask) & acl->tuple_index_mask;
+       0 != acl->tuple_index[idx];
+       idx = (idx + 1) & acl->tuple_index_mask)
+  {
+    t = &acl->tuples[acl->tuple_index[idx] - 1];
+    if (0 == memcmp (&t->mask,
+                     mask,
+                     sizeof (*mask)))
+      return t;
+  }
+  if (0 == (acl->num_tuples & (acl->num_tuples - 1)))
+  {
+    unsigned int cap = (0 == acl->num_tuples) ? 1 : 2 * acl->num_tuples;
+
+    t = realloc (acl->tuples,
+                 cap * sizeof (struct AclTuple));
+    if (NULL == t)
+      return NULL;
+    acl->tuples = t;
+  }
+  acl->tuple_index[idx] = acl->num_tuples + 1;
+  t = &acl->tuples[acl->num_tuples++];
+  memset (t,
+          0,
+          sizeof (*t));
+  t->mask = *mask;
+  t->best = UINT32_MAX;
+  return t;
+}
+
+
+/**
+ * Add all combinations of rule @a i of @a acl with its port
+ * prefixes to the tuples.  In the first pass (@a insert false),
+ * the tuples are created and counted, in the second pass the
+ * combinations are inserted into the hash tables.  If a key is
+ * already present, the earlier (better) rule keeps it.
+ *
+ * @param acl ACL being compiled
+ * @param i index of the rule
+ * @param insert false for the first pass, true for the second
+ * @return 0 on success, 1 on out of memory
+ */
+static int
+acl_expand_rule (struct Acl *acl,
+                 uint32_t i,
+                 bool insert)
+{
+  const struct AclRule *r = &acl->rules[i];
+  uint16_t sv[ACL_MAX_PORT_PREFIXES];
+  uint16_t sm[ACL_MAX_PORT_PREFIXES];
+  uint16_t dv[ACL_MAX_PORT_PREFIXES];
+  uint16_t dm[ACL_MAX_PORT_PREFIXES];
+  unsigned int ns;
+  unsigned int nd;
+  struct AclKey mask;
+  struct AclKey key;
+
+  ns = acl_split_range (r->sport_lo,
+                        r->sport_hi,
+                        sv,
+                        sm);
+  nd = acl_split_range (r->dport_lo,
+                        r->dport_hi,
+                        dv,
+                        dm);
+  memset (&mask,
+          0,
+          sizeof (mask));
+  mask.src = (0 == r->src_len) ? 0 : htonl (~0U << (32 - r->src_len));
+  mask.dst = (0 == r->dst_len) ? 0 : htonl (~0U << (32 - r->dst_len));
+  mask.proto = r->match_proto ? 0xFF : 0;
+  mask.dscp = r->match_dscp ? 0x3F : 0;
+  key.src = r->src.s_addr & mask.src;
+  key.dst = r->dst.s_addr & mask.dst;
+  key.proto = r->proto & mask.proto;
+  key.dscp = r->dscp & mask.dscp;
+  key.zero = 0;
+  for (unsigned int s = 0; s < ns; s++)
+    for (unsigned int d = 0; d < nd; d++)
+    {
+      struct AclTuple *t;
+      uint32_t idx;
+
+      mask.sport = sm[s];
+      mask.dport = dm[d];
+      t = acl_get_tuple (acl,
+                         &mask);
+      if (NULL == t)
+        return 1;
+      if (! insert)
+      {
+        t->count++;
+        if (i < t->best)
+          t->best = i;
+        continue;
+      }
+      key.sport = sv[s];
+      key.dport = dv[d];
+      for (idx = acl_hash (&key) & t->slot_mask;
+           0 != t->entries[idx].rule;
+           idx = (idx + 1) & t->slot_mask)
+        if (0 == memcmp (&t->entries[idx].key,
+                         &key,
+                         sizeof (key)))
+          break;
+      if (0 == t->entries[idx].rule)
+      {
+        t->entries[idx].key = key;
+        t->entries[idx].rule = i + 1;
+      }
+    }
+  return 0;
+}
+
+
+/**
+ * Compare rules by priority, for qsort().
+ */
+static int
+acl_cmp_rules (const void *a,
+               const void *b)
+{
+  const struct AclRule *ra = a;
+  const struct AclRule *rb = b;
+
+  return (ra->prio > rb->prio) - (ra->prio < rb->prio);
+}
+
+
+/**
+ * Compare tuples by their best rule, for qsort().
+ */
+static int
+acl_cmp_tuples (const void *a,
+                const void *b)
+{
+  const struct AclTuple *ta = a;
+  const struct AclTuple *tb = b;
+
+  return (ta->best > tb->best) - (ta->best < tb->best);
+}
+
+
+/**
+ * (Re)build the classifier of @a acl from its rules.
+ *
+ * @param acl ACL to compile
+ * @return 0 on success, 1 on out of memory (then @a acl has no tuples)
+ */
+static int
+acl_compile (struct Acl *acl)
+{
+  acl_free_tuples (acl);
+  qsort (acl->rules,
+         acl->num_rules,
+         sizeof (struct AclRule),
+         &acl_cmp_rules);
+  for (uint32_t i = 0; i < acl->num_rules; i++)
+    if (0 != acl_expand_rule (acl,
+                              i,
+                              false))
+      goto oom;
+  for (unsigned int i = 0; i < acl->num_tuples; i++)
+  {
+    struct AclTuple *t = &acl->tuples[i];
+    uint32_t slots = 4;
+
+    while (slots < 2 * t->count)
+      slots *= 2;
+    t->entries = calloc (slots,
+                         sizeof (struct AclEntry));
+    if (NULL == t->entries)
+      goto oom;
+    t->slot_mask = slots - 1;
+  }
+  for (uint32_t i = 0; i < acl->num_rules; i++)
+    acl_expand_rule (acl,
+                     i,
+                     true);
+  free (acl->tuple_index);
+  acl->tuple_index = NULL;
+  acl->tuple_index_mask = 0;
+  qsort (acl->tuples,
+         acl->num_tuples,
+         sizeof (struct AclTuple),
+         &acl_cmp_tuples);
+  return 0;
+oom:
+  fprintf (stderr,
+           "Out of memory compiling ACL\n");
+  acl_free_tuples (acl);
+  return 1;
+}
+
+
+/**
+ * Find the best rule of @a acl matching @a pkt.
+ *
+ * @param acl ACL to search
+ * @param pkt header fields of the packet
+ * @return NULL if no rule matches
+ */
+static struct AclRule *
+acl_classify (const struct Acl *acl,
+              const struct AclKey *pkt)
+{
+  uint32_t best = UINT32_MAX;
+
+  for (unsigned int i = 0; i < acl->num_tuples; i++)
+  {
+    const struct AclTuple *t = &acl->tuples[i];
+    struct AclKey key;
+    uint32_t idx;
+
+    if (t->best >= best)
+      break; /* tuples are sorted, none of the rest can win */
+    acl_mask (pkt,
+              &t->mask,
+              &key);
+    for (idx = acl_hash (&key) & t->slot_mask;
+         0 != t->entries[idx].rule;
+         idx = (idx + 1) & t->slot_mask)
+    {
+      const struct AclEntry *e = &t->entries[idx];
+
+      if (0 != memcmp (&e->key,
+                       &key,
+                       sizeof (key)))
+        continue;
+      if (e->rule - 1 < best)
+        best = e->rule - 1;
+      break;
+    }
+  }
+  if (UINT32_MAX == best)
+    return NULL;
+  return &acl->rules[best];
+}
+
+
+/**
+ * Check IPv4 packet @a ip against @a acl.
+ *
+ * @param acl ACL to apply, NULL to permit everything
+ * @param ip the IPv4 packet
+ * @param size number of bytes in @a ip
+ * @return true to forward the packet, false to drop it
+ */
+static bool
+acl_check (struct Acl *acl,
+           const char *ip,
+           size_t size)
+{
+  struct AclKey pkt;
+  struct AclRule *r;
+  size_t hlen;
+  size_t total;
+
+  if (NULL == acl)
+    return true;
+  if (size < sizeof (struct IPv4Header))
+    return true; /* route() complains */
+  hlen = IPV4_HLEN (ip);
+  total = get_be16 (IPV4_FIELD (ip, total_length));
+  if ( (4 != IPV4_VERSION (ip)) ||
+       (hlen < sizeof (struct IPv4Header)) ||
+       (total < hlen) ||
+       (total > size) )
+    return true;
+  memset (&pkt,
+          0,
+          sizeof (pkt));
+  pkt.src = get_u32 (IPV4_FIELD (ip, source_address));
+  pkt.dst = get_u32 (IPV4_FIELD (ip, destination_address));
+  pkt.proto = *(const uint8_t *) IPV4_FIELD (ip, protocol);
+  pkt.dscp = *(const uint8_t *) IPV4_FIELD (ip, diff_serv) >> 2;
+  if ( ( (IPPROTO_TCP == pkt.proto) ||
+         (IPPROTO_UDP == pkt.proto) ) &&
+       (total - hlen >= 4) &&
+       (0 == (get_be16 (IPV4_FIELD (ip, fragmentation_info)) & 0x1FFF)) )
+  {
+    pkt.sport = get_be16 (&ip[hlen]);
+    pkt.dport = get_be16 (&ip[hlen + 2]);
+  }
+  r = acl_classify (acl,
+                    &pkt);
+  if (NULL == r)
+  {
+    acl->unmatched++;
+    return true;
+  }
+  r->hits++;
+  return ! r->deny;
+}
+
+
+/**
+ * Apply the ingress ACL of @a ifc to @a ip.
+ *
+ * @param ifc interface @a ip was received on
+ * @param ip the IPv4 packet
+ * @param size number of bytes in @a ip
+ * @return true to route the packet, false to drop it
+ */
+static bool
+acl_ingress (const struct Interface *ifc,
+             const char *ip,
+             size_t size)
+{
+  return acl_check (ifc->acl_in,
+                    ip,
+                    size);
+}
+
+
+/**
+ * Apply the egress ACL of @a ifc to @a ip.
+ *
+ * @param ifc interface @a ip is about to be sent on
+ * @param ip the IPv4 packet
+ * @param size number of bytes in @a ip
+ * @return true to send the packet, false to drop it
+ */
+static bool
+acl_egress (const struct Interface *ifc,
+            const char *ip,
+            size_t size)
+{
+  return acl_check (ifc->acl_out,
+                    ip,
+                    size);
+}
+
+
+/**
+ * Release @a acl.
+ *
+ * @param acl ACL to free, can be NULL
+ */
+static void
+acl_free (struct Acl *acl)
+{
+  if (NULL == acl)
+    return;
+  acl_free_tuples (acl);
+  free (acl->rules);
+  free (acl);
+}
+
+
+/**
+ * Move the ACLs over to a new set of interfaces after a
+ * configuration reload.  Interfaces are matched by name, the ACLs of
+ * removed interfaces are dropped.  Must be called while the old
+ * interfaces are still valid.
+ *
+ * @param nifc the new interfaces
+ * @param nnum number of entries in @a nifc
+ */
+static void
+acl_rebind (struct Interface *nifc,
+            unsigned int nnum)
+{
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    struct Interface *o = &gifc[i];
+    struct Interface *n = NULL;
+
+    for (unsigned int k = 0; k < nnum; k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           o->name))
+        n = &nifc[k];
+    if (NULL == n)
+    {
+      acl_free (o->acl_in);
+      acl_free (o->acl_out);
+    }
+    else
+    {
+      n->acl_in = o->acl_in;
+      n->acl_out = o->acl_out;
+    }
+    o->acl_in = NULL;
+    o->acl_out = NULL;
+  }
+}
+
+
+/**
+ * Parse "IFC in|out" from the strtok() buffer.
+ *
+ * @return NULL on error, otherwise where the ACL of that interface
+ *         and direction is stored
+ */
+static struct Acl **
+acl_parse_target ()
+{
+  const char *name = strtok (NULL, " ");
+  const char *dir = strtok (NULL, " ");
+  struct Interface *ifc;
+
+  if ( (NULL == name) ||
+       (NULL == dir) )
+    return NULL;
+  ifc = find_interface (name);
+  if (NULL == ifc)
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             name);
+    return NULL;
+  }
+  if (0 == strcasecmp (dir,
+                       "in"))
+    return &ifc->acl_in;
+  if (0 == strcasecmp (dir,
+                       "out"))
+    return &ifc->acl_out;
+  fprintf (stderr,
+           "Expected `in' or `out', not `%s'\n",
+           dir);
+  return NULL;
+}
+
+
+/**
+ * Parse port range @a arg, "PORT" or "LO-HI".
+ *
+ * @param arg text to parse
+ * @param lo[out] first port of the range
+ * @param hi[out] last port of the range
+ * @return 0 on success
+ */
+static int
+acl_parse_ports (const char *arg,
+                 uint16_t *lo,
+                 uint16_t *hi)
+{
+  unsigned int a;
+  unsigned int b;
+  char dummy;
+
+  if (1 == sscanf (arg,
+                   "%u%c",
+                   &a,
+                   &dummy))
+    b = a;
+  else if (2 != sscanf (arg,
+                        "%u-%u%c",
+                        &a,
+                        &b,
+                        &dummy))
+    return 1;
+  if ( (a > b) ||
+       (b > UINT16_MAX) )
+    return 1;
+  *lo = (uint16_t) a;
+  *hi = (uint16_t) b;
+  return 0;
+}
+
+
+/**
+ * Parse the match fields of a rule from the strtok() buffer.
+ *
+ * @param r[in,out] rule to update, must match everything initially
+ * @return 0 on success
+ */
+static int
+acl_parse_match (struct AclRule *r)
+{
+  const char *tok;
+
+  while (NULL != (tok = strtok (NULL, " ")))
+  {
+    const char *arg = strtok (NULL, " ");
+    struct in_addr mask;
+    unsigned int val;
+    char dummy;
+
+    if (NULL == arg)
+    {
+      fprintf (stderr,
+               "`%s' lacks an argument\n",
+               tok);
+      return 1;
+    }
+    if ( (0 == strcasecmp (tok,
+                           "src")) ||
+         (0 == strcasecmp (tok,
+                           "dst")) )
+    {
+      bool src = (0 == strcasecmp (tok,
+                                   "src"));
+      struct in_addr *net = src ? &r->src : &r->dst;
+
+      if (0 != parse_network (net,
+                              &mask,
+                              arg))
+        return 1;
+      net->s_addr &= mask.s_addr;
+      if (src)
+        r->src_len = __builtin_popcount (mask.s_addr);
+      else
+        r->dst_len = __builtin_popcount (mask.s_addr);
+    }
+    else if (0 == strcasecmp (tok,
+                              "proto"))
+    {
+      if (0 == strcasecmp (arg,
+                           "tcp"))
+        val = IPPROTO_TCP;
+      else if (0 == strcasecmp (arg,
+                                "udp"))
+        val = IPPROTO_UDP;
+      else if (0 == strcasecmp (arg,
+                                "icmp"))
+        val = IPPROTO_ICMP;
+      else if ( (1 != sscanf (arg,
+                              "%u%c",
+                              &val,
+                              &dummy)) ||
+                (val > UINT8_MAX) )
+      {
+        fprintf (stderr,
+                 "Protocol `%s' invalid\n",
+                 arg);
+        return 1;
+      }
+      r->proto = (uint8_t) val;
+      r->match_proto = true;
+    }
+    else if (0 == strcasecmp (tok,
+                              "sport"))
+    {
+      if (0 != acl_parse_ports (arg,
+                                &r->sport_lo,
+                                &r->sport_hi))
+      {
+        fprintf (stderr,
+                 "Port range `%s' invalid\n",
+                 arg);
+        return 1;
+      }
+    }
+    else if (0 == strcasecmp (tok,
+                              "dport"))
+    {
+      if (0 != acl_parse_ports (arg,
+                                &r->dport_lo,
+                                &r->dport_hi))
+      {
+        fprintf (stderr,
+                 "Port range `%s' invalid\n",
+                 arg);
+        return 1;
+      }
+    }
+    else if (0 == strcasecmp (tok,
+                              "dscp"))
+    {
+      if ( (1 != sscanf (arg,
+                         "%u%c",
+                         &val,
+                         &dummy)) ||
+           (val > 63) )
+      {
+        fprintf (stderr,
+                 "DSCP `%s' invalid\n",
+                 arg);
+        return 1;
+      }
+      r->dscp = (uint8_t) val;
+      r->match_dscp = true;
+    }
+    else
+    {
+      fprintf (stderr,
+               "Unknown match `%s'\n",
+               tok);
+      return 1;
+    }
+  }
+  if ( ( (0 != r->sport_lo) ||
+         (UINT16_MAX != r->sport_hi) ||
+         (0 != r->dport_lo) ||
+         (UINT16_MAX != r->dport_hi) ) &&
+       ( (! r->match_proto) ||
+         ( (IPPROTO_TCP != r->proto) &&
+           (IPPROTO_UDP != r->proto) ) ) )
+  {
+    fprintf (stderr,
+             "Ports require `proto tcp' or `proto udp'\n");
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse a priority from the strtok() buffer.
+ *
+ * @param prio[out] set to the priority
+ * @return 0 on success
+ */
+static int
+acl_parse_prio (uint32_t *prio)
+{
+  const char *tok = strtok (NULL, " ");
+  unsigned int val;
+  char dummy;
+
+  if ( (NULL == tok) ||
+       (1 != sscanf (tok,
+                     "%u%c",
+                     &val,
+                     &dummy)) )
+  {
+    fprintf (stderr,
+             "Expected priority, not `%s'\n",
+             tok);
+    return 1;
+  }
+  *prio = val;
+  return 0;
+}
+
+
+/**
+ * Add a rule: "acl add IFC in|out PRIO permit|deny [MATCH...]".
+ * A rule with the same priority is replaced.
+ */
+static void
+process_cmd_acl_add ()
+{
+  struct Acl **slot;
+  struct Acl *acl;
+  struct AclRule r;
+  const char *action;
+  unsigned int i;
+
+  if (NULL == (slot = acl_parse_target ()))
+    goto usage;
+  memset (&r,
+          0,
+          sizeof (r));
+  r.sport_hi = UINT16_MAX;
+  r.dport_hi = UINT16_MAX;
+  if (0 != acl_parse_prio (&r.prio))
+    return;
+  action = strtok (NULL, " ");
+  if (NULL == action)
+    goto usage;
+  if (0 == strcasecmp (action,
+                       "deny"))
+    r.deny = true;
+  else if (0 != strcasecmp (action,
+                            "permit"))
+    goto usage;
+  if (0 != acl_parse_match (&r))
+    return;
+  acl = *slot;
+  if (NULL == acl)
+  {
+    acl = calloc (1,
+                  sizeof (struct Acl));
+    if (NULL == acl)
+    {
+      fprintf (stderr,
+               "Out of memory\n");
+      return;
+    }
+  }
+  for (i = 0; i < acl->num_rules; i++)
+    if (acl->rules[i].prio == r.prio)
+      break;
+  if (i == acl->num_rules)
+  {
+    struct AclRule *rules;
+
+    if (ACL_MAX_RULES == acl->num_rules)
+    {
+      fprintf (stderr,
+               "ACL full\n");
+      return;
+    }
+    rules = realloc (acl->rules,
+                     (acl->num_rules + 1) * sizeof (struct AclRule));
+    if (NULL == rules)
+    {
+      fprintf (stderr,
+               "Out of memory\n");
+      if (NULL == *slot)
+        acl_free (acl);
+      return;
+    }
+    acl->rules = rules;
+    acl->num_rules++;
+  }
+  acl->rules[i] = r;
+  acl_compile (acl);
+  *slot = acl;
+  return;
+usage:
+  fprintf (stderr,
+           "Usage: acl add IFC in|out PRIO permit|deny [src NET/LEN] [dst NET/LEN] [proto tcp|udp|icmp|NUM] [sport LO[-HI]] [dport LO[-HI]] [dscp DSCP]\n");
+}
+
+
+/**
+ * Delete a rule: "acl del IFC in|out PRIO".
+ */
+static void
+process_cmd_acl_del ()
+{
+  struct Acl **slot;
+  struct Acl *acl;
+  uint32_t prio;
+
+  if (NULL == (slot = acl_parse_target ()))
+  {
+    fprintf (stderr,
+             "Usage: acl del IFC in|out PRIO\n");
+    return;
+  }
+  if (0 != acl_parse_prio (&prio))
+    return;
+  acl = *slot;
+  for (unsigned int i = 0; (NULL != acl) && (i < acl->num_rules); i++)
+  {
+    if (acl->rules[i].prio != prio)
+      continue;
+    memmove (&acl->rules[i],
+             &acl->rules[i + 1],
+             (acl->num_rules - i - 1) * sizeof (struct AclRule));
+    acl->num_rules--;
+    if (0 == acl->num_rules)
+    {
+      acl_free (acl);
+      *slot = NULL;
+      return;
+    }
+    acl_compile (acl);
+    return;
+  }
+  fprintf (stderr,
+           "No such rule\n");
+}
+
+
+/**
+ * Print the rules of @a acl.
+ *
+ * @param name name of the interface
+ * @param dir "in" or "out"
+ * @param acl ACL to print, can be NULL
+ */
+static void
+acl_print (const char *name,
+           const char *dir,
+           const struct Acl *acl)
+{
+  if (NULL == acl)
+    return;
+  print ("%s %s: %u rule(s) in %u tuple(s), %llu packet(s) unmatched\n",
+         name,
+         dir,
+         acl->num_rules,
+         acl->num_tuples,
+         (unsigned long long) acl->unmatched);
+  for (unsigned int i = 0; i < acl->num_rules; i++)
+  {
+    const struct AclRule *r = &acl->rules[i];
+    char match[256];
+    size_t off = 0;
+    char net[INET_ADDRSTRLEN];
+
+    match[0] = '\0';
+    if (0 != r->src_len)
+      off += snprintf (&match[off],
+                       sizeof (match) - off,
+                       " src %s/%u",
+                       inet_ntop (AF_INET,
+                                  &r->src,
+                                  net,
+                                  sizeof (net)),
+                       (unsigned int) r->src_len);
+    if (0 != r->dst_len)
+      off += snprintf (&match[off],
+                       sizeof (match) - off,
+                       " dst %s/%u",
+                       inet_ntop (AF_INET,
+                                  &r->dst,
+                                  net,
+                                  sizeof (net)),
+                       (unsigned int) r->dst_len);
+    if (r->match_proto)
+      off += snprintf (&match[off],
+                       sizeof (match) - off,
+                       " proto %u",
+                       (unsigned int) r->proto);
+    if ( (0 != r->sport_lo) ||
+         (UINT16_MAX != r->sport_hi) )
+      off += snprintf (&match[off],
+                       sizeof (match) - off,
+                       " sport %u-%u",
+                       (unsigned int) r->sport_lo,
+                       (unsigned int) r->sport_hi);
+    if ( (0 != r->dport_lo) ||
+         (UINT16_MAX != r->dport_hi) )
+      off += snprintf (&match[off],
+                       sizeof (match) - off,
+                       " dport %u-%u",
+                       (unsigned int) r->dport_lo,
+                       (unsigned int) r->dport_hi);
+    if (r->match_dscp)
+      snprintf (&match[off],
+                sizeof (match) - off,
+                " dscp %u",
+                (unsigned int) r->dscp);
+    print ("  %u %s%s (%llu hits)\n",
+           (unsigned int) r->prio,
+           r->deny ? "deny" : "permit",
+           match,
+           (unsigned long long) r->hits);
+  }
+}
+
+
+/**
+ * List ACLs: "acl [list [IFC]]".
+ */
+static void
+process_cmd_acl_list ()
+{
+  const char *name = strtok (NULL, " ");
+
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    const struct Interface *ifc = &gifc[i];
+
+    if ( (NULL != name) &&
+         (0 != strcasecmp (name,
+                           ifc->name)) )
+      continue;
+    acl_print (ifc->name,
+               "in",
+               ifc->acl_in);
+    acl_print (ifc->name,
+               "out",
+               ifc->acl_out);
+  }
+}
+
+
+/**
+ * The user entered an "acl" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_acl ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_acl_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_acl_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_acl_list ();
+  else if (0 == strcasecmp ("flush",
+                            subcommand))
+  {
+    struct Acl **slot = acl_parse_target ();
+
+    if (NULL == slot)
+    {
+      fprintf (stderr,
+               "Usage: acl flush IFC in|out\n");
+      return;
+    }
+    acl_free (*slot);
+    *slot = NULL;
+  }
+  else
+    fprintf (stderr,
+             "Usage: acl [add|del|list|flush] ...\n");
+}
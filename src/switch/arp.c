@@ -23,6 +23,7 @@
  */
 #include "glab.h"
 #include "print.c"
+#include "packet.h"
 
 /**
  * gcc 4.x-ism to pack structures (to be used before structs);
@@ -31,18 +32,6 @@
  */
 _Pragma("pack(push)") _Pragma("pack(1)")
 
-struct EthernetHeader
-{
-  struct MacAddress dst;
-  struct MacAddress src;
-
-  /**
-   * See ETH_P-values.
-   */
-  uint16_t tag;
-};
-
-
 /**
  * ARP header for Ethernet-IPv4.
  */
@@ -146,37 +135,6 @@ static unsigned int num_ifc;
 static struct Interface *gifc;
 
 
-/**
- * Forward @a frame to interface @a dst.
- *
- * @param dst target interface to send the frame out on
- * @param frame the frame to forward
- * @param frame_size number of bytes in @a frame
- */
-static void
-forward_to (struct Interface *dst,
-	    const void *frame,
-	    size_t frame_size)
-{
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  if (frame_size > dst->mtu)
-    abort ();
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-	  &hdr,
-	  sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-	  frame,
-	  frame_size);
-  write_all (STDOUT_FILENO,
-	     iob,
-	     sizeof (iob));
-}
-
-
 /**
  * Parse and process frame received on @a ifc.
  *
@@ -189,40 +147,22 @@ parse_frame (struct Interface *ifc,
 	     const void *frame,
 	     size_t frame_size)
 {
-  struct EthernetHeader eh;
-  const char *cframe = frame;
+  struct EthernetFrame ef;
 
-  if (frame_size < sizeof (eh))
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      false,
+                      &ef))
   {
     fprintf (stderr,
 	     "Malformed frame\n");
     return;
   }
-  memcpy (&eh,
-	  frame,
-	  sizeof (eh));
   /* DO WORK HERE */
 }
 
 
-/**
- * Process frame received from @a interface.
- *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
- * @param frame_size number of bytes in @a frame
- */
-static void
-handle_frame (uint16_t interface,
-	      const void *frame,
-	      size_t frame_size)
-{
-  if (interface > num_ifc)
-    abort ();
-  parse_frame (&gifc[interface - 1],
-	       frame,
-	       frame_size);
-}
+GLAB_DEFINE_HANDLE_FRAME (num_ifc, &gifc[interface - 1], parse_frame)
 
 
 /**
@@ -234,7 +174,6 @@ process_cmd_arp ()
 {
   const char *tok = strtok (NULL, " ");
   struct in_addr v4;
-  struct MacAddress mac;
   struct Interface *ifc;
 
   if (NULL == tok)
@@ -443,20 +382,7 @@ handle_control (char *cmd,
 }
 
 
-/**
- * Handle MAC information @a mac
- *
- * @param ifc_num number of the interface with @a mac
- * @param mac the MAC address at @a ifc_num
- */
-static void
-handle_mac (uint16_t ifc_num,
-	    const struct MacAddress *mac)
-{
-  if (ifc_num > num_ifc)
-    abort ();
-  gifc[ifc_num - 1].mac = *mac;
-}
+GLAB_DEFINE_HANDLE_MAC (num_ifc, &gifc[ifc_num - 1])
 
 
 #include "loop.c"
@@ -0,0 +1,1272 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * @file bpf.h
+ * @brief Classic BPF ingress filters with an x86-64 JIT
+ * @author Christian Grothoff
+ *
+ * Compiled in by programs that define GLAB_BPF to 1 before including
+ * packet.h (switch, router and parser).  Each interface can have one
+ * filter, run by GLAB_DEFINE_HANDLE_FRAME() before the frame is
+ * processed; frames for which it returns 0 are dropped.  Filters are
+ * classic BPF as produced by `tcpdump -ddd EXPRESSION`, given either
+ * inline with commas for newlines or as the name of a file with that
+ * output:
+ *
+ *   filter PORT 4,40 0 0 12,21 0 1 2054,6 0 0 0,6 0 0 65535
+ *   filter PORT /tmp/not-arp.bpf
+ *   filter PORT off
+ *   filter jit on|off
+ *   filter
+ *
+ * where PORT is an interface number or "all".  Filters are checked
+ * like the kernel does (forward jumps only, in range, ending in a
+ * return, no constant division by zero or oversized shifts) and
+ * interpreted.  With the JIT on (the default on x86-64), a filter that
+ * ran #BPF_JIT_THRESHOLD times is compiled to machine code.  Turning
+ * the JIT off makes all filters interpreted again, compiled or not.
+ *
+ * Loads beyond the end of the frame make the filter return 0, as do
+ * divisions by a zero X.  Shifts by X use the low 5 bits of X, like
+ * the hardware.  There are no ancillary (SKF_AD_*) loads, as frames
+ * still carry their 802.1Q tags.
+ */
+
+#ifndef GLAB_BPF_H
+#define GLAB_BPF_H
+
+#ifndef GLAB_BPF
+#define GLAB_BPF 0
+#endif
+
+#if GLAB_BPF
+
+#include <linux/filter.h>
+#include <sys/mman.h>
+
+#ifndef GLAB_BPF_JIT
+#if defined(__x86_64__)
+#define GLAB_BPF_JIT 1
+#else
+#define GLAB_BPF_JIT 0
+#endif
+#endif
+
+
+/**
+ * Number of runs after which a filter is compiled.
+ */
+#define BPF_JIT_THRESHOLD 64
+
+/**
+ * Upper bound on the machine code generated per instruction.
+ */
+#define BPF_JIT_MAX_INSN 48
+
+
+/**
+ * Compiled filter: returns the cBPF result for @a frame.
+ */
+typedef uint32_t
+(*BpfJitFunction) (const uint8_t *frame,
+                   uint32_t frame_size);
+
+
+/**
+ * A filter attached to an interface.
+ */
+struct BpfFilter
+{
+  /**
+   * The program.
+   */
+  struct sock_filter *insns;
+
+  /**
+   * Number of instructions in @e insns.
+   */
+  unsigned int len;
+
+  /**
+   * Compiled program, NULL if not (yet) compiled.
+   */
+  BpfJitFunction jit;
+
+  /**
+   * Executable mapping holding @e jit.
+   */
+  void *jit_mem;
+
+  /**
+   * Size of @e jit_mem.
+   */
+  size_t jit_size;
+
+  /**
+   * Frames the filter ran on.
+   */
+  uint64_t runs;
+
+  /**
+   * Frames it dropped.
+   */
+  uint64_t drops;
+};
+
+
+/**
+ * Filters indexed by interface number - 1, NULL if none.
+ */
+static struct BpfFilter **bpf_filters;
+
+/**
+ * Number of entries in #bpf_filters.
+ */
+static unsigned int bpf_num_ifc;
+
+/**
+ * Do we compile hot filters?
+ */
+static bool bpf_jit_enabled = GLAB_BPF_JIT;
+
+
+/**
+ * Allocate the per-interface filter table.  Called by loop() once
+ * the number of interfaces is known.
+ *
+ * @param num_ifc number of interfaces
+ */
+static void
+bpf_init (unsigned int num_ifc)
+{
+  bpf_filters = calloc (num_ifc,
+                        sizeof (struct BpfFilter *));
+  if (NULL == bpf_filters)
+  {
+    fprintf (stderr,
+             "Failed to allocate filter table\n");
+    exit (1);
+  }
+  bpf_num_ifc = num_ifc;
+}
+
+
+/**
+ * Load @a size bytes from @a frame at @a off in network byte order.
+ *
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ * @param off offset to load from
+ * @param size 1, 2 or 4
+ * @param[out] v set to the value
+ * @return false if the load is out of bounds
+ */
+static inline bool
+bpf_load (const uint8_t *frame,
+          uint32_t frame_size,
+          uint64_t off,
+          unsigned int size,
+          uint32_t *v)
+{
+  if (off + size > frame_size)
+    return false;
+  switch (size)
+  {
+  case 1:
+    *v = frame[off];
+    break;
+  case 2:
+    *v = get_be16 (&frame[off]);
+    break;
+  default:
+    *v = ntohl (get_u32 (&frame[off]));
+    break;
+  }
+  return true;
+}
+
+
+/**
+ * Size in bytes of the load in @a code.
+ */
+static inline unsigned int
+bpf_load_size (uint16_t code)
+{
+  switch (BPF_SIZE (code))
+  {
+  case BPF_B:
+    return 1;
+  case BPF_H:
+    return 2;
+  default:
+    return 4;
+  }
+}
+
+
+/**
+ * Interpret @a f on @a frame.
+ *
+ * @param f validated filter
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ * @return filter result, 0 to drop
+ */
+static uint32_t
+bpf_interpret (const struct BpfFilter *f,
+               const uint8_t *frame,
+               uint32_t frame_size)
+{
+  uint32_t mem[BPF_MEMWORDS] = { 0 };
+  uint32_t a = 0;
+  uint32_t x = 0;
+  uint32_t v;
+
+  for (unsigned int pc = 0; pc < f->len; pc++)
+  {
+    const struct sock_filter *i = &f->insns[pc];
+
+    switch (i->code)
+    {
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_ABS:
+      if (! bpf_load (frame,
+                      frame_size,
+                      i->k,
+                      bpf_load_size (i->code),
+                      &a))
+        return 0;
+      break;
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+      if (! bpf_load (frame,
+                      frame_size,
+                      (uint64_t) x + i->k,
+                      bpf_load_size (i->code),
+                      &a))
+        return 0;
+      break;
+    case BPF_LD | BPF_W | BPF_LEN:
+      a = frame_size;
+      break;
+    case BPF_LD | BPF_IMM:
+      a = i->k;
+      break;
+    case BPF_LD | BPF_MEM:
+      a = mem[i->k];
+      break;
+    case BPF_LDX | BPF_W | BPF_IMM:
+      x = i->k;
+      break;
+    case BPF_LDX | BPF_W | BPF_MEM:
+      x = mem[i->k];
+      break;
+    case BPF_LDX | BPF_W | BPF_LEN:
+      x = frame_size;
+      break;
+    case BPF_LDX | BPF_B | BPF_MSH:
+      if (! bpf_load (frame,
+                      frame_size,
+                      i->k,
+                      1,
+                      &v))
+        return 0;
+      x = (v & 0xF) << 2;
+      break;
+    case BPF_ST:
+      mem[i->k] = a;
+      break;
+    case BPF_STX:
+      mem[i->k] = x;
+      break;
+    case BPF_ALU | BPF_ADD | BPF_K: a += i->k; break;
+    case BPF_ALU | BPF_SUB | BPF_K: a -= i->k; break;
+    case BPF_ALU | BPF_MUL | BPF_K: a *= i->k; break;
+    case BPF_ALU | BPF_DIV | BPF_K: a /= i->k; break;
+    case BPF_ALU | BPF_MOD | BPF_K: a %= i->k; break;
+    case BPF_ALU | BPF_OR | BPF_K: a |= i->k; break;
+    case BPF_ALU | BPF_AND | BPF_K: a &= i->k; break;
+    case BPF_ALU | BPF_XOR | BPF_K: a ^= i->k; break;
+    case BPF_ALU | BPF_LSH | BPF_K: a <<= i->k; break;
+    case BPF_ALU | BPF_RSH | BPF_K: a >>= i->k; break;
+    case BPF_ALU | BPF_ADD | BPF_X: a += x; break;
+    case BPF_ALU | BPF_SUB | BPF_X: a -= x; break;
+    case BPF_ALU | BPF_MUL | BPF_X: a *= x; break;
+    case BPF_ALU | BPF_OR | BPF_X: a |= x; break;
+    case BPF_ALU | BPF_AND | BPF_X: a &= x; break;
+    case BPF_ALU | BPF_XOR | BPF_X: a ^= x; break;
+    case BPF_ALU | BPF_LSH | BPF_X: a <<= (x & 31); break;
+    case BPF_ALU | BPF_RSH | BPF_X: a >>= (x & 31); break;
+    case BPF_ALU | BPF_DIV | BPF_X:
+      if (0 == x)
+        return 0;
+      a /= x;
+      break;
+    case BPF_ALU | BPF_MOD | BPF_X:
+      if (0 == x)
+        return 0;
+      a %= x;
+      break;
+    case BPF_ALU | BPF_NEG:
+      a = -a;
+      break;
+    case BPF_JMP | BPF_JA:
+      pc += i->k;
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K: pc += (a == i->k) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JGT | BPF_K: pc += (a > i->k) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JGE | BPF_K: pc += (a >= i->k) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JSET | BPF_K: pc += (0 != (a & i->k)) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JEQ | BPF_X: pc += (a == x) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JGT | BPF_X: pc += (a > x) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JGE | BPF_X: pc += (a >= x) ? i->jt : i->jf; break;
+    case BPF_JMP | BPF_JSET | BPF_X: pc += (0 != (a & x)) ? i->jt : i->jf; break;
+    case BPF_RET | BPF_K:
+      return i->k;
+    case BPF_RET | BPF_A:
+      return a;
+    case BPF_MISC | BPF_TAX:
+      x = a;
+      break;
+    case BPF_MISC | BPF_TXA:
+      a = x;
+      break;
+    default:
+      /* bpf_validate() rejects everything else */
+      return 0;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * Check @a insns like the kernel does before accepting a filter.
+ *
+ * @param insns the program
+ * @param len number of instructions in @a insns
+ * @return NULL if valid, otherwise a description of the problem
+ */
+static const char *
+bpf_validate (const struct sock_filter *insns,
+              unsigned int len)
+{
+  if ( (0 == len) ||
+       (len > BPF_MAXINSNS) )
+    return "invalid program length";
+  for (unsigned int pc = 0; pc < len; pc++)
+  {
+    const struct sock_filter *i = &insns[pc];
+    unsigned int rest = len - pc - 1;
+
+    switch (i->code)
+    {
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+    case BPF_LD | BPF_W | BPF_LEN:
+    case BPF_LD | BPF_IMM:
+    case BPF_LDX | BPF_W | BPF_IMM:
+    case BPF_LDX | BPF_W | BPF_LEN:
+    case BPF_LDX | BPF_B | BPF_MSH:
+    case BPF_ALU | BPF_ADD | BPF_K:
+    case BPF_ALU | BPF_SUB | BPF_K:
+    case BPF_ALU | BPF_MUL | BPF_K:
+    case BPF_ALU | BPF_OR | BPF_K:
+    case BPF_ALU | BPF_AND | BPF_K:
+    case BPF_ALU | BPF_XOR | BPF_K:
+    case BPF_ALU | BPF_ADD | BPF_X:
+    case BPF_ALU | BPF_SUB | BPF_X:
+    case BPF_ALU | BPF_MUL | BPF_X:
+    case BPF_ALU | BPF_DIV | BPF_X:
+    case BPF_ALU | BPF_MOD | BPF_X:
+    case BPF_ALU | BPF_OR | BPF_X:
+    case BPF_ALU | BPF_AND | BPF_X:
+    case BPF_ALU | BPF_XOR | BPF_X:
+    case BPF_ALU | BPF_LSH | BPF_X:
+    case BPF_ALU | BPF_RSH | BPF_X:
+    case BPF_ALU | BPF_NEG:
+    case BPF_MISC | BPF_TAX:
+    case BPF_MISC | BPF_TXA:
+    case BPF_RET | BPF_K:
+    case BPF_RET | BPF_A:
+      break;
+    case BPF_LD | BPF_MEM:
+    case BPF_LDX | BPF_W | BPF_MEM:
+    case BPF_ST:
+    case BPF_STX:
+      if (i->k >= BPF_MEMWORDS)
+        return "scratch memory index out of range";
+      break;
+    case BPF_ALU | BPF_DIV | BPF_K:
+    case BPF_ALU | BPF_MOD | BPF_K:
+      if (0 == i->k)
+        return "division by zero";
+      break;
+    case BPF_ALU | BPF_LSH | BPF_K:
+    case BPF_ALU | BPF_RSH | BPF_K:
+      if (i->k >= 32)
+        return "shift out of range";
+      break;
+    case BPF_JMP | BPF_JA:
+      if (i->k >= rest)
+        return "jump out of range";
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K:
+    case BPF_JMP | BPF_JGT | BPF_K:
+    case BPF_JMP | BPF_JGE | BPF_K:
+    case BPF_JMP | BPF_JSET | BPF_K:
+    case BPF_JMP | BPF_JEQ | BPF_X:
+    case BPF_JMP | BPF_JGT | BPF_X:
+    case BPF_JMP | BPF_JGE | BPF_X:
+    case BPF_JMP | BPF_JSET | BPF_X:
+      if ( (i->jt >= rest) ||
+           (i->jf >= rest) )
+        return "jump out of range";
+      break;
+    default:
+      return "unsupported instruction";
+    }
+  }
+  if (BPF_RET != BPF_CLASS (insns[len - 1].code))
+    return "program does not end with a return";
+  return NULL;
+}
+
+
+#if GLAB_BPF_JIT
+
+/**
+ * Machine code being generated.
+ */
+struct BpfJitState
+{
+  /**
+   * Code buffer.
+   */
+  uint8_t *code;
+
+  /**
+   * Number of bytes emitted.
+   */
+  size_t off;
+
+  /**
+   * Offset of the code of each instruction.
+   */
+  size_t *insn_off;
+
+  /**
+   * Positions of rel32 fields and the instruction they jump to,
+   * where the instruction index "len" is the "return 0" exit.
+   */
+  size_t *fix_pos;
+  unsigned int *fix_target;
+  unsigned int num_fix;
+};
+
+
+/**
+ * Emit @a n bytes of machine code.
+ */
+static void
+bpf_emit (struct BpfJitState *js,
+          const void *bytes,
+          size_t n)
+{
+  memcpy (&js->code[js->off],
+          bytes,
+          n);
+  js->off += n;
+}
+
+
+/**
+ * Emit a 32-bit little-endian immediate.
+ */
+static void
+bpf_emit32 (struct BpfJitState *js,
+            uint32_t v)
+{
+  uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+  bpf_emit (js,
+            b,
+            sizeof (b));
+}
+
+
+/**
+ * Emit jump opcode @a op (one or two bytes, @a n) with a rel32
+ * to instruction @a target, resolved by bpf_jit_fixup().
+ */
+static void
+bpf_emit_jump (struct BpfJitState *js,
+               const uint8_t *op,
+               size_t n,
+               unsigned int target)
+{
+  bpf_emit (js,
+            op,
+            n);
+  js->fix_pos[js->num_fix] = js->off;
+  js->fix_target[js->num_fix] = target;
+  js->num_fix++;
+  bpf_emit32 (js,
+              0);
+}
+
+
+/**
+ * Emit the bounds check for a load of @a size bytes at constant
+ * offset @a k: jump to the "return 0" exit if frame_size (esi) is
+ * smaller than k + size.
+ *
+ * @return false if the load can never succeed
+ */
+static bool
+bpf_emit_abs_check (struct BpfJitState *js,
+                    unsigned int len,
+                    uint32_t k,
+                    unsigned int size)
+{
+  static const uint8_t jb[] = { 0x0F, 0x82 };
+  static const uint8_t jmp[] = { 0xE9 };
+
+  if ((uint64_t) k + size > INT32_MAX)
+  {
+    bpf_emit_jump (js, jmp, sizeof (jmp), len);
+    return false;
+  }
+  bpf_emit (js, "\x81\xFE", 2);                 /* cmp esi, k + size */
+  bpf_emit32 (js, k + size);
+  bpf_emit_jump (js, jb, sizeof (jb), len);
+  return true;
+}
+
+
+/**
+ * Emit a conditional jump instruction.  The comparison has been
+ * emitted; @a jcc_true is the second opcode byte of the 0x0F jcc
+ * taken if the condition holds, @a jcc_true ^ 1 its negation.
+ *
+ * @param js code being generated
+ * @param pc index of the jump instruction
+ * @param i the jump instruction
+ * @param jcc_true condition code
+ */
+static void
+bpf_emit_cond (struct BpfJitState *js,
+               unsigned int pc,
+               const struct sock_filter *i,
+               uint8_t jcc_true)
+{
+  const uint8_t jt[] = { 0x0F, jcc_true };
+  const uint8_t jf[] = { 0x0F, jcc_true ^ 1 };
+  static const uint8_t jmp[] = { 0xE9 };
+
+  if (0 == i->jt)
+  {
+    if (0 != i->jf)
+      bpf_emit_jump (js, jf, sizeof (jf), pc + 1 + i->jf);
+    return;
+  }
+  bpf_emit_jump (js, jt, sizeof (jt), pc + 1 + i->jt);
+  if (0 != i->jf)
+    bpf_emit_jump (js, jmp, sizeof (jmp), pc + 1 + i->jf);
+}
+
+
+/**
+ * Compile @a f to x86-64 machine code.  A lives in eax, X in r9d,
+ * the frame in rdi and its size in esi; the scratch memory is on
+ * the stack.  Only caller-saved registers are used.
+ *
+ * @param f validated filter to compile
+ * @return 0 on success
+ */
+static int
+bpf_jit (struct BpfFilter *f)
+{
+  static const uint8_t jmp[] = { 0xE9 };
+  static const uint8_t ja[] = { 0x0F, 0x87 };
+  static const uint8_t jz[] = { 0x0F, 0x84 };
+  struct BpfJitState js;
+  size_t size;
+  size_t epilogue;
+  size_t ret0;
+  uint8_t *code;
+
+  size = (f->len + 2) * BPF_JIT_MAX_INSN;
+  code = mmap (NULL,
+               size,
+               PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS,
+               -1,
+               0);
+  if (MAP_FAILED == code)
+    return 1;
+  memset (&js,
+          0,
+          sizeof (js));
+  js.code = code;
+  js.insn_off = calloc (f->len, sizeof (size_t));
+  js.fix_pos = calloc (2 * f->len + 1, sizeof (size_t));
+  js.fix_target = calloc (2 * f->len + 1, sizeof (unsigned int));
+  if ( (NULL == js.insn_off) ||
+       (NULL == js.fix_pos) ||
+       (NULL == js.fix_target) )
+  {
+    free (js.insn_off);
+    free (js.fix_pos);
+    free (js.fix_target);
+    munmap (code,
+            size);
+    return 1;
+  }
+
+  /* sub rsp, 64; zero the scratch memory, A and X */
+  bpf_emit (&js, "\x48\x83\xEC\x40", 4);
+  bpf_emit (&js, "\x31\xC0", 2);                /* xor eax, eax */
+  for (unsigned int m = 0; m < BPF_MEMWORDS * 4; m += 8)
+  {
+    uint8_t mov[] = { 0x48, 0x89, 0x44, 0x24, m };   /* mov [rsp+m], rax */
+
+    bpf_emit (&js, mov, sizeof (mov));
+  }
+  bpf_emit (&js, "\x45\x31\xC9", 3);            /* xor r9d, r9d */
+
+  for (unsigned int pc = 0; pc < f->len; pc++)
+  {
+    const struct sock_filter *i = &f->insns[pc];
+    uint8_t m = (uint8_t) (i->k * 4);
+
+    js.insn_off[pc] = js.off;
+    switch (i->code)
+    {
+    case BPF_LD | BPF_W | BPF_ABS:
+      if (! bpf_emit_abs_check (&js, f->len, i->k, 4))
+        break;
+      bpf_emit (&js, "\x8B\x87", 2);            /* mov eax, [rdi+k] */
+      bpf_emit32 (&js, i->k);
+      bpf_emit (&js, "\x0F\xC8", 2);            /* bswap eax */
+      break;
+    case BPF_LD | BPF_H | BPF_ABS:
+      if (! bpf_emit_abs_check (&js, f->len, i->k, 2))
+        break;
+      bpf_emit (&js, "\x0F\xB7\x87", 3);        /* movzx eax, word [rdi+k] */
+      bpf_emit32 (&js, i->k);
+      bpf_emit (&js, "\x66\xC1\xC0\x08", 4);    /* rol ax, 8 */
+      break;
+    case BPF_LD | BPF_B | BPF_ABS:
+      if (! bpf_emit_abs_check (&js, f->len, i->k, 1))
+        break;
+      bpf_emit (&js, "\x0F\xB6\x87", 3);        /* movzx eax, byte [rdi+k] */
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+      {
+        uint8_t lea[] = { 0x48, 0x8D, 0x51, bpf_load_size (i->code) };
+
+        bpf_emit (&js, "\x44\x89\xC9", 3);      /* mov ecx, r9d */
+        bpf_emit (&js, "\xBA", 1);              /* mov edx, k */
+        bpf_emit32 (&js, i->k);
+        bpf_emit (&js, "\x48\x01\xD1", 3);      /* add rcx, rdx */
+        bpf_emit (&js, lea, sizeof (lea));      /* lea rdx, [rcx+size] */
+        bpf_emit (&js, "\x41\x89\xF0", 3);      /* mov r8d, esi */
+        bpf_emit (&js, "\x4C\x39\xC2", 3);      /* cmp rdx, r8 */
+        bpf_emit_jump (&js, ja, sizeof (ja), f->len);
+        if (BPF_W == BPF_SIZE (i->code))
+          bpf_emit (&js, "\x8B\x04\x0F\x0F\xC8", 5);  /* mov eax, [rdi+rcx]; bswap */
+        else if (BPF_H == BPF_SIZE (i->code))
+          bpf_emit (&js, "\x0F\xB7\x04\x0F\x66\xC1\xC0\x08", 8);
+        else
+          bpf_emit (&js, "\x0F\xB6\x04\x0F", 4);
+      }
+      break;
+    case BPF_LD | BPF_W | BPF_LEN:
+      bpf_emit (&js, "\x89\xF0", 2);            /* mov eax, esi */
+      break;
+    case BPF_LD | BPF_IMM:
+      bpf_emit (&js, "\xB8", 1);                /* mov eax, k */
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_LD | BPF_MEM:
+      {
+        uint8_t mov[] = { 0x8B, 0x44, 0x24, m };      /* mov eax, [rsp+m] */
+
+        bpf_emit (&js, mov, sizeof (mov));
+      }
+      break;
+    case BPF_LDX | BPF_W | BPF_IMM:
+      bpf_emit (&js, "\x41\xB9", 2);            /* mov r9d, k */
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_LDX | BPF_W | BPF_MEM:
+      {
+        uint8_t mov[] = { 0x44, 0x8B, 0x4C, 0x24, m }; /* mov r9d, [rsp+m] */
+
+        bpf_emit (&js, mov, sizeof (mov));
+      }
+      break;
+    case BPF_LDX | BPF_W | BPF_LEN:
+      bpf_emit (&js, "\x41\x89\xF1", 3);        /* mov r9d, esi */
+      break;
+    case BPF_LDX | BPF_B | BPF_MSH:
+      if (! bpf_emit_abs_check (&js, f->len, i->k, 1))
+        break;
+      bpf_emit (&js, "\x44\x0F\xB6\x8F", 4);    /* movzx r9d, byte [rdi+k] */
+      bpf_emit32 (&js, i->k);
+      bpf_emit (&js, "\x41\x83\xE1\x0F", 4);    /* and r9d, 0xF */
+      bpf_emit (&js, "\x41\xC1\xE1\x02", 4);    /* shl r9d, 2 */
+      break;
+    case BPF_ST:
+      {
+        uint8_t mov[] = { 0x89, 0x44, 0x24, m };      /* mov [rsp+m], eax */
+
+        bpf_emit (&js, mov, sizeof (mov));
+      }
+      break;
+    case BPF_STX:
+      {
+        uint8_t mov[] = { 0x44, 0x89, 0x4C, 0x24, m }; /* mov [rsp+m], r9d */
+
+        bpf_emit (&js, mov, sizeof (mov));
+      }
+      break;
+    case BPF_ALU | BPF_ADD | BPF_K:
+      bpf_emit (&js, "\x05", 1);
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_SUB | BPF_K:
+      bpf_emit (&js, "\x2D", 1);
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_MUL | BPF_K:
+      bpf_emit (&js, "\x69\xC0", 2);            /* imul eax, eax, k */
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_DIV | BPF_K:
+    case BPF_ALU | BPF_MOD | BPF_K:
+      bpf_emit (&js, "\x31\xD2\xB9", 3);        /* xor edx, edx; mov ecx, k */
+      bpf_emit32 (&js, i->k);
+      bpf_emit (&js, "\xF7\xF1", 2);            /* div ecx */
+      if (BPF_MOD == BPF_OP (i->code))
+        bpf_emit (&js, "\x89\xD0", 2);          /* mov eax, edx */
+      break;
+    case BPF_ALU | BPF_OR | BPF_K:
+      bpf_emit (&js, "\x0D", 1);
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_AND | BPF_K:
+      bpf_emit (&js, "\x25", 1);
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_XOR | BPF_K:
+      bpf_emit (&js, "\x35", 1);
+      bpf_emit32 (&js, i->k);
+      break;
+    case BPF_ALU | BPF_LSH | BPF_K:
+      {
+        uint8_t shl[] = { 0xC1, 0xE0, (uint8_t) i->k };
+
+        bpf_emit (&js, shl, sizeof (shl));
+      }
+      break;
+    case BPF_ALU | BPF_RSH | BPF_K:
+      {
+        uint8_t shr[] = { 0xC1, 0xE8, (uint8_t) i->k };
+
+        bpf_emit (&js, shr, sizeof (shr));
+      }
+      break;
+    case BPF_ALU | BPF_ADD | BPF_X:
+      bpf_emit (&js, "\x44\x01\xC8", 3);
+      break;
+    case BPF_ALU | BPF_SUB | BPF_X:
+      bpf_emit (&js, "\x44\x29\xC8", 3);
+      break;
+    case BPF_ALU | BPF_MUL | BPF_X:
+      bpf_emit (&js, "\x41\x0F\xAF\xC1", 4);    /* imul eax, r9d */
+      break;
+    case BPF_ALU | BPF_DIV | BPF_X:
+    case BPF_ALU | BPF_MOD | BPF_X:
+      bpf_emit (&js, "\x45\x85\xC9", 3);        /* test r9d, r9d */
+      bpf_emit_jump (&js, jz, sizeof (jz), f->len);
+      bpf_emit (&js, "\x31\xD2\x41\xF7\xF1", 5); /* xor edx, edx; div r9d */
+      if (BPF_MOD == BPF_OP (i->code))
+        bpf_emit (&js, "\x89\xD0", 2);
+      break;
+    case BPF_ALU | BPF_OR | BPF_X:
+      bpf_emit (&js, "\x44\x09\xC8", 3);
+      break;
+    case BPF_ALU | BPF_AND | BPF_X:
+      bpf_emit (&js, "\x44\x21\xC8", 3);
+      break;
+    case BPF_ALU | BPF_XOR | BPF_X:
+      bpf_emit (&js, "\x44\x31\xC8", 3);
+      break;
+    case BPF_ALU | BPF_LSH | BPF_X:
+      bpf_emit (&js, "\x44\x89\xC9\xD3\xE0", 5); /* mov ecx, r9d; shl eax, cl */
+      break;
+    case BPF_ALU | BPF_RSH | BPF_X:
+      bpf_emit (&js, "\x44\x89\xC9\xD3\xE8", 5); /* mov ecx, r9d; shr eax, cl */
+      break;
+    case BPF_ALU | BPF_NEG:
+      bpf_emit (&js, "\xF7\xD8", 2);
+      break;
+    case BPF_JMP | BPF_JA:
+      bpf_emit_jump (&js, jmp, sizeof (jmp), pc + 1 + i->k);
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_K:
+    case BPF_JMP | BPF_JGT | BPF_K:
+    case BPF_JMP | BPF_JGE | BPF_K:
+      bpf_emit (&js, "\x3D", 1);                /* cmp eax, k */
+      bpf_emit32 (&js, i->k);
+      bpf_emit_cond (&js, pc, i,
+                     (BPF_JEQ == BPF_OP (i->code)) ? 0x84
+                     : (BPF_JGT == BPF_OP (i->code)) ? 0x87 : 0x83);
+      break;
+    case BPF_JMP | BPF_JSET | BPF_K:
+      bpf_emit (&js, "\xA9", 1);                /* test eax, k */
+      bpf_emit32 (&js, i->k);
+      bpf_emit_cond (&js, pc, i, 0x85);
+      break;
+    case BPF_JMP | BPF_JEQ | BPF_X:
+    case BPF_JMP | BPF_JGT | BPF_X:
+    case BPF_JMP | BPF_JGE | BPF_X:
+      bpf_emit (&js, "\x44\x39\xC8", 3);        /* cmp eax, r9d */
+      bpf_emit_cond (&js, pc, i,
+                     (BPF_JEQ == BPF_OP (i->code)) ? 0x84
+                     : (BPF_JGT == BPF_OP (i->code)) ? 0x87 : 0x83);
+      break;
+    case BPF_JMP | BPF_JSET | BPF_X:
+      bpf_emit (&js, "\x44\x85\xC8", 3);        /* test eax, r9d */
+      bpf_emit_cond (&js, pc, i, 0x85);
+      break;
+    case BPF_RET | BPF_K:
+      bpf_emit (&js, "\xB8", 1);
+      bpf_emit32 (&js, i->k);
+      bpf_emit_jump (&js, jmp, sizeof (jmp), f->len + 1);
+      break;
+    case BPF_RET | BPF_A:
+      bpf_emit_jump (&js, jmp, sizeof (jmp), f->len + 1);
+      break;
+    case BPF_MISC | BPF_TAX:
+      bpf_emit (&js, "\x41\x89\xC1", 3);
+      break;
+    case BPF_MISC | BPF_TXA:
+      bpf_emit (&js, "\x44\x89\xC8", 3);
+      break;
+    }
+  }
+  ret0 = js.off;
+  bpf_emit (&js, "\x31\xC0", 2);                /* xor eax, eax */
+  epilogue = js.off;
+  bpf_emit (&js, "\x48\x83\xC4\x40\xC3", 5);    /* add rsp, 64; ret */
+
+  for (unsigned int n = 0; n < js.num_fix; n++)
+  {
+    size_t target;
+    int32_t rel;
+
+    if (js.fix_target[n] == f->len)
+      target = ret0;
+    else if (js.fix_target[n] == f->len + 1)
+      target = epilogue;
+    else
+      target = js.insn_off[js.fix_target[n]];
+    rel = (int32_t) (target - (js.fix_pos[n] + 4));
+    memcpy (&code[js.fix_pos[n]],
+            &rel,
+            sizeof (rel));
+  }
+  free (js.insn_off);
+  free (js.fix_pos);
+  free (js.fix_target);
+  if (0 != mprotect (code,
+                     size,
+                     PROT_READ | PROT_EXEC))
+  {
+    munmap (code,
+            size);
+    return 1;
+  }
+  f->jit_mem = code;
+  f->jit_size = size;
+  f->jit = (BpfJitFunction) code;
+  return 0;
+}
+
+#endif
+
+
+/**
+ * Free filter @a f.
+ */
+static void
+bpf_free (struct BpfFilter *f)
+{
+  if (NULL == f)
+    return;
+  if (NULL != f->jit_mem)
+    munmap (f->jit_mem,
+            f->jit_size);
+  free (f->insns);
+  free (f);
+}
+
+
+/**
+ * Run the filter of @a ifc_num on @a frame.
+ *
+ * @param ifc_num interface the frame was received on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ * @return true to accept the frame
+ */
+static inline bool
+bpf_ingress (uint16_t ifc_num,
+             const void *frame,
+             size_t frame_size)
+{
+  struct BpfFilter *f;
+  uint32_t ret;
+
+  if ( (ifc_num > bpf_num_ifc) ||
+       (NULL == (f = bpf_filters[ifc_num - 1])) )
+    return true;
+  f->runs++;
+#if GLAB_BPF_JIT
+  if ( (NULL == f->jit) &&
+       bpf_jit_enabled &&
+       (BPF_JIT_THRESHOLD == f->runs) &&
+       (0 != bpf_jit (f)) )
+    fprintf (stderr,
+             "Failed to compile filter, interpreting it\n");
+  if (bpf_jit_enabled &&
+      (NULL != f->jit))
+    ret = f->jit (frame,
+                  frame_size);
+  else
+#endif
+  ret = bpf_interpret (f,
+                       frame,
+                       frame_size);
+  if (0 != ret)
+    return true;
+  f->drops++;
+  return false;
+}
+
+
+/**
+ * Parse a filter in `tcpdump -ddd` format: the number of instructions
+ * followed by four numbers per instruction, separated by commas or
+ * whitespace.
+ *
+ * @param text filter to parse
+ * @return NULL on error (reported to stderr)
+ */
+static struct BpfFilter *
+bpf_parse (const char *text)
+{
+  struct BpfFilter *f;
+  const char *err;
+  unsigned long v[4];
+  unsigned long len;
+  char *end;
+
+  len = strtoul (text,
+                 &end,
+                 10);
+  if ( (end == text) ||
+       (0 == len) ||
+       (len > BPF_MAXINSNS) )
+  {
+    fprintf (stderr,
+             "Filter must start with the number of instructions\n");
+    return NULL;
+  }
+  f = calloc (1,
+              sizeof (*f));
+  if (NULL == f)
+    return NULL;
+  f->len = len;
+  f->insns = calloc (len,
+                     sizeof (struct sock_filter));
+  if (NULL == f->insns)
+  {
+    free (f);
+    return NULL;
+  }
+  for (unsigned int pc = 0; pc < len; pc++)
+  {
+    for (unsigned int j = 0; j < 4; j++)
+    {
+      text = end + strspn (end, ", \t\r\n");
+      v[j] = strtoul (text,
+                      &end,
+                      10);
+      if ( (end == text) ||
+           (v[j] > ((3 == j) ? UINT32_MAX : (0 == j) ? UINT16_MAX : UINT8_MAX)) )
+      {
+        fprintf (stderr,
+                 "Malformed filter instruction %u\n",
+                 pc);
+        bpf_free (f);
+        return NULL;
+      }
+    }
+    f->insns[pc].code = v[0];
+    f->insns[pc].jt = v[1];
+    f->insns[pc].jf = v[2];
+    f->insns[pc].k = v[3];
+  }
+  if (NULL != (err = bpf_validate (f->insns,
+                                   f->len)))
+  {
+    fprintf (stderr,
+             "Invalid filter: %s\n",
+             err);
+    bpf_free (f);
+    return NULL;
+  }
+  return f;
+}
+
+
+/**
+ * Read a filter in `tcpdump -ddd` format from @a filename.
+ *
+ * @param filename file to read
+ * @return NULL on error (reported to stderr)
+ */
+static struct BpfFilter *
+bpf_load_file (const char *filename)
+{
+  struct BpfFilter *f;
+  char *text;
+  size_t size;
+  FILE *fh;
+
+  fh = fopen (filename,
+              "r");
+  if (NULL == fh)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             filename,
+             strerror (errno));
+    return NULL;
+  }
+  text = malloc (BPF_MAXINSNS * 32);
+  if (NULL == text)
+  {
+    fclose (fh);
+    return NULL;
+  }
+  size = fread (text,
+                1,
+                BPF_MAXINSNS * 32 - 1,
+                fh);
+  fclose (fh);
+  text[size] = '\0';
+  f = bpf_parse (text);
+  free (text);
+  return f;
+}
+
+
+/**
+ * Attach a copy of @a f to interface @a ifc_num (or detach
+ * its filter if @a f is NULL).
+ *
+ * @return 0 on success
+ */
+static int
+bpf_attach (unsigned int ifc_num,
+            const struct BpfFilter *f)
+{
+  struct BpfFilter *c = NULL;
+
+  if (NULL != f)
+  {
+    c = calloc (1,
+                sizeof (*c));
+    if (NULL == c)
+      return 1;
+    c->len = f->len;
+    c->insns = malloc (f->len * sizeof (struct sock_filter));
+    if (NULL == c->insns)
+    {
+      free (c);
+      return 1;
+    }
+    memcpy (c->insns,
+            f->insns,
+            f->len * sizeof (struct sock_filter));
+  }
+  bpf_free (bpf_filters[ifc_num - 1]);
+  bpf_filters[ifc_num - 1] = c;
+  return 0;
+}
+
+
+/**
+ * Handle the "filter" control commands.
+ *
+ * @param cmd text the user entered (not 0-terminated)
+ * @param cmd_len length of @a cmd
+ * @return true if @a cmd was a filter command
+ */
+static bool
+bpf_handle_control (const char *cmd,
+                    size_t cmd_len)
+{
+  char buf[cmd_len + 1];
+  struct BpfFilter *f;
+  char *save;
+  const char *tok;
+  const char *arg;
+  unsigned int first;
+  unsigned int last;
+
+  memcpy (buf,
+          cmd,
+          cmd_len);
+  buf[cmd_len] = '\0';
+  tok = strtok_r (buf,
+                  " \n",
+                  &save);
+  if ( (NULL == tok) ||
+       (0 != strcasecmp (tok,
+                         "filter")) )
+    return false;
+  tok = strtok_r (NULL,
+                  " \n",
+                  &save);
+  if (NULL == tok)
+  {
+    for (unsigned int i = 0; i < bpf_num_ifc; i++)
+      if (NULL != (f = bpf_filters[i]))
+        print ("%u: %u instructions%s, %llu frames, %llu dropped\n",
+               i + 1,
+               f->len,
+               (bpf_jit_enabled && (NULL != f->jit)) ? " (compiled)" : "",
+               (unsigned long long) f->runs,
+               (unsigned long long) f->drops);
+    print ("JIT %s\n",
+           bpf_jit_enabled ? "on" : "off");
+    return true;
+  }
+  if (0 == strcasecmp (tok,
+                       "jit"))
+  {
+    tok = strtok_r (NULL,
+                    " \n",
+                    &save);
+    if ( (NULL != tok) &&
+         (0 == strcasecmp (tok,
+                           "on")) )
+    {
+      if (! GLAB_BPF_JIT)
+        fprintf (stderr,
+                 "No JIT for this architecture\n");
+      bpf_jit_enabled = GLAB_BPF_JIT;
+    }
+    else if ( (NULL != tok) &&
+              (0 == strcasecmp (tok,
+                                "off")) )
+      bpf_jit_enabled = false;
+    else
+      fprintf (stderr,
+               "Usage: filter jit on|off\n");
+    return true;
+  }
+  if (0 == strcasecmp (tok,
+                       "all"))
+  {
+    first = 1;
+    last = bpf_num_ifc;
+  }
+  else if ( (1 != sscanf (tok,
+                          "%u",
+                          &first)) ||
+            (0 == first) ||
+            (first > bpf_num_ifc) )
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown\n",
+             tok);
+    return true;
+  }
+  else
+  {
+    last = first;
+  }
+  arg = save + strspn (save, " ");
+  if ('\0' == *arg)
+  {
+    fprintf (stderr,
+             "Usage: filter PORT|all BYTECODE|FILENAME|off\n");
+    return true;
+  }
+  if ( (3 == strcspn (arg,
+                      " \n")) &&
+       (0 == strncasecmp (arg,
+                          "off",
+                          3)) )
+  {
+    for (unsigned int i = first; i <= last; i++)
+      bpf_attach (i,
+                  NULL);
+    print ("Filter removed\n");
+    return true;
+  }
+  if ( (*arg >= '0') &&
+       (*arg <= '9') )
+    f = bpf_parse (arg);
+  else
+    f = bpf_load_file (strtok_r (NULL,
+                                 " \n",
+                                 &save));
+  if (NULL == f)
+    return true;
+  for (unsigned int i = first; i <= last; i++)
+    if (0 != bpf_attach (i,
+                         f))
+      fprintf (stderr,
+               "Failed to attach filter to %u\n",
+               i);
+  print ("Filter with %u instructions attached\n",
+         f->len);
+  bpf_free (f);
+  return true;
+}
+
+#endif
+
+#endif
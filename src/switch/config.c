@@ -0,0 +1,883 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file config.c
+ * @brief Loads Netgear (FASTPATH) startup-config and Debian
+ *        /etc/network/interfaces files into port and interface tables
+ * @author Christian Grothoff
+ *
+ * Both formats are handled by the same line-oriented state machine,
+ * so a file may even mix them.  From a startup-config we take the
+ * VLAN database, the VLAN membership, tagging and PVID of each
+ * physical port ("interface 0/N") and the addresses of routing VLAN
+ * interfaces ("interface vlan N" with "ip address IP NETMASK").  From
+ * an interfaces file we take each "iface NAME inet static|dhcp|manual"
+ * stanza with its address, netmask, gateway and mtu, and each
+ * "iface NAME inet6 static" stanza with its address, netmask and
+ * gateway (merged into the interface of the same name).  An
+ * "iface NAME inet tunnel" stanza with "mode gre" also has the
+ * "local" and "endpoint" addresses of the tunnel.
+ */
+
+
+#ifndef MAX_VLAN_ID
+/**
+ * Largest valid 802.1Q VLAN ID (4095 is reserved).
+ */
+#define MAX_VLAN_ID 4094
+#endif
+
+/**
+ * Number of 64-bit words in a VLAN bitmap.
+ */
+#define CONFIG_VLAN_WORDS ((MAX_VLAN_ID + 64) / 64)
+
+/**
+ * Maximum number of tokens we look at per configuration line.
+ */
+#define CONFIG_MAX_TOKENS 8
+
+
+/**
+ * Switch port as found in a startup-config.
+ */
+struct ConfigPort
+{
+  /**
+   * Name of the port, i.e. "0/1".
+   */
+  char *name;
+
+  /**
+   * VLAN for untagged frames, -1 for none.
+   */
+  int16_t untagged_vlan;
+
+  /**
+   * Bitmap of the VLANs the port is a member of.
+   */
+  uint64_t member_vlans[CONFIG_VLAN_WORDS];
+
+  /**
+   * Bitmap of the VLANs the port sends tagged frames for.
+   * Only members (see #member_vlans) once the file was loaded.
+   */
+  uint64_t tagged_vlans[CONFIG_VLAN_WORDS];
+};
+
+
+/**
+ * IP interface as found in an interfaces file (or a routing
+ * VLAN interface of a startup-config).
+ */
+struct ConfigInterface
+{
+  /**
+   * Name of the interface, i.e. "eth1.24" or "vlan24".
+   */
+  char *name;
+
+  /**
+   * Address of the interface, 0.0.0.0 if it has none.
+   */
+  struct in_addr ip;
+
+  /**
+   * Netmask of the interface.
+   */
+  struct in_addr netmask;
+
+  /**
+   * Default gateway via this interface, 0.0.0.0 for none.
+   */
+  struct in_addr gateway;
+
+  /**
+   * IPv6 address of the interface, :: if it has none.
+   */
+  struct in6_addr ip6;
+
+  /**
+   * IPv6 default gateway via this interface, :: for none.
+   */
+  struct in6_addr gateway6;
+
+  /**
+   * For a GRE tunnel, the local endpoint.
+   */
+  struct in_addr tunnel_local;
+
+  /**
+   * For a GRE tunnel, the remote endpoint, 0.0.0.0 if the interface
+   * is not a tunnel.
+   */
+  struct in_addr tunnel_remote;
+
+  /**
+   * Prefix length of @e ip6.
+   */
+  uint8_t prefix6_len;
+
+  /**
+   * MTU of the interface, 0 if not specified.
+   */
+  unsigned int mtu;
+};
+
+
+/**
+ * Everything we loaded from the configuration files.
+ */
+struct Config
+{
+  /**
+   * Switch ports, in the order they were declared.
+   */
+  struct ConfigPort *ports;
+
+  /**
+   * IP interfaces, in the order they were declared.
+   */
+  struct ConfigInterface *ifcs;
+
+  /**
+   * Length of @e ports.
+   */
+  unsigned int num_ports;
+
+  /**
+   * Length of @e ifcs.
+   */
+  unsigned int num_ifcs;
+
+  /**
+   * VLANs declared in the VLAN database.
+   */
+  uint64_t vlans[CONFIG_VLAN_WORDS];
+};
+
+
+/**
+ * State of the configuration parser.
+ */
+enum ConfigState
+{
+  /**
+   * Not within any block.
+   */
+  CS_TOP,
+
+  /**
+   * Within "vlan database" of a startup-config.
+   */
+  CS_VLAN_DATABASE,
+
+  /**
+   * Within "interface 0/N" of a startup-config.
+   */
+  CS_PORT,
+
+  /**
+   * Within "interface vlan N" of a startup-config.
+   */
+  CS_VLAN_INTERFACE,
+
+  /**
+   * Within an "iface" stanza of an interfaces file.
+   */
+  CS_IFACE,
+
+  /**
+   * Within an "iface NAME inet6" stanza of an interfaces file.
+   */
+  CS_IFACE6,
+
+  /**
+   * Within a block we do not care about.
+   */
+  CS_SKIP
+};
+
+
+/**
+ * Set @a vlan in @a bitmap.
+ *
+ * @param bitmap VLAN bitmap to modify
+ * @param vlan VLAN ID
+ */
+static void
+config_vlan_set (uint64_t *bitmap,
+                 unsigned int vlan)
+{
+  bitmap[vlan / 64] |= (1LLU << (vlan % 64));
+}
+
+
+/**
+ * Test if @a vlan is set in @a bitmap.
+ *
+ * @param bitmap VLAN bitmap to check
+ * @param vlan VLAN ID
+ * @return true if @a vlan is in @a bitmap
+ */
+static bool
+config_vlan_test (const uint64_t *bitmap,
+                  unsigned int vlan)
+{
+  return 0 != (bitmap[vlan / 64] & (1LLU << (vlan % 64)));
+}
+
+
+/**
+ * Parse a VLAN list like "1,24,200-210" into @a bitmap.
+ *
+ * @param list text to parse
+ * @param[out] bitmap VLANs in @a list are set in here
+ * @return 0 on success
+ */
+static int
+config_parse_vlan_list (const char *list,
+                        uint64_t *bitmap)
+{
+  const char *pos = list;
+
+  while ('\0' != *pos)
+  {
+    unsigned long lo;
+    unsigned long hi;
+    char *end;
+
+    lo = strtoul (pos,
+                  &end,
+                  10);
+    if (end == pos)
+      return 1;
+    hi = lo;
+    if ('-' == *end)
+    {
+      pos = end + 1;
+      hi = strtoul (pos,
+                    &end,
+                    10);
+      if (end == pos)
+        return 1;
+    }
+    if ( (0 == lo) ||
+         (hi < lo) ||
+         (hi > MAX_VLAN_ID) )
+      return 1;
+    for (unsigned long vlan = lo; vlan <= hi; vlan++)
+      config_vlan_set (bitmap,
+                       vlan);
+    if (',' == *end)
+      end++;
+    else if ('\0' != *end)
+      return 1;
+    pos = end;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse IPv4 address @a addr, optionally with "/PREFIXLEN".
+ *
+ * @param addr text to parse
+ * @param[out] ip set to the address
+ * @param[out] netmask set to the netmask if a prefix length was given
+ * @return 0 on success
+ */
+static int
+config_parse_address (const char *addr,
+                      struct in_addr *ip,
+                      struct in_addr *netmask)
+{
+  const char *slash = strchr (addr,
+                              '/');
+  char buf[INET_ADDRSTRLEN];
+  unsigned long len;
+  char *end;
+
+  if (NULL == slash)
+    return (1 == inet_pton (AF_INET,
+                            addr,
+                            ip)) ? 0 : 1;
+  if ((size_t) (slash - addr) >= sizeof (buf))
+    return 1;
+  memcpy (buf,
+          addr,
+          slash - addr);
+  buf[slash - addr] = '\0';
+  if (1 != inet_pton (AF_INET,
+                      buf,
+                      ip))
+    return 1;
+  len = strtoul (slash + 1,
+                 &end,
+                 10);
+  if ( ('\0' != *end) ||
+       (end == slash + 1) ||
+       (len > 32) )
+    return 1;
+  netmask->s_addr = htonl (~ (uint32_t) ((1LLU << (32 - len)) - 1LLU));
+  return 0;
+}
+
+
+/**
+ * Parse netmask @a mask, either dotted ("255.255.255.0") or as
+ * prefix length ("24").
+ *
+ * @param mask text to parse
+ * @param[out] netmask set to the netmask
+ * @return 0 on success
+ */
+static int
+config_parse_netmask (const char *mask,
+                      struct in_addr *netmask)
+{
+  unsigned long len;
+  char *end;
+
+  if (NULL != strchr (mask,
+                      '.'))
+    return (1 == inet_pton (AF_INET,
+                            mask,
+                            netmask)) ? 0 : 1;
+  len = strtoul (mask,
+                 &end,
+                 10);
+  if ( ('\0' != *end) ||
+       (end == mask) ||
+       (len > 32) )
+    return 1;
+  netmask->s_addr = htonl (~ (uint32_t) ((1LLU << (32 - len)) - 1LLU));
+  return 0;
+}
+
+
+/**
+ * Parse IPv6 address @a addr with optional prefix length
+ * ("2001:db8::1/64").
+ *
+ * @param addr text to parse
+ * @param[out] ip set to the address
+ * @param[out] len set to the prefix length if one was given
+ * @return 0 on success
+ */
+static int
+config_parse_address6 (const char *addr,
+                       struct in6_addr *ip,
+                       uint8_t *len)
+{
+  const char *slash = strchr (addr,
+                              '/');
+  char buf[INET6_ADDRSTRLEN];
+  unsigned long plen;
+  char *end;
+
+  if (NULL == slash)
+    return (1 == inet_pton (AF_INET6,
+                            addr,
+                            ip)) ? 0 : 1;
+  if ((size_t) (slash - addr) >= sizeof (buf))
+    return 1;
+  memcpy (buf,
+          addr,
+          slash - addr);
+  buf[slash - addr] = '\0';
+  if (1 != inet_pton (AF_INET6,
+                      buf,
+                      ip))
+    return 1;
+  plen = strtoul (slash + 1,
+                  &end,
+                  10);
+  if ( ('\0' != *end) ||
+       (end == slash + 1) ||
+       (plen > 128) )
+    return 1;
+  *len = (uint8_t) plen;
+  return 0;
+}
+
+
+/**
+ * Append a new port named @a name to @a cfg.  FASTPATH ports start
+ * out as untagged members of VLAN 1.
+ *
+ * @param cfg configuration to extend
+ * @param name name of the port
+ * @return NULL on error
+ */
+static struct ConfigPort *
+config_add_port (struct Config *cfg,
+                 const char *name)
+{
+  struct ConfigPort *tmp;
+  struct ConfigPort *port;
+
+  tmp = realloc (cfg->ports,
+                 (cfg->num_ports + 1) * sizeof (struct ConfigPort));
+  if (NULL == tmp)
+  {
+    perror ("realloc");
+    return NULL;
+  }
+  cfg->ports = tmp;
+  port = &cfg->ports[cfg->num_ports++];
+  memset (port,
+          0,
+          sizeof (*port));
+  port->name = strdup (name);
+  port->untagged_vlan = 1;
+  config_vlan_set (port->member_vlans,
+                   1);
+  return port;
+}
+
+
+/**
+ * Append a new interface named @a name to @a cfg.
+ *
+ * @param cfg configuration to extend
+ * @param name name of the interface
+ * @return NULL on error
+ */
+static struct ConfigInterface *
+config_add_interface (struct Config *cfg,
+                      const char *name)
+{
+  struct ConfigInterface *tmp;
+  struct ConfigInterface *ifc;
+
+  tmp = realloc (cfg->ifcs,
+                 (cfg->num_ifcs + 1) * sizeof (struct ConfigInterface));
+  if (NULL == tmp)
+  {
+    perror ("realloc");
+    return NULL;
+  }
+  cfg->ifcs = tmp;
+  ifc = &cfg->ifcs[cfg->num_ifcs++];
+  memset (ifc,
+          0,
+          sizeof (*ifc));
+  ifc->name = strdup (name);
+  return ifc;
+}
+
+
+/**
+ * Find the interface named @a name in @a cfg, or append a new one.
+ *
+ * @param cfg configuration to search and extend
+ * @param name name of the interface
+ * @return NULL on error
+ */
+static struct ConfigInterface *
+config_get_interface (struct Config *cfg,
+                      const char *name)
+{
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+    if (0 == strcmp (cfg->ifcs[i].name,
+                     name))
+      return &cfg->ifcs[i];
+  return config_add_interface (cfg,
+                               name);
+}
+
+
+/**
+ * Finish the interface @a ifc: interfaces files may omit the netmask,
+ * in which case we use the classful one (as ifupdown used to), or a
+ * /64 for IPv6.
+ *
+ * @param ifc interface to finish, may be NULL
+ */
+static void
+config_finish_interface (struct ConfigInterface *ifc)
+{
+  uint32_t ip;
+
+  if (NULL == ifc)
+    return;
+  if ( (! IN6_IS_ADDR_UNSPECIFIED (&ifc->ip6)) &&
+       (0 == ifc->prefix6_len) )
+    ifc->prefix6_len = 64;
+  if ( (0 == ifc->ip.s_addr) ||
+       (0 != ifc->netmask.s_addr) )
+    return;
+  ip = ntohl (ifc->ip.s_addr);
+  if (ip < 0x80000000u)
+    ifc->netmask.s_addr = htonl (0xFF000000u);
+  else if (ip < 0xC0000000u)
+    ifc->netmask.s_addr = htonl (0xFFFF0000u);
+  else
+    ifc->netmask.s_addr = htonl (0xFFFFFF00u);
+}
+
+
+/**
+ * Finish the port @a port: only members can be tagged, and the PVID
+ * only applies if the port is an untagged member of it.
+ *
+ * @param port port to finish, may be NULL
+ */
+static void
+config_finish_port (struct ConfigPort *port)
+{
+  if (NULL == port)
+    return;
+  for (unsigned int i=0;i<CONFIG_VLAN_WORDS;i++)
+    port->tagged_vlans[i] &= port->member_vlans[i];
+  if ( (port->untagged_vlan > 0) &&
+       ( (! config_vlan_test (port->member_vlans,
+                              port->untagged_vlan)) ||
+         config_vlan_test (port->tagged_vlans,
+                           port->untagged_vlan) ) )
+    port->untagged_vlan = -1;
+}
+
+
+/**
+ * Split @a line into whitespace-separated tokens, in place.
+ *
+ * @param line line to split, modified
+ * @param[out] tok set to the tokens
+ * @return number of tokens found
+ */
+static unsigned int
+config_tokenize (char *line,
+                 char *tok[CONFIG_MAX_TOKENS])
+{
+  unsigned int n = 0;
+  char *pos = line;
+
+  while (n < CONFIG_MAX_TOKENS)
+  {
+    while ( (' ' == *pos) ||
+            ('\t' == *pos) ||
+            ('\r' == *pos) ||
+            ('\n' == *pos) )
+      pos++;
+    if ('\0' == *pos)
+      break;
+    tok[n++] = pos;
+    while ( ('\0' != *pos) &&
+            (' ' != *pos) &&
+            ('\t' != *pos) &&
+            ('\r' != *pos) &&
+            ('\n' != *pos) )
+      pos++;
+    if ('\0' != *pos)
+      *pos++ = '\0';
+  }
+  return n;
+}
+
+
+/**
+ * Load configuration file @a filename into @a cfg.  May be called
+ * repeatedly to merge several files into @a cfg.
+ *
+ * @param filename name of the startup-config or interfaces file
+ * @param cfg configuration to extend, must be zeroed initially
+ * @return 0 on success
+ */
+static int
+config_load (const char *filename,
+             struct Config *cfg)
+{
+  FILE *f;
+  char *line = NULL;
+  size_t line_size = 0;
+  unsigned int lineno = 0;
+  enum ConfigState state = CS_TOP;
+  struct ConfigPort *port = NULL;
+  struct ConfigInterface *ifc = NULL;
+  int ret = 0;
+
+  f = fopen (filename,
+             "r");
+  if (NULL == f)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             filename,
+             strerror (errno));
+    return 1;
+  }
+  while ( (0 == ret) &&
+          (-1 != getline (&line,
+                          &line_size,
+                          f)) )
+  {
+    char *tok[CONFIG_MAX_TOKENS];
+    unsigned int n;
+
+    lineno++;
+    n = config_tokenize (line,
+                         tok);
+    if ( (0 == n) ||
+         ('!' == tok[0][0]) ||
+         ('#' == tok[0][0]) )
+      continue;
+    /* keywords that start a new block in either format */
+    if ( (0 == strcmp (tok[0], "exit")) ||
+         (0 == strcmp (tok[0], "auto")) ||
+         (0 == strncmp (tok[0], "allow-", strlen ("allow-"))) ||
+         (0 == strcmp (tok[0], "iface")) ||
+         (0 == strcmp (tok[0], "interface")) ||
+         ( (0 == strcmp (tok[0], "vlan")) &&
+           (n > 1) &&
+           (0 == strcmp (tok[1], "database")) ) )
+    {
+      config_finish_port (port);
+      config_finish_interface (ifc);
+      port = NULL;
+      ifc = NULL;
+      state = CS_TOP;
+    }
+    switch (state)
+    {
+    case CS_TOP:
+      if ( (0 == strcmp (tok[0], "vlan")) &&
+           (n > 1) &&
+           (0 == strcmp (tok[1], "database")) )
+      {
+        state = CS_VLAN_DATABASE;
+      }
+      else if ( (0 == strcmp (tok[0], "interface")) &&
+                (n == 3) &&
+                (0 == strcmp (tok[1], "vlan")) )
+      {
+        char name[32];
+        uint64_t vlan[CONFIG_VLAN_WORDS] = { 0 };
+
+        if (0 != config_parse_vlan_list (tok[2],
+                                         vlan))
+        {
+          ret = 1;
+          break;
+        }
+        snprintf (name,
+                  sizeof (name),
+                  "vlan%s",
+                  tok[2]);
+        ifc = config_add_interface (cfg,
+                                    name);
+        state = (NULL == ifc) ? CS_SKIP : CS_VLAN_INTERFACE;
+      }
+      else if ( (0 == strcmp (tok[0], "interface")) &&
+                (n == 2) &&
+                (0 == strncmp (tok[1], "0/", strlen ("0/"))) )
+      {
+        /* physical port; LAGs ("3/N") and others are not supported */
+        port = config_add_port (cfg,
+                                tok[1]);
+        state = (NULL == port) ? CS_SKIP : CS_PORT;
+      }
+      else if ( (0 == strcmp (tok[0], "iface")) &&
+                (n >= 4) &&
+                (0 == strcmp (tok[2], "inet")) &&
+                (0 != strcmp (tok[3], "loopback")) )
+      {
+        ifc = config_add_interface (cfg,
+                                    tok[1]);
+        state = (NULL == ifc) ? CS_SKIP : CS_IFACE;
+      }
+      else if ( (0 == strcmp (tok[0], "iface")) &&
+                (n >= 4) &&
+                (0 == strcmp (tok[2], "inet6")) &&
+                (0 == strcmp (tok[3], "static")) )
+      {
+        ifc = config_get_interface (cfg,
+                                    tok[1]);
+        state = (NULL == ifc) ? CS_SKIP : CS_IFACE6;
+      }
+      else if ( (0 == strcmp (tok[0], "interface")) ||
+                (0 == strcmp (tok[0], "iface")) ||
+                (0 == strcmp (tok[0], "lineconfig")) )
+      {
+        state = CS_SKIP;
+      }
+      break;
+    case CS_VLAN_DATABASE:
+      if ( (0 == strcmp (tok[0], "vlan")) &&
+           (2 == n) )
+        ret = config_parse_vlan_list (tok[1],
+                                      cfg->vlans);
+      break;
+    case CS_PORT:
+      if ( (0 != strcmp (tok[0], "vlan")) ||
+           (n < 3) )
+        break;
+      if (0 == strcmp (tok[1], "pvid"))
+      {
+        unsigned long pvid;
+        char *end;
+
+        pvid = strtoul (tok[2],
+                        &end,
+                        10);
+        if ( ('\0' != *end) ||
+             (0 == pvid) ||
+             (pvid > MAX_VLAN_ID) )
+          ret = 1;
+        else
+          port->untagged_vlan = (int16_t) pvid;
+      }
+      else if (0 == strcmp (tok[1], "tagging"))
+      {
+        ret = config_parse_vlan_list (tok[2],
+                                      port->tagged_vlans);
+      }
+      else if ( (0 == strcmp (tok[1], "participation")) &&
+                (4 == n) )
+      {
+        uint64_t vlan[CONFIG_VLAN_WORDS] = { 0 };
+
+        ret = config_parse_vlan_list (tok[3],
+                                      vlan);
+        for (unsigned int i=0;i<CONFIG_VLAN_WORDS;i++)
+        {
+          if (0 == strcmp (tok[2], "include"))
+            port->member_vlans[i] |= vlan[i];
+          else if (0 == strcmp (tok[2], "exclude"))
+            port->member_vlans[i] &= ~vlan[i];
+        }
+      }
+      break;
+    case CS_VLAN_INTERFACE:
+      if ( (0 == strcmp (tok[0], "ip")) &&
+           (4 == n) &&
+           (0 == strcmp (tok[1], "address")) )
+      {
+        if ( (0 != config_parse_address (tok[2],
+                                         &ifc->ip,
+                                         &ifc->netmask)) ||
+             (0 != config_parse_netmask (tok[3],
+                                         &ifc->netmask)) )
+          ret = 1;
+      }
+      else if ( (0 == strcmp (tok[0], "ip")) &&
+                (3 == n) &&
+                (0 == strcmp (tok[1], "mtu")) )
+      {
+        ifc->mtu = strtoul (tok[2],
+                            NULL,
+                            10);
+      }
+      break;
+    case CS_IFACE:
+      if (2 != n)
+        break;
+      if (0 == strcmp (tok[0], "address"))
+        ret = config_parse_address (tok[1],
+                                    &ifc->ip,
+                                    &ifc->netmask);
+      else if (0 == strcmp (tok[0], "netmask"))
+        ret = config_parse_netmask (tok[1],
+                                    &ifc->netmask);
+      else if (0 == strcmp (tok[0], "gateway"))
+        ret = (1 == inet_pton (AF_INET,
+                               tok[1],
+                               &ifc->gateway)) ? 0 : 1;
+      else if (0 == strcmp (tok[0], "mtu"))
+        ifc->mtu = strtoul (tok[1],
+                            NULL,
+                            10);
+      else if (0 == strcmp (tok[0], "mode"))
+        ret = (0 == strcmp (tok[1], "gre")) ? 0 : 1;
+      else if (0 == strcmp (tok[0], "local"))
+        ret = (1 == inet_pton (AF_INET,
+                               tok[1],
+                               &ifc->tunnel_local)) ? 0 : 1;
+      else if (0 == strcmp (tok[0], "endpoint"))
+        ret = (1 == inet_pton (AF_INET,
+                               tok[1],
+                               &ifc->tunnel_remote)) ? 0 : 1;
+      break;
+    case CS_IFACE6:
+      if (2 != n)
+        break;
+      if (0 == strcmp (tok[0], "address"))
+        ret = config_parse_address6 (tok[1],
+                                     &ifc->ip6,
+                                     &ifc->prefix6_len);
+      else if (0 == strcmp (tok[0], "netmask"))
+      {
+        unsigned long len;
+        char *end;
+
+        len = strtoul (tok[1],
+                       &end,
+                       10);
+        if ( ('\0' != *end) ||
+             (end == tok[1]) ||
+             (len > 128) )
+          ret = 1;
+        else
+          ifc->prefix6_len = (uint8_t) len;
+      }
+      else if (0 == strcmp (tok[0], "gateway"))
+        ret = (1 == inet_pton (AF_INET6,
+                               tok[1],
+                               &ifc->gateway6)) ? 0 : 1;
+      break;
+    case CS_SKIP:
+      break;
+    }
+    if (0 != ret)
+      fprintf (stderr,
+               "%s:%u: malformed `%s' line\n",
+               filename,
+               lineno,
+               tok[0]);
+  }
+  config_finish_port (port);
+  config_finish_interface (ifc);
+  free (line);
+  fclose (f);
+  return ret;
+}
+
+
+/**
+ * Release memory held by @a cfg.
+ *
+ * @param cfg configuration to free
+ */
+static void
+config_free (struct Config *cfg)
+{
+  for (unsigned int i=0;i<cfg->num_ports;i++)
+    free (cfg->ports[i].name);
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+    free (cfg->ifcs[i].name);
+  free (cfg->ports);
+  free (cfg->ifcs);
+  memset (cfg,
+          0,
+          sizeof (*cfg));
+}
+
+
+/* end of config.c */
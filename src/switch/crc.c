@@ -113,18 +113,28 @@ GNUNET_CRYPTO_crc32_n (const void *buf, size_t len)
  * Perform an incremental step in a CRC16 (for TCP/IP) calculation.
  *
  * @param sum current sum, initially 0
- * @param buf buffer to calculate CRC over (must be 16-bit aligned)
- * @param len number of bytes in hdr, must be multiple of 2
+ * @param buf buffer to calculate CRC over
+ * @param len number of bytes in hdr
  * @return updated crc sum (must be subjected to #GNUNET_CRYPTO_crc16_finish() to get actual crc16)
  */
 uint32_t
 GNUNET_CRYPTO_crc16_step (uint32_t sum, const void *buf, size_t len)
 {
-  const uint16_t *hdr = buf;
+  const char *hdr = buf;
+  uint16_t word;
+
   for (; len >= 2; len -= 2)
-    sum += *(hdr++);
+  {
+    memcpy (&word, hdr, sizeof (word));
+    sum += word;
+    hdr += sizeof (word);
+  }
   if (len == 1)
-    sum += (*hdr) & ntohs(0xFF00);
+  {
+    word = 0;
+    memcpy (&word, hdr, 1);
+    sum += word;
+  }
   return sum;
 }
 
@@ -148,16 +158,38 @@ GNUNET_CRYPTO_crc16_finish (uint32_t sum)
 /**
  * Calculate the checksum of a buffer in one step.
  *
- * @param buf buffer to  calculate CRC over (must be 16-bit aligned)
- * @param len number of bytes in hdr, must be multiple of 2
+ * @param buf buffer to calculate CRC over
+ * @param len number of bytes in hdr
  * @return crc16 value
  */
 uint16_t
 GNUNET_CRYPTO_crc16_n (const void *buf, size_t len)
 {
-  const uint16_t *hdr = buf;
-  uint32_t sum = GNUNET_CRYPTO_crc16_step (0, hdr, len);
+  uint32_t sum = GNUNET_CRYPTO_crc16_step (0, buf, len);
+
+  return GNUNET_CRYPTO_crc16_finish (sum);
+}
+
+
+/**
+ * Update a crc16 after a 16-bit word of the data it covers changed
+ * from @a old_word to @a new_word, without looking at the rest of
+ * the data (RFC 1624).  All values must use the same byte order.
+ *
+ * @param crc crc16 value over the old data
+ * @param old_word previous value of the word that changed
+ * @param new_word new value of that word
+ * @return crc16 value over the new data
+ */
+uint16_t
+GNUNET_CRYPTO_crc16_update (uint16_t crc,
+                            uint16_t old_word,
+                            uint16_t new_word)
+{
+  uint32_t sum = (uint16_t) ~crc;
 
+  sum += (uint16_t) ~old_word;
+  sum += new_word;
   return GNUNET_CRYPTO_crc16_finish (sum);
 }
 
@@ -0,0 +1,1002 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file flow.c
+ * @brief NetFlow/IPFIX-like per-flow accounting for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c and huge.c.  Flows are keyed by the
+ * IPv4 5-tuple plus the index of the input interface (`struct
+ * Interface` @e ifc_index, which tells VLAN sub-interfaces and GRE
+ * tunnels apart; the "flow" command lists the indices); for ICMP the
+ * "destination port" is type * 256 + code, and non-initial fragments
+ * have no ports.  Octets are counted at layer 3 (the IPv4 total
+ * length).
+ *
+ * The table is split into #FLOW_SHARDS shards by the high bits of
+ * the flow hash.  Each shard has a fixed pool of entries, an
+ * open-addressing index and two intrusive lists: by last packet
+ * (for the inactive timeout) and by start of the current record (for
+ * the active timeout), so expiry only ever looks at flows that are
+ * due.  Shards share nothing, so each worker can own a set of them;
+ * with our single main loop, they bound the work done per expiry
+ * step instead.  If a shard is full, its least recently seen flow is
+ * exported early.  The main loop also calls flow_idle() at least once
+ * a second (see GLAB_IDLE() in loop.c), so flows expire and buffered
+ * records are written on an idle router too (though not in the
+ * simulator, where nodes only run when they get input).  All memory
+ * is allocated when accounting is enabled ("flow export FILE"), at
+ * most 72 MB for #FLOW_MAX_FLOWS, as two huge page backed regions
+ * (entries and indices) that the shards are carved from; pages are
+ * only touched as flows are created.
+ *
+ * The export file starts with a 8 byte header (the ASCII magic
+ * "GLFW", a 16-bit version and the 16-bit record size) followed by
+ * `struct FlowExportRecord`s, all in network byte order.
+ */
+
+
+/**
+ * Number of shards, must be a power of two.
+ */
+#define FLOW_SHARDS 16
+
+/**
+ * Maximum number of concurrent flows (over all shards).
+ */
+#define FLOW_MAX_FLOWS (1024 * 1024)
+
+/**
+ * Number of flows per shard.
+ */
+#define FLOW_SHARD_SIZE (FLOW_MAX_FLOWS / FLOW_SHARDS)
+
+/**
+ * Number of slots in the index of a shard (load factor at most 1/2).
+ */
+#define FLOW_INDEX_SIZE (2 * FLOW_SHARD_SIZE)
+
+/**
+ * Marks the end of the lists in a shard.
+ */
+#define FLOW_NIL UINT32_MAX
+
+/**
+ * Default active timeout (in seconds).
+ */
+#define FLOW_DEFAULT_ACTIVE 60
+
+/**
+ * Default inactive timeout (in seconds).
+ */
+#define FLOW_DEFAULT_INACTIVE 15
+
+/**
+ * Maximum number of flows expired per shard and step.
+ */
+#define FLOW_EXPIRE_BATCH 64
+
+/**
+ * Size of the export buffer.
+ */
+#define FLOW_BUF_SIZE (64 * 1024)
+
+/**
+ * Export file format version.
+ */
+#define FLOW_EXPORT_VERSION 2
+
+
+/**
+ * Why a flow record was exported.
+ */
+enum FlowEndReason
+{
+  FLOW_END_INACTIVE = 1,
+  FLOW_END_ACTIVE = 2,
+  FLOW_END_EVICTED = 3,
+  FLOW_END_FLUSH = 4
+};
+
+
+/**
+ * Key of a flow.  No padding, so keys can be compared with memcmp().
+ */
+struct FlowKey
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t proto;
+  uint8_t reserved;
+  uint16_t ifc_index;
+};
+
+
+/**
+ * A flow being accounted.
+ */
+struct FlowEntry
+{
+  struct FlowKey key;
+
+  /**
+   * Bytes in the current record.
+   */
+  uint64_t octets;
+
+  /**
+   * Packets in the current record.
+   */
+  uint32_t packets;
+
+  /**
+   * Start of the current record and last packet, in ms
+   * (see flow_now()).
+   */
+  uint32_t start;
+  uint32_t last;
+
+  /**
+   * Hash of @e key.
+   */
+  uint32_t hash;
+
+  /**
+   * Neighbours in the shard's list by last packet.  For free
+   * entries, @e lru_next links the free list.
+   */
+  uint32_t lru_prev;
+  uint32_t lru_next;
+
+  /**
+   * Neighbours in the shard's list by start of the record.
+   */
+  uint32_t age_prev;
+  uint32_t age_next;
+
+  /**
+   * Union of the TCP flags seen.
+   */
+  uint8_t tcp_flags;
+};
+
+
+/**
+ * One shard of the flow table.
+ */
+struct FlowShard
+{
+  /**
+   * #FLOW_SHARD_SIZE entries.
+   */
+  struct FlowEntry *entries;
+
+  /**
+   * #FLOW_INDEX_SIZE slots, each 0 or an index into @e entries plus one.
+   */
+  uint32_t *index;
+
+  /**
+   * First entry on the free list.
+   */
+  uint32_t free_head;
+
+  /**
+   * Entries from here on were never used (so their pages
+   * need not have been touched yet).
+   */
+  uint32_t fresh;
+
+  /**
+   * Least and most recently seen flows.
+   */
+  uint32_t lru_head;
+  uint32_t lru_tail;
+
+  /**
+   * Flows with the oldest and newest record.
+   */
+  uint32_t age_head;
+  uint32_t age_tail;
+
+  /**
+   * Number of flows in use.
+   */
+  uint32_t count;
+};
+
+
+_Pragma("pack(push)") _Pragma("pack(1)")
+
+/**
+ * Exported flow record, in network byte order.
+ */
+struct FlowExportRecord
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t proto;
+  uint8_t tcp_flags;
+  uint16_t ifc_index;
+
+  /**
+   * A `enum FlowEndReason`.
+   */
+  uint8_t reason;
+  uint8_t reserved[3];
+  uint32_t packets;
+  uint64_t octets;
+
+  /**
+   * First and last packet of the record, in ms since the epoch.
+   */
+  uint64_t start_ms;
+  uint64_t end_ms;
+};
+
+_Pragma("pack(pop)")
+
+
+/**
+ * The shards, entries NULL while accounting is off.
+ */
+static struct FlowShard flow_shards[FLOW_SHARDS];
+
+/**
+ * File we export to, -1 while accounting is off.
+ */
+static int flow_fd = -1;
+
+/**
+ * Records waiting to be written to #flow_fd.
+ */
+static char flow_buf[FLOW_BUF_SIZE];
+
+/**
+ * Number of bytes used in #flow_buf.
+ */
+static size_t flow_buf_off;
+
+/**
+ * Time of the last write to #flow_fd (see flow_now()).
+ */
+static uint32_t flow_last_write;
+
+/**
+ * Active and inactive timeouts, in ms.
+ */
+static uint32_t flow_active_ms;
+static uint32_t flow_inactive_ms;
+
+/**
+ * Wall clock in ms at flow_now() == 0.
+ */
+static uint64_t flow_epoch_ms;
+
+/**
+ * Monotonic clock in ms at flow_now() == 0.
+ */
+static uint64_t flow_base_ms;
+
+/**
+ * Shard to run expiry on next.
+ */
+static unsigned int flow_next_shard;
+
+/**
+ * Statistics for the "flow" command.
+ */
+static uint64_t flow_exported;
+static uint64_t flow_evicted;
+
+
+/**
+ * Read the (coarse) monotonic clock.
+ *
+ * @return ms since accounting was enabled
+ */
+static uint32_t
+flow_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC_COARSE,
+                 &ts);
+  return (uint32_t) (ts.tv_sec * 1000LLU + ts.tv_nsec / 1000000
+                     - flow_base_ms);
+}
+
+
+/**
+ * Hash @a key.
+ *
+ * @param key flow key
+ * @return hash of @a key
+ */
+static uint32_t
+flow_hash (const struct FlowKey *key)
+{
+  uint64_t a = get_u32 (&key->src) | ((uint64_t) get_u32 (&key->dst) << 32);
+  uint64_t b = get_u32 (&key->sport) | ((uint64_t) get_u32 (&key->proto) << 32);
+  uint64_t h;
+
+  h = a * 0x9E3779B97F4A7C15LLU ^ b;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDLLU;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53LLU;
+  h ^= h >> 33;
+  return (uint32_t) h;
+}
+
+
+/**
+ * Write the buffered records to the export file.
+ */
+static void
+flow_write (void)
+{
+  size_t off = 0;
+
+  while (off < flow_buf_off)
+  {
+    ssize_t ret;
+
+    ret = write (flow_fd,
+                 &flow_buf[off],
+                 flow_buf_off - off);
+    if (ret <= 0)
+    {
+      fprintf (stderr,
+               "Writing flow records failed: %s\n",
+               strerror (errno));
+      break;
+    }
+    off += ret;
+  }
+  flow_buf_off = 0;
+  flow_last_write = flow_now ();
+}
+
+
+/**
+ * Export the current record of @a e, unless it is empty.
+ *
+ * @param e flow to export
+ * @param reason why the record ends
+ */
+static void
+flow_export (const struct FlowEntry *e,
+             enum FlowEndReason reason)
+{
+  struct FlowExportRecord *r;
+
+  if (0 == e->packets)
+    return;
+  if (flow_buf_off + sizeof (*r) > sizeof (flow_buf))
+    flow_write ();
+  r = (struct FlowExportRecord *) &flow_buf[flow_buf_off];
+  memset (r,
+          0,
+          sizeof (*r));
+  put_u32 (&r->src, e->key.src);
+  put_u32 (&r->dst, e->key.dst);
+  put_be16 (&r->sport, e->key.sport);
+  put_be16 (&r->dport, e->key.dport);
+  r->proto = e->key.proto;
+  r->tcp_flags = e->tcp_flags;
+  put_be16 (&r->ifc_index, e->key.ifc_index);
+  r->reason = reason;
+  put_u32 (&r->packets, htonl (e->packets));
+  put_u32 (&r->octets, htonl ((uint32_t) (e->octets >> 32)));
+  put_u32 ((char *) &r->octets + 4, htonl ((uint32_t) e->octets));
+  put_u32 (&r->start_ms, htonl ((uint32_t) ((flow_epoch_ms + e->start) >> 32)));
+  put_u32 ((char *) &r->start_ms + 4, htonl ((uint32_t) (flow_epoch_ms + e->start)));
+  put_u32 (&r->end_ms, htonl ((uint32_t) ((flow_epoch_ms + e->last) >> 32)));
+  put_u32 ((char *) &r->end_ms + 4, htonl ((uint32_t) (flow_epoch_ms + e->last)));
+  flow_buf_off += sizeof (*r);
+  flow_exported++;
+}
+
+
+/**
+ * Remove entry @a idx from the list by last packet of @a s.
+ */
+static void
+flow_lru_unlink (struct FlowShard *s,
+                 uint32_t idx)
+{
+  struct FlowEntry *e = &s->entries[idx];
+
+  if (FLOW_NIL == e->lru_prev)
+    s->lru_head = e->lru_next;
+  else
+    s->entries[e->lru_prev].lru_next = e->lru_next;
+  if (FLOW_NIL == e->lru_next)
+    s->lru_tail = e->lru_prev;
+  else
+    s->entries[e->lru_next].lru_prev = e->lru_prev;
+}
+
+
+/**
+ * Append entry @a idx to the list by last packet of @a s.
+ */
+static void
+flow_lru_append (struct FlowShard *s,
+                 uint32_t idx)
+{
+  struct FlowEntry *e = &s->entries[idx];
+
+  e->lru_prev = s->lru_tail;
+  e->lru_next = FLOW_NIL;
+  if (FLOW_NIL == s->lru_tail)
+    s->lru_head = idx;
+  else
+    s->entries[s->lru_tail].lru_next = idx;
+  s->lru_tail = idx;
+}
+
+
+/**
+ * Remove entry @a idx from the list by record start of @a s.
+ */
+static void
+flow_age_unlink (struct FlowShard *s,
+                 uint32_t idx)
+{
+  struct FlowEntry *e = &s->entries[idx];
+
+  if (FLOW_NIL == e->age_prev)
+    s->age_head = e->age_next;
+  else
+    s->entries[e->age_prev].age_next = e->age_next;
+  if (FLOW_NIL == e->age_next)
+    s->age_tail = e->age_prev;
+  else
+    s->entries[e->age_next].age_prev = e->age_prev;
+}
+
+
+/**
+ * Append entry @a idx to the list by record start of @a s.
+ */
+static void
+flow_age_append (struct FlowShard *s,
+                 uint32_t idx)
+{
+  struct FlowEntry *e = &s->entries[idx];
+
+  e->age_prev = s->age_tail;
+  e->age_next = FLOW_NIL;
+  if (FLOW_NIL == s->age_tail)
+    s->age_head = idx;
+  else
+    s->entries[s->age_tail].age_next = idx;
+  s->age_tail = idx;
+}
+
+
+/**
+ * Remove entry @a idx from @a s (without exporting it).
+ *
+ * @param s shard to remove from
+ * @param idx entry to remove
+ */
+static void
+flow_remove (struct FlowShard *s,
+             uint32_t idx)
+{
+  const uint32_t mask = FLOW_INDEX_SIZE - 1;
+  uint32_t i;
+  uint32_t j;
+
+  i = s->entries[idx].hash & mask;
+  while (idx + 1 != s->index[i])
+    i = (i + 1) & mask;
+  /* backward-shift deletion keeps probe sequences intact */
+  j = i;
+  for (;;)
+  {
+    uint32_t home;
+
+    j = (j + 1) & mask;
+    if (0 == s->index[j])
+      break;
+    home = s->entries[s->index[j] - 1].hash & mask;
+    if ( (i <= j)
+         ? ( (home <= i) || (home > j) )
+         : ( (home <= i) && (home > j) ) )
+    {
+      s->index[i] = s->index[j];
+      i = j;
+    }
+  }
+  s->index[i] = 0;
+  flow_lru_unlink (s,
+                   idx);
+  flow_age_unlink (s,
+                   idx);
+  s->entries[idx].lru_next = s->free_head;
+  s->free_head = idx;
+  s->count--;
+}
+
+
+/**
+ * Export and remove flows of @a s that reached a timeout.
+ *
+ * @param s shard to expire
+ * @param now current time (see flow_now())
+ * @param batch maximum number of flows to look at per list
+ */
+static void
+flow_expire_shard (struct FlowShard *s,
+                   uint32_t now,
+                   unsigned int batch)
+{
+  for (unsigned int n = 0;
+       (n < batch) &&
+       (FLOW_NIL != s->lru_head) &&
+       (now - s->entries[s->lru_head].last >= flow_inactive_ms);
+       n++)
+  {
+    uint32_t idx = s->lru_head;
+
+    flow_export (&s->entries[idx],
+                 FLOW_END_INACTIVE);
+    flow_remove (s,
+                 idx);
+  }
+  for (unsigned int n = 0;
+       (n < batch) &&
+       (FLOW_NIL != s->age_head) &&
+       (now - s->entries[s->age_head].start >= flow_active_ms);
+       n++)
+  {
+    uint32_t idx = s->age_head;
+    struct FlowEntry *e = &s->entries[idx];
+
+    flow_export (e,
+                 FLOW_END_ACTIVE);
+    e->packets = 0;
+    e->octets = 0;
+    e->tcp_flags = 0;
+    e->start = now;
+    flow_age_unlink (s,
+                     idx);
+    flow_age_append (s,
+                     idx);
+  }
+}
+
+
+/**
+ * Find the flow for @a key in @a s, creating it if needed.
+ *
+ * @param s shard @a key belongs to
+ * @param key flow key
+ * @param hash hash of @a key
+ * @param now current time (see flow_now())
+ * @return index of the entry
+ */
+static uint32_t
+flow_get (struct FlowShard *s,
+          const struct FlowKey *key,
+          uint32_t hash,
+          uint32_t now)
+{
+  const uint32_t mask = FLOW_INDEX_SIZE - 1;
+  struct FlowEntry *e;
+  uint32_t idx;
+  uint32_t i;
+
+  for (i = hash & mask;
+       0 != s->index[i];
+       i = (i + 1) & mask)
+  {
+    idx = s->index[i] - 1;
+    if ( (s->entries[idx].hash == hash) &&
+         (0 == memcmp (&s->entries[idx].key,
+                       key,
+                       sizeof (*key))) )
+      return idx;
+  }
+  if ( (FLOW_NIL == s->free_head) &&
+       (FLOW_SHARD_SIZE == s->fresh) )
+  {
+    /* shard full: make room by exporting the least recently seen flow */
+    idx = s->lru_head;
+    flow_export (&s->entries[idx],
+                 FLOW_END_EVICTED);
+    flow_remove (s,
+                 idx);
+    flow_evicted++;
+    for (i = hash & mask;
+         0 != s->index[i];
+         i = (i + 1) & mask)
+      ;
+  }
+  if (FLOW_NIL != s->free_head)
+  {
+    idx = s->free_head;
+    s->free_head = s->entries[idx].lru_next;
+  }
+  else
+  {
+    idx = s->fresh++;
+  }
+  e = &s->entries[idx];
+  s->index[i] = idx + 1;
+  s->count++;
+  e->key = *key;
+  e->hash = hash;
+  e->packets = 0;
+  e->octets = 0;
+  e->tcp_flags = 0;
+  e->start = now;
+  e->last = now;
+  flow_lru_append (s,
+                   idx);
+  flow_age_append (s,
+                   idx);
+  return idx;
+}
+
+
+/**
+ * Account IPv4 packet @a ip received on @a ifc.  Also runs one
+ * expiry step whenever the clock advanced.
+ *
+ * @param ifc interface we received the packet on
+ * @param ip IPv4 packet
+ * @param size number of bytes in @a ip (may include link-layer padding)
+ */
+static void
+flow_account (const struct Interface *ifc,
+              const char *ip,
+              size_t size)
+{
+  static uint32_t last_step;
+  struct FlowKey key;
+  struct FlowShard *s;
+  struct FlowEntry *e;
+  size_t hlen;
+  size_t total;
+  uint32_t hash;
+  uint32_t idx;
+  uint32_t now;
+
+  if (-1 == flow_fd)
+    return;
+  if (size < sizeof (struct IPv4Header))
+    return;
+  hlen = IPV4_HLEN (ip);
+  total = get_be16 (IPV4_FIELD (ip, total_length));
+  if ( (4 != IPV4_VERSION (ip)) ||
+       (hlen < sizeof (struct IPv4Header)) ||
+       (total < hlen) ||
+       (total > size) )
+    return;
+  memset (&key,
+          0,
+          sizeof (key));
+  key.src = get_u32 (IPV4_FIELD (ip, source_address));
+  key.dst = get_u32 (IPV4_FIELD (ip, destination_address));
+  key.proto = *(const uint8_t *) IPV4_FIELD (ip, protocol);
+  key.ifc_index = ifc->ifc_index;
+  if (0 == (get_be16 (IPV4_FIELD (ip, fragmentation_info)) & 0x1FFF))
+  {
+    const char *l4 = &ip[hlen];
+
+    switch (key.proto)
+    {
+    case IPPROTO_TCP:
+    case IPPROTO_UDP:
+      if (total - hlen >= 4)
+      {
+        key.sport = get_be16 (l4);
+        key.dport = get_be16 (l4 + 2);
+      }
+      break;
+    case IPPROTO_ICMP:
+      if (total - hlen >= 2)
+        key.dport = (uint16_t) (((const uint8_t *) l4)[0] << 8
+                                | ((const uint8_t *) l4)[1]);
+      break;
+    }
+  }
+  hash = flow_hash (&key);
+  s = &flow_shards[hash >> (32 - __builtin_ctz (FLOW_SHARDS))];
+  now = flow_now ();
+  idx = flow_get (s,
+                  &key,
+                  hash,
+                  now);
+  e = &s->entries[idx];
+  e->packets++;
+  e->octets += total;
+  e->last = now;
+  if ( (IPPROTO_TCP == key.proto) &&
+       (total - hlen >= 14) &&
+       (0 == (get_be16 (IPV4_FIELD (ip, fragmentation_info)) & 0x1FFF)) )
+    e->tcp_flags |= ((const uint8_t *) ip)[hlen + 13];
+  if (idx != s->lru_tail)
+  {
+    flow_lru_unlink (s,
+                     idx);
+    flow_lru_append (s,
+                     idx);
+  }
+  if (now != last_step)
+  {
+    last_step = now;
+    flow_expire_shard (&flow_shards[flow_next_shard],
+                       now,
+                       FLOW_EXPIRE_BATCH);
+    flow_next_shard = (flow_next_shard + 1) % FLOW_SHARDS;
+    if ( (0 != flow_buf_off) &&
+         (now - flow_last_write >= 1000) )
+      flow_write ();
+  }
+}
+
+
+/**
+ * Run expiry on all shards and write the buffered records, so that
+ * flows time out and reach the export file even if no IPv4 packets
+ * arrive.  Called by loop.c as GLAB_IDLE(), does something at most
+ * once a second.
+ */
+static void
+flow_idle (void)
+{
+  static uint32_t last_idle;
+  uint32_t now;
+
+  if (-1 == flow_fd)
+    return;
+  now = flow_now ();
+  if (now - last_idle < 1000)
+    return;
+  last_idle = now;
+  for (unsigned int i = 0; i < FLOW_SHARDS; i++)
+    flow_expire_shard (&flow_shards[i],
+                       now,
+                       FLOW_EXPIRE_BATCH);
+  if ( (0 != flow_buf_off) &&
+       (now - flow_last_write >= 1000) )
+    flow_write ();
+}
+
+
+/**
+ * Export all flows and stop accounting.
+ */
+static void
+flow_disable (void)
+{
+  if (-1 == flow_fd)
+    return;
+  for (unsigned int i = 0; i < FLOW_SHARDS; i++)
+  {
+    struct FlowShard *s = &flow_shards[i];
+
+    for (uint32_t idx = s->lru_head;
+         FLOW_NIL != idx;
+         idx = s->entries[idx].lru_next)
+      flow_export (&s->entries[idx],
+                   FLOW_END_FLUSH);
+  }
+  huge_free (flow_shards[0].entries);
+  huge_free (flow_shards[0].index);
+  memset (flow_shards,
+          0,
+          sizeof (flow_shards));
+  flow_write ();
+  close (flow_fd);
+  flow_fd = -1;
+}
+
+
+/**
+ * Start accounting and exporting to @a filename.
+ *
+ * @param filename file to append records to
+ * @param active active timeout in seconds
+ * @param inactive inactive timeout in seconds
+ * @return 0 on success
+ */
+static int
+flow_enable (const char *filename,
+             unsigned int active,
+             unsigned int inactive)
+{
+  struct timespec ts;
+  struct FlowEntry *entries;
+  uint32_t *slots;
+  int fd;
+
+  fd = open (filename,
+             O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+             0644);
+  if (-1 == fd)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             filename,
+             strerror (errno));
+    return 1;
+  }
+  entries = huge_alloc (FLOW_SHARDS * FLOW_SHARD_SIZE
+                        * sizeof (struct FlowEntry),
+                        "flow entries");
+  slots = huge_alloc (FLOW_SHARDS * FLOW_INDEX_SIZE
+                      * sizeof (uint32_t),
+                      "flow index");
+  if ( (NULL == entries) ||
+       (NULL == slots) )
+  {
+    fprintf (stderr,
+             "Failed to allocate flow table\n");
+    huge_free (entries);
+    huge_free (slots);
+    close (fd);
+    return 1;
+  }
+  for (unsigned int i = 0; i < FLOW_SHARDS; i++)
+  {
+    struct FlowShard *s = &flow_shards[i];
+
+    s->entries = &entries[i * FLOW_SHARD_SIZE];
+    s->index = &slots[i * FLOW_INDEX_SIZE];
+    s->free_head = FLOW_NIL;
+    s->fresh = 0;
+    s->lru_head = s->lru_tail = FLOW_NIL;
+    s->age_head = s->age_tail = FLOW_NIL;
+  }
+  flow_fd = fd;
+  clock_gettime (CLOCK_MONOTONIC_COARSE,
+                 &ts);
+  flow_base_ms = ts.tv_sec * 1000LLU + ts.tv_nsec / 1000000;
+  clock_gettime (CLOCK_REALTIME,
+                 &ts);
+  flow_epoch_ms = ts.tv_sec * 1000LLU + ts.tv_nsec / 1000000;
+  flow_active_ms = active * 1000;
+  flow_inactive_ms = inactive * 1000;
+  flow_exported = 0;
+  flow_evicted = 0;
+  flow_buf_off = 0;
+  flow_last_write = 0;
+  if (0 == lseek (fd,
+                  0,
+                  SEEK_END))
+  {
+    memcpy (flow_buf,
+            "GLFW",
+            4);
+    put_be16 (&flow_buf[4],
+              FLOW_EXPORT_VERSION);
+    put_be16 (&flow_buf[6],
+              sizeof (struct FlowExportRecord));
+    flow_buf_off = 8;
+    flow_write ();
+  }
+  return 0;
+}
+
+
+/**
+ * The user entered a "flow" command:
+ *
+ *   flow                               show statistics and interface indices
+ *   flow export FILE [ACTIVE [INACTIVE]]  start accounting, timeouts in s
+ *   flow expire                        export flows that timed out
+ *   flow off                           export all flows and stop
+ *
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_flow ()
+{
+  const char *tok = strtok (NULL, " ");
+
+  if (NULL == tok)
+  {
+    uint64_t count = 0;
+
+    if (-1 == flow_fd)
+    {
+      print ("Flow accounting off\n");
+      return;
+    }
+    for (unsigned int i = 0; i < FLOW_SHARDS; i++)
+      count += flow_shards[i].count;
+    print ("%llu active flows, %llu records exported, %llu flows evicted\n",
+           (unsigned long long) count,
+           (unsigned long long) flow_exported,
+           (unsigned long long) flow_evicted);
+    for (unsigned int i = 0; i < num_ifc; i++)
+      print ("%u: %s\n",
+             (unsigned int) gifc[i].ifc_index,
+             gifc[i].name);
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "off"))
+  {
+    flow_disable ();
+    print ("Flow accounting off\n");
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "expire"))
+  {
+    uint32_t now;
+
+    if (-1 == flow_fd)
+      return;
+    now = flow_now ();
+    for (unsigned int i = 0; i < FLOW_SHARDS; i++)
+      flow_expire_shard (&flow_shards[i],
+                         now,
+                         FLOW_SHARD_SIZE);
+    flow_write ();
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "export"))
+  {
+    const char *filename = strtok (NULL, " ");
+    unsigned int active = FLOW_DEFAULT_ACTIVE;
+    unsigned int inactive = FLOW_DEFAULT_INACTIVE;
+
+    tok = strtok (NULL, " ");
+    if ( (NULL != tok) &&
+         ( (1 != sscanf (tok, "%u", &active)) ||
+           (0 == active) ||
+           (active > 86400) ) )
+      filename = NULL;
+    tok = strtok (NULL, " ");
+    if ( (NULL != tok) &&
+         ( (1 != sscanf (tok, "%u", &inactive)) ||
+           (0 == inactive) ||
+           (inactive > 86400) ) )
+      filename = NULL;
+    if (NULL == filename)
+    {
+      fprintf (stderr,
+               "Usage: flow export FILE [ACTIVE [INACTIVE]]\n");
+      return;
+    }
+    flow_disable ();
+    if (0 == flow_enable (filename,
+                          active,
+                          inactive))
+      print ("Exporting flows to `%s'\n",
+             filename);
+    return;
+  }
+  fprintf (stderr,
+           "Usage: flow [export FILE [ACTIVE [INACTIVE]] | expire | off]\n");
+}
@@ -47,6 +47,60 @@
 #include <stdbool.h>
 
 
+/**
+ * Size of a cache line, for laying out data touched per frame.
+ */
+#define GLAB_CACHE_LINE 64
+
+/**
+ * Round @a size up to a multiple of #GLAB_CACHE_LINE, as needed
+ * for aligned_alloc().
+ */
+#define GLAB_CACHE_ALIGN(size) \
+  (((size) + GLAB_CACHE_LINE - 1) & ~((size_t) GLAB_CACHE_LINE - 1))
+
+#ifndef GLAB_SIM
+/**
+ * Build as a node module for the simulator (see sim.c) instead of
+ * a program talking to its parent via stdin and stdout.
+ */
+#define GLAB_SIM 0
+#endif
+
+#if GLAB_SIM
+/**
+ * Read up to @a size bytes of GLAB messages for the current node,
+ * provided by sim.c.  Returns 0 when the simulation is over.
+ */
+ssize_t
+glab_sim_read (void *buf,
+               size_t size);
+
+/**
+ * Pass GLAB messages of the current node to the simulator.
+ */
+void
+glab_sim_write (const void *buf,
+                size_t size);
+
+/**
+ * clock_gettime() returning the simulated time.
+ */
+int
+glab_sim_clock_gettime (clockid_t clk,
+                        struct timespec *ts);
+
+/**
+ * time() returning the simulated time.
+ */
+time_t
+glab_sim_time (time_t *t);
+
+#define clock_gettime(clk, ts) glab_sim_clock_gettime (clk, ts)
+#define time(t) glab_sim_time (t)
+#endif
+
+
 /**
  * gcc 4.x-ism to pack structures (to be used before structs);
  * Using this still causes structs to be unaligned on the stack on Sparc
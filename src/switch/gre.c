@@ -0,0 +1,456 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file gre.c
+ * @brief point-to-point GRE tunnels (RFC 2784) for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c.  A tunnel is an interface without an
+ * interface number (and thus without Ethernet framing) that has a
+ * local and a remote endpoint address.  IPv4 packets routed to it
+ * get an outer IPv4 and GRE header written into their headroom and
+ * are then routed to the remote endpoint, which must be reachable
+ * via an Ethernet interface (tunnels are not nested).  Received GRE
+ * packets from the remote endpoint to the local one are stripped in
+ * place and processed as if the inner packet had arrived on the
+ * tunnel.
+ *
+ * The IPv4 MTU of a tunnel is that of the interface towards the
+ * remote endpoint minus #GRE_OVERHEAD, capped by the MTU given for
+ * the tunnel (if any).  As it is used for the "fragmentation
+ * needed" check and for fragmenting before encapsulation, the outer
+ * packets always fit and are never fragmented themselves.
+ */
+
+
+/**
+ * GRE header flag: checksum present.
+ */
+#define GRE_FLAG_CHECKSUM 0x8000
+
+/**
+ * GRE header flag: routing present (RFC 1701, not supported).
+ */
+#define GRE_FLAG_ROUTING 0x4000
+
+/**
+ * GRE header flag: key present (RFC 2890).
+ */
+#define GRE_FLAG_KEY 0x2000
+
+/**
+ * GRE header flag: sequence number present (RFC 2890).
+ */
+#define GRE_FLAG_SEQUENCE 0x1000
+
+/**
+ * Bits of the GRE version number.
+ */
+#define GRE_VERSION_MASK 0x0007
+
+
+/**
+ * GRE header (RFC 2784), without the optional fields.
+ */
+struct GreHeader
+{
+  /**
+   * Flags and version.
+   */
+  uint16_t flags_version;
+
+  /**
+   * Ethernet type of the payload.
+   */
+  uint16_t protocol;
+};
+
+
+/**
+ * Bytes added to each packet sent through a tunnel.
+ */
+#define GRE_OVERHEAD (sizeof (struct IPv4Header) + sizeof (struct GreHeader))
+
+/**
+ * Access @a field of the GRE header @a gh.
+ */
+#define GRE_FIELD(gh, field) ((char *) (gh) + offsetof (struct GreHeader, field))
+
+
+/**
+ * Identification for the next outer IPv4 header.
+ */
+static uint16_t gre_ident;
+
+
+/**
+ * Find the route to the remote endpoint of @a tun.
+ *
+ * @param tun the tunnel
+ * @return NULL if the endpoint is unreachable or only reachable
+ *         through a tunnel
+ */
+static struct Route *
+gre_underlay (const struct Interface *tun)
+{
+  struct Route *r;
+
+  r = lookup_route (tun->tunnel_remote);
+  if ( (NULL == r) ||
+       (0 == r->ifc->ifc_num) )
+    return NULL;
+  return r;
+}
+
+
+/**
+ * Determine the IPv4 MTU of @a ifc, see #IPV4_MTU.
+ *
+ * @param ifc interface or tunnel
+ * @return largest IPv4 packet @a ifc can send without fragmenting it
+ */
+static size_t
+gre_mtu (const struct Interface *ifc)
+{
+  const struct Route *r;
+  size_t mtu;
+
+  if (0 != ifc->ifc_num)
+    return ifc->mtu - sizeof (struct EthernetHeader);
+  r = gre_underlay (ifc);
+  if (NULL == r)
+    return (0 == ifc->mtu) ? UINT16_MAX : ifc->mtu;
+  mtu = r->ifc->mtu - sizeof (struct EthernetHeader) - GRE_OVERHEAD;
+  if ( (0 != ifc->mtu) &&
+       (ifc->mtu < mtu) )
+    mtu = ifc->mtu;
+  return mtu;
+}
+
+
+/**
+ * Encapsulate IPv4 packet @a ip if @a ifc is a tunnel and send it
+ * to the remote endpoint, see #IPV4_TUNNEL_OUTPUT.  If the headroom
+ * is too small, the packet is copied once.
+ *
+ * @param ifc interface the packet was routed to
+ * @param ip IPv4 packet, in a writable buffer
+ * @param size number of bytes in @a ip
+ * @param headroom number of writable bytes in front of @a ip
+ * @return false if @a ifc is not a tunnel
+ */
+static bool
+gre_output (struct Interface *ifc,
+            char *ip,
+            size_t size,
+            size_t headroom)
+{
+  struct Route *r;
+  char *outer;
+  char *gh;
+
+  if (0 != ifc->ifc_num)
+    return false;
+  r = gre_underlay (ifc);
+  if ( (NULL == r) ||
+       (size + GRE_OVERHEAD > UINT16_MAX) )
+  {
+    ifc->tunnel_drops++;
+    return true;
+  }
+  if (headroom < GRE_OVERHEAD)
+  {
+    char buf[GLAB_FRAME_HEADROOM + GRE_OVERHEAD + size];
+
+    memcpy (&buf[GLAB_FRAME_HEADROOM + GRE_OVERHEAD],
+            ip,
+            size);
+    return gre_output (ifc,
+                       &buf[GLAB_FRAME_HEADROOM + GRE_OVERHEAD],
+                       size,
+                       GLAB_FRAME_HEADROOM + GRE_OVERHEAD);
+  }
+  outer = ip - GRE_OVERHEAD;
+  gh = ip - sizeof (struct GreHeader);
+  put_be16 (GRE_FIELD (gh, flags_version),
+            0);
+  put_be16 (GRE_FIELD (gh, protocol),
+            ETH_P_IPV4);
+  /* version and header length, then the TOS of the inner packet */
+  outer[0] = 0x45;
+  outer[1] = ip[1];
+  put_be16 (IPV4_FIELD (outer, total_length),
+            GRE_OVERHEAD + size);
+  put_be16 (IPV4_FIELD (outer, identification),
+            gre_ident++);
+  /* the outer packet fits (see gre_mtu()), so fragments of the inner
+     packet stay whole; we do not set DF to leave the underlay free
+     to fragment if its MTU shrinks */
+  put_be16 (IPV4_FIELD (outer, fragmentation_info),
+            0);
+  *(uint8_t *) IPV4_FIELD (outer, ttl) = DEFAULT_TTL;
+  *(uint8_t *) IPV4_FIELD (outer, protocol) = IPPROTO_GRE;
+  put_u16 (IPV4_FIELD (outer, checksum),
+           0);
+  put_u32 (IPV4_FIELD (outer, source_address),
+           ifc->tunnel_local.s_addr);
+  put_u32 (IPV4_FIELD (outer, destination_address),
+           ifc->tunnel_remote.s_addr);
+  put_u16 (IPV4_FIELD (outer, checksum),
+           GNUNET_CRYPTO_crc16_n (outer,
+                                  sizeof (struct IPv4Header)));
+  ifc->tunnel_tx++;
+  transmit_ip_in_place (r->ifc,
+                        route_next_hop (r,
+                                        ifc->tunnel_remote),
+                        outer,
+                        GRE_OVERHEAD + size,
+                        headroom - GRE_OVERHEAD);
+  return true;
+}
+
+
+/**
+ * Check if IPv4 packet @a *ip is a GRE packet for one of our
+ * tunnels and if so, strip the outer headers in place.
+ *
+ * @param[in,out] ip IPv4 packet, set to the inner packet
+ * @param[in,out] size number of bytes in @a *ip
+ * @param[in,out] headroom number of writable bytes in front of @a *ip
+ * @return the tunnel the inner packet was received on, NULL if
+ *         @a *ip is not for one of our tunnels (or was dropped)
+ */
+static struct Interface *
+gre_decap (char **ip,
+           size_t *size,
+           size_t *headroom)
+{
+  char *outer = *ip;
+  struct Interface *tun = NULL;
+  uint32_t src;
+  uint32_t dst;
+  size_t hlen;
+  size_t total;
+  size_t glen;
+  uint16_t flags;
+
+  if ( (*size < sizeof (struct IPv4Header)) ||
+       (IPPROTO_GRE != *(const uint8_t *) IPV4_FIELD (outer, protocol)) )
+    return NULL;
+  src = get_u32 (IPV4_FIELD (outer, source_address));
+  dst = get_u32 (IPV4_FIELD (outer, destination_address));
+  for (unsigned int i=0;i<num_ifc;i++)
+    if ( (0 == gifc[i].ifc_num) &&
+         (dst == gifc[i].tunnel_local.s_addr) &&
+         (src == gifc[i].tunnel_remote.s_addr) )
+      tun = &gifc[i];
+  if (NULL == tun)
+    return NULL;
+  hlen = IPV4_HLEN (outer);
+  total = get_be16 (IPV4_FIELD (outer, total_length));
+  if ( (4 != IPV4_VERSION (outer)) ||
+       (hlen < sizeof (struct IPv4Header)) ||
+       (total < hlen + sizeof (struct GreHeader)) ||
+       (total > *size) ||
+       (0 != GNUNET_CRYPTO_crc16_n (outer,
+                                    hlen)) ||
+       /* we do not reassemble */
+       (0 != (get_be16 (IPV4_FIELD (outer, fragmentation_info))
+              & ((IP_FLAGS_MORE_FRAGMENTS << 13) | 0x1FFF))) )
+  {
+    tun->tunnel_drops++;
+    return NULL;
+  }
+  flags = get_be16 (GRE_FIELD (&outer[hlen], flags_version));
+  glen = sizeof (struct GreHeader);
+  if (0 != (flags & GRE_FLAG_CHECKSUM))
+    glen += 4;
+  if (0 != (flags & GRE_FLAG_SEQUENCE))
+    glen += 4;
+  /* no keys are configured, so keyed packets are not for us */
+  if ( (0 != (flags & (GRE_FLAG_ROUTING | GRE_FLAG_KEY | GRE_VERSION_MASK))) ||
+       (ETH_P_IPV4 != get_be16 (GRE_FIELD (&outer[hlen], protocol))) ||
+       (total < hlen + glen) ||
+       ( (0 != (flags & GRE_FLAG_CHECKSUM)) &&
+         (0 != GNUNET_CRYPTO_crc16_n (&outer[hlen],
+                                      total - hlen))) )
+  {
+    tun->tunnel_drops++;
+    return NULL;
+  }
+  tun->tunnel_rx++;
+  *ip = &outer[hlen + glen];
+  *size = total - hlen - glen;
+  *headroom += hlen + glen;
+  return tun;
+}
+
+
+/**
+ * Parse tunnel specification @a net, initializing @a ifc.  Format
+ * of @a net is "GRE:LOCAL:REMOTE".
+ *
+ * @param ifc[out] interface specification to initialize
+ * @param net tunnel specification to parse
+ * @return 0 on success
+ */
+static int
+gre_parse_arg (struct Interface *ifc,
+               const char *net)
+{
+  char local[INET_ADDRSTRLEN];
+  const char *colon;
+
+  net += strlen ("GRE:");
+  colon = strchr (net, ':');
+  if ( (NULL == colon) ||
+       ((size_t) (colon - net) >= sizeof (local)) )
+  {
+    fprintf (stderr,
+             "Tunnel specification `%s' is not of the form `GRE:LOCAL:REMOTE'\n",
+             net);
+    return 1;
+  }
+  memcpy (local,
+          net,
+          colon - net);
+  local[colon - net] = '\0';
+  if ( (1 != inet_pton (AF_INET,
+                        local,
+                        &ifc->tunnel_local)) ||
+       (1 != inet_pton (AF_INET,
+                        colon + 1,
+                        &ifc->tunnel_remote)) ||
+       (0 == ifc->tunnel_remote.s_addr) )
+  {
+    fprintf (stderr,
+             "Invalid tunnel endpoints in `%s'\n",
+             net);
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Check the tunnels among the interfaces @a ifcs: the local endpoint
+ * must be the address of one of the Ethernet interfaces (otherwise
+ * we would decapsulate packets we merely route) and tunnels have no
+ * IPv6 addresses and no VLAN.
+ *
+ * @param ifcs interfaces to check
+ * @param num number of entries in @a ifcs
+ * @return 0 if all tunnels are valid
+ */
+static int
+gre_check (const struct Interface *ifcs,
+           unsigned int num)
+{
+  for (unsigned int i=0;i<num;i++)
+  {
+    const struct Interface *tun = &ifcs[i];
+    bool found = false;
+
+    if (0 == tun->tunnel_remote.s_addr)
+      continue;
+    if ( (0 != tun->vlan) ||
+         (! IN6_IS_ADDR_UNSPECIFIED (&tun->ip6)) )
+    {
+      fprintf (stderr,
+               "Tunnel `%s' cannot have a VLAN or an IPv6 address\n",
+               tun->name);
+      return 1;
+    }
+    for (unsigned int j=0;j<num;j++)
+      if ( (0 == ifcs[j].tunnel_remote.s_addr) &&
+           (0 != ifcs[j].ip.s_addr) &&
+           (tun->tunnel_local.s_addr == ifcs[j].ip.s_addr) )
+        found = true;
+    if (! found)
+    {
+      fprintf (stderr,
+               "Local endpoint of tunnel `%s' is not an interface address\n",
+               tun->name);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/**
+ * The user entered a "gre" command: list the tunnels with their
+ * endpoints, the interface towards the remote endpoint, the
+ * effective MTU and the packet counters.
+ */
+static void
+process_cmd_gre ()
+{
+  const char *tok = strtok (NULL, " ");
+  unsigned int count = 0;
+
+  if ( (NULL != tok) &&
+       (0 != strcasecmp (tok,
+                         "list")) )
+  {
+    fprintf (stderr,
+             "Usage: gre [list]\n");
+    return;
+  }
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    const struct Interface *tun = &gifc[i];
+    const struct Route *r;
+    char local[INET_ADDRSTRLEN];
+    char remote[INET_ADDRSTRLEN];
+
+    if (0 != tun->ifc_num)
+      continue;
+    count++;
+    r = gre_underlay (tun);
+    inet_ntop (AF_INET,
+               &tun->tunnel_local,
+               local,
+               sizeof (local));
+    inet_ntop (AF_INET,
+               &tun->tunnel_remote,
+               remote,
+               sizeof (remote));
+    if (NULL == r)
+      print ("%s local %s remote %s unreachable, %llu packets in, %llu out, %llu dropped\n",
+             tun->name,
+             local,
+             remote,
+             (unsigned long long) tun->tunnel_rx,
+             (unsigned long long) tun->tunnel_tx,
+             (unsigned long long) tun->tunnel_drops);
+    else
+      print ("%s local %s remote %s dev %s mtu %u, %llu packets in, %llu out, %llu dropped\n",
+             tun->name,
+             local,
+             remote,
+             r->ifc->name,
+             (unsigned int) gre_mtu (tun),
+             (unsigned long long) tun->tunnel_rx,
+             (unsigned long long) tun->tunnel_tx,
+             (unsigned long long) tun->tunnel_drops);
+  }
+  if (0 == count)
+    print ("No tunnels\n");
+}
@@ -23,23 +23,6 @@
  */
 #include "glab.h"
 
-/**
- * gcc 4.x-ism to pack structures (to be used before structs);
- * Using this still causes structs to be unaligned on the stack on Sparc
- * (See #670578 from Debian).
- */
-_Pragma("pack(push)") _Pragma("pack(1)")
-
-
-struct EthernetHeader
-{
-  struct MacAddress dst;
-  struct MacAddress src;
-  uint16_t tag;
-};
-
-_Pragma("pack(pop)")
-
 
 /**
  * Per-interface context.
@@ -71,73 +54,33 @@ static struct Interface *gifc;
 
 
 #include "print.c"
+#include "packet.h"
 
 
 /**
- * Forward @a frame to interface @a dst.
+ * Send @a frame received on @a src_ifc out on all other interfaces.
  *
- * @param dst target interface to send the frame out on
- * @param frame the frame to forward
+ * @param src_ifc interface we got the frame on
+ * @param frame the frame, in the receive buffer
  * @param frame_size number of bytes in @a frame
  */
-static void
-forward_to (struct Interface *dst,
-	    const void *frame,
-	    size_t frame_size)
-{
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-	  &hdr,
-	  sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-	  frame,
-	  frame_size);
-  write_all (STDOUT_FILENO,
-	     iob,
-	     sizeof (iob));
-}
-
-
 static void
 fwd_frame (struct Interface *src_ifc,
-	   const void *frame,
+	   void *frame,
 	   size_t frame_size)
 {
-  /* do work here */
-  int a = 0;
-  for (a = 0; a < num_ifc; a++) {
-   	if(&gifc[a].ifc_num != &src_ifc->ifc_num) {
-        print("Frame from %u to %u forwarded\n", (unsigned)&src_ifc->ifc_num, (unsigned)&gifc[a].ifc_num);
-        forward_to (&gifc[a], frame, frame_size);
-   	} else {
-        print("Frame from %u to %u dropped\n", (unsigned)&src_ifc->ifc_num, (unsigned)&gifc[a].ifc_num);
-    }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if (gifc[i].ifc_num == src_ifc->ifc_num)
+      continue;
+    glab_send_in_place (gifc[i].ifc_num,
+                        frame,
+                        frame_size);
   }
 }
 
 
-/**
- * Process frame received from @a interface.
- *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
- * @param frame_size number of bytes in @a frame
- */
-static void
-handle_frame (uint16_t interface,
-	      const void *frame,
-	      size_t frame_size)
-{
-  if (interface > num_ifc)
-    abort ();
-  fwd_frame (&gifc[interface - 1],
-	     frame,
-	     frame_size);
-}
+GLAB_DEFINE_HANDLE_FRAME (num_ifc, &gifc[interface - 1], fwd_frame)
 
 
 /**
@@ -156,20 +99,7 @@ handle_control (char *cmd,
 }
 
 
-/**
- * Handle MAC information @a mac
- *
- * @param ifc_num number of the interface with @a mac
- * @param mac the MAC address at @a ifc_num
- */
-static void
-handle_mac (uint16_t ifc_num,
-	    const struct MacAddress *mac)
-{
-  if (ifc_num > num_ifc)
-    abort ();
-  gifc[ifc_num - 1].mac = *mac;
-}
+GLAB_DEFINE_HANDLE_MAC (num_ifc, &gifc[ifc_num - 1])
 
 
 #include "loop.c"
@@ -0,0 +1,359 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file huge.c
+ * @brief huge page backed memory for the large lookup tables
+ * @author Christian Grothoff
+ *
+ * To be included after print.c.  The MAC table, the flow and NAT
+ * shards and the IPv6 tree bitmap are probed at random for every
+ * frame, so with 4 KiB pages nearly every probe also misses the TLB.
+ * huge_alloc() therefore tries, in this order:
+ *  - explicit 2 MiB pages from the hugetlb pool (MAP_HUGETLB),
+ *    which only works if the administrator reserved some
+ *    (/proc/sys/vm/nr_hugepages),
+ *  - a 2 MiB aligned anonymous mapping marked MADV_HUGEPAGE, so
+ *    that transparent huge pages can back it (unless THP is "never"),
+ *  - plain pages.
+ * Sizes are rounded up to whole huge pages; tables smaller than
+ * #HUGE_MIN_SIZE are not worth that and always get plain pages.
+ * Like calloc(), the memory is zeroed and (except for the hugetlb
+ * pool) only backed as it is touched.  Each region is remembered so
+ * that huge_report() can tell what we actually got.
+ */
+
+#include <sys/mman.h>
+
+/**
+ * Size of the huge pages we ask for.
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * Allocations below this size always use plain pages.
+ */
+#define HUGE_MIN_SIZE (64 * 1024)
+
+
+/**
+ * How a region is backed.
+ */
+enum HugeKind
+{
+  /**
+   * Plain pages.
+   */
+  HUGE_PLAIN,
+
+  /**
+   * Aligned and marked for transparent huge pages.
+   */
+  HUGE_THP,
+
+  /**
+   * Explicit huge pages from the hugetlb pool.
+   */
+  HUGE_HUGETLB
+};
+
+
+/**
+ * A region returned by huge_alloc().
+ */
+struct HugeRegion
+{
+  /**
+   * Kept in a list.
+   */
+  struct HugeRegion *next;
+
+  /**
+   * Start of the mapping.
+   */
+  void *ptr;
+
+  /**
+   * Size requested by the caller.
+   */
+  size_t size;
+
+  /**
+   * Size of the mapping.
+   */
+  size_t len;
+
+  /**
+   * What the region is for (static string).
+   */
+  const char *what;
+
+  /**
+   * How the region is backed.
+   */
+  enum HugeKind kind;
+};
+
+
+/**
+ * All live regions, most recent first.
+ */
+static struct HugeRegion *huge_regions;
+
+
+/**
+ * Find out how transparent huge pages are configured.
+ *
+ * @param buf where to store the mode
+ * @param buf_size number of bytes in @a buf
+ * @return @a buf, "always", "madvise" or "never"; "unavailable" if
+ *         the kernel has no THP
+ */
+static const char *
+huge_thp_mode (char *buf,
+               size_t buf_size)
+{
+  FILE *f;
+  char line[128];
+  char *start;
+  char *end;
+
+  snprintf (buf,
+            buf_size,
+            "unavailable");
+  f = fopen ("/sys/kernel/mm/transparent_hugepage/enabled",
+             "r");
+  if (NULL == f)
+    return buf;
+  /* the active mode is in brackets: "always [madvise] never" */
+  if ( (NULL != fgets (line,
+                       sizeof (line),
+                       f)) &&
+       (NULL != (start = strchr (line,
+                                 '['))) &&
+       (NULL != (end = strchr (start,
+                               ']'))) )
+  {
+    *end = '\0';
+    snprintf (buf,
+              buf_size,
+              "%s",
+              start + 1);
+  }
+  fclose (f);
+  return buf;
+}
+
+
+/**
+ * Map @a len bytes aligned to #HUGE_PAGE_SIZE.
+ *
+ * @param len multiple of #HUGE_PAGE_SIZE
+ * @return NULL on failure
+ */
+static void *
+huge_map_aligned (size_t len)
+{
+  char *raw;
+  uintptr_t start;
+  size_t head;
+
+  raw = mmap (NULL,
+              len + HUGE_PAGE_SIZE,
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS,
+              -1,
+              0);
+  if (MAP_FAILED == raw)
+    return NULL;
+  start = ((uintptr_t) raw + HUGE_PAGE_SIZE - 1) & ~ (uintptr_t) (HUGE_PAGE_SIZE - 1);
+  head = start - (uintptr_t) raw;
+  if (0 != head)
+    munmap (raw,
+            head);
+  munmap ((void *) (start + len),
+          HUGE_PAGE_SIZE - head);
+  return (void *) start;
+}
+
+
+/**
+ * Allocate @a size zeroed bytes, backed by huge pages if we can
+ * get them.  Free with huge_free().
+ *
+ * @param size number of bytes
+ * @param what what the memory is for, static string for huge_report()
+ * @return NULL on failure
+ */
+static void *
+huge_alloc (size_t size,
+            const char *what)
+{
+  struct HugeRegion *r;
+  char mode[32];
+
+  r = malloc (sizeof (*r));
+  if (NULL == r)
+    return NULL;
+  r->size = size;
+  r->what = what;
+  r->ptr = MAP_FAILED;
+  if (size >= HUGE_MIN_SIZE)
+  {
+    r->len = (size + HUGE_PAGE_SIZE - 1) & ~ (size_t) (HUGE_PAGE_SIZE - 1);
+    r->kind = HUGE_HUGETLB;
+    r->ptr = mmap (NULL,
+                   r->len,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1,
+                   0);
+    if ( (MAP_FAILED == r->ptr) &&
+         (0 != strcmp ("never",
+                       huge_thp_mode (mode,
+                                      sizeof (mode)))) &&
+         (NULL != (r->ptr = huge_map_aligned (r->len))) )
+    {
+      r->kind = HUGE_THP;
+      if (0 != madvise (r->ptr,
+                        r->len,
+                        MADV_HUGEPAGE))
+        r->kind = HUGE_PLAIN;
+    }
+    if (NULL == r->ptr)
+      r->ptr = MAP_FAILED;
+  }
+  if (MAP_FAILED == r->ptr)
+  {
+    r->len = size;
+    r->kind = HUGE_PLAIN;
+    r->ptr = mmap (NULL,
+                   r->len,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1,
+                   0);
+  }
+  if (MAP_FAILED == r->ptr)
+  {
+    free (r);
+    return NULL;
+  }
+  r->next = huge_regions;
+  huge_regions = r;
+  return r->ptr;
+}
+
+
+/**
+ * Free memory from huge_alloc().
+ *
+ * @param ptr memory to free, may be NULL
+ */
+static void
+huge_free (void *ptr)
+{
+  struct HugeRegion **pos;
+
+  if (NULL == ptr)
+    return;
+  for (pos = &huge_regions; NULL != *pos; pos = &(*pos)->next)
+  {
+    struct HugeRegion *r = *pos;
+
+    if (r->ptr != ptr)
+      continue;
+    *pos = r->next;
+    munmap (r->ptr,
+            r->len);
+    free (r);
+    return;
+  }
+  abort ();
+}
+
+
+/**
+ * Report the huge page setup of the system and how each of our
+ * regions is backed.
+ *
+ * @param to_stderr true to write to stderr (at startup), false to
+ *        print() to our parent
+ */
+static void
+huge_report (bool to_stderr)
+{
+  char line[256];
+  char mode[32];
+  unsigned long total = 0;
+  unsigned long avail = 0;
+  FILE *f;
+
+  f = fopen ("/proc/meminfo",
+             "r");
+  if (NULL != f)
+  {
+    while (NULL != fgets (line,
+                          sizeof (line),
+                          f))
+    {
+      (void) sscanf (line,
+                     "HugePages_Total: %lu",
+                     &total);
+      (void) sscanf (line,
+                     "HugePages_Free: %lu",
+                     &avail);
+    }
+    fclose (f);
+  }
+  snprintf (line,
+            sizeof (line),
+            "memory: %lu of %lu huge pages free, transparent huge pages %s\n",
+            avail,
+            total,
+            huge_thp_mode (mode,
+                           sizeof (mode)));
+  if (to_stderr)
+    fputs (line,
+           stderr);
+  else
+    print ("%s",
+           line);
+  for (const struct HugeRegion *r = huge_regions; NULL != r; r = r->next)
+  {
+    static const char *kinds[] = {
+      [HUGE_PLAIN] = "plain pages",
+      [HUGE_THP] = "transparent huge pages",
+      [HUGE_HUGETLB] = "huge pages"
+    };
+
+    snprintf (line,
+              sizeof (line),
+              "memory: %s: %zu kB in %zu kB of %s\n",
+              r->what,
+              r->size / 1024,
+              r->len / 1024,
+              kinds[r->kind]);
+    if (to_stderr)
+      fputs (line,
+             stderr);
+    else
+      print ("%s",
+             line);
+  }
+}
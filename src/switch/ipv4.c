@@ -0,0 +1,1709 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file ipv4.c
+ * @brief IPv4 forwarding engine (routing table, ARP cache,
+ *        fragmentation and ICMP errors) shared by router.c and l3switch.c
+ * @author Christian Grothoff
+ *
+ * To be included after packet.h and after the includer has defined
+ * a `struct Interface` with (at least) the `mac`, `ip`, `netmask`,
+ * `name` and `mtu` fields, the `gifc` and `num_ifc` globals with all
+ * IPv4 interfaces, find_interface(), forward_frame_payload_to() and
+ * forward_frame_payload_in_place().
+ *
+ * Received packets are inspected and modified in place through the
+ * IPV4_FIELD() and ARP_FIELD() accessors, never copied to the stack.
+ */
+
+
+/* see http://www.iana.org/assignments/ethernet-numbers */
+#ifndef ETH_P_IPV4
+/**
+ * Number for IPv4
+ */
+#define ETH_P_IPV4 0x0800
+#endif
+
+#ifndef ETH_P_ARP
+/**
+ * Number for ARP
+ */
+#define ETH_P_ARP 0x0806
+#endif
+
+/**
+ * ARP hardware type for Ethernet.
+ */
+#define ARP_HTYPE_ETHERNET 1
+
+/**
+ * ARP protocol type for IPv4.
+ */
+#define ARP_PTYPE_IPV4 ETH_P_IPV4
+
+/**
+ * ARP operation for requests.
+ */
+#define ARP_OP_REQUEST 1
+
+/**
+ * ARP operation for replies.
+ */
+#define ARP_OP_REPLY 2
+
+/**
+ * Default TTL for IPv4 packets we originate (ICMP errors).
+ */
+#define DEFAULT_TTL 64
+
+
+/**
+ * gcc 4.x-ism to pack structures (to be used before structs);
+ * Using this still causes structs to be unaligned on the stack on Sparc
+ * (See #670578 from Debian).
+ */
+_Pragma("pack(push)") _Pragma("pack(1)")
+
+/**
+ * ARP header for Ethernet-IPv4.
+ */
+struct ArpHeaderEthernetIPv4
+{
+  /**
+   * Must be #ARP_HTYPE_ETHERNET.
+   */
+  uint16_t htype;
+
+  /**
+   * Protocol type, must be #ARP_PTYPE_IPV4
+   */
+  uint16_t ptype;
+
+  /**
+   * HLEN.  Must be #MAC_ADDR_SIZE.
+   */
+  uint8_t hlen;
+
+  /**
+   * PLEN.  Must be sizeof (struct in_addr) (aka 4).
+   */
+  uint8_t plen;
+
+  /**
+   * Type of the operation.
+   */
+  uint16_t oper;
+
+  /**
+   * HW address of sender. We only support Ethernet.
+   */
+  struct MacAddress sender_ha;
+
+  /**
+   * Layer3-address of sender. We only support IPv4.
+   */
+  struct in_addr sender_pa;
+
+  /**
+   * HW address of target. We only support Ethernet.
+   */
+  struct MacAddress target_ha;
+
+  /**
+   * Layer3-address of target. We only support IPv4.
+   */
+  struct in_addr target_pa;
+};
+
+
+/* some systems use one underscore only, and mingw uses no underscore... */
+#ifndef __BYTE_ORDER
+#ifdef _BYTE_ORDER
+#define __BYTE_ORDER _BYTE_ORDER
+#else
+#ifdef BYTE_ORDER
+#define __BYTE_ORDER BYTE_ORDER
+#endif
+#endif
+#endif
+#ifndef __BIG_ENDIAN
+#ifdef _BIG_ENDIAN
+#define __BIG_ENDIAN _BIG_ENDIAN
+#else
+#ifdef BIG_ENDIAN
+#define __BIG_ENDIAN BIG_ENDIAN
+#endif
+#endif
+#endif
+#ifndef __LITTLE_ENDIAN
+#ifdef _LITTLE_ENDIAN
+#define __LITTLE_ENDIAN _LITTLE_ENDIAN
+#else
+#ifdef LITTLE_ENDIAN
+#define __LITTLE_ENDIAN LITTLE_ENDIAN
+#endif
+#endif
+#endif
+
+
+/* flags as found in the top three bits of the fragmentation info */
+#define IP_FLAGS_RESERVED 4
+#define IP_FLAGS_DO_NOT_FRAGMENT 2
+#define IP_FLAGS_MORE_FRAGMENTS 1
+#define IP_FLAGS 7
+
+#define IP_FRAGMENT_MULTIPLE 8
+
+/**
+ * Standard IPv4 header.
+ */
+struct IPv4Header
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+  unsigned int header_length:4;
+  unsigned int version:4;
+#elif __BYTE_ORDER == __BIG_ENDIAN
+  unsigned int version:4;
+  unsigned int header_length:4;
+#else
+  #error byteorder undefined
+#endif
+  uint8_t diff_serv;
+
+  /**
+   * Length of the packet, including this header.
+   */
+  uint16_t total_length;
+
+  /**
+   * Unique random ID for matching up fragments.
+   */
+  uint16_t identification;
+
+  /**
+   * Fragmentation flags and fragmentation offset.
+   */
+  uint16_t fragmentation_info;
+
+  /**
+   * How many more hops can this packet be forwarded?
+   */
+  uint8_t ttl;
+
+  /**
+   * L4-protocol, for example, IPPROTO_UDP or IPPROTO_TCP.
+   */
+  uint8_t protocol;
+
+  /**
+   * Checksum.
+   */
+  uint16_t checksum;
+
+  /**
+   * Origin of the packet.
+   */
+  struct in_addr source_address;
+
+  /**
+   * Destination of the packet.
+   */
+  struct in_addr destination_address;
+};
+
+
+
+#define	ICMPTYPE_DESTINATION_UNREACHABLE 3
+#define	ICMPTYPE_TIME_EXCEEDED 11
+
+#define ICMPCODE_NETWORK_UNREACHABLE 0
+#define ICMPCODE_HOST_UNREACHABLE 1
+#define ICMPCODE_FRAGMENTATION_REQUIRED 4
+
+/**
+ * ICMP header.
+ */
+struct IcmpHeader
+{
+  uint8_t type;
+  uint8_t code;
+  uint16_t crc;
+
+  union
+  {
+    /**
+     * Payload for #ICMPTYPE_DESTINATION_UNREACHABLE (RFC 1191)
+     */
+    struct ih_pmtu
+    {
+      uint16_t empty;
+      uint16_t next_hop_mtu;
+    } destination_unreachable;
+
+    /**
+     * Unused bytes for #ICMPTYPE_TIME_EXCEEDED.
+     */
+    uint32_t time_exceeded_unused;
+
+  } quench;
+
+  /* followed by original IP header + first 8 bytes of original IP datagram
+     (at least for the two ICMP message types we care about here) */
+
+};
+_Pragma("pack(pop)")
+
+
+/**
+ * Address of @a field of the IPv4 header at @a ip (which need not be
+ * aligned), to be accessed with get_*() and put_*().
+ */
+#define IPV4_FIELD(ip, field) ((char *) (ip) + offsetof (struct IPv4Header, field))
+
+/**
+ * Address of @a field of the ARP header at @a ah (which need not be
+ * aligned), to be accessed with get_*() and put_*().
+ */
+#define ARP_FIELD(ah, field) ((char *) (ah) + offsetof (struct ArpHeaderEthernetIPv4, field))
+
+/**
+ * Length of the IPv4 header at @a ip in bytes, including options.
+ */
+#define IPV4_HLEN(ip) ((((const uint8_t *) (ip))[0] & 0x0F) * 4)
+
+/**
+ * IP version of the header at @a ip.
+ */
+#define IPV4_VERSION(ip) (((const uint8_t *) (ip))[0] >> 4)
+
+#ifndef IPV4_EGRESS_HOOK
+/**
+ * Decide if IPv4 packet @a ip of @a size bytes may be routed out via
+ * @a ifc, after the MTU check and before the TTL is decremented.
+ * The includer can define this to filter or rewrite @a ip in place,
+ * see acl.c and nat.c.
+ */
+#define IPV4_EGRESS_HOOK(ifc, ip, size) true
+#endif
+
+#ifndef IPV4_MTU
+/**
+ * Largest IPv4 packet that can be sent via @a ifc without
+ * fragmenting it.  The includer can define this for interfaces
+ * that are not plain Ethernet, see gre.c.
+ */
+#define IPV4_MTU(ifc) ((size_t) (ifc)->mtu - sizeof (struct EthernetHeader))
+#endif
+
+#ifndef IPV4_TUNNEL_OUTPUT
+/**
+ * If @a ifc is a tunnel rather than an Ethernet interface, send the
+ * IPv4 packet @a ip of @a size bytes through it and evaluate to
+ * true.  @a ip is writable and has @a headroom writable bytes in
+ * front of it.  The includer can define this to add tunnels, see
+ * gre.c.
+ */
+#define IPV4_TUNNEL_OUTPUT(ifc, ip, size, headroom) false
+#endif
+
+#ifndef IPV4_MAX_LABELS
+/**
+ * Maximum number of MPLS labels a route can push.  The includer can
+ * define this to support "route add ... label L1/L2", together with
+ * IPV4_LABEL_OUTPUT(r, next_hop, ip, size, headroom) to send the
+ * IPv4 packet @a ip (TTL already decremented) with the labels of
+ * route @a r, see mpls.c.
+ */
+#define IPV4_MAX_LABELS 0
+#endif
+
+
+/**
+ * Entry in the routing table.
+ */
+struct Route
+{
+  /**
+   * Target network.
+   */
+  struct in_addr network;
+
+  /**
+   * Netmask of the target network.
+   */
+  struct in_addr netmask;
+
+  /**
+   * Next hop, 0.0.0.0 for directly connected networks.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * Interface to send packets out on.
+   */
+  struct Interface *ifc;
+
+  /**
+   * Was this route derived from the interface configuration
+   * (connected networks, gateways) rather than added by the user?
+   */
+  bool configured;
+
+#if IPV4_MAX_LABELS > 0
+  /**
+   * Number of entries in @e labels, 0 to send plain IPv4.
+   */
+  uint8_t num_labels;
+
+  /**
+   * MPLS labels to push, outermost first.
+   */
+  uint32_t labels[IPV4_MAX_LABELS];
+#endif
+};
+
+
+/**
+ * Entry in the ARP cache.
+ */
+struct ArpEntry
+{
+  /**
+   * IPv4 address of the neighbour.
+   */
+  struct in_addr ip;
+
+  /**
+   * MAC address of the neighbour.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Interface the neighbour was seen on.
+   */
+  struct Interface *ifc;
+};
+
+
+/**
+ * The routing table.
+ */
+static struct Route *routes;
+
+/**
+ * Number of entries in #routes.
+ */
+static unsigned int num_routes;
+
+/**
+ * The ARP cache.
+ */
+static struct ArpEntry *arp_cache;
+
+/**
+ * Number of entries in #arp_cache.
+ */
+static unsigned int num_arp;
+
+/**
+ * The broadcast MAC address.
+ */
+static const struct MacAddress broadcast_mac = {
+  .mac = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }
+};
+
+
+/**
+ * Look up the MAC of @a ip in the ARP cache of @a ifc.
+ *
+ * @param ifc interface the neighbour is on
+ * @param ip IPv4 address to look up
+ * @return NULL if @a ip is not in the cache
+ */
+static struct ArpEntry *
+arp_lookup (const struct Interface *ifc,
+            struct in_addr ip)
+{
+  for (unsigned int i=0;i<num_arp;i++)
+    if ( (ifc == arp_cache[i].ifc) &&
+         (ip.s_addr == arp_cache[i].ip.s_addr) )
+      return &arp_cache[i];
+  return NULL;
+}
+
+
+/**
+ * Update the ARP cache with the binding of @a ip to @a mac on @a ifc.
+ *
+ * @param ifc interface the neighbour is on
+ * @param ip IPv4 address of the neighbour
+ * @param mac MAC address of the neighbour
+ * @param create true to add a new entry if @a ip is not yet known,
+ *        false to only update existing entries
+ */
+static void
+arp_learn (struct Interface *ifc,
+           struct in_addr ip,
+           const struct MacAddress *mac,
+           bool create)
+{
+  struct ArpEntry *ae;
+
+  if (0 == ip.s_addr)
+    return;
+  ae = arp_lookup (ifc,
+                   ip);
+  if (NULL == ae)
+  {
+    struct ArpEntry *tmp;
+
+    if (! create)
+      return;
+    tmp = realloc (arp_cache,
+                   (num_arp + 1) * sizeof (struct ArpEntry));
+    if (NULL == tmp)
+    {
+      perror ("realloc");
+      return;
+    }
+    arp_cache = tmp;
+    ae = &arp_cache[num_arp++];
+    ae->ip = ip;
+    ae->ifc = ifc;
+  }
+  ae->mac = *mac;
+}
+
+
+/**
+ * Send an ARP message via @a ifc.
+ *
+ * @param ifc interface to send the ARP message out on
+ * @param oper #ARP_OP_REQUEST or #ARP_OP_REPLY
+ * @param dst destination MAC for the Ethernet header
+ * @param target_ha target hardware address for the ARP header
+ * @param target_pa target protocol address for the ARP header
+ */
+static void
+send_arp (struct Interface *ifc,
+          uint16_t oper,
+          const struct MacAddress *dst,
+          const struct MacAddress *target_ha,
+          struct in_addr target_pa)
+{
+  struct ArpHeaderEthernetIPv4 ah;
+
+  ah.htype = htons (ARP_HTYPE_ETHERNET);
+  ah.ptype = htons (ARP_PTYPE_IPV4);
+  ah.hlen = MAC_ADDR_SIZE;
+  ah.plen = sizeof (struct in_addr);
+  ah.oper = htons (oper);
+  ah.sender_ha = ifc->mac;
+  ah.sender_pa = ifc->ip;
+  ah.target_ha = *target_ha;
+  ah.target_pa = target_pa;
+  forward_frame_payload_to (ifc,
+                            dst,
+                            ETH_P_ARP,
+                            &ah,
+                            sizeof (ah));
+}
+
+
+/**
+ * Find the most specific route for @a dst.
+ *
+ * @param dst destination address to route
+ * @return NULL if there is no route to @a dst
+ */
+static struct Route *
+lookup_route (struct in_addr dst)
+{
+  struct Route *best = NULL;
+
+  for (unsigned int i=0;i<num_routes;i++)
+  {
+    struct Route *r = &routes[i];
+
+    if ( (dst.s_addr & r->netmask.s_addr) != r->network.s_addr)
+      continue;
+    if ( (NULL == best) ||
+         (ntohl (r->netmask.s_addr) > ntohl (best->netmask.s_addr)) )
+      best = r;
+  }
+  return best;
+}
+
+
+/**
+ * Determine the next hop for @a dst when using route @a r.
+ *
+ * @param r route to use
+ * @param dst final destination
+ * @return the gateway of @a r, or @a dst for directly connected networks
+ */
+static struct in_addr
+route_next_hop (const struct Route *r,
+                struct in_addr dst)
+{
+  if (0 == r->next_hop.s_addr)
+    return dst;
+  return r->next_hop;
+}
+
+
+/**
+ * Check if @a ip is one of our own addresses.
+ *
+ * @param ip address to check
+ * @return true if @a ip is assigned to one of our interfaces
+ */
+static bool
+is_local_address (struct in_addr ip)
+{
+  for (unsigned int i=0;i<num_ifc;i++)
+    if ( (0 != gifc[i].ip.s_addr) &&
+         (ip.s_addr == gifc[i].ip.s_addr) )
+      return true;
+  return false;
+}
+
+
+/**
+ * Find the MAC of @a next_hop on @a ifc.  If it is unknown, an ARP
+ * request is sent instead (and the caller should drop the packet).
+ *
+ * @param ifc interface to send the packet out on
+ * @param next_hop neighbour to send the packet to
+ * @return NULL on ARP miss
+ */
+static const struct ArpEntry *
+resolve_next_hop (struct Interface *ifc,
+                  struct in_addr next_hop)
+{
+  const struct ArpEntry *ae;
+  const struct MacAddress zero = { .mac = { 0 } };
+
+  ae = arp_lookup (ifc,
+                   next_hop);
+  if (NULL != ae)
+    return ae;
+  GLAB_PROBE2 (arp_miss,
+               ifc->name,
+               next_hop.s_addr);
+#if DEBUG
+  fprintf (stderr,
+           "ARP miss for next hop, dropping packet\n");
+#endif
+  send_arp (ifc,
+            ARP_OP_REQUEST,
+            &broadcast_mac,
+            &zero,
+            next_hop);
+  return NULL;
+}
+
+
+/**
+ * Function called by ipv4_fragment() with each fragment.
+ *
+ * @param cls closure
+ * @param packet the fragment, in a writable buffer
+ * @param size number of bytes in @a packet
+ * @param headroom number of writable bytes in front of @a packet
+ * @return false to drop the remaining fragments
+ */
+typedef bool
+(*Ipv4FragmentCallback) (void *cls,
+                         char *packet,
+                         size_t size,
+                         size_t headroom);
+
+
+/**
+ * Split an IPv4 packet into fragments of at most @a mtu bytes and
+ * pass them to @a cb.  Sets the total length, fragmentation
+ * information and checksum of each fragment.  Each fragment is
+ * assembled behind #GLAB_FRAME_HEADROOM bytes of headroom, so that
+ * @a cb can add headers without copying it again.
+ *
+ * @param hdr IPv4 header, including options
+ * @param hlen number of bytes in @a hdr
+ * @param payload IPv4 payload
+ * @param payload_size number of bytes in @a payload
+ * @param mtu largest fragment to create
+ * @param cb function to call with each fragment
+ * @param cb_cls closure for @a cb
+ */
+static void
+ipv4_fragment (const void *hdr,
+               size_t hlen,
+               const void *payload,
+               size_t payload_size,
+               size_t mtu,
+               Ipv4FragmentCallback cb,
+               void *cb_cls)
+{
+  const char *cpayload = payload;
+  uint16_t fi;
+  unsigned int flags;
+  size_t max_payload;
+  size_t off;
+
+  fi = get_be16 (IPV4_FIELD (hdr, fragmentation_info));
+  flags = fi >> 13;
+  max_payload = (mtu - hlen)
+    / IP_FRAGMENT_MULTIPLE * IP_FRAGMENT_MULTIPLE;
+  off = 0;
+  do
+  {
+    size_t chunk = payload_size - off;
+    unsigned int fflags = flags & ~IP_FLAGS_MORE_FRAGMENTS;
+    char buf[GLAB_FRAME_HEADROOM + hlen
+             + ((chunk > max_payload) ? max_payload : chunk)];
+    char *packet = &buf[GLAB_FRAME_HEADROOM];
+
+    if (chunk > max_payload)
+      chunk = max_payload;
+    if ( (off + chunk < payload_size) ||
+         (0 != (flags & IP_FLAGS_MORE_FRAGMENTS)) )
+      fflags |= IP_FLAGS_MORE_FRAGMENTS;
+    memcpy (packet,
+            hdr,
+            hlen);
+    put_be16 (IPV4_FIELD (packet, total_length),
+              hlen + chunk);
+    put_be16 (IPV4_FIELD (packet, fragmentation_info),
+              (fflags << 13)
+              | ((fi & 0x1FFF) + off / IP_FRAGMENT_MULTIPLE));
+    put_u16 (IPV4_FIELD (packet, checksum),
+             0);
+    put_u16 (IPV4_FIELD (packet, checksum),
+             GNUNET_CRYPTO_crc16_n (packet,
+                                    hlen));
+    memcpy (&packet[hlen],
+            &cpayload[off],
+            chunk);
+    if (! cb (cb_cls,
+              packet,
+              hlen + chunk,
+              GLAB_FRAME_HEADROOM))
+      return;
+    off += chunk;
+  }
+  while (off < payload_size);
+}
+
+
+/**
+ * Closure for transmit_fragment().
+ */
+struct TransmitContext
+{
+  /**
+   * Interface to send the fragments out on.
+   */
+  struct Interface *ifc;
+
+  /**
+   * Neighbour to send the fragments to.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * ARP entry of @e next_hop, NULL until the first fragment.
+   */
+  const struct ArpEntry *ae;
+};
+
+
+/**
+ * Send a fragment created by transmit_ip(), see
+ * #Ipv4FragmentCallback.
+ *
+ * @param cls a `struct TransmitContext`
+ * @param packet the fragment, in a writable buffer
+ * @param size number of bytes in @a packet
+ * @param headroom number of writable bytes in front of @a packet
+ * @return false on ARP miss
+ */
+static bool
+transmit_fragment (void *cls,
+                   char *packet,
+                   size_t size,
+                   size_t headroom)
+{
+  struct TransmitContext *tc = cls;
+
+  if (IPV4_TUNNEL_OUTPUT (tc->ifc,
+                          packet,
+                          size,
+                          headroom))
+    return true;
+  if ( (NULL == tc->ae) &&
+       (NULL == (tc->ae = resolve_next_hop (tc->ifc,
+                                            tc->next_hop))) )
+    return false;
+  forward_frame_payload_in_place (tc->ifc,
+                                  &tc->ae->mac,
+                                  ETH_P_IPV4,
+                                  packet,
+                                  size,
+                                  headroom);
+  return true;
+}
+
+
+/**
+ * Transmit IPv4 packet via @a ifc to @a next_hop, fragmenting it
+ * if it exceeds the MTU of @a ifc.  If the MAC of @a next_hop is
+ * unknown, an ARP request is sent instead and the packet is dropped.
+ *
+ * @param ifc interface to send the packet out on
+ * @param next_hop neighbour to send the packet to
+ * @param hdr IPv4 header, including options
+ * @param hlen number of bytes in @a hdr
+ * @param payload IPv4 payload
+ * @param payload_size number of bytes in @a payload
+ */
+static void
+transmit_ip (struct Interface *ifc,
+             struct in_addr next_hop,
+             const void *hdr,
+             size_t hlen,
+             const void *payload,
+             size_t payload_size)
+{
+  struct TransmitContext tc = {
+    .ifc = ifc,
+    .next_hop = next_hop
+  };
+
+  ipv4_fragment (hdr,
+                 hlen,
+                 payload,
+                 payload_size,
+                 IPV4_MTU (ifc),
+                 &transmit_fragment,
+                 &tc);
+}
+
+
+/**
+ * Transmit IPv4 packet @a ip via @a ifc to @a next_hop without
+ * copying it if it fits the MTU of @a ifc; otherwise it is
+ * fragmented by transmit_ip().
+ *
+ * @param ifc interface to send the packet out on
+ * @param next_hop neighbour to send the packet to
+ * @param ip IPv4 packet, in a writable buffer
+ * @param total number of bytes in @a ip
+ * @param headroom number of writable bytes in front of @a ip
+ */
+static void
+transmit_ip_in_place (struct Interface *ifc,
+                      struct in_addr next_hop,
+                      char *ip,
+                      size_t total,
+                      size_t headroom)
+{
+  size_t hlen = IPV4_HLEN (ip);
+  const struct ArpEntry *ae;
+
+  if (total > IPV4_MTU (ifc))
+  {
+    transmit_ip (ifc,
+                 next_hop,
+                 ip,
+                 hlen,
+                 &ip[hlen],
+                 total - hlen);
+    return;
+  }
+  if (IPV4_TUNNEL_OUTPUT (ifc,
+                          ip,
+                          total,
+                          headroom))
+    return;
+  ae = resolve_next_hop (ifc,
+                         next_hop);
+  if (NULL == ae)
+    return;
+  forward_frame_payload_in_place (ifc,
+                                  &ae->mac,
+                                  ETH_P_IPV4,
+                                  ip,
+                                  total,
+                                  headroom);
+}
+
+
+/**
+ * Send ICMP error message about the IPv4 packet @a orig_hdr
+ * received on @a origin back to its source.
+ *
+ * @param origin interface we received the offending packet from
+ * @param orig_hdr IPv4 header of the offending packet, including options
+ * @param orig_hlen number of bytes in @a orig_hdr
+ * @param orig_payload payload of the offending packet
+ * @param orig_payload_size number of bytes in @a orig_payload
+ * @param type ICMP type
+ * @param code ICMP code
+ * @param mtu next hop MTU for #ICMPCODE_FRAGMENTATION_REQUIRED, otherwise 0
+ */
+static void
+send_icmp_error (struct Interface *origin,
+                 const void *orig_hdr,
+                 size_t orig_hlen,
+                 const void *orig_payload,
+                 size_t orig_payload_size,
+                 uint8_t type,
+                 uint8_t code,
+                 uint16_t mtu)
+{
+  size_t quote = (orig_payload_size > 8) ? 8 : orig_payload_size;
+  char body[sizeof (struct IcmpHeader) + orig_hlen + quote];
+  struct IcmpHeader icmp;
+  struct IPv4Header ip;
+  struct Route *r;
+
+  /* never send errors about fragments other than the first or about
+     ICMP errors (RFC 1122, 3.2.2) */
+  struct in_addr orig_src;
+
+  if (0 != (get_be16 (IPV4_FIELD (orig_hdr, fragmentation_info)) & 0x1FFF))
+    return;
+  if ( (IPPROTO_ICMP == *(const uint8_t *) IPV4_FIELD (orig_hdr, protocol)) &&
+       (orig_payload_size > 0) &&
+       ( (ICMPTYPE_DESTINATION_UNREACHABLE == *(const uint8_t *) orig_payload) ||
+         (ICMPTYPE_TIME_EXCEEDED == *(const uint8_t *) orig_payload) ) )
+    return;
+  if (0 == origin->ip.s_addr)
+    return;
+  orig_src.s_addr = get_u32 (IPV4_FIELD (orig_hdr, source_address));
+  r = lookup_route (orig_src);
+  if (NULL == r)
+    return;
+  memset (&icmp,
+          0,
+          sizeof (icmp));
+  icmp.type = type;
+  icmp.code = code;
+  icmp.quench.destination_unreachable.next_hop_mtu = htons (mtu);
+  memcpy (body,
+          &icmp,
+          sizeof (icmp));
+  memcpy (&body[sizeof (icmp)],
+          orig_hdr,
+          orig_hlen);
+  memcpy (&body[sizeof (icmp) + orig_hlen],
+          orig_payload,
+          quote);
+  icmp.crc = GNUNET_CRYPTO_crc16_n (body,
+                                    sizeof (body));
+  memcpy (body,
+          &icmp,
+          sizeof (icmp));
+  memset (&ip,
+          0,
+          sizeof (ip));
+  ip.version = 4;
+  ip.header_length = sizeof (ip) / 4;
+  ip.identification = (uint16_t) random ();
+  ip.ttl = DEFAULT_TTL;
+  ip.protocol = IPPROTO_ICMP;
+  ip.source_address = origin->ip;
+  ip.destination_address = orig_src;
+  transmit_ip (r->ifc,
+               route_next_hop (r,
+                               orig_src),
+               &ip,
+               sizeof (ip),
+               body,
+               sizeof (body));
+}
+
+
+/**
+ * Determine the largest IPv4 packet that can be sent via @a r
+ * without fragmenting it: the MTU of its interface minus the MPLS
+ * labels it pushes.
+ *
+ * @param r route to use
+ * @return MTU of @a r
+ */
+static size_t
+route_mtu (const struct Route *r)
+{
+#if IPV4_MAX_LABELS > 0
+  return IPV4_MTU (r->ifc) - 4 * r->num_labels;
+#else
+  return IPV4_MTU (r->ifc);
+#endif
+}
+
+
+/**
+ * Route the IPv4 packet @a ip, decrementing its TTL in place.
+ *
+ * @param origin interface we received the packet from
+ * @param ip IPv4 packet, in a writable buffer
+ * @param size number of bytes in @a ip (may include link-layer padding)
+ * @param headroom number of writable bytes in front of @a ip
+ */
+static void
+route (struct Interface *origin,
+       char *ip,
+       size_t size,
+       size_t headroom)
+{
+  size_t hlen;
+  size_t total;
+  struct Route *r;
+  struct in_addr dst_addr;
+  uint32_t dst;
+  uint8_t *ttl;
+  uint16_t old_word;
+
+  if (size < sizeof (struct IPv4Header))
+  {
+    fprintf (stderr,
+             "Malformed IPv4 packet\n");
+    return;
+  }
+  hlen = IPV4_HLEN (ip);
+  total = get_be16 (IPV4_FIELD (ip, total_length));
+  if ( (4 != IPV4_VERSION (ip)) ||
+       (hlen < sizeof (struct IPv4Header)) ||
+       (total < hlen) ||
+       (total > size) )
+  {
+    fprintf (stderr,
+             "Malformed IPv4 packet\n");
+    return;
+  }
+  if (0 != GNUNET_CRYPTO_crc16_n (ip,
+                                  hlen))
+  {
+    fprintf (stderr,
+             "IPv4 header checksum invalid\n");
+    return;
+  }
+  dst_addr.s_addr = get_u32 (IPV4_FIELD (ip, destination_address));
+  dst = ntohl (dst_addr.s_addr);
+  if ( (INADDR_BROADCAST == dst) ||
+       IN_MULTICAST (dst) ||
+       is_local_address (dst_addr) )
+    return; /* we do not implement a local IP stack */
+  r = lookup_route (dst_addr);
+  GLAB_PROBE3 (route_lookup,
+               dst_addr.s_addr,
+               (NULL == r) ? NULL : r->ifc->name,
+               (NULL == r) ? 0 : route_next_hop (r,
+                                                 dst_addr).s_addr);
+  if (NULL == r)
+  {
+    send_icmp_error (origin,
+                     ip,
+                     hlen,
+                     &ip[hlen],
+                     total - hlen,
+                     ICMPTYPE_DESTINATION_UNREACHABLE,
+                     ICMPCODE_NETWORK_UNREACHABLE,
+                     0);
+    return;
+  }
+  ttl = (uint8_t *) IPV4_FIELD (ip, ttl);
+  if (*ttl <= 1)
+  {
+    send_icmp_error (origin,
+                     ip,
+                     hlen,
+                     &ip[hlen],
+                     total - hlen,
+                     ICMPTYPE_TIME_EXCEEDED,
+                     0,
+                     0);
+    return;
+  }
+  if ( (total > route_mtu (r)) &&
+       (0 != ((get_be16 (IPV4_FIELD (ip, fragmentation_info)) >> 13)
+              & IP_FLAGS_DO_NOT_FRAGMENT)) )
+  {
+    send_icmp_error (origin,
+                     ip,
+                     hlen,
+                     &ip[hlen],
+                     total - hlen,
+                     ICMPTYPE_DESTINATION_UNREACHABLE,
+                     ICMPCODE_FRAGMENTATION_REQUIRED,
+                     route_mtu (r));
+    return;
+  }
+  if (! IPV4_EGRESS_HOOK (r->ifc,
+                          ip,
+                          total))
+    return;
+  /* TTL shares a 16-bit word with the protocol */
+  old_word = get_u16 (ttl);
+  (*ttl)--;
+  put_u16 (IPV4_FIELD (ip, checksum),
+           GNUNET_CRYPTO_crc16_update (get_u16 (IPV4_FIELD (ip, checksum)),
+                                       old_word,
+                                       get_u16 (ttl)));
+#if IPV4_MAX_LABELS > 0
+  if (0 != r->num_labels)
+  {
+    IPV4_LABEL_OUTPUT (r,
+                       route_next_hop (r,
+                                       dst_addr),
+                       ip,
+                       total,
+                       headroom);
+    return;
+  }
+#endif
+  transmit_ip_in_place (r->ifc,
+                        route_next_hop (r,
+                                        dst_addr),
+                        ip,
+                        total,
+                        headroom);
+}
+
+
+/**
+ * Process ARP (request or response!)
+ *
+ * @param ifc interface we received the ARP request from
+ * @param eh ethernet header
+ * @param ah ARP header, at least sizeof (struct ArpHeaderEthernetIPv4) bytes
+ */
+static void
+handle_arp (struct Interface *ifc,
+            const struct EthernetHeader *eh,
+            const void *ah)
+{
+  const struct MacAddress *sender_ha;
+  struct in_addr sender_pa;
+  bool for_us;
+
+  if ( (ARP_HTYPE_ETHERNET != get_be16 (ARP_FIELD (ah, htype))) ||
+       (ARP_PTYPE_IPV4 != get_be16 (ARP_FIELD (ah, ptype))) ||
+       (MAC_ADDR_SIZE != *(const uint8_t *) ARP_FIELD (ah, hlen)) ||
+       (sizeof (struct in_addr) != *(const uint8_t *) ARP_FIELD (ah, plen)) )
+  {
+#if DEBUG
+    fprintf (stderr,
+             "Unsupported ARP frame\n");
+#endif
+    return;
+  }
+  sender_ha = (const struct MacAddress *) ARP_FIELD (ah, sender_ha);
+  sender_pa.s_addr = get_u32 (ARP_FIELD (ah, sender_pa));
+  for_us = (0 != ifc->ip.s_addr) &&
+    (get_u32 (ARP_FIELD (ah, target_pa)) == ifc->ip.s_addr);
+  /* RFC 826: always refresh known senders, only add new ones if we are the target */
+  arp_learn (ifc,
+             sender_pa,
+             sender_ha,
+             for_us);
+  if ( for_us &&
+       (ARP_OP_REQUEST == get_be16 (ARP_FIELD (ah, oper))) )
+    send_arp (ifc,
+              ARP_OP_REPLY,
+              sender_ha,
+              sender_ha,
+              sender_pa);
+}
+
+
+/**
+ * Print ARP cache entry @a ae.
+ *
+ * @param ae entry to print
+ */
+static void
+print_arp_entry (const struct ArpEntry *ae)
+{
+  print ("%s -> %02X:%02X:%02X:%02X:%02X:%02X (%s)\n",
+         inet_ntoa (ae->ip),
+         ae->mac.mac[0],
+         ae->mac.mac[1],
+         ae->mac.mac[2],
+         ae->mac.mac[3],
+         ae->mac.mac[4],
+         ae->mac.mac[5],
+         ae->ifc->name);
+}
+
+
+/**
+ * Print the entire ARP cache.
+ */
+static void
+print_arp_cache ()
+{
+  for (unsigned int i=0;i<num_arp;i++)
+    print_arp_entry (&arp_cache[i]);
+}
+
+
+/**
+ * The user entered an "arp" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_arp ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct in_addr v4;
+  struct Interface *ifc;
+  const struct ArpEntry *ae;
+
+  if (NULL == tok)
+    {
+      print_arp_cache ();
+      return;
+    }
+  if (1 !=
+      inet_pton (AF_INET,
+                 tok,
+                 &v4))
+    {
+      fprintf (stderr,
+               "`%s' is not a valid IPv4 address\n",
+               tok);
+      return;
+    }
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+    {
+      fprintf (stderr,
+               "No network interface provided\n");
+      return;
+    }
+  ifc = find_interface (tok);
+  if (NULL == ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+  ae = arp_lookup (ifc,
+                   v4);
+  if (NULL == ae)
+    {
+      const struct MacAddress zero = { .mac = { 0 } };
+
+      send_arp (ifc,
+                ARP_OP_REQUEST,
+                &broadcast_mac,
+                &zero,
+                v4);
+      print ("%s not in ARP cache, request sent on %s\n",
+             inet_ntoa (v4),
+             ifc->name);
+      return;
+    }
+  print_arp_entry (ae);
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a network and @a netmask.
+ * Format of @a net is "IP/NETMASK".
+ *
+ * @param network[out] network specification to initialize
+ * @param netmask[out] netmask specification to initialize
+ * @param arg interface specification to parse
+ * @return 0 on success
+ */
+static int
+parse_network (struct in_addr *network,
+               struct in_addr *netmask,
+               const char *net)
+{
+  const char *tok;
+  char *ip;
+  unsigned int mask;
+
+  tok = strchr (net, '/');
+  if (NULL == tok)
+    {
+      fprintf (stderr,
+               "Error in network specification: lacks '/'\n");
+      return 1;
+    }
+  ip = strndup (net,
+                tok - net);
+  if (1 !=
+      inet_pton (AF_INET,
+                 ip,
+                 network))
+    {
+      fprintf (stderr,
+               "IP address `%s' malformed\n",
+               ip);
+      free (ip);
+      return 1;
+    }
+  free (ip);
+  tok++;
+  if (1 !=
+      sscanf (tok,
+              "%u",
+              &mask))
+    {
+      fprintf (stderr,
+               "Netmask `%s' malformed\n",
+               tok);
+      return 1;
+    }
+  if (mask > 32)
+    {
+      fprintf (stderr,
+               "Netmask invalid (too large)\n");
+      return 1;
+    }
+  netmask->s_addr = htonl (~ (uint32_t) ((1LLU << (32 - mask)) - 1LLU));
+  return 0;
+}
+
+
+/**
+ * Parse route from arguments in strtok() buffer.
+ *
+ * @param target_network[out] set to target network
+ * @param target_netmask[out] set to target netmask
+ * @param next_hop[out] set to next hop
+ * @param ifc[out] set to target interface
+ */
+static int
+parse_route (struct in_addr *target_network,
+             struct in_addr *target_netmask,
+             struct in_addr *next_hop,
+             struct Interface **ifc)
+{
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != parse_network (target_network,
+                            target_netmask,
+                            tok)) )
+    {
+      fprintf (stderr,
+               "Expected network specification, not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("via",
+                         tok)))
+    {
+      fprintf (stderr,
+               "Expected `via', not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != inet_pton (AF_INET,
+                        tok,
+                        next_hop)) )
+    {
+      fprintf (stderr,
+               "Expected next hop, not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("dev",
+                         tok)))
+    {
+      fprintf (stderr,
+               "Expected `dev', not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  *ifc = find_interface (tok);
+  if (NULL == *ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return 1;
+    }
+  return 0;
+}
+
+
+#if IPV4_MAX_LABELS > 0
+/**
+ * Parse an MPLS label stack like "100/200" (outermost first).
+ * Labels 0 (IPv4 explicit null) and 16 to 2^20-1 are allowed.
+ *
+ * @param spec text to parse
+ * @param[out] labels set to the labels
+ * @param[out] num_labels set to the number of labels
+ * @return 0 on success
+ */
+static int
+parse_label_stack (const char *spec,
+                   uint32_t labels[IPV4_MAX_LABELS],
+                   uint8_t *num_labels)
+{
+  const char *pos = spec;
+
+  *num_labels = 0;
+  while (1)
+  {
+    unsigned long label;
+    char *end;
+
+    label = strtoul (pos,
+                     &end,
+                     10);
+    if ( (end == pos) ||
+         ( ('\0' != *end) &&
+           ('/' != *end) ) ||
+         ( (0 != label) &&
+           (label < 16) ) ||
+         (label >= (1LU << 20)) ||
+         (IPV4_MAX_LABELS == *num_labels) )
+    {
+      fprintf (stderr,
+               "Invalid label stack `%s' (at most %u labels, 0 or 16-1048575)\n",
+               spec,
+               (unsigned int) IPV4_MAX_LABELS);
+      return 1;
+    }
+    labels[(*num_labels)++] = (uint32_t) label;
+    if ('\0' == *end)
+      return 0;
+    pos = end + 1;
+  }
+}
+#endif
+
+
+/**
+ * Add an entry to the routing table.
+ *
+ * @param network target network
+ * @param netmask netmask of @a network
+ * @param next_hop gateway, 0.0.0.0 for directly connected networks
+ * @param ifc interface to use
+ * @param configured true if the route is derived from the interface
+ *        configuration, false if it was added by the user
+ * @return the new entry, NULL on error
+ */
+static struct Route *
+add_route (struct in_addr network,
+           struct in_addr netmask,
+           struct in_addr next_hop,
+           struct Interface *ifc,
+           bool configured)
+{
+  struct Route *tmp;
+
+  tmp = realloc (routes,
+                 (num_routes + 1) * sizeof (struct Route));
+  if (NULL == tmp)
+    {
+      perror ("realloc");
+      return NULL;
+    }
+  routes = tmp;
+  memset (&routes[num_routes],
+          0,
+          sizeof (struct Route));
+  routes[num_routes].network.s_addr = network.s_addr & netmask.s_addr;
+  routes[num_routes].netmask = netmask;
+  routes[num_routes].next_hop = next_hop;
+  routes[num_routes].ifc = ifc;
+  routes[num_routes].configured = configured;
+  return &routes[num_routes++];
+}
+
+
+/**
+ * Add a route.  If MPLS is supported, the route can be followed by
+ * "label L1/L2" to push these labels.
+ */
+static void
+process_cmd_route_add ()
+{
+  struct in_addr target_network;
+  struct in_addr target_netmask;
+  struct in_addr next_hop;
+  struct Interface *ifc;
+  struct Route *r;
+#if IPV4_MAX_LABELS > 0
+  uint32_t labels[IPV4_MAX_LABELS];
+  uint8_t num_labels = 0;
+  const char *tok;
+#endif
+
+  if (0 != parse_route (&target_network,
+                        &target_netmask,
+                        &next_hop,
+                        &ifc))
+    return;
+#if IPV4_MAX_LABELS > 0
+  tok = strtok (NULL, " ");
+  if (NULL != tok)
+  {
+    if (0 != strcasecmp ("label",
+                         tok))
+    {
+      fprintf (stderr,
+               "Expected `label', not `%s'\n",
+               tok);
+      return;
+    }
+    tok = strtok (NULL, " ");
+    if (NULL == tok)
+    {
+      fprintf (stderr,
+               "Expected label stack\n");
+      return;
+    }
+    if (0 != parse_label_stack (tok,
+                                labels,
+                                &num_labels))
+      return;
+  }
+#endif
+  r = add_route (target_network,
+                 target_netmask,
+                 next_hop,
+                 ifc,
+                 false);
+  if (NULL == r)
+    return;
+#if IPV4_MAX_LABELS > 0
+  r->num_labels = num_labels;
+  memcpy (r->labels,
+          labels,
+          num_labels * sizeof (uint32_t));
+#endif
+}
+
+
+/**
+ * Delete a route.
+ */
+static void
+process_cmd_route_del ()
+{
+  struct in_addr target_network;
+  struct in_addr target_netmask;
+  struct in_addr next_hop;
+  struct Interface *ifc;
+
+  if (0 != parse_route (&target_network,
+                        &target_netmask,
+                        &next_hop,
+                        &ifc))
+    return;
+  target_network.s_addr &= target_netmask.s_addr;
+  for (unsigned int i=0;i<num_routes;i++)
+    {
+      struct Route *r = &routes[i];
+
+      if ( (r->network.s_addr == target_network.s_addr) &&
+           (r->netmask.s_addr == target_netmask.s_addr) &&
+           (r->next_hop.s_addr == next_hop.s_addr) &&
+           (r->ifc == ifc) )
+        {
+          memmove (r,
+                   &routes[i + 1],
+                   (num_routes - i - 1) * sizeof (struct Route));
+          num_routes--;
+          return;
+        }
+    }
+  fprintf (stderr,
+           "No such route\n");
+}
+
+
+/**
+ * Print out the routing table.
+ */
+static void
+process_cmd_route_list ()
+{
+  for (unsigned int i=0;i<num_routes;i++)
+    {
+      const struct Route *r = &routes[i];
+      char net[INET_ADDRSTRLEN];
+      char hop[INET_ADDRSTRLEN];
+      char labels[IPV4_MAX_LABELS * 8 + 8];
+
+      inet_ntop (AF_INET,
+                 &r->network,
+                 net,
+                 sizeof (net));
+      inet_ntop (AF_INET,
+                 &r->next_hop,
+                 hop,
+                 sizeof (hop));
+      labels[0] = '\0';
+#if IPV4_MAX_LABELS > 0
+      for (unsigned int j=0;j<r->num_labels;j++)
+        snprintf (&labels[strlen (labels)],
+                  sizeof (labels) - strlen (labels),
+                  "%s%u",
+                  (0 == j) ? " label " : "/",
+                  (unsigned int) r->labels[j]);
+#endif
+      print ("%s/%u via %s dev %s%s\n",
+             net,
+             (unsigned int) __builtin_popcount (r->netmask.s_addr),
+             hop,
+             r->ifc->name,
+             labels);
+    }
+}
+
+
+/**
+ * The user entered a "route" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_route ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_route_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_route_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_route_list ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Move the routing table and the ARP cache over to a new set of
+ * interfaces after a configuration reload.  Interfaces are matched
+ * by name.  Routes derived from the old interface configuration are
+ * dropped (the caller adds the new ones), user routes are kept as
+ * long as their interface still exists, and ARP entries are kept as
+ * long as the address of their interface is unchanged.  Must be
+ * called while the old interfaces are still valid.
+ *
+ * @param nifc the new interfaces
+ * @param nnum number of entries in @a nifc
+ */
+static void
+ipv4_rebind (struct Interface *nifc,
+             unsigned int nnum)
+{
+  unsigned int j;
+
+  j = 0;
+  for (unsigned int i=0;i<num_routes;i++)
+  {
+    struct Interface *n = NULL;
+
+    if (routes[i].configured)
+      continue;
+    for (unsigned int k=0;k<nnum;k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           routes[i].ifc->name))
+        n = &nifc[k];
+    if (NULL == n)
+      continue;
+    routes[j] = routes[i];
+    routes[j].ifc = n;
+    j++;
+  }
+  num_routes = j;
+  j = 0;
+  for (unsigned int i=0;i<num_arp;i++)
+  {
+    const struct Interface *o = arp_cache[i].ifc;
+    struct Interface *n = NULL;
+
+    for (unsigned int k=0;k<nnum;k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           o->name))
+        n = &nifc[k];
+    if ( (NULL == n) ||
+         (n->ip.s_addr != o->ip.s_addr) ||
+         (n->netmask.s_addr != o->netmask.s_addr) )
+      continue;
+    arp_cache[j] = arp_cache[i];
+    arp_cache[j].ifc = n;
+    j++;
+  }
+  num_arp = j;
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a ifc.
+ * Format of @a net is "IPV4:IP/NETMASK".
+ *
+ * @param ifc[out] interface specification to initialize
+ * @param arg interface specification to parse
+ * @return 0 on success
+ */
+static int
+parse_network_arg (struct Interface *ifc,
+                   const char *net)
+{
+  if (0 !=
+      strncasecmp (net,
+                   "IPV4:",
+                   strlen ("IPV4:")))
+    {
+      fprintf (stderr,
+               "Interface specification `%s' does not start with `IPV4:'\n",
+               net);
+      return 1;
+    }
+  net += strlen ("IPV4:");
+  return parse_network (&ifc->ip,
+                        &ifc->netmask,
+                        net);
+}
+
+
+/* end of ipv4.c */
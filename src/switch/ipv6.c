@@ -0,0 +1,2039 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file ipv6.c
+ * @brief IPv6 forwarding engine (tree-bitmap routing table, NDP
+ *        neighbour cache and ICMPv6 errors) for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c and huge.c, and after the includer has
+ * defined a `struct Interface` with (at least) the `mac`, `ip6`,
+ * `prefix6_len`, `name` and `mtu` fields, the `gifc` and `num_ifc` globals,
+ * find_interface(), forward_frame_payload_to() and
+ * forward_frame_payload_in_place().
+ *
+ * Every interface has an EUI-64 link-local address derived from its
+ * MAC and optionally one global address (`ip6`/`prefix6_len`).  We
+ * answer neighbour solicitations for both, but otherwise do not
+ * implement a local IPv6 stack.
+ *
+ * Routes are kept in a plain array for the "route6" command and
+ * compiled into a tree bitmap (Eatherton, Varghese and Dittia) with
+ * strides of #LPM6_STRIDE bits whenever they change.  Each node has
+ * an internal bitmap of the prefixes ending within its stride and
+ * an external bitmap of the children present; children and results
+ * of a node are stored contiguously, so a node is 24 bytes and a
+ * lookup touches at most one node per stride (22 for a /128).
+ */
+
+
+/* see http://www.iana.org/assignments/ethernet-numbers */
+#ifndef ETH_P_IPV6
+/**
+ * Number for IPv6
+ */
+#define ETH_P_IPV6 0x86DD
+#endif
+
+#define ICMP6TYPE_DESTINATION_UNREACHABLE 1
+#define ICMP6TYPE_PACKET_TOO_BIG 2
+#define ICMP6TYPE_TIME_EXCEEDED 3
+#define ICMP6TYPE_NEIGHBOR_SOLICITATION 135
+#define ICMP6TYPE_NEIGHBOR_ADVERTISEMENT 136
+
+#define ICMP6CODE_NO_ROUTE 0
+#define ICMP6CODE_BEYOND_SCOPE 2
+
+/**
+ * ICMPv6 types below this value are errors (RFC 4443, 2.1).
+ */
+#define ICMP6TYPE_FIRST_INFORMATIONAL 128
+
+/**
+ * NDP option carrying the link-layer address of the sender.
+ */
+#define NDP_OPTION_SOURCE_LL 1
+
+/**
+ * NDP option carrying the link-layer address of the target.
+ */
+#define NDP_OPTION_TARGET_LL 2
+
+/* flags in the first byte of a neighbour advertisement */
+#define NDP_FLAG_ROUTER 0x80
+#define NDP_FLAG_SOLICITED 0x40
+#define NDP_FLAG_OVERRIDE 0x20
+
+/**
+ * Hop limit of NDP messages, receivers check that they were not
+ * forwarded (RFC 4861, 7.1).
+ */
+#define NDP_HOP_LIMIT 255
+
+/**
+ * Default hop limit for IPv6 packets we originate (ICMPv6 errors).
+ */
+#define DEFAULT_HOP_LIMIT 64
+
+/**
+ * Minimum IPv6 MTU, ICMPv6 errors must not exceed it (RFC 4443, 2.4).
+ */
+#define IPV6_MIN_MTU 1280
+
+/**
+ * Number of address bits consumed per tree bitmap node.  With 6,
+ * the internal bitmap has 63 and the external bitmap 64 bits.
+ */
+#define LPM6_STRIDE 6
+
+
+_Pragma("pack(push)") _Pragma("pack(1)")
+
+/**
+ * Standard IPv6 header.
+ */
+struct IPv6Header
+{
+  /**
+   * Version (6), traffic class and flow label.
+   */
+  uint32_t version_class_flow;
+
+  /**
+   * Length of the packet, excluding this header.
+   */
+  uint16_t payload_length;
+
+  /**
+   * Type of the first extension header or the L4-protocol.
+   */
+  uint8_t next_header;
+
+  /**
+   * How many more hops can this packet be forwarded?
+   */
+  uint8_t hop_limit;
+
+  /**
+   * Origin of the packet.
+   */
+  struct in6_addr source_address;
+
+  /**
+   * Destination of the packet.
+   */
+  struct in6_addr destination_address;
+};
+
+
+/**
+ * ICMPv6 header.
+ */
+struct Icmp6Header
+{
+  uint8_t type;
+  uint8_t code;
+  uint16_t crc;
+
+  /**
+   * MTU for #ICMP6TYPE_PACKET_TOO_BIG, flags for
+   * #ICMP6TYPE_NEIGHBOR_ADVERTISEMENT, otherwise unused.
+   */
+  uint32_t data;
+
+  /* followed by as much of the original packet as fits (errors)
+     or the NDP target and options */
+};
+
+
+/**
+ * Neighbour solicitation or advertisement.
+ */
+struct NdpHeader
+{
+  struct Icmp6Header icmp;
+
+  /**
+   * Address being resolved.
+   */
+  struct in6_addr target;
+
+  /* followed by options */
+};
+
+
+/**
+ * NDP source or target link-layer address option for Ethernet.
+ */
+struct NdpLinkLayerOption
+{
+  /**
+   * #NDP_OPTION_SOURCE_LL or #NDP_OPTION_TARGET_LL.
+   */
+  uint8_t type;
+
+  /**
+   * Length of the option in units of 8 bytes, 1.
+   */
+  uint8_t length;
+
+  struct MacAddress mac;
+};
+
+
+/**
+ * Pseudo header covered by ICMPv6 checksums (RFC 8200, 8.1).
+ */
+struct IPv6PseudoHeader
+{
+  struct in6_addr source_address;
+  struct in6_addr destination_address;
+  uint32_t length;
+  uint8_t zero[3];
+  uint8_t next_header;
+};
+_Pragma("pack(pop)")
+
+
+/**
+ * Address of @a field of the IPv6 header at @a ip (which need not be
+ * aligned), to be accessed with get_*() and put_*() or memcpy().
+ */
+#define IPV6_FIELD(ip, field) ((char *) (ip) + offsetof (struct IPv6Header, field))
+
+/**
+ * Address of @a field of the NDP message at @a nd (which need not be
+ * aligned).
+ */
+#define NDP_FIELD(nd, field) ((char *) (nd) + offsetof (struct NdpHeader, field))
+
+/**
+ * IP version of the header at @a ip.
+ */
+#define IPV6_VERSION(ip) (((const uint8_t *) (ip))[0] >> 4)
+
+
+/**
+ * Entry in the IPv6 routing table.
+ */
+struct Route6
+{
+  /**
+   * Target network.
+   */
+  struct in6_addr network;
+
+  /**
+   * Next hop, :: for directly connected networks.
+   */
+  struct in6_addr next_hop;
+
+  /**
+   * Interface to send packets out on.
+   */
+  struct Interface *ifc;
+
+  /**
+   * Prefix length of @e network.
+   */
+  uint8_t len;
+
+  /**
+   * Was this route derived from the interface configuration
+   * (connected networks, gateways) rather than added by the user?
+   */
+  bool configured;
+};
+
+
+/**
+ * Entry in the NDP neighbour cache.
+ */
+struct NdpEntry
+{
+  /**
+   * IPv6 address of the neighbour.
+   */
+  struct in6_addr ip;
+
+  /**
+   * MAC address of the neighbour.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Interface the neighbour was seen on.
+   */
+  struct Interface *ifc;
+};
+
+
+/**
+ * Node of the tree bitmap.
+ */
+struct Lpm6Node
+{
+  /**
+   * Bit (2^l - 1 + v) is set if a prefix of length l < #LPM6_STRIDE
+   * with value v (relative to this node) ends here.
+   */
+  uint64_t internal;
+
+  /**
+   * Bit v is set if the child for the next #LPM6_STRIDE bits v exists.
+   */
+  uint64_t external;
+
+  /**
+   * Index of the first child in #lpm6_nodes.
+   */
+  uint32_t children;
+
+  /**
+   * Index of the first result in #lpm6_results.
+   */
+  uint32_t results;
+};
+
+
+/**
+ * Route while compiling the tree bitmap.
+ */
+struct Lpm6Prefix
+{
+  /**
+   * Network in host byte order.
+   */
+  unsigned __int128 network;
+
+  /**
+   * Index in #routes6.
+   */
+  uint32_t route;
+
+  /**
+   * Prefix length.
+   */
+  uint8_t len;
+};
+
+
+/**
+ * Tree bitmap node still to be filled in while compiling.
+ */
+struct Lpm6Pending
+{
+  /**
+   * First prefix below the node in the sorted prefixes.
+   */
+  uint32_t lo;
+
+  /**
+   * End of the prefixes below the node.
+   */
+  uint32_t hi;
+
+  /**
+   * Level of the node, 0 for the root.
+   */
+  unsigned int level;
+};
+
+
+/**
+ * The IPv6 routing table.
+ */
+static struct Route6 *routes6;
+
+/**
+ * Number of entries in #routes6.
+ */
+static unsigned int num_routes6;
+
+/**
+ * Tree bitmap compiled from #routes6, the root is the first node.
+ */
+static struct Lpm6Node *lpm6_nodes;
+
+/**
+ * Number of entries in #lpm6_nodes, 0 if there are no routes.
+ */
+static unsigned int lpm6_num_nodes;
+
+/**
+ * Indices into #routes6 for the prefixes in #lpm6_nodes, stored right
+ * after the nodes in the same huge_alloc() region.
+ */
+static uint32_t *lpm6_results;
+
+/**
+ * For each value v of a stride, the internal bitmap positions of
+ * all prefixes within the stride that match v.
+ */
+static uint64_t lpm6_match[1 << LPM6_STRIDE];
+
+/**
+ * The NDP neighbour cache.
+ */
+static struct NdpEntry *ndp_cache;
+
+/**
+ * Number of entries in #ndp_cache.
+ */
+static unsigned int num_ndp;
+
+/**
+ * The all-nodes multicast address.
+ */
+static const struct in6_addr all_nodes_ip6 = {
+  .s6_addr = { 0xFF, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01 }
+};
+
+
+/**
+ * Convert IPv6 address @a addr (which need not be aligned) to a
+ * number in host byte order.
+ *
+ * @param addr address to convert
+ * @return @a addr as number
+ */
+static inline unsigned __int128
+ipv6_to_u128 (const void *addr)
+{
+  const uint8_t *b = addr;
+  unsigned __int128 v = 0;
+
+  for (unsigned int i=0;i<sizeof (struct in6_addr);i++)
+    v = (v << 8) | b[i];
+  return v;
+}
+
+
+/**
+ * Convert @a v from host byte order to IPv6 address @a addr.
+ *
+ * @param v number to convert
+ * @param[out] addr set to the address
+ */
+static void
+ipv6_from_u128 (unsigned __int128 v,
+                struct in6_addr *addr)
+{
+  for (int i=sizeof (struct in6_addr) - 1;i>=0;i--)
+  {
+    addr->s6_addr[i] = (uint8_t) v;
+    v >>= 8;
+  }
+}
+
+
+/**
+ * Compute the netmask for prefix length @a len.
+ *
+ * @param len prefix length, at most 128
+ * @return netmask in host byte order
+ */
+static unsigned __int128
+ipv6_mask (unsigned int len)
+{
+  if (0 == len)
+    return 0;
+  return (~ (unsigned __int128) 0) << (128 - len);
+}
+
+
+/**
+ * Compute the link-local address of @a ifc (fe80::/64 with the
+ * modified EUI-64 of its MAC, RFC 4291, 2.5.1).
+ *
+ * @param ifc interface
+ * @param[out] ll set to the link-local address
+ */
+static void
+ipv6_link_local (const struct Interface *ifc,
+                 struct in6_addr *ll)
+{
+  memset (ll,
+          0,
+          sizeof (*ll));
+  ll->s6_addr[0] = 0xFE;
+  ll->s6_addr[1] = 0x80;
+  ll->s6_addr[8] = ifc->mac.mac[0] ^ 0x02;
+  ll->s6_addr[9] = ifc->mac.mac[1];
+  ll->s6_addr[10] = ifc->mac.mac[2];
+  ll->s6_addr[11] = 0xFF;
+  ll->s6_addr[12] = 0xFE;
+  ll->s6_addr[13] = ifc->mac.mac[3];
+  ll->s6_addr[14] = ifc->mac.mac[4];
+  ll->s6_addr[15] = ifc->mac.mac[5];
+}
+
+
+/**
+ * Check if @a ip is assigned to @a ifc.
+ *
+ * @param ifc interface to check
+ * @param ip address to check
+ * @return true if @a ip is the global or link-local address of @a ifc
+ */
+static bool
+ipv6_is_ours (const struct Interface *ifc,
+              const struct in6_addr *ip)
+{
+  struct in6_addr ll;
+
+  if ( (! IN6_IS_ADDR_UNSPECIFIED (&ifc->ip6)) &&
+       IN6_ARE_ADDR_EQUAL (ip,
+                           &ifc->ip6) )
+    return true;
+  ipv6_link_local (ifc,
+                   &ll);
+  return IN6_ARE_ADDR_EQUAL (ip,
+                             &ll);
+}
+
+
+/**
+ * Check if @a ip is one of our own IPv6 addresses.
+ *
+ * @param ip address to check
+ * @return true if @a ip is assigned to one of our interfaces
+ */
+static bool
+is_local_address6 (const struct in6_addr *ip)
+{
+  for (unsigned int i=0;i<num_ifc;i++)
+    if (ipv6_is_ours (&gifc[i],
+                      ip))
+      return true;
+  return false;
+}
+
+
+/**
+ * Select the source address for packets we send via @a ifc to @a dst:
+ * the global address of @a ifc unless @a dst is link-local or @a ifc
+ * has none.
+ *
+ * @param ifc interface the packet is sent out on
+ * @param dst destination of the packet
+ * @param[out] src set to the source address
+ */
+static void
+ipv6_source_address (const struct Interface *ifc,
+                     const struct in6_addr *dst,
+                     struct in6_addr *src)
+{
+  if ( IN6_IS_ADDR_LINKLOCAL (dst) ||
+       IN6_IS_ADDR_UNSPECIFIED (&ifc->ip6) )
+    ipv6_link_local (ifc,
+                     src);
+  else
+    *src = ifc->ip6;
+}
+
+
+/**
+ * Compute the ICMPv6 checksum of @a body.
+ *
+ * @param src source address of the IPv6 packet
+ * @param dst destination address of the IPv6 packet
+ * @param body ICMPv6 message
+ * @param len number of bytes in @a body
+ * @return checksum, 0 if @a body includes a valid checksum
+ */
+static uint16_t
+icmp6_checksum (const struct in6_addr *src,
+                const struct in6_addr *dst,
+                const void *body,
+                size_t len)
+{
+  struct IPv6PseudoHeader ph;
+  uint32_t sum;
+
+  memset (&ph,
+          0,
+          sizeof (ph));
+  ph.source_address = *src;
+  ph.destination_address = *dst;
+  ph.length = htonl ((uint32_t) len);
+  ph.next_header = IPPROTO_ICMPV6;
+  sum = GNUNET_CRYPTO_crc16_step (0,
+                                  &ph,
+                                  sizeof (ph));
+  sum = GNUNET_CRYPTO_crc16_step (sum,
+                                  body,
+                                  len);
+  return GNUNET_CRYPTO_crc16_finish (sum);
+}
+
+
+/**
+ * Fill in the IPv6 header @a ip for a packet we originate.
+ *
+ * @param[out] ip header to initialize
+ * @param src source address
+ * @param dst destination address
+ * @param hop_limit hop limit to use
+ * @param payload_length number of bytes following @a ip
+ */
+static void
+ipv6_init_header (struct IPv6Header *ip,
+                  const struct in6_addr *src,
+                  const struct in6_addr *dst,
+                  uint8_t hop_limit,
+                  size_t payload_length)
+{
+  ip->version_class_flow = htonl (6u << 28);
+  ip->payload_length = htons ((uint16_t) payload_length);
+  ip->next_header = IPPROTO_ICMPV6;
+  ip->hop_limit = hop_limit;
+  ip->source_address = *src;
+  ip->destination_address = *dst;
+}
+
+
+/**
+ * Look up the MAC of @a ip in the neighbour cache of @a ifc.
+ *
+ * @param ifc interface the neighbour is on
+ * @param ip IPv6 address to look up
+ * @return NULL if @a ip is not in the cache
+ */
+static struct NdpEntry *
+ndp_lookup (const struct Interface *ifc,
+            const struct in6_addr *ip)
+{
+  for (unsigned int i=0;i<num_ndp;i++)
+    if ( (ifc == ndp_cache[i].ifc) &&
+         IN6_ARE_ADDR_EQUAL (ip,
+                             &ndp_cache[i].ip) )
+      return &ndp_cache[i];
+  return NULL;
+}
+
+
+/**
+ * Update the neighbour cache with the binding of @a ip to @a mac on @a ifc.
+ *
+ * @param ifc interface the neighbour is on
+ * @param ip IPv6 address of the neighbour
+ * @param mac MAC address of the neighbour
+ * @param create true to add a new entry if @a ip is not yet known,
+ *        false to only update existing entries
+ */
+static void
+ndp_learn (struct Interface *ifc,
+           const struct in6_addr *ip,
+           const struct MacAddress *mac,
+           bool create)
+{
+  struct NdpEntry *ne;
+
+  if ( IN6_IS_ADDR_UNSPECIFIED (ip) ||
+       IN6_IS_ADDR_MULTICAST (ip) )
+    return;
+  ne = ndp_lookup (ifc,
+                   ip);
+  if (NULL == ne)
+  {
+    struct NdpEntry *tmp;
+
+    if (! create)
+      return;
+    tmp = realloc (ndp_cache,
+                   (num_ndp + 1) * sizeof (struct NdpEntry));
+    if (NULL == tmp)
+    {
+      perror ("realloc");
+      return;
+    }
+    ndp_cache = tmp;
+    ne = &ndp_cache[num_ndp++];
+    ne->ip = *ip;
+    ne->ifc = ifc;
+  }
+  ne->mac = *mac;
+}
+
+
+/**
+ * Send a neighbour solicitation or advertisement via @a ifc.
+ * Solicitations carry our MAC as source link-layer address,
+ * advertisements as target link-layer address.
+ *
+ * @param ifc interface to send the message out on
+ * @param type #ICMP6TYPE_NEIGHBOR_SOLICITATION or #ICMP6TYPE_NEIGHBOR_ADVERTISEMENT
+ * @param flags NDP_FLAG_* for advertisements, 0 for solicitations
+ * @param dst_mac destination MAC for the Ethernet header
+ * @param src source address for the IPv6 header
+ * @param dst destination address for the IPv6 header
+ * @param target address being resolved or advertised
+ */
+static void
+send_ndp (struct Interface *ifc,
+          uint8_t type,
+          uint8_t flags,
+          const struct MacAddress *dst_mac,
+          const struct in6_addr *src,
+          const struct in6_addr *dst,
+          const struct in6_addr *target)
+{
+  char packet[sizeof (struct IPv6Header)
+              + sizeof (struct NdpHeader)
+              + sizeof (struct NdpLinkLayerOption)];
+  char *body = &packet[sizeof (struct IPv6Header)];
+  struct IPv6Header ip;
+  struct NdpHeader nd;
+  struct NdpLinkLayerOption opt;
+
+  memset (&nd,
+          0,
+          sizeof (nd));
+  nd.icmp.type = type;
+  nd.icmp.data = htonl ((uint32_t) flags << 24);
+  nd.target = *target;
+  opt.type = (ICMP6TYPE_NEIGHBOR_SOLICITATION == type)
+    ? NDP_OPTION_SOURCE_LL
+    : NDP_OPTION_TARGET_LL;
+  opt.length = sizeof (opt) / 8;
+  opt.mac = ifc->mac;
+  ipv6_init_header (&ip,
+                    src,
+                    dst,
+                    NDP_HOP_LIMIT,
+                    sizeof (nd) + sizeof (opt));
+  memcpy (packet,
+          &ip,
+          sizeof (ip));
+  memcpy (body,
+          &nd,
+          sizeof (nd));
+  memcpy (&body[sizeof (nd)],
+          &opt,
+          sizeof (opt));
+  nd.icmp.crc = icmp6_checksum (src,
+                                dst,
+                                body,
+                                sizeof (nd) + sizeof (opt));
+  memcpy (body,
+          &nd,
+          sizeof (nd));
+  forward_frame_payload_to (ifc,
+                            dst_mac,
+                            ETH_P_IPV6,
+                            packet,
+                            sizeof (packet));
+}
+
+
+/**
+ * Send a neighbour solicitation for @a target via @a ifc to its
+ * solicited-node multicast address (RFC 4291, 2.7.1).
+ *
+ * @param ifc interface to send the solicitation out on
+ * @param target address to resolve
+ */
+static void
+send_ndp_solicitation (struct Interface *ifc,
+                       const struct in6_addr *target)
+{
+  struct in6_addr snm;
+  struct in6_addr src;
+  struct MacAddress mac;
+
+  memset (&snm,
+          0,
+          sizeof (snm));
+  snm.s6_addr[0] = 0xFF;
+  snm.s6_addr[1] = 0x02;
+  snm.s6_addr[11] = 0x01;
+  snm.s6_addr[12] = 0xFF;
+  memcpy (&snm.s6_addr[13],
+          &target->s6_addr[13],
+          3);
+  /* multicast MACs are 33:33 followed by the low 32 bits (RFC 2464, 7) */
+  mac.mac[0] = 0x33;
+  mac.mac[1] = 0x33;
+  memcpy (&mac.mac[2],
+          &snm.s6_addr[12],
+          4);
+  ipv6_source_address (ifc,
+                       target,
+                       &src);
+  send_ndp (ifc,
+            ICMP6TYPE_NEIGHBOR_SOLICITATION,
+            0,
+            &mac,
+            &src,
+            &snm,
+            target);
+}
+
+
+/**
+ * Find the MAC of @a next_hop on @a ifc.  If it is unknown, a
+ * neighbour solicitation is sent instead (and the caller should
+ * drop the packet).
+ *
+ * @param ifc interface to send the packet out on
+ * @param next_hop neighbour to send the packet to
+ * @return NULL on neighbour cache miss
+ */
+static const struct NdpEntry *
+resolve_next_hop6 (struct Interface *ifc,
+                   const struct in6_addr *next_hop)
+{
+  const struct NdpEntry *ne;
+
+  ne = ndp_lookup (ifc,
+                   next_hop);
+  if (NULL != ne)
+    return ne;
+  GLAB_PROBE2 (ndp_miss,
+               ifc->name,
+               next_hop);
+#if DEBUG
+  fprintf (stderr,
+           "NDP miss for next hop, dropping packet\n");
+#endif
+  send_ndp_solicitation (ifc,
+                         next_hop);
+  return NULL;
+}
+
+
+/**
+ * Compute the internal bitmap positions matching each stride value
+ * (#lpm6_match), once.
+ */
+static void
+lpm6_init_match ()
+{
+  if (0 != lpm6_match[0])
+    return;
+  for (unsigned int v=0;v<(1u << LPM6_STRIDE);v++)
+    for (unsigned int l=0;l<LPM6_STRIDE;l++)
+      lpm6_match[v] |= 1LLU << ((1u << l) - 1 + (v >> (LPM6_STRIDE - l)));
+}
+
+
+/**
+ * Extract the @a level-th stride of @a addr.
+ *
+ * @param addr address in host byte order
+ * @param level stride to extract, bits beyond the address are 0
+ * @return stride value
+ */
+static inline unsigned int
+lpm6_stride (unsigned __int128 addr,
+             unsigned int level)
+{
+  unsigned int off = level * LPM6_STRIDE;
+
+  if (off >= 128)
+    return 0;
+  return (unsigned int) ((addr << off) >> (128 - LPM6_STRIDE));
+}
+
+
+/**
+ * Order prefixes by network, then by length, then by position in
+ * the routing table (for qsort()).
+ *
+ * @param a a `struct Lpm6Prefix`
+ * @param b a `struct Lpm6Prefix`
+ * @return -1, 0 or 1
+ */
+static int
+lpm6_prefix_cmp (const void *a,
+                 const void *b)
+{
+  const struct Lpm6Prefix *pa = a;
+  const struct Lpm6Prefix *pb = b;
+
+  if (pa->network != pb->network)
+    return (pa->network < pb->network) ? -1 : 1;
+  if (pa->len != pb->len)
+    return (pa->len < pb->len) ? -1 : 1;
+  if (pa->route != pb->route)
+    return (pa->route < pb->route) ? -1 : 1;
+  return 0;
+}
+
+
+/**
+ * Compile #routes6 into the tree bitmap.  Nodes are created in
+ * breadth-first order from the sorted prefixes: the prefixes below
+ * a node are a contiguous range, those ending within its stride go
+ * to its internal bitmap and the others form one contiguous range
+ * per child.  If the same prefix is routed more than once, the
+ * first route wins (like lookup_route() does for IPv4).  On
+ * allocation failure the previous tree bitmap is kept.
+ */
+static void
+lpm6_rebuild ()
+{
+  struct Lpm6Prefix *prefixes;
+  struct Lpm6Pending *pending;
+  struct Lpm6Node *nodes;
+  struct Lpm6Node *table;
+  uint32_t *results;
+  unsigned int num_nodes;
+  unsigned int max_nodes;
+  unsigned int num_results;
+
+  lpm6_init_match ();
+  if (0 == num_routes6)
+  {
+    huge_free (lpm6_nodes);
+    lpm6_nodes = NULL;
+    lpm6_results = NULL;
+    lpm6_num_nodes = 0;
+    return;
+  }
+  max_nodes = num_routes6 + 1;
+  prefixes = malloc (num_routes6 * sizeof (struct Lpm6Prefix));
+  pending = malloc (max_nodes * sizeof (struct Lpm6Pending));
+  nodes = malloc (max_nodes * sizeof (struct Lpm6Node));
+  results = malloc (num_routes6 * sizeof (uint32_t));
+  if ( (NULL == prefixes) ||
+       (NULL == pending) ||
+       (NULL == nodes) ||
+       (NULL == results) )
+    goto oom;
+  for (unsigned int i=0;i<num_routes6;i++)
+  {
+    prefixes[i].network = ipv6_to_u128 (&routes6[i].network);
+    prefixes[i].len = routes6[i].len;
+    prefixes[i].route = i;
+  }
+  qsort (prefixes,
+         num_routes6,
+         sizeof (struct Lpm6Prefix),
+         &lpm6_prefix_cmp);
+  pending[0].lo = 0;
+  pending[0].hi = num_routes6;
+  pending[0].level = 0;
+  num_nodes = 1;
+  num_results = 0;
+  for (unsigned int n=0;n<num_nodes;n++)
+  {
+    struct Lpm6Pending p = pending[n];
+    unsigned int base = p.level * LPM6_STRIDE;
+    uint32_t internal[(1 << LPM6_STRIDE) - 1];
+    uint64_t ibits = 0;
+    uint64_t ebits = 0;
+
+    nodes[n].children = num_nodes;
+    for (unsigned int i=p.lo;i<p.hi;i++)
+    {
+      const struct Lpm6Prefix *px = &prefixes[i];
+      unsigned int rest = px->len - base;
+      unsigned int v = lpm6_stride (px->network,
+                                    p.level);
+
+      if (rest < LPM6_STRIDE)
+      {
+        unsigned int k = (1u << rest) - 1 + (v >> (LPM6_STRIDE - rest));
+
+        if (0 == (ibits & (1LLU << k)))
+        {
+          ibits |= 1LLU << k;
+          internal[k] = px->route;
+        }
+        continue;
+      }
+      /* longer prefixes with the same stride value are adjacent */
+      if (0 == (ebits & (1LLU << v)))
+      {
+        if (num_nodes == max_nodes)
+        {
+          struct Lpm6Pending *tp;
+          struct Lpm6Node *tn;
+
+          max_nodes *= 2;
+          tp = realloc (pending,
+                        max_nodes * sizeof (struct Lpm6Pending));
+          if (NULL != tp)
+            pending = tp;
+          tn = realloc (nodes,
+                        max_nodes * sizeof (struct Lpm6Node));
+          if (NULL != tn)
+            nodes = tn;
+          if ( (NULL == tp) ||
+               (NULL == tn) )
+            goto oom;
+        }
+        ebits |= 1LLU << v;
+        pending[num_nodes].lo = i;
+        pending[num_nodes].level = p.level + 1;
+        num_nodes++;
+      }
+      pending[num_nodes - 1].hi = i + 1;
+    }
+    nodes[n].internal = ibits;
+    nodes[n].external = ebits;
+    nodes[n].results = num_results;
+    for (unsigned int k=0;k<(1 << LPM6_STRIDE) - 1;k++)
+      if (0 != (ibits & (1LLU << k)))
+        results[num_results++] = internal[k];
+  }
+  /* the lookup walks nodes and results at random, keep them together */
+  table = huge_alloc (num_nodes * sizeof (struct Lpm6Node)
+                      + num_results * sizeof (uint32_t),
+                      "IPv6 tree bitmap");
+  if (NULL == table)
+    goto oom;
+  memcpy (table,
+          nodes,
+          num_nodes * sizeof (struct Lpm6Node));
+  memcpy (&table[num_nodes],
+          results,
+          num_results * sizeof (uint32_t));
+  free (prefixes);
+  free (pending);
+  free (nodes);
+  free (results);
+  huge_free (lpm6_nodes);
+  lpm6_nodes = table;
+  lpm6_results = (uint32_t *) &table[num_nodes];
+  lpm6_num_nodes = num_nodes;
+  return;
+oom:
+  perror ("malloc");
+  free (prefixes);
+  free (pending);
+  free (nodes);
+  free (results);
+}
+
+
+/**
+ * Find the most specific IPv6 route for @a dst in the tree bitmap.
+ * At each node, the longest prefix ending within the stride is the
+ * highest internal bit matching the stride value.
+ *
+ * @param dst destination address to route
+ * @return NULL if there is no route to @a dst
+ */
+static struct Route6 *
+lookup_route6 (const struct in6_addr *dst)
+{
+  unsigned __int128 addr = ipv6_to_u128 (dst);
+  const struct Lpm6Node *node;
+  uint32_t best = UINT32_MAX;
+
+  if (0 == lpm6_num_nodes)
+    return NULL;
+  node = &lpm6_nodes[0];
+  for (unsigned int level=0;;level++)
+  {
+    unsigned int v = lpm6_stride (addr,
+                                  level);
+    uint64_t m = node->internal & lpm6_match[v];
+
+    if (0 != m)
+    {
+      unsigned int k = 63 - __builtin_clzll (m);
+
+      best = node->results
+        + __builtin_popcountll (node->internal & ((1LLU << k) - 1));
+    }
+    if (0 == (node->external & (1LLU << v)))
+      break;
+    node = &lpm6_nodes[node->children
+                       + __builtin_popcountll (node->external
+                                               & ((1LLU << v) - 1))];
+  }
+  if (UINT32_MAX == best)
+    return NULL;
+  return &routes6[lpm6_results[best]];
+}
+
+
+/**
+ * Determine the next hop for @a dst when using route @a r.
+ *
+ * @param r route to use
+ * @param dst final destination
+ * @return the gateway of @a r, or @a dst for directly connected networks
+ */
+static const struct in6_addr *
+route6_next_hop (const struct Route6 *r,
+                 const struct in6_addr *dst)
+{
+  if (IN6_IS_ADDR_UNSPECIFIED (&r->next_hop))
+    return dst;
+  return &r->next_hop;
+}
+
+
+/**
+ * Find the upper-layer protocol of the IPv6 packet @a ip by skipping
+ * the extension headers we know about.
+ *
+ * @param ip IPv6 packet
+ * @param total number of bytes in @a ip
+ * @param[out] proto set to the upper-layer protocol
+ * @return offset of the upper-layer header in @a ip, 0 if it is not
+ *         in this packet (truncated, or not the first fragment)
+ */
+static size_t
+ipv6_upper_layer (const char *ip,
+                  size_t total,
+                  uint8_t *proto)
+{
+  const uint8_t *b = (const uint8_t *) ip;
+  size_t off = sizeof (struct IPv6Header);
+  uint8_t nh = b[offsetof (struct IPv6Header, next_header)];
+
+  for (;;)
+  {
+    switch (nh)
+    {
+    case IPPROTO_HOPOPTS:
+    case IPPROTO_ROUTING:
+    case IPPROTO_DSTOPTS:
+      if (off + 2 > total)
+        return 0;
+      nh = b[off];
+      off += (b[off + 1] + 1) * 8;
+      break;
+    case IPPROTO_FRAGMENT:
+      if (off + 8 > total)
+        return 0;
+      if (0 != (get_be16 (&b[off + 2]) & 0xFFF8))
+        return 0;
+      nh = b[off];
+      off += 8;
+      break;
+    default:
+      if (off > total)
+        return 0;
+      *proto = nh;
+      return off;
+    }
+  }
+}
+
+
+/**
+ * Send ICMPv6 error message about the IPv6 packet @a orig received
+ * on @a origin back to its source, quoting as much of @a orig as
+ * fits into the minimum MTU (RFC 4443, 2.4).
+ *
+ * @param origin interface we received the offending packet from
+ * @param orig the offending packet
+ * @param orig_size number of bytes in @a orig
+ * @param type ICMPv6 type
+ * @param code ICMPv6 code
+ * @param mtu next hop MTU for #ICMP6TYPE_PACKET_TOO_BIG, otherwise 0
+ */
+static void
+send_icmp6_error (struct Interface *origin,
+                  const char *orig,
+                  size_t orig_size,
+                  uint8_t type,
+                  uint8_t code,
+                  uint32_t mtu)
+{
+  struct in6_addr orig_src;
+  struct in6_addr orig_dst;
+  struct in6_addr src;
+  const struct in6_addr *next_hop;
+  struct Interface *ifc;
+  const struct NdpEntry *ne;
+  struct IPv6Header ip;
+  struct Icmp6Header icmp;
+  size_t max_quote;
+  size_t upper;
+  uint8_t proto;
+
+  memcpy (&orig_src,
+          IPV6_FIELD (orig, source_address),
+          sizeof (orig_src));
+  memcpy (&orig_dst,
+          IPV6_FIELD (orig, destination_address),
+          sizeof (orig_dst));
+  /* never send errors to multicast or unspecified sources, about
+     multicast destinations or about ICMPv6 errors (RFC 4443, 2.4) */
+  if ( IN6_IS_ADDR_MULTICAST (&orig_src) ||
+       IN6_IS_ADDR_UNSPECIFIED (&orig_src) ||
+       IN6_IS_ADDR_MULTICAST (&orig_dst) )
+    return;
+  upper = ipv6_upper_layer (orig,
+                            orig_size,
+                            &proto);
+  if ( (0 != upper) &&
+       (IPPROTO_ICMPV6 == proto) &&
+       (upper < orig_size) &&
+       (((const uint8_t *) orig)[upper] < ICMP6TYPE_FIRST_INFORMATIONAL) )
+    return;
+  if (IN6_IS_ADDR_LINKLOCAL (&orig_src))
+  {
+    ifc = origin;
+    next_hop = &orig_src;
+    ipv6_link_local (origin,
+                     &src);
+  }
+  else
+  {
+    struct Route6 *r = lookup_route6 (&orig_src);
+
+    if (NULL == r)
+      return;
+    ifc = r->ifc;
+    next_hop = route6_next_hop (r,
+                                &orig_src);
+    if (! IN6_IS_ADDR_UNSPECIFIED (&origin->ip6))
+      src = origin->ip6;
+    else
+      ipv6_source_address (ifc,
+                           &orig_src,
+                           &src);
+  }
+  max_quote = IPV6_MIN_MTU - sizeof (ip) - sizeof (icmp);
+  if (ifc->mtu - sizeof (struct EthernetHeader) - sizeof (ip) - sizeof (icmp)
+      < max_quote)
+    max_quote = ifc->mtu - sizeof (struct EthernetHeader)
+      - sizeof (ip) - sizeof (icmp);
+  if (orig_size > max_quote)
+    orig_size = max_quote;
+  ne = resolve_next_hop6 (ifc,
+                          next_hop);
+  if (NULL == ne)
+    return;
+  {
+    char packet[sizeof (ip) + sizeof (icmp) + orig_size];
+    char *body = &packet[sizeof (ip)];
+
+    memset (&icmp,
+            0,
+            sizeof (icmp));
+    icmp.type = type;
+    icmp.code = code;
+    icmp.data = htonl (mtu);
+    memcpy (body,
+            &icmp,
+            sizeof (icmp));
+    memcpy (&body[sizeof (icmp)],
+            orig,
+            orig_size);
+    icmp.crc = icmp6_checksum (&src,
+                               &orig_src,
+                               body,
+                               sizeof (icmp) + orig_size);
+    memcpy (body,
+            &icmp,
+            sizeof (icmp));
+    ipv6_init_header (&ip,
+                      &src,
+                      &orig_src,
+                      DEFAULT_HOP_LIMIT,
+                      sizeof (icmp) + orig_size);
+    memcpy (packet,
+            &ip,
+            sizeof (ip));
+    forward_frame_payload_to (ifc,
+                              &ne->mac,
+                              ETH_P_IPV6,
+                              packet,
+                              sizeof (packet));
+  }
+}
+
+
+/**
+ * Process ICMPv6 message addressed to us: answer neighbour
+ * solicitations for our addresses and learn from solicitations and
+ * advertisements (RFC 4861, 7.2).  Everything else is ignored.
+ *
+ * @param ifc interface we received the packet from
+ * @param src_mac source MAC of the frame
+ * @param ip IPv6 packet
+ * @param total number of bytes in @a ip
+ */
+static void
+handle_icmp6 (struct Interface *ifc,
+              const struct MacAddress *src_mac,
+              const char *ip,
+              size_t total)
+{
+  const char *body = &ip[sizeof (struct IPv6Header)];
+  size_t len = total - sizeof (struct IPv6Header);
+  const struct MacAddress *lladdr = NULL;
+  struct in6_addr src;
+  struct in6_addr dst;
+  struct in6_addr target;
+  uint8_t type;
+  bool for_us;
+
+  if ( (IPPROTO_ICMPV6 != *(const uint8_t *) IPV6_FIELD (ip, next_header)) ||
+       (len < sizeof (struct NdpHeader)) )
+    return;
+  type = *(const uint8_t *) body;
+  if ( (ICMP6TYPE_NEIGHBOR_SOLICITATION != type) &&
+       (ICMP6TYPE_NEIGHBOR_ADVERTISEMENT != type) )
+    return; /* we do not implement a local IP stack */
+  memcpy (&src,
+          IPV6_FIELD (ip, source_address),
+          sizeof (src));
+  memcpy (&dst,
+          IPV6_FIELD (ip, destination_address),
+          sizeof (dst));
+  memcpy (&target,
+          NDP_FIELD (body, target),
+          sizeof (target));
+  if ( (NDP_HOP_LIMIT != *(const uint8_t *) IPV6_FIELD (ip, hop_limit)) ||
+       (0 != *(const uint8_t *) NDP_FIELD (body, icmp.code)) ||
+       IN6_IS_ADDR_MULTICAST (&target) )
+  {
+#if DEBUG
+    fprintf (stderr,
+             "Invalid NDP message\n");
+#endif
+    return;
+  }
+  if (0 != icmp6_checksum (&src,
+                           &dst,
+                           body,
+                           len))
+  {
+    fprintf (stderr,
+             "ICMPv6 checksum invalid\n");
+    return;
+  }
+  for (size_t off = sizeof (struct NdpHeader);
+       off + 2 <= len;
+       off += ((const uint8_t *) body)[off + 1] * 8)
+  {
+    const uint8_t *opt = (const uint8_t *) &body[off];
+
+    if ( (0 == opt[1]) ||
+         (off + opt[1] * 8 > len) )
+      return; /* malformed options invalidate the message */
+    if ( (opt[0] == ((ICMP6TYPE_NEIGHBOR_SOLICITATION == type)
+                     ? NDP_OPTION_SOURCE_LL
+                     : NDP_OPTION_TARGET_LL)) &&
+         (opt[1] * 8 >= sizeof (struct NdpLinkLayerOption)) )
+      lladdr = (const struct MacAddress *) &opt[2];
+  }
+  for_us = ipv6_is_ours (ifc,
+                         &target);
+  if (ICMP6TYPE_NEIGHBOR_ADVERTISEMENT == type)
+  {
+    /* like ARP, refresh known neighbours but only add new ones if
+       they answer a solicitation of ours */
+    if (NULL != lladdr)
+      ndp_learn (ifc,
+                 &target,
+                 lladdr,
+                 ipv6_is_ours (ifc,
+                               &dst));
+    return;
+  }
+  if (IN6_IS_ADDR_UNSPECIFIED (&src))
+  {
+    /* duplicate address detection, answer to all nodes */
+    struct MacAddress mac = {
+      .mac = { 0x33, 0x33, 0x00, 0x00, 0x00, 0x01 }
+    };
+
+    if ( (NULL != lladdr) ||
+         (! for_us) )
+      return;
+    send_ndp (ifc,
+              ICMP6TYPE_NEIGHBOR_ADVERTISEMENT,
+              NDP_FLAG_ROUTER | NDP_FLAG_OVERRIDE,
+              &mac,
+              &target,
+              &all_nodes_ip6,
+              &target);
+    return;
+  }
+  if (NULL != lladdr)
+    ndp_learn (ifc,
+               &src,
+               lladdr,
+               for_us);
+  if (for_us)
+    send_ndp (ifc,
+              ICMP6TYPE_NEIGHBOR_ADVERTISEMENT,
+              NDP_FLAG_ROUTER | NDP_FLAG_SOLICITED | NDP_FLAG_OVERRIDE,
+              (NULL != lladdr) ? lladdr : src_mac,
+              &target,
+              &src,
+              &target);
+}
+
+
+/**
+ * Transmit IPv6 packet @a ip via @a ifc to @a next_hop without
+ * copying it.  If the MAC of @a next_hop is unknown, a neighbour
+ * solicitation is sent instead and the packet is dropped.  IPv6
+ * routers never fragment, the caller must check the MTU.
+ *
+ * @param ifc interface to send the packet out on
+ * @param next_hop neighbour to send the packet to
+ * @param ip IPv6 packet, in a writable buffer
+ * @param total number of bytes in @a ip
+ * @param headroom number of writable bytes in front of @a ip
+ */
+static void
+transmit_ip6_in_place (struct Interface *ifc,
+                       const struct in6_addr *next_hop,
+                       char *ip,
+                       size_t total,
+                       size_t headroom)
+{
+  const struct NdpEntry *ne;
+
+  ne = resolve_next_hop6 (ifc,
+                          next_hop);
+  if (NULL == ne)
+    return;
+  forward_frame_payload_in_place (ifc,
+                                  &ne->mac,
+                                  ETH_P_IPV6,
+                                  ip,
+                                  total,
+                                  headroom);
+}
+
+
+/**
+ * Route the IPv6 packet @a ip, decrementing its hop limit in place.
+ * Packets for link-local multicast groups and for our own addresses
+ * are passed to handle_icmp6().
+ *
+ * @param origin interface we received the packet from
+ * @param src_mac source MAC of the frame
+ * @param ip IPv6 packet, in a writable buffer
+ * @param size number of bytes in @a ip (may include link-layer padding)
+ * @param headroom number of writable bytes in front of @a ip
+ */
+static void
+route6 (struct Interface *origin,
+        const struct MacAddress *src_mac,
+        char *ip,
+        size_t size,
+        size_t headroom)
+{
+  size_t total;
+  struct Route6 *r;
+  struct in6_addr src;
+  struct in6_addr dst;
+  uint8_t *hop_limit;
+
+  if ( (size < sizeof (struct IPv6Header)) ||
+       (6 != IPV6_VERSION (ip)) )
+  {
+    fprintf (stderr,
+             "Malformed IPv6 packet\n");
+    return;
+  }
+  total = sizeof (struct IPv6Header)
+    + get_be16 (IPV6_FIELD (ip, payload_length));
+  if (total > size)
+  {
+    fprintf (stderr,
+             "Malformed IPv6 packet\n");
+    return;
+  }
+  memcpy (&src,
+          IPV6_FIELD (ip, source_address),
+          sizeof (src));
+  memcpy (&dst,
+          IPV6_FIELD (ip, destination_address),
+          sizeof (dst));
+  if (IN6_IS_ADDR_MULTICAST (&dst))
+  {
+    if (IN6_IS_ADDR_MC_LINKLOCAL (&dst))
+      handle_icmp6 (origin,
+                    src_mac,
+                    ip,
+                    total);
+    return; /* we do not route multicast */
+  }
+  if (is_local_address6 (&dst))
+  {
+    handle_icmp6 (origin,
+                  src_mac,
+                  ip,
+                  total);
+    return;
+  }
+  /* never forward from multicast or unspecified sources or to
+     link-local destinations (RFC 4291, 2.5.2 and 2.5.6) */
+  if ( IN6_IS_ADDR_MULTICAST (&src) ||
+       IN6_IS_ADDR_UNSPECIFIED (&src) ||
+       IN6_IS_ADDR_LINKLOCAL (&dst) )
+    return;
+  r = lookup_route6 (&dst);
+  GLAB_PROBE3 (route6_lookup,
+               &dst,
+               (NULL == r) ? NULL : r->ifc->name,
+               (NULL == r) ? NULL : route6_next_hop (r,
+                                                     &dst));
+  if (NULL == r)
+  {
+    send_icmp6_error (origin,
+                      ip,
+                      total,
+                      ICMP6TYPE_DESTINATION_UNREACHABLE,
+                      ICMP6CODE_NO_ROUTE,
+                      0);
+    return;
+  }
+  if ( IN6_IS_ADDR_LINKLOCAL (&src) &&
+       (r->ifc != origin) )
+  {
+    send_icmp6_error (origin,
+                      ip,
+                      total,
+                      ICMP6TYPE_DESTINATION_UNREACHABLE,
+                      ICMP6CODE_BEYOND_SCOPE,
+                      0);
+    return;
+  }
+  hop_limit = (uint8_t *) IPV6_FIELD (ip, hop_limit);
+  if (*hop_limit <= 1)
+  {
+    send_icmp6_error (origin,
+                      ip,
+                      total,
+                      ICMP6TYPE_TIME_EXCEEDED,
+                      0,
+                      0);
+    return;
+  }
+  if (sizeof (struct EthernetHeader) + total > r->ifc->mtu)
+  {
+    send_icmp6_error (origin,
+                      ip,
+                      total,
+                      ICMP6TYPE_PACKET_TOO_BIG,
+                      0,
+                      r->ifc->mtu - sizeof (struct EthernetHeader));
+    return;
+  }
+  /* unlike IPv4, there is no header checksum to update */
+  (*hop_limit)--;
+  transmit_ip6_in_place (r->ifc,
+                         route6_next_hop (r,
+                                          &dst),
+                         ip,
+                         total,
+                         headroom);
+}
+
+
+/**
+ * Print neighbour cache entry @a ne.
+ *
+ * @param ne entry to print
+ */
+static void
+print_ndp_entry (const struct NdpEntry *ne)
+{
+  char ip[INET6_ADDRSTRLEN];
+
+  inet_ntop (AF_INET6,
+             &ne->ip,
+             ip,
+             sizeof (ip));
+  print ("%s -> %02X:%02X:%02X:%02X:%02X:%02X (%s)\n",
+         ip,
+         ne->mac.mac[0],
+         ne->mac.mac[1],
+         ne->mac.mac[2],
+         ne->mac.mac[3],
+         ne->mac.mac[4],
+         ne->mac.mac[5],
+         ne->ifc->name);
+}
+
+
+/**
+ * The user entered an "ndp" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_ndp ()
+{
+  const char *tok = strtok (NULL, " ");
+  struct in6_addr v6;
+  struct Interface *ifc;
+  const struct NdpEntry *ne;
+
+  if (NULL == tok)
+    {
+      for (unsigned int i=0;i<num_ndp;i++)
+        print_ndp_entry (&ndp_cache[i]);
+      return;
+    }
+  if (1 !=
+      inet_pton (AF_INET6,
+                 tok,
+                 &v6))
+    {
+      fprintf (stderr,
+               "`%s' is not a valid IPv6 address\n",
+               tok);
+      return;
+    }
+  tok = strtok (NULL, " ");
+  if (NULL == tok)
+    {
+      fprintf (stderr,
+               "No network interface provided\n");
+      return;
+    }
+  ifc = find_interface (tok);
+  if (NULL == ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return;
+    }
+  ne = ndp_lookup (ifc,
+                   &v6);
+  if (NULL == ne)
+    {
+      char ip[INET6_ADDRSTRLEN];
+
+      send_ndp_solicitation (ifc,
+                             &v6);
+      inet_ntop (AF_INET6,
+                 &v6,
+                 ip,
+                 sizeof (ip));
+      print ("%s not in neighbour cache, solicitation sent on %s\n",
+             ip,
+             ifc->name);
+      return;
+    }
+  print_ndp_entry (ne);
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a network and @a len.
+ * Format of @a net is "IP/LEN".
+ *
+ * @param network[out] set to the network (with host bits cleared)
+ * @param len[out] set to the prefix length
+ * @param net network specification to parse
+ * @param address[out] set to @a net's address with the host bits, may be NULL
+ * @return 0 on success
+ */
+static int
+parse_network6 (struct in6_addr *network,
+                uint8_t *len,
+                const char *net,
+                struct in6_addr *address)
+{
+  const char *tok;
+  char *ip;
+  unsigned int plen;
+  struct in6_addr addr;
+
+  tok = strchr (net, '/');
+  if (NULL == tok)
+    {
+      fprintf (stderr,
+               "Error in network specification: lacks '/'\n");
+      return 1;
+    }
+  ip = strndup (net,
+                tok - net);
+  if (1 !=
+      inet_pton (AF_INET6,
+                 ip,
+                 &addr))
+    {
+      fprintf (stderr,
+               "IPv6 address `%s' malformed\n",
+               ip);
+      free (ip);
+      return 1;
+    }
+  free (ip);
+  tok++;
+  if (1 !=
+      sscanf (tok,
+              "%u",
+              &plen))
+    {
+      fprintf (stderr,
+               "Prefix length `%s' malformed\n",
+               tok);
+      return 1;
+    }
+  if (plen > 128)
+    {
+      fprintf (stderr,
+               "Prefix length invalid (too large)\n");
+      return 1;
+    }
+  if (NULL != address)
+    *address = addr;
+  ipv6_from_u128 (ipv6_to_u128 (&addr) & ipv6_mask (plen),
+                  network);
+  *len = (uint8_t) plen;
+  return 0;
+}
+
+
+/**
+ * Parse IPv6 route from arguments in strtok() buffer.
+ * Format is "NET/LEN via HOP dev IFC", with HOP "::" for
+ * directly connected networks.
+ *
+ * @param network[out] set to target network
+ * @param len[out] set to target prefix length
+ * @param next_hop[out] set to next hop
+ * @param ifc[out] set to target interface
+ * @return 0 on success
+ */
+static int
+parse_route6 (struct in6_addr *network,
+              uint8_t *len,
+              struct in6_addr *next_hop,
+              struct Interface **ifc)
+{
+  char *tok;
+
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != parse_network6 (network,
+                             len,
+                             tok,
+                             NULL)) )
+    {
+      fprintf (stderr,
+               "Expected network specification, not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("via",
+                         tok)))
+    {
+      fprintf (stderr,
+               "Expected `via', not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (1 != inet_pton (AF_INET6,
+                        tok,
+                        next_hop)) )
+    {
+      fprintf (stderr,
+               "Expected next hop, not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("dev",
+                         tok)))
+    {
+      fprintf (stderr,
+               "Expected `dev', not `%s'\n",
+               tok);
+      return 1;
+    }
+  tok = strtok (NULL, " ");
+  *ifc = find_interface (tok);
+  if (NULL == *ifc)
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown\n",
+               tok);
+      return 1;
+    }
+  if (0 == (*ifc)->ifc_num)
+    {
+      /* GRE tunnels only carry IPv4 */
+      fprintf (stderr,
+               "Interface `%s' is a tunnel and cannot carry IPv6\n",
+               tok);
+      return 1;
+    }
+  return 0;
+}
+
+
+/**
+ * Add an entry to the IPv6 routing table.  The caller must
+ * lpm6_rebuild() before the next lookup.
+ *
+ * @param network target network, host bits must be clear
+ * @param len prefix length of @a network
+ * @param next_hop gateway, :: for directly connected networks
+ * @param ifc interface to use
+ * @param configured true if the route is derived from the interface
+ *        configuration, false if it was added by the user
+ */
+static void
+add_route6 (const struct in6_addr *network,
+            uint8_t len,
+            const struct in6_addr *next_hop,
+            struct Interface *ifc,
+            bool configured)
+{
+  struct Route6 *tmp;
+
+  tmp = realloc (routes6,
+                 (num_routes6 + 1) * sizeof (struct Route6));
+  if (NULL == tmp)
+    {
+      perror ("realloc");
+      return;
+    }
+  routes6 = tmp;
+  routes6[num_routes6].network = *network;
+  routes6[num_routes6].len = len;
+  routes6[num_routes6].next_hop = *next_hop;
+  routes6[num_routes6].ifc = ifc;
+  routes6[num_routes6].configured = configured;
+  num_routes6++;
+}
+
+
+/**
+ * Add an IPv6 route.
+ */
+static void
+process_cmd_route6_add ()
+{
+  struct in6_addr network;
+  struct in6_addr next_hop;
+  struct Interface *ifc;
+  uint8_t len;
+
+  if (0 != parse_route6 (&network,
+                         &len,
+                         &next_hop,
+                         &ifc))
+    return;
+  add_route6 (&network,
+              len,
+              &next_hop,
+              ifc,
+              false);
+  lpm6_rebuild ();
+}
+
+
+/**
+ * Delete an IPv6 route.
+ */
+static void
+process_cmd_route6_del ()
+{
+  struct in6_addr network;
+  struct in6_addr next_hop;
+  struct Interface *ifc;
+  uint8_t len;
+
+  if (0 != parse_route6 (&network,
+                         &len,
+                         &next_hop,
+                         &ifc))
+    return;
+  for (unsigned int i=0;i<num_routes6;i++)
+    {
+      struct Route6 *r = &routes6[i];
+
+      if ( IN6_ARE_ADDR_EQUAL (&r->network,
+                               &network) &&
+           (r->len == len) &&
+           IN6_ARE_ADDR_EQUAL (&r->next_hop,
+                               &next_hop) &&
+           (r->ifc == ifc) )
+        {
+          memmove (r,
+                   &routes6[i + 1],
+                   (num_routes6 - i - 1) * sizeof (struct Route6));
+          num_routes6--;
+          lpm6_rebuild ();
+          return;
+        }
+    }
+  fprintf (stderr,
+           "No such route\n");
+}
+
+
+/**
+ * Print out the IPv6 routing table.
+ */
+static void
+process_cmd_route6_list ()
+{
+  for (unsigned int i=0;i<num_routes6;i++)
+    {
+      const struct Route6 *r = &routes6[i];
+      char net[INET6_ADDRSTRLEN];
+      char hop[INET6_ADDRSTRLEN];
+
+      inet_ntop (AF_INET6,
+                 &r->network,
+                 net,
+                 sizeof (net));
+      inet_ntop (AF_INET6,
+                 &r->next_hop,
+                 hop,
+                 sizeof (hop));
+      print ("%s/%u via %s dev %s\n",
+             net,
+             (unsigned int) r->len,
+             hop,
+             r->ifc->name);
+    }
+}
+
+
+/**
+ * The user entered a "route6" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_route6 ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_route6_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_route6_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_route6_list ();
+  else
+    fprintf (stderr,
+             "Subcommand `%s' not understood\n",
+             subcommand);
+}
+
+
+/**
+ * Move the IPv6 routing table and the neighbour cache over to a new
+ * set of interfaces after a configuration reload, like ipv4_rebind().
+ * User routes whose interface became a tunnel are dropped.  Neighbour
+ * entries are kept as long as the IPv6 address of their interface is
+ * unchanged.  The caller must add the configured routes
+ * and lpm6_rebuild() afterwards.
+ *
+ * @param nifc the new interfaces
+ * @param nnum number of entries in @a nifc
+ */
+static void
+ipv6_rebind (struct Interface *nifc,
+             unsigned int nnum)
+{
+  unsigned int j;
+
+  j = 0;
+  for (unsigned int i=0;i<num_routes6;i++)
+  {
+    struct Interface *n = NULL;
+
+    if (routes6[i].configured)
+      continue;
+    for (unsigned int k=0;k<nnum;k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           routes6[i].ifc->name))
+        n = &nifc[k];
+    if ( (NULL == n) ||
+         (0 == n->ifc_num) )
+      continue;
+    routes6[j] = routes6[i];
+    routes6[j].ifc = n;
+    j++;
+  }
+  num_routes6 = j;
+  j = 0;
+  for (unsigned int i=0;i<num_ndp;i++)
+  {
+    const struct Interface *o = ndp_cache[i].ifc;
+    struct Interface *n = NULL;
+
+    for (unsigned int k=0;k<nnum;k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           o->name))
+        n = &nifc[k];
+    if ( (NULL == n) ||
+         (! IN6_ARE_ADDR_EQUAL (&n->ip6,
+                                &o->ip6)) ||
+         (n->prefix6_len != o->prefix6_len) )
+      continue;
+    ndp_cache[j] = ndp_cache[i];
+    ndp_cache[j].ifc = n;
+    j++;
+  }
+  num_ndp = j;
+}
+
+
+/**
+ * Parse network specification in @a net, initializing @a ifc.
+ * Format of @a net is "IPV6:IP/LEN".
+ *
+ * @param ifc[out] interface specification to initialize
+ * @param arg interface specification to parse
+ * @return 0 on success
+ */
+static int
+parse_network6_arg (struct Interface *ifc,
+                    const char *net)
+{
+  struct in6_addr network;
+
+  if (0 !=
+      strncasecmp (net,
+                   "IPV6:",
+                   strlen ("IPV6:")))
+    {
+      fprintf (stderr,
+               "Interface specification `%s' does not start with `IPV6:'\n",
+               net);
+      return 1;
+    }
+  net += strlen ("IPV6:");
+  return parse_network6 (&network,
+                         &ifc->prefix6_len,
+                         net,
+                         &ifc->ip6);
+}
+
+
+/* end of ipv6.c */
@@ -0,0 +1,1347 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file l3switch.c
+ * @brief VLAN-aware Ethernet switch with routed VLAN interfaces (SVIs)
+ * @author Christian Grothoff
+ *
+ * Bridges frames between ports like vswitch.c and routes between
+ * VLANs like router.c, within one process: frames addressed to the
+ * MAC of a VLAN's SVI are handed to the IPv4 engine, and the routed
+ * packet is bridged into the target VLAN right away instead of
+ * taking another round trip through the parent.
+ */
+#include "glab.h"
+#include "print.c"
+#include "crc.c"
+#include "packet.h"
+
+
+/**
+ * Value used to indicate "no VLAN".
+ */
+#define NO_VLAN (-1)
+
+/**
+ * Which VLAN should we assume for untagged frames on
+ * interfaces without any specified tag?
+ */
+#define DEFAULT_VLAN 1
+
+/**
+ * Number of entries in the MAC table, must be a power of two.
+ */
+#define MAC_TABLE_SIZE 4096
+
+/**
+ * How many consecutive slots of the MAC table do we probe?
+ */
+#define MAC_TABLE_PROBES 16
+
+/**
+ * After how many seconds do we forget where a MAC is?
+ */
+#define MAC_AGE_TIME 300
+
+/**
+ * Writable bytes bridge() needs in front of a frame to push an
+ * 802.1Q tag and the GLAB message header in place.
+ */
+#define BRIDGE_HEADROOM (VLAN_TAG_SIZE + sizeof (struct GLAB_MessageHeader))
+
+
+/**
+ * Per-port context.
+ */
+struct Port
+{
+  /**
+   * MAC of the port.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Number of this port.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Name of the network interface, i.e. "eth0".
+   */
+  char *name;
+
+  /**
+   * Which untagged VLAN does this port participate in?
+   * #NO_VLAN for none.
+   */
+  int16_t untagged_vlan;
+
+  /**
+   * Bitmap of the tagged VLANs this port participates in.
+   */
+  uint64_t tagged_vlans[(MAX_VLAN_ID + 64) / 64];
+};
+
+
+/**
+ * Routed VLAN interface (SVI).
+ */
+struct Interface
+{
+  /**
+   * MAC of interface.
+   */
+  struct MacAddress mac;
+
+  /**
+   * IPv4 address of interface (we only support one IP per interface!)
+   */
+  struct in_addr ip;
+
+  /**
+   * IPv4 netmask of interface.
+   */
+  struct in_addr netmask;
+
+  /**
+   * Name of the interface, i.e. "vlan24".
+   */
+  char *name;
+
+  /**
+   * MTU to enforce for this interface.
+   */
+  uint16_t mtu;
+
+  /**
+   * VLAN this interface routes for.
+   */
+  uint16_t vlan;
+};
+
+
+/**
+ * Entry in the MAC table.
+ */
+struct MacEntry
+{
+  /**
+   * The MAC address.
+   */
+  struct MacAddress mac;
+
+  /**
+   * VLAN the MAC was seen in.
+   */
+  uint16_t vlan;
+
+  /**
+   * Port the MAC was seen on, NULL if the slot is unused.
+   */
+  struct Port *port;
+
+  /**
+   * When did we last see the MAC?
+   */
+  time_t last_seen;
+};
+
+
+/**
+ * Number of available ports.
+ */
+static unsigned int num_port;
+
+/**
+ * All the ports.
+ */
+static struct Port *gport;
+
+/**
+ * Number of SVIs.
+ */
+static unsigned int num_ifc;
+
+/**
+ * All the SVIs.
+ */
+static struct Interface *gifc;
+
+/**
+ * SVIs by VLAN ID, NULL for VLANs that are only bridged.
+ */
+static struct Interface *svi_by_vlan[MAX_VLAN_ID + 1];
+
+/**
+ * The MAC table, shared by all VLANs.
+ */
+static struct MacEntry mac_table[MAC_TABLE_SIZE];
+
+
+/**
+ * Check if @a port participates in @a vlan.
+ *
+ * @param port port to check
+ * @param vlan VLAN ID
+ * @return true if frames of @a vlan may be sent out on @a port
+ */
+static bool
+port_in_vlan (const struct Port *port,
+              uint16_t vlan)
+{
+  if (vlan == port->untagged_vlan)
+    return true;
+  return 0 != (port->tagged_vlans[vlan / 64] & (1LLU << (vlan % 64)));
+}
+
+
+/**
+ * Compute the first slot of the MAC table to probe for @a mac in @a vlan.
+ *
+ * @param mac the MAC address
+ * @param vlan the VLAN ID
+ * @return slot index
+ */
+static unsigned int
+mac_hash (const struct MacAddress *mac,
+          uint16_t vlan)
+{
+  uint32_t h = 2166136261u;
+
+  for (unsigned int i=0;i<MAC_ADDR_SIZE;i++)
+    h = (h ^ mac->mac[i]) * 16777619u;
+  h = (h ^ vlan) * 16777619u;
+  return h & (MAC_TABLE_SIZE - 1);
+}
+
+
+/**
+ * Find the port behind @a mac in @a vlan.
+ *
+ * @param mac MAC to look up
+ * @param vlan VLAN to look in
+ * @param now current time
+ * @return NULL if unknown (or aged out)
+ */
+static struct Port *
+mac_lookup (const struct MacAddress *mac,
+            uint16_t vlan,
+            time_t now)
+{
+  unsigned int h = mac_hash (mac,
+                             vlan);
+
+  for (unsigned int i=0;i<MAC_TABLE_PROBES;i++)
+  {
+    struct MacEntry *me = &mac_table[(h + i) & (MAC_TABLE_SIZE - 1)];
+
+    if ( (NULL != me->port) &&
+         (vlan == me->vlan) &&
+         mac_equal (mac,
+                    &me->mac) )
+      return (now - me->last_seen > MAC_AGE_TIME) ? NULL : me->port;
+  }
+  return NULL;
+}
+
+
+/**
+ * Remember that @a mac in @a vlan is behind @a port.
+ * Replaces the least recently seen entry if all probed slots are in use.
+ *
+ * @param mac MAC to learn
+ * @param vlan VLAN the MAC was seen in
+ * @param port port the MAC was seen on
+ * @param now current time
+ */
+static void
+mac_learn (const struct MacAddress *mac,
+           uint16_t vlan,
+           struct Port *port,
+           time_t now)
+{
+  unsigned int h = mac_hash (mac,
+                             vlan);
+  struct MacEntry *victim = NULL;
+
+  for (unsigned int i=0;i<MAC_TABLE_PROBES;i++)
+  {
+    struct MacEntry *me = &mac_table[(h + i) & (MAC_TABLE_SIZE - 1)];
+
+    if ( (NULL != me->port) &&
+         (vlan == me->vlan) &&
+         mac_equal (mac,
+                    &me->mac) )
+    {
+      victim = me;
+      break;
+    }
+    if ( (NULL == victim) ||
+         (me->last_seen < victim->last_seen) )
+      victim = me;
+  }
+  victim->mac = *mac;
+  victim->vlan = vlan;
+  victim->port = port;
+  victim->last_seen = now;
+}
+
+
+/**
+ * Send @a frame of @a vlan out on @a port without copying it, pushing
+ * or popping the 802.1Q tag in place as required by @a port.
+ *
+ * @param port port to send the frame out on
+ * @param vlan VLAN of the frame
+ * @param[in,out] frame the frame, updated if the tag was pushed or popped
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param[in,out] tagged whether @a frame currently carries the tag
+ */
+static void
+port_send (struct Port *port,
+           uint16_t vlan,
+           char **frame,
+           size_t *frame_size,
+           bool *tagged)
+{
+  bool want = (vlan != port->untagged_vlan);
+
+  if (want && ! *tagged)
+    *frame = eth_push_vlan_in_place (*frame,
+                                     frame_size,
+                                     vlan);
+  else if (*tagged && ! want)
+    *frame = eth_pop_vlan_in_place (*frame,
+                                    frame_size);
+  *tagged = want;
+  glab_send_in_place (port->ifc_num,
+                      *frame,
+                      *frame_size);
+}
+
+
+/**
+ * Bridge untagged @a frame within @a vlan.  The frame is sent out
+ * in place and needs #BRIDGE_HEADROOM writable bytes in front of it;
+ * it is untagged again when this function returns.
+ *
+ * @param ingress port we received the frame on, NULL if it was
+ *        generated by one of our SVIs
+ * @param vlan VLAN of the frame
+ * @param frame untagged frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+bridge (struct Port *ingress,
+        uint16_t vlan,
+        char *frame,
+        size_t frame_size)
+{
+  const struct EthernetHeader *eh = (const struct EthernetHeader *) frame;
+  bool tagged = false;
+  struct Port *dst;
+
+  dst = NULL;
+  if (! mac_is_multicast (&eh->dst))
+  {
+    dst = mac_lookup (&eh->dst,
+                      vlan,
+                      time (NULL));
+    if ( (NULL != dst) &&
+         (dst != ingress) &&
+         port_in_vlan (dst,
+                       vlan) )
+      port_send (dst,
+                 vlan,
+                 &frame,
+                 &frame_size,
+                 &tagged);
+  }
+  if (NULL == dst)
+    for (unsigned int i=0;i<num_port;i++)
+      if ( (&gport[i] != ingress) &&
+           port_in_vlan (&gport[i],
+                         vlan) )
+        port_send (&gport[i],
+                   vlan,
+                   &frame,
+                   &frame_size,
+                   &tagged);
+  if (tagged)
+    eth_pop_vlan_in_place (frame,
+                           &frame_size);
+}
+
+
+/**
+ * Find SVI by @a name.
+ *
+ * @param name name to look up by
+ * @return NULL if @a name was not found
+ */
+static struct Interface *
+find_interface (const char *name)
+{
+  for (unsigned int i=0;i<num_ifc;i++)
+    if (0 == strcasecmp (name,
+                         gifc[i].name))
+      return &gifc[i];
+  return NULL;
+}
+
+
+/**
+ * Bridge @a frame_payload from SVI @a ifc to @a target_ha without
+ * copying it, by writing the Ethernet header into the @a headroom in
+ * front of it.  Falls back to forward_frame_payload_to() if the
+ * headroom is too small.
+ *
+ * @param ifc SVI to send frame out on
+ * @param target destination MAC
+ * @param tag Ethernet tag to use
+ * @param frame_payload payload to use in frame, in a writable buffer
+ * @param frame_payload_size number of bytes in @a frame_payload
+ * @param headroom number of writable bytes in front of @a frame_payload
+ */
+static void
+forward_frame_payload_in_place (struct Interface *ifc,
+                                const struct MacAddress *target_ha,
+                                uint16_t tag,
+                                void *frame_payload,
+                                size_t frame_payload_size,
+                                size_t headroom);
+
+
+/**
+ * Create Ethernet frame and bridge it from SVI @a ifc to @a target_ha.
+ *
+ * @param ifc SVI to send frame out on
+ * @param target destination MAC
+ * @param tag Ethernet tag to use
+ * @param frame_payload payload to use in frame
+ * @param frame_payload_size number of bytes in @a frame_payload
+ */
+static void
+forward_frame_payload_to (struct Interface *ifc,
+                          const struct MacAddress *target_ha,
+                          uint16_t tag,
+                          const void *frame_payload,
+                          size_t frame_payload_size)
+{
+  size_t headroom = BRIDGE_HEADROOM + sizeof (struct EthernetHeader);
+  char buf[headroom + frame_payload_size];
+
+  memcpy (&buf[headroom],
+          frame_payload,
+          frame_payload_size);
+  forward_frame_payload_in_place (ifc,
+                                  target_ha,
+                                  tag,
+                                  &buf[headroom],
+                                  frame_payload_size,
+                                  headroom);
+}
+
+
+static void
+forward_frame_payload_in_place (struct Interface *ifc,
+                                const struct MacAddress *target_ha,
+                                uint16_t tag,
+                                void *frame_payload,
+                                size_t frame_payload_size,
+                                size_t headroom)
+{
+  char *frame = (char *) frame_payload - sizeof (struct EthernetHeader);
+
+  if (headroom < BRIDGE_HEADROOM + sizeof (struct EthernetHeader))
+  {
+    forward_frame_payload_to (ifc,
+                              target_ha,
+                              tag,
+                              frame_payload,
+                              frame_payload_size);
+    return;
+  }
+  if (frame_payload_size + sizeof (struct EthernetHeader) > ifc->mtu)
+    abort ();
+  memcpy (&frame[offsetof (struct EthernetHeader, dst)],
+          target_ha,
+          sizeof (struct MacAddress));
+  memcpy (&frame[offsetof (struct EthernetHeader, src)],
+          &ifc->mac,
+          sizeof (struct MacAddress));
+  put_be16 (&frame[offsetof (struct EthernetHeader, tag)],
+            tag);
+  bridge (NULL,
+          ifc->vlan,
+          frame,
+          sizeof (struct EthernetHeader) + frame_payload_size);
+}
+
+
+#include "ipv4.c"
+#include "config.c"
+
+
+/**
+ * Hand untagged @a frame to the IPv4 engine of SVI @a ifc.
+ *
+ * @param ifc SVI that received the frame
+ * @param frame untagged frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+svi_input (struct Interface *ifc,
+           char *frame,
+           size_t frame_size)
+{
+  struct EthernetFrame ef;
+
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      false,
+                      &ef))
+    return;
+  switch (ef.type)
+  {
+  case ETH_P_IPV4:
+    route (ifc,
+           (char *) ef.payload,
+           ef.payload_size,
+           GLAB_FRAME_HEADROOM + (ef.payload - frame));
+    break;
+  case ETH_P_ARP:
+    if (ef.payload_size < sizeof (struct ArpHeaderEthernetIPv4))
+    {
+#if DEBUG
+      fprintf (stderr,
+               "Unsupported ARP frame\n");
+#endif
+      return;
+    }
+    handle_arp (ifc,
+                ef.eh,
+                ef.payload);
+    break;
+  default:
+    return;
+  }
+}
+
+
+/**
+ * Switch (untagged) @a frame received on @a port in @a vlan,
+ * handing it to the SVI of @a vlan if it is addressed to it.
+ *
+ * @param port port we got the frame on
+ * @param vlan VLAN the frame belongs to
+ * @param frame untagged frame, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+switch_frame (struct Port *port,
+              uint16_t vlan,
+              char *frame,
+              size_t frame_size)
+{
+  const struct EthernetHeader *eh = (const struct EthernetHeader *) frame;
+  struct Interface *svi = svi_by_vlan[vlan];
+
+  if (! mac_is_multicast (&eh->src))
+    mac_learn (&eh->src,
+               vlan,
+               port,
+               time (NULL));
+  if ( (NULL != svi) &&
+       mac_equal (&eh->dst,
+                  &svi->mac) )
+  {
+    svi_input (svi,
+               frame,
+               frame_size);
+    return;
+  }
+  bridge (port,
+          vlan,
+          frame,
+          frame_size);
+  if ( (NULL != svi) &&
+       mac_is_multicast (&eh->dst) )
+    svi_input (svi,
+               frame,
+               frame_size);
+}
+
+
+/**
+ * Parse and process frame received on @a port.
+ *
+ * @param port port we got the frame on
+ * @param frame raw frame data, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+parse_frame (struct Port *port,
+	     void *frame,
+	     size_t frame_size)
+{
+  struct EthernetFrame ef;
+  uint16_t vlan;
+
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      true,
+                      &ef))
+  {
+    fprintf (stderr,
+	     "Malformed frame\n");
+    return;
+  }
+  if (! ef.tagged)
+  {
+    if (NO_VLAN == port->untagged_vlan)
+      return;
+    switch_frame (port,
+                  (uint16_t) port->untagged_vlan,
+                  frame,
+                  frame_size);
+    return;
+  }
+  vlan = ef.vlan;
+  if (0 == vlan)
+  {
+    /* priority-tagged, belongs to the untagged VLAN */
+    if (NO_VLAN == port->untagged_vlan)
+      return;
+    vlan = (uint16_t) port->untagged_vlan;
+  }
+  if (! port_in_vlan (port,
+                      vlan))
+  {
+#if DEBUG
+    fprintf (stderr,
+             "Port %s is not in VLAN %u\n",
+             port->name,
+             vlan);
+#endif
+    return;
+  }
+  frame = eth_pop_vlan_in_place (frame,
+                                 &frame_size);
+  switch_frame (port,
+                vlan,
+                frame,
+                frame_size);
+}
+
+
+GLAB_DEFINE_HANDLE_FRAME (num_port, &gport[interface - 1], parse_frame)
+
+
+/**
+ * Print out the MAC table.
+ */
+static void
+process_cmd_mac ()
+{
+  time_t now = time (NULL);
+
+  for (unsigned int i=0;i<MAC_TABLE_SIZE;i++)
+  {
+    const struct MacEntry *me = &mac_table[i];
+
+    if ( (NULL == me->port) ||
+         (now - me->last_seen > MAC_AGE_TIME) )
+      continue;
+    print ("%02X:%02X:%02X:%02X:%02X:%02X vlan %u port %s\n",
+           me->mac.mac[0],
+           me->mac.mac[1],
+           me->mac.mac[2],
+           me->mac.mac[3],
+           me->mac.mac[4],
+           me->mac.mac[5],
+           (unsigned int) me->vlan,
+           me->port->name);
+  }
+}
+
+
+/**
+ * Parse a VLAN ID from @a spec.
+ *
+ * @param spec text to parse
+ * @param what what we are parsing, for error reporting
+ * @param[out] vlan set to the VLAN ID
+ * @return 0 on success
+ */
+static int
+parse_vlan_id (const char *spec,
+               const char *what,
+               uint16_t *vlan)
+{
+  unsigned int tag;
+
+  if (1 != sscanf (spec,
+                   "%u",
+                   &tag))
+  {
+    fprintf (stderr,
+             "Expected VLAN ID in %s, not `%s'\n",
+             what,
+             spec);
+    return 1;
+  }
+  if ( (0 == tag) ||
+       (tag > MAX_VLAN_ID) )
+  {
+    fprintf (stderr,
+             "%u is not a valid 802.1Q VLAN ID (in %s)\n",
+             tag,
+             what);
+    return 1;
+  }
+  *vlan = (uint16_t) tag;
+  return 0;
+}
+
+
+/**
+ * Parse port specification @a arg, which is of the form
+ * "IFCNAME", "IFCNAME[T:VID,VID,...]" or "IFCNAME[U:VID]".
+ *
+ * @param arg command-line argument
+ * @param port port to initialize
+ * @return 0 on success
+ */
+static int
+parse_port_arg (const char *arg,
+                struct Port *port)
+{
+  const char *openbracket;
+  const char *closebracket;
+  char *spec;
+  int ret;
+
+  port->untagged_vlan = NO_VLAN;
+  openbracket = strchr (arg,
+			(unsigned char) '[');
+  if (NULL == openbracket)
+  {
+    port->name = strdup (arg);
+    port->untagged_vlan = DEFAULT_VLAN;
+    return 0;
+  }
+  port->name = strndup (arg,
+                        openbracket - arg);
+  openbracket++;
+  closebracket = strchr (openbracket,
+			 (unsigned char) ']');
+  if ( (NULL == closebracket) ||
+       (':' != openbracket[1]) )
+  {
+    fprintf (stderr,
+	     "Malformed port specification `%s'\n",
+	     arg);
+    return 1;
+  }
+  spec = strndup (&openbracket[2],
+                  closebracket - &openbracket[2]);
+  ret = 0;
+  switch (*openbracket)
+  {
+  case 'T':
+    for (const char *tok = strtok (spec,
+                                   ",");
+         NULL != tok;
+         tok = strtok (NULL,
+                       ","))
+    {
+      uint16_t vlan;
+
+      if (0 != parse_vlan_id (tok,
+                              port->name,
+                              &vlan))
+      {
+        ret = 1;
+        break;
+      }
+      port->tagged_vlans[vlan / 64] |= (1LLU << (vlan % 64));
+    }
+    break;
+  case 'U':
+    {
+      uint16_t vlan;
+
+      if (0 != parse_vlan_id (spec,
+                              port->name,
+                              &vlan))
+        ret = 1;
+      else
+        port->untagged_vlan = (int16_t) vlan;
+    }
+    break;
+  default:
+    fprintf (stderr,
+	     "Unsupported tagged/untagged specification `%c' for port %s\n",
+	     *openbracket,
+	     port->name);
+    ret = 1;
+  }
+  free (spec);
+  return ret;
+}
+
+
+/**
+ * Parse SVI specification @a arg, which is of the form
+ * "vlanVID[IPV4:IP/NETMASK]=MTU".  The "=MTU" is optional.
+ *
+ * @param arg command-line argument
+ * @param ifc SVI to initialize
+ * @return 0 on success
+ */
+static int
+parse_svi_arg (const char *arg,
+               struct Interface *ifc)
+{
+  const char *openbracket;
+  const char *closebracket;
+  char *nspec;
+
+  ifc->mtu = 1500; /* default in case unspecified */
+  openbracket = strchr (arg,
+                        '[');
+  closebracket = (NULL == openbracket) ? NULL : strchr (openbracket,
+                                                        ']');
+  if (NULL == closebracket)
+  {
+    fprintf (stderr,
+             "Malformed SVI specification `%s'\n",
+             arg);
+    return 1;
+  }
+  ifc->name = strndup (arg,
+                       openbracket - arg);
+  if (0 != parse_vlan_id (&ifc->name[strlen ("vlan")],
+                          ifc->name,
+                          &ifc->vlan))
+    return 1;
+  nspec = strndup (openbracket + 1,
+                   closebracket - openbracket - 1);
+  if (0 != parse_network_arg (ifc,
+                              nspec))
+  {
+    free (nspec);
+    return 1;
+  }
+  free (nspec);
+  if ('=' == closebracket[1])
+  {
+    unsigned int mtu;
+
+    if ( (1 != sscanf (&closebracket[2],
+                       "%u",
+                       &mtu)) ||
+         (mtu < 400) ||
+         (mtu > UINT16_MAX) )
+    {
+      fprintf (stderr,
+               "Error in SVI specification: invalid MTU\n");
+      return 1;
+    }
+    ifc->mtu = mtu;
+  }
+  return 0;
+}
+
+
+/**
+ * Initialize SVI @a ifc and register it for its VLAN.
+ *
+ * @param ifc SVI, with name, address, netmask, mtu and vlan set
+ * @return 0 on success
+ */
+static int
+add_svi (struct Interface *ifc)
+{
+  struct in_addr direct = { .s_addr = 0 };
+
+  if (NULL != svi_by_vlan[ifc->vlan])
+  {
+    fprintf (stderr,
+             "Duplicate SVI for VLAN %u\n",
+             (unsigned int) ifc->vlan);
+    return 1;
+  }
+  svi_by_vlan[ifc->vlan] = ifc;
+  add_route (ifc->ip,
+             ifc->netmask,
+             direct,
+             ifc,
+             true);
+  return 0;
+}
+
+
+/**
+ * Initialize SVI @a ifc from interface @a ci of a configuration file.
+ *
+ * @param ifc[out] SVI to initialize
+ * @param ci interface as found in the configuration, named "vlanVID"
+ * @return 0 on success
+ */
+static int
+init_svi_from_config (struct Interface *ifc,
+                      const struct ConfigInterface *ci)
+{
+  ifc->name = strdup (ci->name);
+  ifc->ip = ci->ip;
+  ifc->netmask = ci->netmask;
+  ifc->mtu = (0 == ci->mtu) ? 1500 : ci->mtu;
+  if ( (ci->mtu > UINT16_MAX) ||
+       (ifc->mtu < 400) )
+  {
+    fprintf (stderr,
+             "Invalid MTU for SVI `%s'\n",
+             ci->name);
+    return 1;
+  }
+  return parse_vlan_id (&ci->name[strlen ("vlan")],
+                        ci->name,
+                        &ifc->vlan);
+}
+
+
+/**
+ * Check if @a ci of a configuration file is an SVI.
+ *
+ * @param ci interface as found in the configuration
+ * @return true if @a ci is named "vlanVID"
+ */
+static bool
+config_is_svi (const struct ConfigInterface *ci)
+{
+  if (0 == strncasecmp (ci->name,
+                        "vlan",
+                        strlen ("vlan")))
+    return true;
+  fprintf (stderr,
+           "Ignoring interface `%s', not an SVI\n",
+           ci->name);
+  return false;
+}
+
+
+/**
+ * Add the default route of SVI @a ifc, if @a ci has a gateway.
+ *
+ * @param ifc the SVI
+ * @param ci interface @a ifc was built from
+ */
+static void
+add_svi_gateway (struct Interface *ifc,
+                 const struct ConfigInterface *ci)
+{
+  struct in_addr any = { .s_addr = 0 };
+
+  if (0 != ci->gateway.s_addr)
+    add_route (any,
+               any,
+               ci->gateway,
+               ifc,
+               true);
+}
+
+
+/**
+ * Load ports and SVIs from the configuration files in @a files.
+ * Ports are taken from startup-configs, SVIs from "interface vlan N"
+ * blocks or from "iface vlanN" stanzas.
+ *
+ * @param num_files number of entries in @a files
+ * @param files names of the configuration files
+ * @return 0 on success
+ */
+static int
+load_config (int num_files,
+             char **files)
+{
+  struct Config cfg;
+
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  for (int i=0;i<num_files;i++)
+    if (0 != config_load (files[i],
+                          &cfg))
+      return 1;
+  gport = calloc (cfg.num_ports + 1,
+                  sizeof (struct Port));
+  gifc = calloc (cfg.num_ifcs + 1,
+                 sizeof (struct Interface));
+  if ( (NULL == gport) ||
+       (NULL == gifc) )
+  {
+    perror ("calloc");
+    return 1;
+  }
+  for (unsigned int i=0;i<cfg.num_ports;i++)
+  {
+    struct Port *port = &gport[num_port++];
+
+    port->ifc_num = num_port;
+    port->name = strdup (cfg.ports[i].name);
+    port->untagged_vlan = cfg.ports[i].untagged_vlan;
+    memcpy (port->tagged_vlans,
+            cfg.ports[i].tagged_vlans,
+            sizeof (port->tagged_vlans));
+  }
+  for (unsigned int i=0;i<cfg.num_ifcs;i++)
+  {
+    const struct ConfigInterface *ci = &cfg.ifcs[i];
+    struct Interface *ifc = &gifc[num_ifc];
+
+    if (! config_is_svi (ci))
+      continue;
+    if ( (0 != init_svi_from_config (ifc,
+                                     ci)) ||
+         (0 != add_svi (ifc)) )
+      return 1;
+    num_ifc++;
+    add_svi_gateway (ifc,
+                     ci);
+  }
+  config_free (&cfg);
+  return 0;
+}
+
+
+/**
+ * Forget all MAC table entries pointing to @a port.
+ *
+ * @param port port whose entries to drop
+ */
+static void
+mac_flush_port (const struct Port *port)
+{
+  for (unsigned int i=0;i<MAC_TABLE_SIZE;i++)
+    if (port == mac_table[i].port)
+      mac_table[i].port = NULL;
+}
+
+
+/**
+ * Find port by @a name.
+ *
+ * @param name name to look up by
+ * @return NULL if @a name was not found
+ */
+static struct Port *
+find_port (const char *name)
+{
+  for (unsigned int i=0;i<num_port;i++)
+    if (0 == strcasecmp (name,
+                         gport[i].name))
+      return &gport[i];
+  return NULL;
+}
+
+
+/**
+ * Check the configuration @a cfg to be reloaded and build its SVIs.
+ * Ports cannot be added or removed at runtime (their numbers are
+ * assigned by our parent); a configuration without ports leaves the
+ * ports alone.
+ *
+ * @param cfg the new configuration
+ * @param nifc[out] SVIs to initialize
+ * @param[out] nnum set to the number of SVIs in @a nifc
+ * @return 0 on success
+ */
+static int
+build_reload_svis (const struct Config *cfg,
+                   struct Interface *nifc,
+                   unsigned int *nnum)
+{
+  uint64_t seen[(MAX_VLAN_ID + 64) / 64] = { 0 };
+
+  if ( (0 != cfg->num_ports) &&
+       (num_port != cfg->num_ports) )
+  {
+    fprintf (stderr,
+             "Cannot add or remove ports at runtime\n");
+    return 1;
+  }
+  for (unsigned int i=0;i<cfg->num_ports;i++)
+    if (NULL == find_port (cfg->ports[i].name))
+    {
+      fprintf (stderr,
+               "Cannot add port `%s' at runtime\n",
+               cfg->ports[i].name);
+      return 1;
+    }
+  *nnum = 0;
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+  {
+    struct Interface *ifc = &nifc[*nnum];
+
+    if (! config_is_svi (&cfg->ifcs[i]))
+      continue;
+    (*nnum)++;
+    if (0 != init_svi_from_config (ifc,
+                                   &cfg->ifcs[i]))
+      return 1;
+    if (0 != (seen[ifc->vlan / 64] & (1LLU << (ifc->vlan % 64))))
+    {
+      fprintf (stderr,
+               "Duplicate SVI for VLAN %u\n",
+               (unsigned int) ifc->vlan);
+      return 1;
+    }
+    seen[ifc->vlan / 64] |= (1LLU << (ifc->vlan % 64));
+  }
+  return 0;
+}
+
+
+/**
+ * The user entered a "reload" command: load the configuration file
+ * given as argument and apply the differences to the running
+ * configuration.  Nothing is changed unless the new configuration is
+ * valid.  MAC table entries are only dropped for ports whose VLAN
+ * membership changed, routes and ARP entries only for SVIs that were
+ * removed or readdressed.  As control messages are processed between
+ * frames, the new configuration takes effect atomically for the next
+ * frame.
+ */
+static void
+process_cmd_reload ()
+{
+  const char *filename = strtok (NULL, " ");
+  struct Config cfg;
+  struct Interface *nifc;
+  unsigned int nnum;
+  unsigned int changed;
+
+  if (NULL == filename)
+  {
+    fprintf (stderr,
+             "Usage: reload FILENAME\n");
+    return;
+  }
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  nifc = NULL;
+  nnum = 0;
+  if ( (0 != config_load (filename,
+                          &cfg)) ||
+       (NULL == (nifc = calloc (cfg.num_ifcs + 1,
+                                sizeof (struct Interface)))) ||
+       (0 != build_reload_svis (&cfg,
+                                nifc,
+                                &nnum)) )
+  {
+    if (NULL != nifc)
+      for (unsigned int i=0;i<nnum;i++)
+        free (nifc[i].name);
+    free (nifc);
+    config_free (&cfg);
+    fprintf (stderr,
+             "Configuration `%s' not applied\n",
+             filename);
+    return;
+  }
+  changed = 0;
+  for (unsigned int i=0;i<cfg.num_ports;i++)
+  {
+    const struct ConfigPort *cp = &cfg.ports[i];
+    struct Port *port = find_port (cp->name);
+
+    if ( (port->untagged_vlan == cp->untagged_vlan) &&
+         (0 == memcmp (port->tagged_vlans,
+                       cp->tagged_vlans,
+                       sizeof (port->tagged_vlans))) )
+      continue;
+    port->untagged_vlan = cp->untagged_vlan;
+    memcpy (port->tagged_vlans,
+            cp->tagged_vlans,
+            sizeof (port->tagged_vlans));
+    mac_flush_port (port);
+    changed++;
+  }
+  ipv4_rebind (nifc,
+               nnum);
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    svi_by_vlan[gifc[i].vlan] = NULL;
+    free (gifc[i].name);
+  }
+  free (gifc);
+  gifc = nifc;
+  num_ifc = nnum;
+  nnum = 0;
+  for (unsigned int i=0;i<cfg.num_ifcs;i++)
+  {
+    struct Interface *ifc;
+
+    if (0 != strncasecmp (cfg.ifcs[i].name,
+                          "vlan",
+                          strlen ("vlan")))
+      continue;
+    ifc = &gifc[nnum++];
+    if (num_port > 0)
+      ifc->mac = gport[0].mac;
+    (void) add_svi (ifc);
+    add_svi_gateway (ifc,
+                     &cfg.ifcs[i]);
+  }
+  config_free (&cfg);
+  print ("Reloaded `%s', %u port(s) changed, %u SVI(s) active\n",
+         filename,
+         changed,
+         num_ifc);
+}
+
+
+/**
+ * Handle control message @a cmd.
+ *
+ * @param cmd text the user entered
+ * @param cmd_len length of @a cmd
+ */
+static void
+handle_control (char *cmd,
+		size_t cmd_len)
+{
+  const char *tok;
+
+  cmd[cmd_len - 1] = '\0';
+  tok = strtok (cmd,
+		" ");
+  if (NULL == tok)
+    return;
+  if (0 == strcasecmp (tok,
+		       "arp"))
+    process_cmd_arp ();
+  else if (0 == strcasecmp (tok,
+			    "route"))
+    process_cmd_route ();
+  else if (0 == strcasecmp (tok,
+			    "mac"))
+    process_cmd_mac ();
+  else if (0 == strcasecmp (tok,
+			    "reload"))
+    process_cmd_reload ();
+  else
+    fprintf (stderr,
+	     "Unsupported command `%s'\n",
+	     tok);
+}
+
+
+/**
+ * Handle MAC information @a mac.  The SVIs all use the MAC of
+ * the first port.
+ *
+ * @param ifc_num number of the interface with @a mac
+ * @param mac the MAC address at @a ifc_num
+ */
+static void
+handle_mac (uint16_t ifc_num,
+	    const struct MacAddress *mac)
+{
+  if (ifc_num > num_port)
+    abort ();
+  gport[ifc_num - 1].mac = *mac;
+  if (1 == ifc_num)
+    for (unsigned int i=0;i<num_ifc;i++)
+      gifc[i].mac = *mac;
+}
+
+
+#include "loop.c"
+
+
+/**
+ * Launches the L3 switch.
+ *
+ * @param argc number of arguments in @a argv
+ * @param argv binary name, followed by list of ports to switch between
+ *        (as for vswitch) and SVIs (as "vlanVID[IPV4:IP/NETMASK]=MTU"),
+ *        or "-c" followed by a list of configuration files to load
+ * @return not really
+ */
+int
+main (int argc,
+      char **argv)
+{
+  if ( (argc > 2) &&
+       (0 == strcmp (argv[1],
+                     "-c")) )
+  {
+    if (0 != load_config (argc - 2,
+                          &argv[2]))
+      return 1;
+  }
+  else
+  {
+    gport = calloc (argc,
+                    sizeof (struct Port));
+    gifc = calloc (argc,
+                   sizeof (struct Interface));
+    if ( (NULL == gport) ||
+         (NULL == gifc) )
+    {
+      perror ("calloc");
+      return 1;
+    }
+    for (unsigned int i=1;i<argc;i++)
+    {
+      if ( (0 == strncasecmp (argv[i],
+                              "vlan",
+                              strlen ("vlan"))) &&
+           (NULL != strchr (argv[i],
+                            '[')) )
+      {
+        if ( (0 != parse_svi_arg (argv[i],
+                                  &gifc[num_ifc])) ||
+             (0 != add_svi (&gifc[num_ifc])) )
+          return 1;
+        num_ifc++;
+        continue;
+      }
+      gport[num_port].ifc_num = num_port + 1;
+      if (0 != parse_port_arg (argv[i],
+                               &gport[num_port]))
+        return 1;
+      num_port++;
+    }
+  }
+  loop ();
+  for (unsigned int i=0;i<num_port;i++)
+    free (gport[i].name);
+  for (unsigned int i=0;i<num_ifc;i++)
+    free (gifc[i].name);
+  free (gport);
+  free (gifc);
+  free (routes);
+  free (arp_cache);
+  return 0;
+}
@@ -0,0 +1,371 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * @file latency.h
+ * @brief Optional per-stage latency histograms
+ * @author Christian Grothoff
+ *
+ * Compiled in only with -DGLAB_LATENCY=1; otherwise none of this
+ * exists and loop.c and packet.h contain no timing code at all.
+ *
+ * Each frame is split into three stages, timed with the TSC:
+ *  - framing: from read() returning (or the previous message being
+ *    done) until handle_frame() is called,
+ *  - process: handle_frame(), excluding time spent in egress,
+ *  - egress: each write of a frame to our parent.
+ * Samples go into log-linear (HDR-style) histograms with
+ * 2^#LAT_SUB_BITS sub-buckets per power of two, so percentiles
+ * are accurate to about 6% over the full 64-bit range.
+ *
+ * Must be included after print.c.
+ */
+
+#ifndef GLAB_LATENCY_H
+#define GLAB_LATENCY_H
+
+#ifndef GLAB_LATENCY
+#define GLAB_LATENCY 0
+#endif
+
+#if GLAB_LATENCY
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/**
+ * Stages of frame processing we measure.
+ */
+enum LatencyStage
+{
+  LAT_FRAMING,
+  LAT_PROCESS,
+  LAT_EGRESS,
+  LAT_NUM_STAGES
+};
+
+/**
+ * log2 of the number of sub-buckets per power of two.
+ */
+#define LAT_SUB_BITS 4
+
+/**
+ * Number of sub-buckets per power of two.
+ */
+#define LAT_SUB_COUNT (1u << LAT_SUB_BITS)
+
+/**
+ * Number of buckets needed to cover all 64-bit values.
+ */
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB_COUNT)
+
+
+/**
+ * Log-linear histogram of TSC cycle counts.
+ */
+struct LatencyHistogram
+{
+  /**
+   * Number of samples.
+   */
+  uint64_t count;
+
+  /**
+   * Largest sample.
+   */
+  uint64_t max;
+
+  /**
+   * Number of samples per bucket, see latency_bucket().
+   */
+  uint64_t buckets[LAT_BUCKETS];
+};
+
+
+/**
+ * Histogram per stage.
+ */
+static struct LatencyHistogram latency_hist[LAT_NUM_STAGES];
+
+/**
+ * Cycles spent in egress while processing the current frame.
+ */
+static uint64_t latency_egress_cycles;
+
+/**
+ * TSC when the current frame was handed to handle_frame().
+ */
+static uint64_t latency_frame_tsc;
+
+/**
+ * TSC and wall clock of the first sample, to convert cycles to ns.
+ */
+static uint64_t latency_tsc0;
+static struct timespec latency_ts0;
+
+
+/**
+ * Read the time stamp counter (or a nanosecond clock where there is none).
+ *
+ * @return current time in cycles
+ */
+static inline uint64_t
+latency_now (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc ();
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &ts);
+  return ts.tv_sec * 1000000000LLU + ts.tv_nsec;
+#endif
+}
+
+
+/**
+ * Find the histogram bucket for @a v.
+ *
+ * @param v sample value
+ * @return bucket index, below #LAT_BUCKETS
+ */
+static inline unsigned int
+latency_bucket (uint64_t v)
+{
+  unsigned int e;
+
+  if (v < LAT_SUB_COUNT)
+    return (unsigned int) v;
+  e = 63 - __builtin_clzll (v);
+  return (e - LAT_SUB_BITS + 1) * LAT_SUB_COUNT
+    + (unsigned int) (v >> (e - LAT_SUB_BITS)) - LAT_SUB_COUNT;
+}
+
+
+/**
+ * Get the largest value that falls into bucket @a idx.
+ *
+ * @param idx bucket index
+ * @return upper bound of the bucket
+ */
+static uint64_t
+latency_bucket_max (unsigned int idx)
+{
+  unsigned int k = idx / LAT_SUB_COUNT;
+  uint64_t m = idx % LAT_SUB_COUNT;
+
+  if (0 == k)
+    return m;
+  return ((LAT_SUB_COUNT + m + 1) << (k - 1)) - 1;
+}
+
+
+/**
+ * Add a sample of @a cycles to the histogram of @a stage.
+ *
+ * @param stage stage the sample is for
+ * @param cycles duration of the stage
+ */
+static inline void
+latency_record (enum LatencyStage stage,
+                uint64_t cycles)
+{
+  struct LatencyHistogram *h = &latency_hist[stage];
+
+  if (0 == latency_tsc0)
+  {
+    latency_tsc0 = latency_now ();
+    clock_gettime (CLOCK_MONOTONIC,
+                   &latency_ts0);
+  }
+  h->count++;
+  if (cycles > h->max)
+    h->max = cycles;
+  h->buckets[latency_bucket (cycles)]++;
+}
+
+
+/**
+ * A frame read at @a stamp is about to be handed to handle_frame().
+ *
+ * @param stamp when read() returned or the previous message was done
+ */
+static inline void
+latency_frame_start (uint64_t stamp)
+{
+  latency_frame_tsc = latency_now ();
+  latency_egress_cycles = 0;
+  latency_record (LAT_FRAMING,
+                  latency_frame_tsc - stamp);
+}
+
+
+/**
+ * handle_frame() returned.
+ *
+ * @return current time, to be used as stamp for the next message
+ */
+static inline uint64_t
+latency_frame_end (void)
+{
+  uint64_t now = latency_now ();
+
+  latency_record (LAT_PROCESS,
+                  now - latency_frame_tsc - latency_egress_cycles);
+  return now;
+}
+
+
+/**
+ * A frame write that started at @a start finished.
+ *
+ * @param start when the write started
+ */
+static inline void
+latency_egress (uint64_t start)
+{
+  uint64_t cycles = latency_now () - start;
+
+  latency_egress_cycles += cycles;
+  latency_record (LAT_EGRESS,
+                  cycles);
+}
+
+
+/**
+ * Find the @a permille-th percentile of @a h.
+ *
+ * @param h histogram to inspect
+ * @param permille percentile times ten, i.e. 999 for p99.9
+ * @return upper bound of the bucket the percentile falls into
+ */
+static uint64_t
+latency_percentile (const struct LatencyHistogram *h,
+                    unsigned int permille)
+{
+  uint64_t want = (h->count * permille + 999) / 1000;
+  uint64_t seen = 0;
+
+  for (unsigned int i = 0; i < LAT_BUCKETS; i++)
+  {
+    seen += h->buckets[i];
+    if ( (seen >= want) &&
+         (seen > 0) )
+      return (latency_bucket_max (i) < h->max) ? latency_bucket_max (i) : h->max;
+  }
+  return h->max;
+}
+
+
+/**
+ * Print percentiles of all stages (in cycles and, once calibrated,
+ * in nanoseconds).
+ */
+static void
+latency_dump (void)
+{
+  static const char *names[LAT_NUM_STAGES] = {
+    "framing",
+    "process",
+    "egress"
+  };
+  static const unsigned int permilles[] = { 500, 900, 990, 999 };
+  double ns_per_cycle = 0.0;
+  struct timespec ts;
+  uint64_t cycles;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &ts);
+  cycles = latency_now () - latency_tsc0;
+  if ( (0 != latency_tsc0) &&
+       (cycles > 0) )
+    ns_per_cycle = ((ts.tv_sec - latency_ts0.tv_sec) * 1e9
+                    + (ts.tv_nsec - latency_ts0.tv_nsec)) / cycles;
+  print ("stage     count       p50       p90       p99     p99.9       max (cycles)\n");
+  for (unsigned int s = 0; s < LAT_NUM_STAGES; s++)
+  {
+    const struct LatencyHistogram *h = &latency_hist[s];
+    uint64_t p[4];
+
+    for (unsigned int i = 0; i < 4; i++)
+      p[i] = latency_percentile (h,
+                                 permilles[i]);
+    print ("%-7s %7llu %9llu %9llu %9llu %9llu %9llu\n",
+           names[s],
+           (unsigned long long) h->count,
+           (unsigned long long) p[0],
+           (unsigned long long) p[1],
+           (unsigned long long) p[2],
+           (unsigned long long) p[3],
+           (unsigned long long) h->max);
+    if ( (0.0 != ns_per_cycle) &&
+         (0 != h->count) )
+      print ("%-7s %7s %9.0f %9.0f %9.0f %9.0f %9.0f (ns)\n",
+             "",
+             "",
+             p[0] * ns_per_cycle,
+             p[1] * ns_per_cycle,
+             p[2] * ns_per_cycle,
+             p[3] * ns_per_cycle,
+             h->max * ns_per_cycle);
+  }
+}
+
+
+/**
+ * Handle the "latency" and "latency reset" control commands.
+ *
+ * @param cmd text the user entered (not 0-terminated)
+ * @param cmd_len length of @a cmd
+ * @return true if @a cmd was a latency command
+ */
+static bool
+latency_handle_control (const char *cmd,
+                        size_t cmd_len)
+{
+  size_t len = strlen ("latency");
+
+  if ( (cmd_len < len) ||
+       (0 != strncasecmp (cmd,
+                          "latency",
+                          len)) ||
+       ( (cmd_len > len) &&
+         (' ' != cmd[len]) &&
+         ('\n' != cmd[len]) &&
+         ('\0' != cmd[len]) ) )
+    return false;
+  if ( (cmd_len >= len + 6) &&
+       (0 == strncasecmp (&cmd[len + 1],
+                          "reset",
+                          5)) )
+  {
+    memset (latency_hist,
+            0,
+            sizeof (latency_hist));
+    print ("Latency histograms reset\n");
+    return true;
+  }
+  latency_dump ();
+  return true;
+}
+
+#endif
+
+#endif
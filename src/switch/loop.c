@@ -23,30 +23,109 @@
  */
 
 
+#include "latency.h"
+#include "usdt.h"
+#include "sflow.h"
+#include "bpf.h"
+
+/**
+ * How long to wait for input before calling GLAB_IDLE() (in ms).
+ * Includers may define GLAB_IDLE() to run periodic work (such as
+ * expiring state) that must also happen while no messages arrive.
+ */
+#define GLAB_IDLE_MS 1000
+
+#if GLAB_SIM && defined(GLAB_IDLE)
+/**
+ * Read input from the simulator instead of our parent.  Nodes only
+ * run when they get input, so GLAB_IDLE() is not called while idle.
+ */
+#define GLAB_READ(buf, size) (GLAB_IDLE (), glab_sim_read (buf, size))
+#elif GLAB_SIM
+#define GLAB_READ(buf, size) glab_sim_read (buf, size)
+#elif defined(GLAB_IDLE)
+#include <poll.h>
+
+/**
+ * Read input from our parent, calling GLAB_IDLE() before waiting and
+ * whenever there was no input for #GLAB_IDLE_MS.
+ *
+ * @param buf where to read to
+ * @param size number of bytes available in @a buf
+ * @return result of read()
+ */
+static ssize_t
+glab_read_idle (void *buf,
+                size_t size)
+{
+  struct pollfd pfd = {
+    .fd = STDIN_FILENO,
+    .events = POLLIN
+  };
+
+  for (;;)
+  {
+    int ret;
+
+    GLAB_IDLE ();
+    ret = poll (&pfd,
+                1,
+                GLAB_IDLE_MS);
+    if (ret > 0)
+      return read (STDIN_FILENO,
+                   buf,
+                   size);
+    if ( (-1 == ret) &&
+         (EINTR != errno) )
+      return -1;
+  }
+}
+
+#define GLAB_READ(buf, size) glab_read_idle (buf, size)
+#else
+#define GLAB_READ(buf, size) read (STDIN_FILENO, buf, size)
+#endif
+
+#ifndef GLAB_HEADROOM
+/**
+ * Bytes to keep free in front of each message, see packet.h.
+ */
+#define GLAB_HEADROOM 0
+#endif
+
+
 /**
- * Sample main loop.  Reads packets from STDIN_FILENO
+ * Sample main loop.  Reads packets from STDIN_FILENO (or the simulator)
  * and calls handle_mac(), handle_control() or handle_frame()
- * on each depending on the type.
+ * on each depending on the type.  Frames passed to handle_frame()
+ * may be modified in place; the GLAB message header in front of
+ * them and #GLAB_HEADROOM bytes before that may be overwritten.
  */
 static void
 loop ()
 {
-  char buf[UINT16_MAX];
+  char storage[GLAB_HEADROOM + UINT16_MAX];
+  char *buf = &storage[GLAB_HEADROOM];
   size_t off;
   ssize_t ret;
   int have_mac;
+#if GLAB_LATENCY
+  uint64_t stamp;
+#endif
 
   off = 0;
   have_mac = 0;
-  while (-1 != (ret = read (STDIN_FILENO,
-                            &buf[off],
-                            sizeof (buf) - off)))
+  while (-1 != (ret = GLAB_READ (&buf[off],
+                                 UINT16_MAX - off)))
     {
       struct GLAB_MessageHeader hdr;
       uint16_t size;
 
       if (0 >= ret)
 	break;
+#if GLAB_LATENCY
+      stamp = latency_now ();
+#endif
       off += ret;
       while (off > sizeof (struct GLAB_MessageHeader))
 	{
@@ -72,18 +151,54 @@ loop ()
 		    handle_mac (i + 1,
 				&mac);
 		  }
+#if GLAB_SFLOW
+		sflow_init ((size - sizeof (hdr)) / sizeof (struct MacAddress));
+#endif
+#if GLAB_BPF
+		bpf_init ((size - sizeof (hdr)) / sizeof (struct MacAddress));
+#endif
 		have_mac = 1;
 	      }
 	    else
 	      {
+#if GLAB_LATENCY
+		if (latency_handle_control (&buf[sizeof (hdr)],
+					    size - sizeof (hdr)))
+		  break;
+#endif
+#if GLAB_BPF
+		if (bpf_handle_control (&buf[sizeof (hdr)],
+					size - sizeof (hdr)))
+		  break;
+#endif
+#if GLAB_SFLOW
+		if (sflow_handle_control (&buf[sizeof (hdr)],
+					  size - sizeof (hdr)))
+		  break;
+#endif
 		handle_control (&buf[sizeof (hdr)],
 				size - sizeof (hdr));
 	      }
 	    break;
 	  default:
+#if GLAB_LATENCY
+	    latency_frame_start (stamp);
+#endif
+	    GLAB_PROBE3 (receive,
+			 ntohs (hdr.type),
+			 &buf[sizeof (hdr)],
+			 size - sizeof (hdr));
+#if GLAB_SFLOW
+	    sflow_ingress (ntohs (hdr.type),
+			   &buf[sizeof (hdr)],
+			   size - sizeof (hdr));
+#endif
 	    handle_frame (ntohs (hdr.type),
-			  (const void *) &buf[sizeof (hdr)],
+			  (void *) &buf[sizeof (hdr)],
 			  size - sizeof (hdr));
+#if GLAB_LATENCY
+	    stamp = latency_frame_end ();
+#endif
 	    break;
 	  }
 	  memmove (buf,
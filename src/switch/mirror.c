@@ -0,0 +1,608 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file mirror.c
+ * @brief Port mirroring (SPAN) for switch.c and vswitch.c
+ * @author Christian Grothoff
+ *
+ * To be included after packet.h and the definition of `num_ifc`.
+ * A mirror session copies the frames received (rx) or sent (tx) on
+ * some interfaces, or received in some VLANs, to an analyzer
+ * interface.  The frame is sent to the analyzer straight from the
+ * receive buffer like any other egress, so mirroring costs one more
+ * write but no copy.  Truncation only shortens that write, and
+ * sampling skips it for all but one in N frames.  Frames are
+ * mirrored as they are on the wire of the source interface, i.e.
+ * with the 802.1Q tag as received or as sent.  Nothing is mirrored
+ * to the interface a frame came from or already went out on.
+ *
+ * Like a SPAN destination port, an analyzer interface is taken out
+ * of normal forwarding: frames received on it are neither learned
+ * nor forwarded, and no frames are switched or flooded to it, so it
+ * only ever gets the mirrored copies (see mirror_is_dest()).
+ *
+ * The fast path only tests one bit mask per interface and one per
+ * VLAN, which have two bits per session (rx and tx).
+ */
+
+
+/**
+ * Maximum number of mirror sessions, limited by the bits in the masks.
+ */
+#define MIRROR_MAX_SESSIONS 4
+
+/**
+ * Bits of all sessions for received frames.
+ */
+#define MIRROR_RX_BITS 0x55
+
+/**
+ * Bits of all sessions for sent frames.
+ */
+#define MIRROR_TX_BITS 0xAA
+
+
+/**
+ * A mirror session.
+ */
+struct MirrorSession
+{
+  /**
+   * Frames mirrored.
+   */
+  uint64_t mirrored;
+
+  /**
+   * Frames skipped due to sampling.
+   */
+  uint64_t skipped;
+
+  /**
+   * Mirror one in this many frames.
+   */
+  uint32_t sample;
+
+  /**
+   * Mirror at most this many bytes per frame, 0 for all.
+   */
+  uint16_t truncate;
+
+  /**
+   * Analyzer interface, 0 if the session is unused.
+   */
+  uint16_t dest;
+};
+
+
+/**
+ * The sessions.
+ */
+static struct MirrorSession mirror_sessions[MIRROR_MAX_SESSIONS];
+
+/**
+ * Per interface, indexed by interface number: bit 2*s is set if
+ * session s mirrors frames received there, bit 2*s+1 if it mirrors
+ * frames sent there.  NULL while no session was ever added.
+ */
+static uint8_t *mirror_ports;
+
+/**
+ * Per interface, indexed by interface number: number of sessions
+ * using it as analyzer.  Allocated with #mirror_ports.
+ */
+static uint8_t *mirror_dests;
+
+/**
+ * Per VLAN: bit 2*s is set if session s mirrors frames received in
+ * the VLAN.
+ */
+static uint8_t mirror_vlans[VLAN_VID_MASK + 1];
+
+/**
+ * Number of sessions in use.
+ */
+static unsigned int mirror_num_sessions;
+
+
+/**
+ * Send @a frame to the analyzers of the sessions in @a bits.
+ *
+ * @param bits session bits that matched
+ * @param ifc_num interface the frame was received or sent on
+ * @param frame the frame, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+mirror_send (uint8_t bits,
+             uint16_t ifc_num,
+             char *frame,
+             size_t frame_size)
+{
+  for (unsigned int s = 0; s < MIRROR_MAX_SESSIONS; s++)
+  {
+    struct MirrorSession *ms = &mirror_sessions[s];
+
+    if ( (0 == ((bits >> (2 * s)) & 3)) ||
+         (ms->dest == ifc_num) )
+      continue;
+    if ( (ms->sample > 1) &&
+         (0 != random () % ms->sample) )
+    {
+      ms->skipped++;
+      continue;
+    }
+    ms->mirrored++;
+    glab_send_in_place (ms->dest,
+                        frame,
+                        ( (0 != ms->truncate) &&
+                          (frame_size > ms->truncate) )
+                        ? ms->truncate
+                        : frame_size);
+  }
+}
+
+
+/**
+ * Check if @a ifc_num is the analyzer of a session and must thus
+ * not take part in normal forwarding.
+ *
+ * @param ifc_num interface to check
+ * @return true if frames must not be switched to or from @a ifc_num
+ */
+static inline bool
+mirror_is_dest (uint16_t ifc_num)
+{
+  return (0 != mirror_num_sessions) &&
+         (0 != mirror_dests[ifc_num]);
+}
+
+
+/**
+ * Mirror @a frame received on @a ifc_num in @a vlan, if any session
+ * asks for it.
+ *
+ * @param ifc_num interface the frame was received on
+ * @param vlan VLAN the frame was classified into
+ * @param frame the frame, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+mirror_rx (uint16_t ifc_num,
+           int16_t vlan,
+           char *frame,
+           size_t frame_size)
+{
+  uint8_t bits;
+
+  if (0 == mirror_num_sessions)
+    return;
+  bits = (mirror_ports[ifc_num]
+          | mirror_vlans[(uint16_t) vlan & VLAN_VID_MASK])
+    & MIRROR_RX_BITS;
+  if (0 != bits)
+    mirror_send (bits,
+                 ifc_num,
+                 frame,
+                 frame_size);
+}
+
+
+/**
+ * Mirror @a frame sent on @a ifc_num, if any session asks for it.
+ *
+ * @param ifc_num interface the frame was sent on
+ * @param frame the frame as sent, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+mirror_tx (uint16_t ifc_num,
+           char *frame,
+           size_t frame_size)
+{
+  uint8_t bits;
+
+  if (0 == mirror_num_sessions)
+    return;
+  bits = mirror_ports[ifc_num] & MIRROR_TX_BITS;
+  if (0 != bits)
+    mirror_send (bits,
+                 ifc_num,
+                 frame,
+                 frame_size);
+}
+
+
+/**
+ * Parse a list like "1,3-5" of numbers in [@a min, @a max] and set
+ * @a bit in @a masks for each.
+ *
+ * @param list text to parse
+ * @param min smallest value allowed
+ * @param max largest value allowed
+ * @param masks masks to update, indexed by the numbers
+ * @param bit bit to set
+ * @return 0 on success
+ */
+static int
+mirror_parse_list (const char *list,
+                   unsigned int min,
+                   unsigned int max,
+                   uint8_t *masks,
+                   uint8_t bit)
+{
+  const char *pos = list;
+
+  for (;;)
+  {
+    char *end;
+    unsigned long lo;
+    unsigned long hi;
+
+    lo = strtoul (pos,
+                  &end,
+                  10);
+    if (end == pos)
+      return 1;
+    hi = lo;
+    if ('-' == *end)
+    {
+      pos = end + 1;
+      hi = strtoul (pos,
+                    &end,
+                    10);
+      if (end == pos)
+        return 1;
+    }
+    if ( (lo < min) ||
+         (hi > max) ||
+         (lo > hi) )
+      return 1;
+    for (unsigned long i = lo; i <= hi; i++)
+      masks[i] |= bit;
+    if ('\0' == *end)
+      return 0;
+    if (',' != *end)
+      return 1;
+    pos = end + 1;
+  }
+}
+
+
+/**
+ * Remove session @a s from the masks.
+ *
+ * @param s session number
+ */
+static void
+mirror_clear_bits (unsigned int s)
+{
+  uint8_t keep = (uint8_t) ~(3 << (2 * s));
+
+  for (unsigned int i = 0; i <= num_ifc; i++)
+    mirror_ports[i] &= keep;
+  for (unsigned int i = 0; i <= VLAN_VID_MASK; i++)
+    mirror_vlans[i] &= keep;
+}
+
+
+/**
+ * The user entered "mirror add DEST [rx PORTS] [tx PORTS]
+ * [both PORTS] [vlan VIDS] [truncate BYTES] [sample N]".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mirror_add ()
+{
+  const char *dest = strtok (NULL, " ");
+  struct MirrorSession *ms = NULL;
+  const char *key;
+  unsigned int s;
+  unsigned int d;
+  bool have_source = false;
+
+  if ( (NULL == mirror_ports) &&
+       (NULL == (mirror_ports = calloc (2 * (num_ifc + 1),
+                                        sizeof (uint8_t)))) )
+  {
+    perror ("calloc");
+    return;
+  }
+  mirror_dests = &mirror_ports[num_ifc + 1];
+  for (s = 0; s < MIRROR_MAX_SESSIONS; s++)
+    if (0 == mirror_sessions[s].dest)
+    {
+      ms = &mirror_sessions[s];
+      break;
+    }
+  if (NULL == ms)
+  {
+    fprintf (stderr,
+             "At most %u mirror sessions are supported\n",
+             MIRROR_MAX_SESSIONS);
+    return;
+  }
+  if ( (NULL == dest) ||
+       (1 != sscanf (dest,
+                     "%u",
+                     &d)) ||
+       (0 == d) ||
+       (d > num_ifc) )
+  {
+    fprintf (stderr,
+             "Usage: mirror add DEST [rx|tx|both PORTS] [vlan VIDS] [truncate BYTES] [sample N]\n");
+    return;
+  }
+  ms->sample = 1;
+  ms->truncate = 0;
+  while (NULL != (key = strtok (NULL, " ")))
+  {
+    const char *val = strtok (NULL, " ");
+    unsigned int v;
+    int ret = 1;
+
+    if (NULL == val)
+      break;
+    if (0 == strcasecmp (key,
+                         "rx"))
+      ret = mirror_parse_list (val,
+                               1,
+                               num_ifc,
+                               mirror_ports,
+                               1 << (2 * s));
+    else if (0 == strcasecmp (key,
+                              "tx"))
+      ret = mirror_parse_list (val,
+                               1,
+                               num_ifc,
+                               mirror_ports,
+                               2 << (2 * s));
+    else if (0 == strcasecmp (key,
+                              "both"))
+      ret = mirror_parse_list (val,
+                               1,
+                               num_ifc,
+                               mirror_ports,
+                               3 << (2 * s));
+    else if (0 == strcasecmp (key,
+                              "vlan"))
+      ret = mirror_parse_list (val,
+                               0,
+                               VLAN_VID_MASK,
+                               mirror_vlans,
+                               1 << (2 * s));
+    else if ( (0 == strcasecmp (key,
+                                "truncate")) &&
+              (1 == sscanf (val,
+                            "%u",
+                            &v)) &&
+              (v >= sizeof (struct EthernetHeader)) &&
+              (v <= UINT16_MAX) )
+    {
+      ms->truncate = (uint16_t) v;
+      ret = 0;
+    }
+    else if ( (0 == strcasecmp (key,
+                                "sample")) &&
+              (1 == sscanf (val,
+                            "%u",
+                            &v)) &&
+              (v > 0) )
+    {
+      ms->sample = v;
+      ret = 0;
+    }
+    if (0 != ret)
+    {
+      fprintf (stderr,
+               "Invalid mirror option `%s %s'\n",
+               key,
+               val);
+      mirror_clear_bits (s);
+      return;
+    }
+    if ( (0 != strcasecmp (key,
+                           "truncate")) &&
+         (0 != strcasecmp (key,
+                           "sample")) )
+      have_source = true;
+  }
+  if ( (NULL != key) ||
+       (! have_source) )
+  {
+    fprintf (stderr,
+             "Mirror session needs `rx', `tx', `both' or `vlan' with a value\n");
+    mirror_clear_bits (s);
+    return;
+  }
+  ms->dest = (uint16_t) d;
+  ms->mirrored = 0;
+  ms->skipped = 0;
+  mirror_dests[d]++;
+  mirror_num_sessions++;
+  print ("Mirror session %u to interface %u\n",
+         s,
+         d);
+}
+
+
+/**
+ * The user entered "mirror del SESSION".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mirror_del ()
+{
+  const char *arg = strtok (NULL, " ");
+  unsigned int s;
+
+  if ( (NULL == arg) ||
+       (1 != sscanf (arg,
+                     "%u",
+                     &s)) ||
+       (s >= MIRROR_MAX_SESSIONS) ||
+       (0 == mirror_sessions[s].dest) )
+  {
+    fprintf (stderr,
+             "Usage: mirror del SESSION\n");
+    return;
+  }
+  mirror_clear_bits (s);
+  mirror_dests[mirror_sessions[s].dest]--;
+  mirror_sessions[s].dest = 0;
+  mirror_num_sessions--;
+}
+
+
+/**
+ * Append the numbers in [@a min, @a max] whose entry in @a masks has
+ * any of @a bits to @a buf as a list like "1,3-5".
+ *
+ * @param buf buffer to write to
+ * @param size number of bytes in @a buf
+ * @param masks masks to look at
+ * @param min first number
+ * @param max last number
+ * @param bits bits to look for
+ */
+static void
+mirror_format_list (char *buf,
+                    size_t size,
+                    const uint8_t *masks,
+                    unsigned int min,
+                    unsigned int max,
+                    uint8_t bits)
+{
+  size_t off = 0;
+
+  buf[0] = '\0';
+  for (unsigned int i = min; i <= max; i++)
+  {
+    unsigned int j = i;
+    int ret;
+
+    if (0 == (masks[i] & bits))
+      continue;
+    while ( (j < max) &&
+            (0 != (masks[j + 1] & bits)) )
+      j++;
+    ret = (i == j)
+      ? snprintf (&buf[off],
+                  size - off,
+                  "%s%u",
+                  (0 == off) ? "" : ",",
+                  i)
+      : snprintf (&buf[off],
+                  size - off,
+                  "%s%u-%u",
+                  (0 == off) ? "" : ",",
+                  i,
+                  j);
+    if ( (ret < 0) ||
+         ((size_t) ret >= size - off) )
+      return;
+    off += ret;
+    i = j;
+  }
+}
+
+
+/**
+ * The user entered "mirror list".
+ */
+static void
+process_cmd_mirror_list ()
+{
+  for (unsigned int s = 0; s < MIRROR_MAX_SESSIONS; s++)
+  {
+    const struct MirrorSession *ms = &mirror_sessions[s];
+    char rx[256];
+    char tx[256];
+    char vlans[256];
+
+    if (0 == ms->dest)
+      continue;
+    mirror_format_list (rx,
+                        sizeof (rx),
+                        mirror_ports,
+                        1,
+                        num_ifc,
+                        1 << (2 * s));
+    mirror_format_list (tx,
+                        sizeof (tx),
+                        mirror_ports,
+                        1,
+                        num_ifc,
+                        2 << (2 * s));
+    mirror_format_list (vlans,
+                        sizeof (vlans),
+                        mirror_vlans,
+                        0,
+                        VLAN_VID_MASK,
+                        1 << (2 * s));
+    print ("%u: to %u rx [%s] tx [%s] vlan [%s] truncate %u sample 1/%u: %llu mirrored, %llu skipped\n",
+           s,
+           ms->dest,
+           rx,
+           tx,
+           vlans,
+           ms->truncate,
+           ms->sample,
+           (unsigned long long) ms->mirrored,
+           (unsigned long long) ms->skipped);
+  }
+}
+
+
+/**
+ * The user entered a "mirror" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mirror ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("add",
+                       subcommand))
+    process_cmd_mirror_add ();
+  else if (0 == strcasecmp ("del",
+                            subcommand))
+    process_cmd_mirror_del ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_mirror_list ();
+  else
+    fprintf (stderr,
+             "Usage: mirror [add|del|list] ...\n");
+}
+
+
+/**
+ * Release the mirror state.
+ */
+static void
+mirror_free ()
+{
+  free (mirror_ports);
+  mirror_ports = NULL;
+  mirror_dests = NULL;
+  mirror_num_sessions = 0;
+}
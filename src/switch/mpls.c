@@ -0,0 +1,776 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file mpls.c
+ * @brief MPLS label switching (RFC 3031, 3032) for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c and huge.c, with #IPV4_MAX_LABELS
+ * defined.  Labelled frames are switched by their top label with a
+ * single load from a table indexed by the label (no longest prefix
+ * match), so we only accept incoming labels below #MPLS_LABEL_SLOTS,
+ * which keeps the table at 2 MB: one huge page.  It is allocated
+ * with the first entry.  An entry either
+ *  - swaps the top label for one or more labels (swap and push),
+ *  - pops it and forwards the rest to a neighbour (penultimate hop
+ *    popping), or
+ *  - pops it and looks at the rest itself: the next label, or the
+ *    IPv4 packet at the bottom of the stack.
+ * Labels are pushed onto IPv4 packets by routes with a label stack
+ * (see "route add ... label" in ipv4.c).  The label stack is always
+ * edited in place, pushed labels go into the headroom of the frame.
+ *
+ * The TTL of the top label is decremented, copied into pushed labels
+ * and, when popping, into the label below.  The TTL of an IPv4 packet
+ * is copied into the labels pushed onto it (the "uniform" model of
+ * RFC 3443), but the label TTL is not copied back into the IPv4
+ * packet when the last label is popped ("short pipe").  Frames whose
+ * TTL expires, that would exceed the MTU or that carry an unknown
+ * label are dropped.
+ */
+
+
+/**
+ * Ethernet type of MPLS unicast frames.
+ */
+#define ETH_P_MPLS 0x8847
+
+/**
+ * Number of entries in the label table: incoming labels must be
+ * below this.
+ */
+#define MPLS_LABEL_SLOTS (1 << 16)
+
+/**
+ * Reserved label: pop, IPv4 packet follows (RFC 3032).
+ */
+#define MPLS_LABEL_IPV4_NULL 0
+
+/**
+ * Smallest label that is not reserved.
+ */
+#define MPLS_LABEL_MIN 16
+
+/**
+ * Bottom of stack bit of a label stack entry.
+ */
+#define MPLS_BOS 0x100
+
+/**
+ * Size of a label stack entry.
+ */
+#define MPLS_ENTRY_SIZE 4
+
+/**
+ * Build a label stack entry.
+ */
+#define MPLS_ENTRY(label, tc, bos, ttl) \
+  (((uint32_t) (label) << 12) | ((uint32_t) (tc) << 9) \
+   | ((bos) ? MPLS_BOS : 0) | (uint32_t) (ttl))
+
+
+/**
+ * What to do with frames carrying a label.
+ */
+enum MplsOp
+{
+  /**
+   * Label not in use.
+   */
+  MPLS_OP_NONE = 0,
+
+  /**
+   * Replace the top label with @e out and forward.
+   */
+  MPLS_OP_SWAP,
+
+  /**
+   * Pop the top label and forward (penultimate hop popping).
+   */
+  MPLS_OP_PHP,
+
+  /**
+   * Pop the top label and process what is below it.
+   */
+  MPLS_OP_POP
+};
+
+
+/**
+ * Entry in the label table, 32 bytes.
+ */
+struct MplsEntry
+{
+  /**
+   * Interface to forward on, NULL for #MPLS_OP_POP.
+   */
+  struct Interface *ifc;
+
+  /**
+   * Neighbour to forward to.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * Labels replacing the top label for #MPLS_OP_SWAP, outermost first.
+   */
+  uint32_t out[IPV4_MAX_LABELS];
+
+  /**
+   * Number of entries in @e out.
+   */
+  uint8_t num_out;
+
+  /**
+   * What to do, an `enum MplsOp`.
+   */
+  uint8_t op;
+};
+
+
+/**
+ * Label table, indexed by incoming label; NULL until the first
+ * entry is added.
+ */
+static struct MplsEntry *mpls_table;
+
+/**
+ * Number of labels in use in #mpls_table.
+ */
+static unsigned int mpls_count;
+
+/**
+ * Number of frames we forwarded (swapped or popped, but labelled).
+ */
+static uint64_t mpls_switched;
+
+/**
+ * Number of frames whose last label we popped.
+ */
+static uint64_t mpls_popped;
+
+/**
+ * Number of IPv4 packets we pushed labels onto.
+ */
+static uint64_t mpls_pushed;
+
+/**
+ * Number of frames dropped for an unknown or unsupported label.
+ */
+static uint64_t mpls_unknown;
+
+/**
+ * Number of frames dropped because their TTL expired.
+ */
+static uint64_t mpls_expired;
+
+/**
+ * Number of frames dropped because they would exceed the MTU.
+ */
+static uint64_t mpls_too_big;
+
+
+/**
+ * Context of mpls_push().
+ */
+struct MplsPushContext
+{
+  /**
+   * Interface to send the packets out on.
+   */
+  struct Interface *ifc;
+
+  /**
+   * Labels to push, outermost first.
+   */
+  const uint32_t *labels;
+
+  /**
+   * Number of entries in @e labels.
+   */
+  unsigned int num_labels;
+
+  /**
+   * Neighbour to send the packets to.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * ARP entry of @e next_hop, NULL until the first packet.
+   */
+  const struct ArpEntry *ae;
+};
+
+
+/**
+ * Push the labels of @a cls onto the IPv4 packet @a ip and send it,
+ * see #Ipv4FragmentCallback.  The labels get the TTL of @a ip and
+ * its precedence as traffic class.
+ *
+ * @param cls a `struct MplsPushContext`
+ * @param ip IPv4 packet (or fragment), in a writable buffer
+ * @param size number of bytes in @a ip
+ * @param headroom number of writable bytes in front of @a ip
+ * @return false on ARP miss
+ */
+static bool
+mpls_push (void *cls,
+           char *ip,
+           size_t size,
+           size_t headroom)
+{
+  struct MplsPushContext *pc = cls;
+  size_t push = pc->num_labels * MPLS_ENTRY_SIZE;
+  uint8_t ttl = *(const uint8_t *) IPV4_FIELD (ip, ttl);
+  uint8_t tc = ((const uint8_t *) ip)[1] >> 5;
+  char *stack;
+
+  if ( (NULL == pc->ae) &&
+       (NULL == (pc->ae = resolve_next_hop (pc->ifc,
+                                            pc->next_hop))) )
+    return false;
+  if (headroom < push)
+  {
+    char buf[GLAB_FRAME_HEADROOM + size];
+
+    memcpy (&buf[GLAB_FRAME_HEADROOM],
+            ip,
+            size);
+    return mpls_push (cls,
+                      &buf[GLAB_FRAME_HEADROOM],
+                      size,
+                      GLAB_FRAME_HEADROOM);
+  }
+  stack = ip - push;
+  for (unsigned int i=0;i<pc->num_labels;i++)
+    put_u32 (&stack[i * MPLS_ENTRY_SIZE],
+             htonl (MPLS_ENTRY (pc->labels[i],
+                                tc,
+                                i + 1 == pc->num_labels,
+                                ttl)));
+  mpls_pushed++;
+  forward_frame_payload_in_place (pc->ifc,
+                                  &pc->ae->mac,
+                                  ETH_P_MPLS,
+                                  stack,
+                                  push + size,
+                                  headroom - push);
+  return true;
+}
+
+
+/**
+ * Send IPv4 packet @a ip with the labels of route @a r, see
+ * #IPV4_LABEL_OUTPUT.  Packets that would exceed the MTU with the
+ * labels are fragmented first (route() already refused those with
+ * DF set).
+ *
+ * @param r route with labels
+ * @param next_hop neighbour to send the packet to
+ * @param ip IPv4 packet, in a writable buffer
+ * @param size number of bytes in @a ip
+ * @param headroom number of writable bytes in front of @a ip
+ */
+static void
+mpls_impose (const struct Route *r,
+             struct in_addr next_hop,
+             char *ip,
+             size_t size,
+             size_t headroom)
+{
+  struct MplsPushContext pc = {
+    .ifc = r->ifc,
+    .labels = r->labels,
+    .num_labels = r->num_labels,
+    .next_hop = next_hop
+  };
+  size_t hlen = IPV4_HLEN (ip);
+
+  if (size <= route_mtu (r))
+  {
+    (void) mpls_push (&pc,
+                      ip,
+                      size,
+                      headroom);
+    return;
+  }
+  ipv4_fragment (ip,
+                 hlen,
+                 &ip[hlen],
+                 size - hlen,
+                 route_mtu (r),
+                 &mpls_push,
+                 &pc);
+}
+
+
+/**
+ * Switch MPLS frame payload @a *pkt by its label stack, in place.
+ * If the last label is popped by us, the caller gets the IPv4
+ * packet below it.
+ *
+ * @param[in,out] pkt label stack, set to the IPv4 packet
+ * @param[in,out] size number of bytes in @a *pkt
+ * @param[in,out] headroom number of writable bytes in front of @a *pkt
+ * @return true if @a *pkt is now an IPv4 packet for the caller to
+ *         process, false if the frame was forwarded or dropped
+ */
+static bool
+mpls_input (char **pkt,
+            size_t *size,
+            size_t *headroom)
+{
+  char *stack = *pkt;
+  size_t len = *size;
+  size_t room = *headroom;
+  const struct MplsEntry *e;
+  const struct ArpEntry *ae;
+  uint32_t lse;
+  uint32_t label;
+  uint8_t ttl;
+  bool bos;
+
+  while (1)
+  {
+    if (len < MPLS_ENTRY_SIZE)
+    {
+      mpls_unknown++;
+      return false;
+    }
+    lse = ntohl (get_u32 (stack));
+    label = lse >> 12;
+    bos = (0 != (lse & MPLS_BOS));
+    ttl = (uint8_t) lse;
+    if ( (MPLS_LABEL_IPV4_NULL == label) ||
+         ( (label < MPLS_LABEL_SLOTS) &&
+           (NULL != mpls_table) &&
+           (MPLS_OP_POP == mpls_table[label].op) ) )
+    {
+      /* pop and look at what is below */
+      stack += MPLS_ENTRY_SIZE;
+      len -= MPLS_ENTRY_SIZE;
+      room += MPLS_ENTRY_SIZE;
+      if (bos)
+      {
+        mpls_popped++;
+        *pkt = stack;
+        *size = len;
+        *headroom = room;
+        return true;
+      }
+      /* the TTL carries over to the new top label */
+      if (ttl <= 1)
+      {
+        mpls_expired++;
+        return false;
+      }
+      if (len >= MPLS_ENTRY_SIZE)
+        stack[3] = (char) (ttl - 1);
+      continue;
+    }
+    break;
+  }
+  if ( (label < MPLS_LABEL_MIN) ||
+       (label >= MPLS_LABEL_SLOTS) ||
+       (NULL == mpls_table) ||
+       (MPLS_OP_NONE == mpls_table[label].op) )
+  {
+    mpls_unknown++;
+    return false;
+  }
+  if (ttl <= 1)
+  {
+    mpls_expired++;
+    return false;
+  }
+  e = &mpls_table[label];
+  if (MPLS_OP_SWAP == e->op)
+  {
+    size_t push = (e->num_out - 1) * MPLS_ENTRY_SIZE;
+    uint8_t tc = (uint8_t) ((lse >> 9) & 7);
+
+    if ( (push > room) ||
+         (len + push + sizeof (struct EthernetHeader) > e->ifc->mtu) )
+    {
+      mpls_too_big++;
+      return false;
+    }
+    stack -= push;
+    room -= push;
+    len += push;
+    for (unsigned int i=0;i<e->num_out;i++)
+      put_u32 (&stack[i * MPLS_ENTRY_SIZE],
+               htonl (MPLS_ENTRY (e->out[i],
+                                  tc,
+                                  bos && (i + 1 == e->num_out),
+                                  ttl - 1)));
+  }
+  else
+  {
+    stack += MPLS_ENTRY_SIZE;
+    len -= MPLS_ENTRY_SIZE;
+    room += MPLS_ENTRY_SIZE;
+    if (! bos)
+    {
+      if (len < MPLS_ENTRY_SIZE)
+      {
+        mpls_unknown++;
+        return false;
+      }
+      stack[3] = (char) (ttl - 1);
+    }
+    if (len + sizeof (struct EthernetHeader) > e->ifc->mtu)
+    {
+      mpls_too_big++;
+      return false;
+    }
+  }
+  ae = resolve_next_hop (e->ifc,
+                         e->next_hop);
+  if (NULL == ae)
+    return false;
+  mpls_switched++;
+  forward_frame_payload_in_place (e->ifc,
+                                  &ae->mac,
+                                  ( (MPLS_OP_PHP == e->op) && bos)
+                                  ? ETH_P_IPV4
+                                  : ETH_P_MPLS,
+                                  stack,
+                                  len,
+                                  room);
+  return false;
+}
+
+
+/**
+ * Move the label table over to a new set of interfaces after a
+ * configuration reload, like ipv4_rebind().  Entries forwarding via
+ * removed interfaces are dropped.  Must be called while the old
+ * interfaces are still valid.
+ *
+ * @param nifc the new interfaces
+ * @param nnum number of entries in @a nifc
+ */
+static void
+mpls_rebind (struct Interface *nifc,
+             unsigned int nnum)
+{
+  if (NULL == mpls_table)
+    return;
+  for (unsigned int i=0;i<MPLS_LABEL_SLOTS;i++)
+  {
+    struct MplsEntry *e = &mpls_table[i];
+    struct Interface *n = NULL;
+
+    if (NULL == e->ifc)
+      continue;
+    for (unsigned int k=0;k<nnum;k++)
+      if (0 == strcasecmp (nifc[k].name,
+                           e->ifc->name))
+        n = &nifc[k];
+    if ( (NULL == n) ||
+         (0 == n->ifc_num) )
+    {
+      memset (e,
+              0,
+              sizeof (*e));
+      mpls_count--;
+      continue;
+    }
+    e->ifc = n;
+  }
+}
+
+
+/**
+ * Stop label switching and free the label table.
+ */
+static void
+mpls_disable ()
+{
+  huge_free (mpls_table);
+  mpls_table = NULL;
+  mpls_count = 0;
+}
+
+
+/**
+ * Parse an incoming label from @a tok.
+ *
+ * @param tok text to parse, may be NULL
+ * @param[out] label set to the label
+ * @return 0 on success
+ */
+static int
+mpls_parse_label (const char *tok,
+                  uint32_t *label)
+{
+  unsigned long l;
+  char *end;
+
+  if (NULL == tok)
+    return 1;
+  l = strtoul (tok,
+               &end,
+               10);
+  if ( (end == tok) ||
+       ('\0' != *end) ||
+       (l < MPLS_LABEL_MIN) ||
+       (l >= MPLS_LABEL_SLOTS) )
+  {
+    fprintf (stderr,
+             "Label `%s' invalid, must be within [%u,%u]\n",
+             tok,
+             MPLS_LABEL_MIN,
+             MPLS_LABEL_SLOTS - 1);
+    return 1;
+  }
+  *label = (uint32_t) l;
+  return 0;
+}
+
+
+/**
+ * Parse "via HOP dev IFC" into @a e, the rest is taken from the
+ * strtok() buffer.
+ *
+ * @param tok first token, should be "via", may be NULL
+ * @param[out] e entry to update
+ * @return 0 on success
+ */
+static int
+mpls_parse_next_hop (const char *tok,
+                     struct MplsEntry *e)
+{
+  if ( (NULL == tok) ||
+       (0 != strcasecmp ("via",
+                         tok)) ||
+       (NULL == (tok = strtok (NULL, " "))) ||
+       (1 != inet_pton (AF_INET,
+                        tok,
+                        &e->next_hop)) ||
+       (NULL == (tok = strtok (NULL, " "))) ||
+       (0 != strcasecmp ("dev",
+                         tok)) ||
+       (NULL == (tok = strtok (NULL, " "))) )
+  {
+    fprintf (stderr,
+             "Expected `via HOP dev IFC'\n");
+    return 1;
+  }
+  e->ifc = find_interface (tok);
+  if ( (NULL == e->ifc) ||
+       (0 == e->ifc->ifc_num) )
+  {
+    fprintf (stderr,
+             "Interface `%s' unknown or not an Ethernet interface\n",
+             tok);
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Add a label table entry: "LABEL swap L1[/L2] via HOP dev IFC",
+ * "LABEL pop via HOP dev IFC" or "LABEL pop".
+ */
+static void
+mpls_cmd_add ()
+{
+  struct MplsEntry e;
+  uint32_t label;
+  const char *op;
+  const char *tok;
+
+  memset (&e,
+          0,
+          sizeof (e));
+  if (0 != mpls_parse_label (strtok (NULL, " "),
+                             &label))
+    return;
+  op = strtok (NULL, " ");
+  if ( (NULL != op) &&
+       (0 == strcasecmp (op,
+                         "swap")) )
+  {
+    tok = strtok (NULL, " ");
+    if ( (NULL == tok) ||
+         (0 != parse_label_stack (tok,
+                                  e.out,
+                                  &e.num_out)) ||
+         (0 != mpls_parse_next_hop (strtok (NULL, " "),
+                                    &e)) )
+      return;
+    e.op = MPLS_OP_SWAP;
+  }
+  else if ( (NULL != op) &&
+            (0 == strcasecmp (op,
+                              "pop")) )
+  {
+    tok = strtok (NULL, " ");
+    e.op = (NULL == tok) ? MPLS_OP_POP : MPLS_OP_PHP;
+    if ( (NULL != tok) &&
+         (0 != mpls_parse_next_hop (tok,
+                                    &e)) )
+      return;
+  }
+  else
+  {
+    fprintf (stderr,
+             "Usage: mpls add LABEL (swap L1[/L2] via HOP dev IFC | pop [via HOP dev IFC])\n");
+    return;
+  }
+  if (NULL == mpls_table)
+  {
+    mpls_table = huge_alloc (MPLS_LABEL_SLOTS * sizeof (struct MplsEntry),
+                             "MPLS label table");
+    if (NULL == mpls_table)
+    {
+      fprintf (stderr,
+               "Failed to allocate label table\n");
+      return;
+    }
+  }
+  if (MPLS_OP_NONE == mpls_table[label].op)
+    mpls_count++;
+  mpls_table[label] = e;
+}
+
+
+/**
+ * Print the label table entry for @a label.
+ *
+ * @param label incoming label
+ * @param e its entry
+ */
+static void
+mpls_print_entry (uint32_t label,
+                  const struct MplsEntry *e)
+{
+  char hop[INET_ADDRSTRLEN];
+  char out[IPV4_MAX_LABELS * 8 + 1];
+
+  if (MPLS_OP_POP == e->op)
+  {
+    print ("%u pop\n",
+           (unsigned int) label);
+    return;
+  }
+  inet_ntop (AF_INET,
+             &e->next_hop,
+             hop,
+             sizeof (hop));
+  if (MPLS_OP_PHP == e->op)
+  {
+    print ("%u pop via %s dev %s\n",
+           (unsigned int) label,
+           hop,
+           e->ifc->name);
+    return;
+  }
+  out[0] = '\0';
+  for (unsigned int i=0;i<e->num_out;i++)
+    snprintf (&out[strlen (out)],
+              sizeof (out) - strlen (out),
+              "%s%u",
+              (0 == i) ? "" : "/",
+              (unsigned int) e->out[i]);
+  print ("%u swap %s via %s dev %s\n",
+         (unsigned int) label,
+         out,
+         hop,
+         e->ifc->name);
+}
+
+
+/**
+ * The user entered an "mpls" command.  Subcommands are:
+ *
+ *   mpls [list]                                    show the label table
+ *   mpls add LABEL swap L1[/L2] via HOP dev IFC    swap (and push)
+ *   mpls add LABEL pop via HOP dev IFC             penultimate hop popping
+ *   mpls add LABEL pop                             pop and look below
+ *   mpls del LABEL                                 remove an entry
+ *   mpls off                                       clear the table
+ *
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_mpls ()
+{
+  const char *tok = strtok (NULL, " ");
+
+  if ( (NULL == tok) ||
+       (0 == strcasecmp (tok,
+                         "list")) )
+  {
+    print ("%u labels, %llu switched, %llu pushed, %llu popped, %llu unknown, %llu TTL expired, %llu too big\n",
+           mpls_count,
+           (unsigned long long) mpls_switched,
+           (unsigned long long) mpls_pushed,
+           (unsigned long long) mpls_popped,
+           (unsigned long long) mpls_unknown,
+           (unsigned long long) mpls_expired,
+           (unsigned long long) mpls_too_big);
+    if (NULL == mpls_table)
+      return;
+    for (uint32_t i=0;i<MPLS_LABEL_SLOTS;i++)
+      if (MPLS_OP_NONE != mpls_table[i].op)
+        mpls_print_entry (i,
+                          &mpls_table[i]);
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "add"))
+  {
+    mpls_cmd_add ();
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "del"))
+  {
+    uint32_t label;
+
+    if (0 != mpls_parse_label (strtok (NULL, " "),
+                               &label))
+      return;
+    if ( (NULL == mpls_table) ||
+         (MPLS_OP_NONE == mpls_table[label].op) )
+    {
+      fprintf (stderr,
+               "No such label\n");
+      return;
+    }
+    memset (&mpls_table[label],
+            0,
+            sizeof (struct MplsEntry));
+    mpls_count--;
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "off"))
+  {
+    mpls_disable ();
+    return;
+  }
+  fprintf (stderr,
+           "Subcommand `%s' not understood\n",
+           tok);
+}
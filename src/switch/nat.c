@@ -0,0 +1,1486 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file nat.c
+ * @brief connection tracking and masquerading (source NAT) for router.c
+ * @author Christian Grothoff
+ *
+ * To be included after ipv4.c and huge.c.  Packets routed out via the uplink
+ * get the uplink's address as source address and, if needed, a new
+ * source port (the ICMP echo identifier for pings).  Each translated
+ * connection is tracked with its original 5-tuple and the 5-tuple of
+ * its replies; replies arriving on the uplink are translated back
+ * before they are routed, as are ICMP errors about the connection.
+ * Only TCP, UDP and ICMP echo can be translated, other packets and
+ * non-initial fragments are dropped.  Checksums are updated
+ * incrementally (RFC 1624), except for the ICMP checksum of errors,
+ * which covers the quoted packet.
+ *
+ * The table is split into #NAT_SHARDS shards by the hash of the
+ * remote endpoint (protocol, address and port), which both
+ * directions of a connection share.  Each shard has a fixed pool of
+ * connections and an open-addressing index with two slots per
+ * connection, one per direction.  TCP connections follow a reduced
+ * state machine (SYN seen, established, closing, reset) and every
+ * state has its own timeout, so each state has a list of its
+ * connections by last packet and expiry only ever looks at the
+ * connections that are due.  Expiry runs one bounded step per clock
+ * tick on one shard at a time, and connections found expired on
+ * lookup are removed right away.  All memory is allocated when
+ * masquerading is enabled, at most 80 MB for #NAT_MAX_CONNS, as two
+ * huge page backed regions the shards are carved from; pages are
+ * only touched as connections are created.
+ *
+ * Source ports are kept if possible.  As the remote endpoint is part
+ * of the reply key, the same uplink port can be used for
+ * connections to different remote endpoints, so the number of
+ * connections is not limited by the number of ports.
+ */
+
+
+/**
+ * Number of shards, must be a power of two.
+ */
+#define NAT_SHARDS 16
+
+/**
+ * Maximum number of tracked connections (over all shards).
+ */
+#define NAT_MAX_CONNS (1024 * 1024)
+
+/**
+ * Number of connections per shard.
+ */
+#define NAT_SHARD_SIZE (NAT_MAX_CONNS / NAT_SHARDS)
+
+/**
+ * Number of slots in the index of a shard (two per connection,
+ * load factor at most 1/2).
+ */
+#define NAT_INDEX_SIZE (4 * NAT_SHARD_SIZE)
+
+/**
+ * Marks the end of the lists in a shard.
+ */
+#define NAT_NIL UINT32_MAX
+
+/**
+ * Maximum number of connections expired per state and step.
+ */
+#define NAT_EXPIRE_BATCH 64
+
+/**
+ * Lowest port (or ICMP identifier) we allocate on the uplink.
+ */
+#define NAT_PORT_MIN 1024
+
+/**
+ * How many ports to try before giving up on a new connection.
+ */
+#define NAT_PORT_TRIES 64
+
+/**
+ * TCP flags we look at.
+ */
+#define NAT_TCP_FIN 0x01
+#define NAT_TCP_SYN 0x02
+#define NAT_TCP_RST 0x04
+#define NAT_TCP_ACK 0x10
+
+/**
+ * ICMP types we translate.
+ */
+#define NAT_ICMP_ECHO_REPLY 0
+#define NAT_ICMP_ECHO_REQUEST 8
+#define NAT_ICMP_PARAMETER_PROBLEM 12
+
+
+/**
+ * State of a connection, each with its own timeout.
+ */
+enum NatState
+{
+  NAT_STATE_TCP_SYN = 0,
+  NAT_STATE_TCP_ESTABLISHED,
+  NAT_STATE_TCP_CLOSING,
+  NAT_STATE_TCP_RESET,
+  NAT_STATE_UDP,
+  NAT_STATE_UDP_ASSURED,
+  NAT_STATE_ICMP,
+  NAT_STATE_MAX
+};
+
+
+/**
+ * Direction of a packet relative to its connection.
+ */
+enum NatDirection
+{
+  /**
+   * From the internal host to the remote endpoint.
+   */
+  NAT_ORIGINAL = 0,
+
+  /**
+   * From the remote endpoint back to the uplink.
+   */
+  NAT_REPLY = 1
+};
+
+
+/**
+ * Names of the states, for the "nat" command.
+ */
+static const char *const nat_state_names[NAT_STATE_MAX] = {
+  "tcp-syn",
+  "tcp-established",
+  "tcp-closing",
+  "tcp-reset",
+  "udp",
+  "udp-assured",
+  "icmp"
+};
+
+/**
+ * Timeout of each state, in ms.  TCP established and UDP follow
+ * the minimums of RFC 5382 and RFC 4787.
+ */
+static uint32_t nat_timeout_ms[NAT_STATE_MAX] = {
+  60 * 1000,
+  7440 * 1000,
+  120 * 1000,
+  10 * 1000,
+  30 * 1000,
+  180 * 1000,
+  30 * 1000
+};
+
+
+/**
+ * 5-tuple of one direction of a connection.  Addresses are in
+ * network byte order, ports in host byte order.  For ICMP echo,
+ * the identifier is the source port of requests and the
+ * destination port of replies.  No padding, so keys can be
+ * compared with memcmp().
+ */
+struct NatKey
+{
+  uint32_t src;
+  uint32_t dst;
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t proto;
+  uint8_t reserved[3];
+};
+
+
+/**
+ * A tracked connection.  Its reply key is (remote endpoint, uplink
+ * address and port), see nat_reply_key().
+ */
+struct NatConn
+{
+  /**
+   * Key of the original direction, as sent by the internal host.
+   */
+  struct NatKey orig;
+
+  /**
+   * Uplink address (network byte order) the connection is
+   * translated to.
+   */
+  uint32_t ext_addr;
+
+  /**
+   * Uplink port (or ICMP identifier) the connection is translated to.
+   */
+  uint16_t ext_port;
+
+  /**
+   * A `enum NatState`.
+   */
+  uint8_t state;
+
+  /**
+   * Hashes of the original and the reply key.
+   */
+  uint32_t hash[2];
+
+  /**
+   * Time of the last packet (see nat_now()).
+   */
+  uint32_t last;
+
+  /**
+   * Neighbours in the list of the shard for @e state.  For free
+   * connections, @e next links the free list.
+   */
+  uint32_t prev;
+  uint32_t next;
+};
+
+
+/**
+ * One shard of the connection table.
+ */
+struct NatShard
+{
+  /**
+   * #NAT_SHARD_SIZE connections.
+   */
+  struct NatConn *conns;
+
+  /**
+   * #NAT_INDEX_SIZE slots, each 0 or (index into @e conns * 2 +
+   * `enum NatDirection`) plus one.
+   */
+  uint32_t *index;
+
+  /**
+   * First connection on the free list.
+   */
+  uint32_t free_head;
+
+  /**
+   * Connections from here on were never used.
+   */
+  uint32_t fresh;
+
+  /**
+   * Per state, the connections with the oldest and newest last packet.
+   */
+  uint32_t head[NAT_STATE_MAX];
+  uint32_t tail[NAT_STATE_MAX];
+
+  /**
+   * Number of connections in use.
+   */
+  uint32_t count;
+};
+
+
+/**
+ * The shards, conns NULL while masquerading is off.
+ */
+static struct NatShard nat_shards[NAT_SHARDS];
+
+/**
+ * Interface we masquerade on, NULL while masquerading is off.
+ */
+static struct Interface *nat_uplink;
+
+/**
+ * Only translate packets from this network (network byte order),
+ * all if @e nat_netmask is 0.
+ */
+static struct in_addr nat_network;
+static struct in_addr nat_netmask;
+
+/**
+ * Monotonic clock in ms at nat_now() == 0.
+ */
+static uint64_t nat_base_ms;
+
+/**
+ * Shard to run expiry on next.
+ */
+static unsigned int nat_next_shard;
+
+/**
+ * Statistics for the "nat" command.
+ */
+static uint64_t nat_created;
+static uint64_t nat_expired;
+static uint64_t nat_no_port;
+static uint64_t nat_full;
+static uint64_t nat_dropped;
+static uint64_t nat_translated[2];
+
+
+/**
+ * Read the (coarse) monotonic clock.
+ *
+ * @return ms since masquerading was enabled
+ */
+static uint32_t
+nat_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC_COARSE,
+                 &ts);
+  return (uint32_t) (ts.tv_sec * 1000LLU + ts.tv_nsec / 1000000
+                     - nat_base_ms);
+}
+
+
+/**
+ * Hash @a key.
+ *
+ * @param key connection key
+ * @return hash of @a key
+ */
+static uint32_t
+nat_hash (const struct NatKey *key)
+{
+  uint64_t a = key->src | ((uint64_t) key->dst << 32);
+  uint64_t b = key->sport | ((uint32_t) key->dport << 16)
+    | ((uint64_t) key->proto << 32);
+  uint64_t h;
+
+  h = a * 0x9E3779B97F4A7C15LLU ^ b;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDLLU;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53LLU;
+  h ^= h >> 33;
+  return (uint32_t) h;
+}
+
+
+/**
+ * Find the shard of the connection with the given remote endpoint,
+ * which is the destination of the original and the source of the
+ * reply direction.
+ *
+ * @param proto IP protocol
+ * @param addr address of the remote endpoint
+ * @param port port of the remote endpoint
+ * @return the shard
+ */
+static struct NatShard *
+nat_shard (uint8_t proto,
+           uint32_t addr,
+           uint16_t port)
+{
+  uint64_t h = (addr | ((uint64_t) port << 32) | ((uint64_t) proto << 48))
+    * 0x9E3779B97F4A7C15LLU;
+
+  return &nat_shards[h >> (64 - __builtin_ctz (NAT_SHARDS))];
+}
+
+
+/**
+ * Compute the key of the reply direction of @a c.
+ *
+ * @param c connection
+ * @param key[out] set to the reply key
+ */
+static void
+nat_reply_key (const struct NatConn *c,
+               struct NatKey *key)
+{
+  memset (key,
+          0,
+          sizeof (*key));
+  key->src = c->orig.dst;
+  key->dst = c->ext_addr;
+  key->sport = c->orig.dport;
+  key->dport = c->ext_port;
+  key->proto = c->orig.proto;
+}
+
+
+/**
+ * Remove connection @a idx from the list of its state in @a s.
+ */
+static void
+nat_unlink (struct NatShard *s,
+            uint32_t idx)
+{
+  struct NatConn *c = &s->conns[idx];
+
+  if (NAT_NIL == c->prev)
+    s->head[c->state] = c->next;
+  else
+    s->conns[c->prev].next = c->next;
+  if (NAT_NIL == c->next)
+    s->tail[c->state] = c->prev;
+  else
+    s->conns[c->next].prev = c->prev;
+}
+
+
+/**
+ * Append connection @a idx to the list of its state in @a s.
+ */
+static void
+nat_append (struct NatShard *s,
+            uint32_t idx)
+{
+  struct NatConn *c = &s->conns[idx];
+
+  c->prev = s->tail[c->state];
+  c->next = NAT_NIL;
+  if (NAT_NIL == s->tail[c->state])
+    s->head[c->state] = idx;
+  else
+    s->conns[s->tail[c->state]].next = idx;
+  s->tail[c->state] = idx;
+}
+
+
+/**
+ * Remove index slot @a v (for @a hash) from @a s.
+ *
+ * @param s shard to update
+ * @param v slot value to remove
+ * @param hash hash of the key of @a v
+ */
+static void
+nat_index_remove (struct NatShard *s,
+                  uint32_t v,
+                  uint32_t hash)
+{
+  const uint32_t mask = NAT_INDEX_SIZE - 1;
+  uint32_t i;
+  uint32_t j;
+
+  i = hash & mask;
+  while (v != s->index[i])
+    i = (i + 1) & mask;
+  /* backward-shift deletion keeps probe sequences intact */
+  j = i;
+  for (;;)
+  {
+    uint32_t home;
+    uint32_t w;
+
+    j = (j + 1) & mask;
+    w = s->index[j];
+    if (0 == w)
+      break;
+    home = s->conns[(w - 1) >> 1].hash[(w - 1) & 1] & mask;
+    if ( (i <= j)
+         ? ( (home <= i) || (home > j) )
+         : ( (home <= i) && (home > j) ) )
+    {
+      s->index[i] = w;
+      i = j;
+    }
+  }
+  s->index[i] = 0;
+}
+
+
+/**
+ * Remove connection @a idx from @a s.
+ *
+ * @param s shard to remove from
+ * @param idx connection to remove
+ */
+static void
+nat_remove (struct NatShard *s,
+            uint32_t idx)
+{
+  struct NatConn *c = &s->conns[idx];
+
+  nat_index_remove (s,
+                    idx * 2 + NAT_ORIGINAL + 1,
+                    c->hash[NAT_ORIGINAL]);
+  nat_index_remove (s,
+                    idx * 2 + NAT_REPLY + 1,
+                    c->hash[NAT_REPLY]);
+  nat_unlink (s,
+              idx);
+  c->next = s->free_head;
+  s->free_head = idx;
+  s->count--;
+}
+
+
+/**
+ * Remove connections of @a s that reached their timeout.
+ *
+ * @param s shard to expire
+ * @param now current time (see nat_now())
+ * @param batch maximum number of connections to remove per state
+ */
+static void
+nat_expire_shard (struct NatShard *s,
+                  uint32_t now,
+                  unsigned int batch)
+{
+  for (unsigned int st = 0; st < NAT_STATE_MAX; st++)
+    for (unsigned int n = 0;
+         (n < batch) &&
+         (NAT_NIL != s->head[st]) &&
+         (now - s->conns[s->head[st]].last >= nat_timeout_ms[st]);
+         n++)
+    {
+      nat_remove (s,
+                  s->head[st]);
+      nat_expired++;
+    }
+}
+
+
+/**
+ * Find the connection with @a key in @a s.  Connections that timed
+ * out are removed instead.
+ *
+ * @param s shard @a key belongs to
+ * @param key key of either direction
+ * @param hash hash of @a key
+ * @param now current time (see nat_now())
+ * @param dir[out] set to the direction @a key matched
+ * @return index of the connection, #NAT_NIL if not found
+ */
+static uint32_t
+nat_lookup (struct NatShard *s,
+            const struct NatKey *key,
+            uint32_t hash,
+            uint32_t now,
+            enum NatDirection *dir)
+{
+  const uint32_t mask = NAT_INDEX_SIZE - 1;
+
+  for (uint32_t i = hash & mask;
+       0 != s->index[i];
+       i = (i + 1) & mask)
+  {
+    uint32_t idx = (s->index[i] - 1) >> 1;
+    enum NatDirection d = (s->index[i] - 1) & 1;
+    struct NatConn *c = &s->conns[idx];
+    struct NatKey rk;
+
+    if (c->hash[d] != hash)
+      continue;
+    if (NAT_REPLY == d)
+      nat_reply_key (c,
+                     &rk);
+    if (0 != memcmp ( (NAT_ORIGINAL == d) ? &c->orig : &rk,
+                      key,
+                      sizeof (*key)))
+      continue;
+    if (now - c->last >= nat_timeout_ms[c->state])
+    {
+      nat_remove (s,
+                  idx);
+      nat_expired++;
+      return NAT_NIL;
+    }
+    *dir = d;
+    return idx;
+  }
+  return NAT_NIL;
+}
+
+
+/**
+ * Add index slot @a v for @a hash to @a s.
+ */
+static void
+nat_index_add (struct NatShard *s,
+               uint32_t v,
+               uint32_t hash)
+{
+  const uint32_t mask = NAT_INDEX_SIZE - 1;
+  uint32_t i;
+
+  for (i = hash & mask;
+       0 != s->index[i];
+       i = (i + 1) & mask)
+    ;
+  s->index[i] = v;
+}
+
+
+/**
+ * Create a connection for the original direction @a key in @a s,
+ * translated to @a ext_addr and a free port.
+ *
+ * @param s shard @a key belongs to
+ * @param key original key (not yet tracked)
+ * @param hash hash of @a key
+ * @param ext_addr uplink address
+ * @param now current time (see nat_now())
+ * @return index of the connection, #NAT_NIL on failure
+ */
+static uint32_t
+nat_create (struct NatShard *s,
+            const struct NatKey *key,
+            uint32_t hash,
+            uint32_t ext_addr,
+            uint32_t now)
+{
+  struct NatConn *c;
+  struct NatKey rk;
+  uint32_t rhash = 0;
+  uint32_t idx;
+  unsigned int i;
+
+  if ( (NAT_NIL == s->free_head) &&
+       (NAT_SHARD_SIZE == s->fresh) )
+  {
+    nat_expire_shard (s,
+                      now,
+                      NAT_SHARD_SIZE);
+    if (NAT_NIL == s->free_head)
+    {
+      nat_full++;
+      return NAT_NIL;
+    }
+  }
+  memset (&rk,
+          0,
+          sizeof (rk));
+  rk.src = key->dst;
+  rk.dst = ext_addr;
+  rk.sport = key->dport;
+  rk.proto = key->proto;
+  for (i = 0; i < NAT_PORT_TRIES; i++)
+  {
+    enum NatDirection dir;
+
+    /* keep the source port if we can */
+    if ( (0 == i) &&
+         (key->sport >= NAT_PORT_MIN) )
+      rk.dport = key->sport;
+    else
+      rk.dport = NAT_PORT_MIN
+        + (hash + i) % (UINT16_MAX + 1 - NAT_PORT_MIN);
+    rhash = nat_hash (&rk);
+    if (NAT_NIL == nat_lookup (s,
+                               &rk,
+                               rhash,
+                               now,
+                               &dir))
+      break;
+  }
+  if (NAT_PORT_TRIES == i)
+  {
+    nat_no_port++;
+    return NAT_NIL;
+  }
+  if (NAT_NIL != s->free_head)
+  {
+    idx = s->free_head;
+    s->free_head = s->conns[idx].next;
+  }
+  else
+  {
+    idx = s->fresh++;
+  }
+  c = &s->conns[idx];
+  c->orig = *key;
+  c->ext_addr = ext_addr;
+  c->ext_port = rk.dport;
+  c->hash[NAT_ORIGINAL] = hash;
+  c->hash[NAT_REPLY] = rhash;
+  c->last = now;
+  switch (key->proto)
+  {
+  case IPPROTO_TCP:
+    c->state = NAT_STATE_TCP_SYN;
+    break;
+  case IPPROTO_UDP:
+    c->state = NAT_STATE_UDP;
+    break;
+  default:
+    c->state = NAT_STATE_ICMP;
+    break;
+  }
+  nat_index_add (s,
+                 idx * 2 + NAT_ORIGINAL + 1,
+                 hash);
+  nat_index_add (s,
+                 idx * 2 + NAT_REPLY + 1,
+                 rhash);
+  nat_append (s,
+              idx);
+  s->count++;
+  nat_created++;
+  return idx;
+}
+
+
+/**
+ * Update the state of connection @a idx for a packet in direction
+ * @a dir and refresh its timeout.
+ *
+ * @param s shard of the connection
+ * @param idx the connection
+ * @param dir direction of the packet
+ * @param tcp_flags TCP flags of the packet, 0 if not TCP
+ * @param now current time (see nat_now())
+ */
+static void
+nat_track (struct NatShard *s,
+           uint32_t idx,
+           enum NatDirection dir,
+           uint8_t tcp_flags,
+           uint32_t now)
+{
+  struct NatConn *c = &s->conns[idx];
+  enum NatState state = c->state;
+
+  switch (state)
+  {
+  case NAT_STATE_TCP_SYN:
+  case NAT_STATE_TCP_ESTABLISHED:
+  case NAT_STATE_TCP_CLOSING:
+  case NAT_STATE_TCP_RESET:
+    if (0 != (tcp_flags & NAT_TCP_RST))
+      state = NAT_STATE_TCP_RESET;
+    else if ( (NAT_ORIGINAL == dir) &&
+              (NAT_TCP_SYN == (tcp_flags & (NAT_TCP_SYN | NAT_TCP_ACK))) )
+      state = NAT_STATE_TCP_SYN; /* (re)opened */
+    else if (0 != (tcp_flags & NAT_TCP_FIN))
+      state = NAT_STATE_TCP_CLOSING;
+    else if ( (NAT_STATE_TCP_SYN == state) &&
+              (NAT_REPLY == dir) )
+      state = NAT_STATE_TCP_ESTABLISHED;
+    break;
+  case NAT_STATE_UDP:
+    if (NAT_REPLY == dir)
+      state = NAT_STATE_UDP_ASSURED;
+    break;
+  default:
+    break;
+  }
+  c->last = now;
+  if ( (state == c->state) &&
+       (idx == s->tail[state]) )
+    return;
+  nat_unlink (s,
+              idx);
+  c->state = state;
+  nat_append (s,
+              idx);
+}
+
+
+/**
+ * Run one expiry step whenever the clock advanced.
+ *
+ * @return current time (see nat_now())
+ */
+static uint32_t
+nat_step (void)
+{
+  static uint32_t last_step;
+  uint32_t now = nat_now ();
+
+  if (now != last_step)
+  {
+    last_step = now;
+    nat_expire_shard (&nat_shards[nat_next_shard],
+                      now,
+                      NAT_EXPIRE_BATCH);
+    nat_next_shard = (nat_next_shard + 1) % NAT_SHARDS;
+  }
+  return now;
+}
+
+
+/**
+ * Set the 16-bit word at @a word to @a value and update the
+ * checksums @a csum1 and @a csum2 that cover it.
+ *
+ * @param word where to write @a value
+ * @param value new value, in network byte order
+ * @param csum1 checksum to update, NULL for none
+ * @param csum2 another checksum to update, NULL for none
+ */
+static void
+nat_set_word (char *word,
+              uint16_t value,
+              char *csum1,
+              char *csum2)
+{
+  uint16_t old = get_u16 (word);
+
+  put_u16 (word,
+           value);
+  if (NULL != csum1)
+    put_u16 (csum1,
+             GNUNET_CRYPTO_crc16_update (get_u16 (csum1),
+                                         old,
+                                         value));
+  if (NULL != csum2)
+    put_u16 (csum2,
+             GNUNET_CRYPTO_crc16_update (get_u16 (csum2),
+                                         old,
+                                         value));
+}
+
+
+/**
+ * Rewrite the source or destination of IPv4 packet @a ip and
+ * update the checksums.
+ *
+ * @param ip IPv4 packet (or the start of one quoted in an ICMP error)
+ * @param hlen length of the IPv4 header
+ * @param avail number of bytes of @a ip available
+ * @param source true to rewrite the source, false for the destination
+ * @param addr new address, in network byte order
+ * @param port new port (TCP, UDP) or ICMP echo identifier
+ */
+static void
+nat_rewrite (char *ip,
+             size_t hlen,
+             size_t avail,
+             bool source,
+             uint32_t addr,
+             uint16_t port)
+{
+  char *ipsum = IPV4_FIELD (ip, checksum);
+  char *field = source
+    ? IPV4_FIELD (ip, source_address)
+    : IPV4_FIELD (ip, destination_address);
+  char *l4 = &ip[hlen];
+  char *l4sum = NULL;
+  char *pseudo = NULL;
+  char *portp;
+  uint8_t proto = *(uint8_t *) IPV4_FIELD (ip, protocol);
+  uint16_t words[2];
+
+  switch (proto)
+  {
+  case IPPROTO_TCP:
+    if (avail - hlen >= 18)
+      l4sum = pseudo = &l4[16];
+    portp = source ? &l4[0] : &l4[2];
+    break;
+  case IPPROTO_UDP:
+    if (0 != get_u16 (&l4[6]))
+      l4sum = pseudo = &l4[6];
+    portp = source ? &l4[0] : &l4[2];
+    break;
+  default:
+    l4sum = &l4[2];
+    portp = &l4[4]; /* echo identifier */
+    break;
+  }
+  memcpy (words,
+          &addr,
+          sizeof (words));
+  nat_set_word (field,
+                words[0],
+                ipsum,
+                pseudo);
+  nat_set_word (field + 2,
+                words[1],
+                ipsum,
+                pseudo);
+  nat_set_word (portp,
+                htons (port),
+                l4sum,
+                NULL);
+  /* 0 means "no checksum" for UDP */
+  if ( (IPPROTO_UDP == proto) &&
+       (NULL != l4sum) &&
+       (0 == get_u16 (l4sum)) )
+    put_u16 (l4sum,
+             0xFFFF);
+}
+
+
+/**
+ * Extract the key of IPv4 packet @a ip.  For ICMP, only echo
+ * requests (if @a request) or echo replies are supported.
+ *
+ * @param ip IPv4 packet (or the start of one quoted in an ICMP error)
+ * @param hlen length of the IPv4 header
+ * @param avail number of bytes of @a ip available
+ * @param request true to accept ICMP echo requests, false for replies
+ * @param key[out] set to the key
+ * @param tcp_flags[out] set to the TCP flags, 0 if unknown
+ * @return 0 on success, 1 if @a ip cannot be translated
+ */
+static int
+nat_parse (const char *ip,
+           size_t hlen,
+           size_t avail,
+           bool request,
+           struct NatKey *key,
+           uint8_t *tcp_flags)
+{
+  const char *l4 = &ip[hlen];
+
+  memset (key,
+          0,
+          sizeof (*key));
+  *tcp_flags = 0;
+  if (avail - hlen < 8)
+    return 1;
+  key->src = get_u32 (IPV4_FIELD (ip, source_address));
+  key->dst = get_u32 (IPV4_FIELD (ip, destination_address));
+  key->proto = *(const uint8_t *) IPV4_FIELD (ip, protocol);
+  switch (key->proto)
+  {
+  case IPPROTO_TCP:
+    if (avail - hlen >= 14)
+      *tcp_flags = ((const uint8_t *) l4)[13];
+    /* fall through */
+  case IPPROTO_UDP:
+    key->sport = get_be16 (&l4[0]);
+    key->dport = get_be16 (&l4[2]);
+    return 0;
+  case IPPROTO_ICMP:
+    if (*(const uint8_t *) l4 != (request
+                                  ? NAT_ICMP_ECHO_REQUEST
+                                  : NAT_ICMP_ECHO_REPLY))
+      return 1;
+    if (request)
+      key->sport = get_be16 (&l4[4]);
+    else
+      key->dport = get_be16 (&l4[4]);
+    return 0;
+  default:
+    return 1;
+  }
+}
+
+
+/**
+ * Masquerade IPv4 packet @a ip that is about to be sent via @a ifc.
+ * The header of @a ip was already validated by route().
+ *
+ * @param ifc interface @a ip is routed out via
+ * @param ip the IPv4 packet
+ * @param size number of bytes in @a ip
+ * @return true to send the packet, false to drop it
+ */
+static bool
+nat_egress (const struct Interface *ifc,
+            char *ip,
+            size_t size)
+{
+  struct NatShard *s;
+  struct NatKey key;
+  enum NatDirection dir;
+  uint32_t src;
+  uint32_t hash;
+  uint32_t idx;
+  uint32_t now;
+  uint8_t tcp_flags;
+  size_t hlen;
+
+  if (ifc != nat_uplink)
+    return true;
+  src = get_u32 (IPV4_FIELD (ip, source_address));
+  if ( (src == ifc->ip.s_addr) ||
+       ( (src & nat_netmask.s_addr) != nat_network.s_addr) )
+    return true;
+  hlen = IPV4_HLEN (ip);
+  if ( (0 != (get_be16 (IPV4_FIELD (ip, fragmentation_info)) & 0x1FFF)) ||
+       (0 != nat_parse (ip,
+                        hlen,
+                        size,
+                        true,
+                        &key,
+                        &tcp_flags)) )
+  {
+    nat_dropped++;
+    return false;
+  }
+  now = nat_step ();
+  hash = nat_hash (&key);
+  s = nat_shard (key.proto,
+                 key.dst,
+                 key.dport);
+  idx = nat_lookup (s,
+                    &key,
+                    hash,
+                    now,
+                    &dir);
+  if (NAT_NIL == idx)
+  {
+    dir = NAT_ORIGINAL;
+    idx = nat_create (s,
+                      &key,
+                      hash,
+                      ifc->ip.s_addr,
+                      now);
+  }
+  if ( (NAT_NIL == idx) ||
+       (NAT_ORIGINAL != dir) )
+  {
+    nat_dropped++;
+    return false;
+  }
+  nat_track (s,
+             idx,
+             NAT_ORIGINAL,
+             tcp_flags,
+             now);
+  nat_rewrite (ip,
+               hlen,
+               size,
+               true,
+               s->conns[idx].ext_addr,
+               s->conns[idx].ext_port);
+  nat_translated[NAT_ORIGINAL]++;
+  return true;
+}
+
+
+/**
+ * Translate an ICMP error received on the uplink about a packet
+ * of a tracked connection back to the internal host.
+ *
+ * @param ip the IPv4 packet carrying the ICMP error
+ * @param hlen length of its IPv4 header
+ * @param total length of the IPv4 packet
+ */
+static void
+nat_ingress_icmp_error (char *ip,
+                        size_t hlen,
+                        size_t total)
+{
+  char *icmp = &ip[hlen];
+  char *inner = &icmp[8];
+  size_t avail = total - hlen - 8;
+  size_t ihlen;
+  struct NatShard *s;
+  struct NatKey key;
+  struct NatKey rk;
+  const struct NatConn *c;
+  enum NatDirection dir;
+  uint32_t idx;
+  uint32_t now;
+  uint8_t tcp_flags;
+
+  if ( (total - hlen < 8 + sizeof (struct IPv4Header)) ||
+       (4 != IPV4_VERSION (inner)) ||
+       ((ihlen = IPV4_HLEN (inner)) < sizeof (struct IPv4Header)) ||
+       (ihlen > avail) ||
+       (0 != nat_parse (inner,
+                        ihlen,
+                        avail,
+                        true,
+                        &key,
+                        &tcp_flags)) )
+    return;
+  /* the quoted packet went out translated, look up its reply key */
+  memset (&rk,
+          0,
+          sizeof (rk));
+  rk.src = key.dst;
+  rk.dst = key.src;
+  rk.sport = key.dport;
+  rk.dport = key.sport;
+  rk.proto = key.proto;
+  now = nat_step ();
+  s = nat_shard (rk.proto,
+                 rk.src,
+                 rk.sport);
+  idx = nat_lookup (s,
+                    &rk,
+                    nat_hash (&rk),
+                    now,
+                    &dir);
+  if ( (NAT_NIL == idx) ||
+       (NAT_REPLY != dir) )
+    return;
+  c = &s->conns[idx];
+  nat_rewrite (inner,
+               ihlen,
+               avail,
+               true,
+               c->orig.src,
+               c->orig.sport);
+  nat_set_word (IPV4_FIELD (ip, destination_address),
+                get_u16 (&c->orig.src),
+                IPV4_FIELD (ip, checksum),
+                NULL);
+  nat_set_word (IPV4_FIELD (ip, destination_address) + 2,
+                get_u16 ((const char *) &c->orig.src + 2),
+                IPV4_FIELD (ip, checksum),
+                NULL);
+  /* the ICMP checksum covers the quoted packet, recompute it */
+  put_u16 (&icmp[2],
+           0);
+  put_u16 (&icmp[2],
+           GNUNET_CRYPTO_crc16_n (icmp,
+                                  total - hlen));
+  nat_translated[NAT_REPLY]++;
+}
+
+
+/**
+ * Translate IPv4 packet @a ip received on @a ifc back to the
+ * internal host if it belongs to a tracked connection.  Must be
+ * called before the packet is routed.
+ *
+ * @param ifc interface @a ip was received on
+ * @param ip the IPv4 packet
+ * @param size number of bytes in @a ip
+ */
+static void
+nat_ingress (const struct Interface *ifc,
+             char *ip,
+             size_t size)
+{
+  struct NatShard *s;
+  struct NatKey key;
+  enum NatDirection dir;
+  uint32_t idx;
+  uint32_t now;
+  uint8_t tcp_flags;
+  size_t hlen;
+  size_t total;
+  uint8_t type;
+
+  if (ifc != nat_uplink)
+    return;
+  if (size < sizeof (struct IPv4Header))
+    return; /* route() complains */
+  hlen = IPV4_HLEN (ip);
+  total = get_be16 (IPV4_FIELD (ip, total_length));
+  if ( (4 != IPV4_VERSION (ip)) ||
+       (hlen < sizeof (struct IPv4Header)) ||
+       (total < hlen) ||
+       (total > size) ||
+       (get_u32 (IPV4_FIELD (ip, destination_address)) != ifc->ip.s_addr) ||
+       (0 != (get_be16 (IPV4_FIELD (ip, fragmentation_info)) & 0x1FFF)) )
+    return;
+  if ( (IPPROTO_ICMP == *(const uint8_t *) IPV4_FIELD (ip, protocol)) &&
+       (total - hlen >= 1) )
+  {
+    type = *(const uint8_t *) &ip[hlen];
+    if ( (ICMPTYPE_DESTINATION_UNREACHABLE == type) ||
+         (ICMPTYPE_TIME_EXCEEDED == type) ||
+         (NAT_ICMP_PARAMETER_PROBLEM == type) )
+    {
+      nat_ingress_icmp_error (ip,
+                              hlen,
+                              total);
+      return;
+    }
+  }
+  if (0 != nat_parse (ip,
+                      hlen,
+                      total,
+                      false,
+                      &key,
+                      &tcp_flags))
+    return;
+  now = nat_step ();
+  s = nat_shard (key.proto,
+                 key.src,
+                 key.sport);
+  idx = nat_lookup (s,
+                    &key,
+                    nat_hash (&key),
+                    now,
+                    &dir);
+  if ( (NAT_NIL == idx) ||
+       (NAT_REPLY != dir) )
+    return;
+  nat_track (s,
+             idx,
+             NAT_REPLY,
+             tcp_flags,
+             now);
+  nat_rewrite (ip,
+               hlen,
+               total,
+               false,
+               s->conns[idx].orig.src,
+               s->conns[idx].orig.sport);
+  nat_translated[NAT_REPLY]++;
+}
+
+
+/**
+ * Stop masquerading and forget all connections.
+ */
+static void
+nat_disable (void)
+{
+  huge_free (nat_shards[0].conns);
+  huge_free (nat_shards[0].index);
+  memset (nat_shards,
+          0,
+          sizeof (nat_shards));
+  nat_uplink = NULL;
+}
+
+
+/**
+ * Start masquerading packets routed out via @a ifc.
+ *
+ * @param ifc the uplink, must have an address
+ * @return 0 on success
+ */
+static int
+nat_enable (struct Interface *ifc)
+{
+  struct timespec ts;
+  struct NatConn *conns;
+  uint32_t *slots;
+
+  conns = huge_alloc (NAT_SHARDS * NAT_SHARD_SIZE
+                      * sizeof (struct NatConn),
+                      "NAT connections");
+  slots = huge_alloc (NAT_SHARDS * NAT_INDEX_SIZE
+                      * sizeof (uint32_t),
+                      "NAT index");
+  if ( (NULL == conns) ||
+       (NULL == slots) )
+  {
+    fprintf (stderr,
+             "Failed to allocate connection table\n");
+    huge_free (conns);
+    huge_free (slots);
+    return 1;
+  }
+  for (unsigned int i = 0; i < NAT_SHARDS; i++)
+  {
+    struct NatShard *s = &nat_shards[i];
+
+    s->conns = &conns[i * NAT_SHARD_SIZE];
+    s->index = &slots[i * NAT_INDEX_SIZE];
+    s->free_head = NAT_NIL;
+    s->fresh = 0;
+    for (unsigned int st = 0; st < NAT_STATE_MAX; st++)
+      s->head[st] = s->tail[st] = NAT_NIL;
+  }
+  clock_gettime (CLOCK_MONOTONIC_COARSE,
+                 &ts);
+  nat_base_ms = ts.tv_sec * 1000LLU + ts.tv_nsec / 1000000;
+  nat_uplink = ifc;
+  return 0;
+}
+
+
+/**
+ * Move masquerading over to a new set of interfaces after a
+ * configuration reload.  If the uplink is gone, masquerading is
+ * disabled; if its address changed, the connections are dropped.
+ * Must be called while the old interfaces are still valid.
+ *
+ * @param nifc the new interfaces
+ * @param nnum number of entries in @a nifc
+ */
+static void
+nat_rebind (struct Interface *nifc,
+            unsigned int nnum)
+{
+  struct Interface *n = NULL;
+
+  if (NULL == nat_uplink)
+    return;
+  for (unsigned int k = 0; k < nnum; k++)
+    if (0 == strcasecmp (nifc[k].name,
+                         nat_uplink->name))
+      n = &nifc[k];
+  if ( (NULL != n) &&
+       (n->ip.s_addr == nat_uplink->ip.s_addr) )
+  {
+    nat_uplink = n;
+    return;
+  }
+  nat_disable ();
+  if ( (NULL != n) &&
+       (0 != n->ip.s_addr) )
+    nat_enable (n);
+}
+
+
+/**
+ * Print up to @a max connections.
+ *
+ * @param max maximum number of connections to print
+ */
+static void
+nat_list (unsigned int max)
+{
+  uint32_t now = nat_now ();
+
+  for (unsigned int i = 0; i < NAT_SHARDS; i++)
+  {
+    const struct NatShard *s = &nat_shards[i];
+
+    for (unsigned int st = 0; st < NAT_STATE_MAX; st++)
+      for (uint32_t idx = s->head[st];
+           NAT_NIL != idx;
+           idx = s->conns[idx].next)
+      {
+        const struct NatConn *c = &s->conns[idx];
+        char isrc[INET_ADDRSTRLEN];
+        char rdst[INET_ADDRSTRLEN];
+        char ext[INET_ADDRSTRLEN];
+
+        if (0 == max--)
+          return;
+        inet_ntop (AF_INET,
+                   &c->orig.src,
+                   isrc,
+                   sizeof (isrc));
+        inet_ntop (AF_INET,
+                   &c->orig.dst,
+                   rdst,
+                   sizeof (rdst));
+        inet_ntop (AF_INET,
+                   &c->ext_addr,
+                   ext,
+                   sizeof (ext));
+        print ("%u %s:%u -> %s:%u as %s:%u %s %us\n",
+               (unsigned int) c->orig.proto,
+               isrc,
+               (unsigned int) c->orig.sport,
+               rdst,
+               (unsigned int) c->orig.dport,
+               ext,
+               (unsigned int) c->ext_port,
+               nat_state_names[st],
+               (unsigned int) ((now - c->last) / 1000));
+      }
+  }
+}
+
+
+/**
+ * The user entered a "nat" command:
+ *
+ *   nat                               show statistics
+ *   nat masquerade IFC [NET/LEN]      masquerade (packets from NET) onto IFC
+ *   nat timeout STATE SECONDS         set the timeout of a state
+ *   nat list [MAX]                    show (up to MAX) connections
+ *   nat off                           stop and forget all connections
+ *
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_nat ()
+{
+  const char *tok = strtok (NULL, " ");
+
+  if (NULL == tok)
+  {
+    uint64_t count = 0;
+
+    if (NULL == nat_uplink)
+    {
+      print ("Masquerading off\n");
+      return;
+    }
+    for (unsigned int i = 0; i < NAT_SHARDS; i++)
+      count += nat_shards[i].count;
+    print ("Masquerading on %s, %llu connections, %llu created, %llu expired\n",
+           nat_uplink->name,
+           (unsigned long long) count,
+           (unsigned long long) nat_created,
+           (unsigned long long) nat_expired);
+    print ("%llu packets out, %llu in, %llu dropped, %llu without port, %llu table full\n",
+           (unsigned long long) nat_translated[NAT_ORIGINAL],
+           (unsigned long long) nat_translated[NAT_REPLY],
+           (unsigned long long) nat_dropped,
+           (unsigned long long) nat_no_port,
+           (unsigned long long) nat_full);
+    for (unsigned int st = 0; st < NAT_STATE_MAX; st++)
+      print ("timeout %s %us\n",
+             nat_state_names[st],
+             (unsigned int) (nat_timeout_ms[st] / 1000));
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "off"))
+  {
+    nat_disable ();
+    print ("Masquerading off\n");
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "list"))
+  {
+    unsigned int max = 100;
+
+    tok = strtok (NULL, " ");
+    if ( (NULL != tok) &&
+         (1 != sscanf (tok,
+                       "%u",
+                       &max)) )
+    {
+      fprintf (stderr,
+               "Usage: nat list [MAX]\n");
+      return;
+    }
+    nat_list (max);
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "timeout"))
+  {
+    const char *state = strtok (NULL, " ");
+    unsigned int secs;
+
+    tok = strtok (NULL, " ");
+    if ( (NULL != state) &&
+         (NULL != tok) &&
+         (1 == sscanf (tok,
+                       "%u",
+                       &secs)) &&
+         (secs > 0) &&
+         (secs <= 86400) )
+      for (unsigned int st = 0; st < NAT_STATE_MAX; st++)
+        if (0 == strcasecmp (state,
+                             nat_state_names[st]))
+        {
+          nat_timeout_ms[st] = secs * 1000;
+          return;
+        }
+    fprintf (stderr,
+             "Usage: nat timeout STATE SECONDS\n");
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "masquerade"))
+  {
+    const char *name = strtok (NULL, " ");
+    const char *net = strtok (NULL, " ");
+    struct Interface *ifc;
+    struct in_addr network = { .s_addr = 0 };
+    struct in_addr netmask = { .s_addr = 0 };
+
+    if (NULL == name)
+    {
+      fprintf (stderr,
+               "Usage: nat masquerade IFC [NET/LEN]\n");
+      return;
+    }
+    ifc = find_interface (name);
+    if ( (NULL == ifc) ||
+         (0 == ifc->ip.s_addr) )
+    {
+      fprintf (stderr,
+               "Interface `%s' unknown or without address\n",
+               name);
+      return;
+    }
+    if ( (NULL != net) &&
+         (0 != parse_network (&network,
+                              &netmask,
+                              net)) )
+      return;
+    nat_disable ();
+    nat_network.s_addr = network.s_addr & netmask.s_addr;
+    nat_netmask = netmask;
+    if (0 == nat_enable (ifc))
+      print ("Masquerading on %s\n",
+             ifc->name);
+    return;
+  }
+  fprintf (stderr,
+           "Usage: nat [masquerade IFC [NET/LEN] | timeout STATE SECONDS | list [MAX] | off]\n");
+}
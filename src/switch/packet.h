@@ -0,0 +1,574 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * @file packet.h
+ * @brief Ethernet definitions and per-frame helpers shared by all programs
+ * @author Christian Grothoff
+ *
+ * Everything in here is `static inline` or a macro, so each program
+ * gets its own copy of the per-frame path which the compiler can
+ * inline and specialize: constant arguments (such as whether 802.1Q
+ * tags are to be parsed) remove the unused branches entirely.
+ *
+ * Headers are read and written in place through the get_*() and put_*()
+ * accessors, which are safe for any alignment, so frames can be
+ * modified and sent back out of the receive buffer without copying.
+ *
+ * Must be included after print.c (for write_all()) and before loop.c.
+ * The GLAB_DEFINE_* macros expect the includer's `struct Interface` to
+ * have (at least) the `ifc_num` and `mac` fields.
+ */
+
+#ifndef GLAB_PACKET_H
+#define GLAB_PACKET_H
+
+#include "glab.h"
+#include "latency.h"
+#include "usdt.h"
+#include "sflow.h"
+
+
+/* see http://www.iana.org/assignments/ethernet-numbers */
+#ifndef ETH_P_IPV4
+/**
+ * Number for IPv4
+ */
+#define ETH_P_IPV4 0x0800
+#endif
+
+#ifndef ETH_P_ARP
+/**
+ * Number for ARP
+ */
+#define ETH_P_ARP 0x0806
+#endif
+
+#ifndef ETH_P_8021Q
+/**
+ * Number for IEEE 802.1Q VLAN-tagged frames
+ */
+#define ETH_P_8021Q 0x8100
+#endif
+
+/**
+ * Mask to extract the VLAN ID from the 802.1Q TCI.
+ */
+#define VLAN_VID_MASK 0x0FFF
+
+/**
+ * Largest valid 802.1Q VLAN ID (4095 is reserved).
+ */
+#define MAX_VLAN_ID 4094
+
+/**
+ * Number of bytes loop.c keeps free in front of the GLAB message
+ * header of each frame it passes to handle_frame().  Together with
+ * that header, this space may be overwritten to push headers or to
+ * send the frame back out in place (see #GLAB_FRAME_HEADROOM).
+ */
+#define GLAB_HEADROOM 64
+
+/**
+ * Number of writable bytes in front of each frame passed to handle_frame().
+ */
+#define GLAB_FRAME_HEADROOM (GLAB_HEADROOM + sizeof (struct GLAB_MessageHeader))
+
+
+/**
+ * gcc 4.x-ism to pack structures (to be used before structs);
+ * Using this still causes structs to be unaligned on the stack on Sparc
+ * (See #670578 from Debian).
+ */
+_Pragma("pack(push)") _Pragma("pack(1)")
+
+struct EthernetHeader
+{
+  struct MacAddress dst;
+  struct MacAddress src;
+
+  /**
+   * See ETH_P-values.
+   */
+  uint16_t tag;
+};
+
+
+/**
+ * Ethernet header with an IEEE 802.1Q tag.
+ */
+struct VlanEthernetHeader
+{
+  struct MacAddress dst;
+  struct MacAddress src;
+
+  /**
+   * Must be #ETH_P_8021Q.
+   */
+  uint16_t tpid;
+
+  /**
+   * Priority, DEI and VLAN ID.
+   */
+  uint16_t tci;
+
+  /**
+   * See ETH_P-values.
+   */
+  uint16_t tag;
+};
+
+_Pragma("pack(pop)")
+
+
+/**
+ * Number of bytes an 802.1Q tag adds to a frame.
+ */
+#define VLAN_TAG_SIZE (sizeof (struct VlanEthernetHeader) - sizeof (struct EthernetHeader))
+
+
+/**
+ * A 16-bit value at any alignment.  Going through this rather than
+ * memcpy() gives the same single load or store, but no UBSan nonnull
+ * check on memcpy()'s arguments: on its error path gcc -O2 takes the
+ * pointer to be NULL and warns about the writes into the headroom in
+ * front of a frame.
+ */
+struct UnalignedU16
+{
+  uint16_t v;
+} __attribute__ ((packed, may_alias));
+
+
+/**
+ * A 32-bit value at any alignment, see `struct UnalignedU16`.
+ */
+struct UnalignedU32
+{
+  uint32_t v;
+} __attribute__ ((packed, may_alias));
+
+
+/**
+ * Load 16 bits from @a p, which need not be aligned.
+ *
+ * @param p where to read from
+ * @return value at @a p, in the byte order it was stored in
+ */
+static inline uint16_t
+get_u16 (const void *p)
+{
+  return ((const struct UnalignedU16 *) p)->v;
+}
+
+
+/**
+ * Store 16 bits at @a p, which need not be aligned.
+ *
+ * @param p where to write to
+ * @param v value to store (not converted)
+ */
+static inline void
+put_u16 (void *p,
+         uint16_t v)
+{
+  ((struct UnalignedU16 *) p)->v = v;
+}
+
+
+/**
+ * Load 32 bits from @a p, which need not be aligned.
+ *
+ * @param p where to read from
+ * @return value at @a p, in the byte order it was stored in
+ */
+static inline uint32_t
+get_u32 (const void *p)
+{
+  return ((const struct UnalignedU32 *) p)->v;
+}
+
+
+/**
+ * Store 32 bits at @a p, which need not be aligned.
+ *
+ * @param p where to write to
+ * @param v value to store (not converted)
+ */
+static inline void
+put_u32 (void *p,
+         uint32_t v)
+{
+  ((struct UnalignedU32 *) p)->v = v;
+}
+
+
+/**
+ * Load a 16-bit value in network byte order from @a p.
+ *
+ * @param p where to read from
+ * @return value at @a p in host byte order
+ */
+static inline uint16_t
+get_be16 (const void *p)
+{
+  return ntohs (get_u16 (p));
+}
+
+
+/**
+ * Store @a v in network byte order at @a p.
+ *
+ * @param p where to write to
+ * @param v value in host byte order
+ */
+static inline void
+put_be16 (void *p,
+          uint16_t v)
+{
+  put_u16 (p,
+           htons (v));
+}
+
+
+/**
+ * Result of parsing the Ethernet header of a frame.  Refers to the
+ * frame itself, nothing is copied.
+ */
+struct EthernetFrame
+{
+  /**
+   * Ethernet header at the start of the frame.  Its @e tag is
+   * #ETH_P_8021Q for tagged frames, use @e type instead.
+   */
+  const struct EthernetHeader *eh;
+
+  /**
+   * EtherType behind any 802.1Q tag, in host byte order.
+   */
+  uint16_t type;
+
+  /**
+   * VLAN ID from the 802.1Q tag, 0 if the frame was untagged
+   * or only priority-tagged.
+   */
+  uint16_t vlan;
+
+  /**
+   * Did the frame carry an 802.1Q tag?
+   */
+  bool tagged;
+
+  /**
+   * Start of the payload behind the (last) EtherType.
+   */
+  const char *payload;
+
+  /**
+   * Number of bytes in @e payload.
+   */
+  size_t payload_size;
+};
+
+
+/**
+ * Compare two MACs.
+ *
+ * @param mac1 first MAC
+ * @param mac2 second MAC
+ * @return true if @a mac1 and @a mac2 are equal
+ */
+static inline bool
+mac_equal (const struct MacAddress *mac1,
+           const struct MacAddress *mac2)
+{
+  return 0 == memcmp (mac1,
+                      mac2,
+                      sizeof (struct MacAddress));
+}
+
+
+/**
+ * Check if @a mac is a multicast (or broadcast) address.
+ *
+ * @param mac MAC to check
+ * @return true for group addresses
+ */
+static inline bool
+mac_is_multicast (const struct MacAddress *mac)
+{
+  return 0 != (mac->mac[0] & 1);
+}
+
+
+/**
+ * Parse the Ethernet header of @a frame.
+ *
+ * @param frame raw frame data
+ * @param frame_size number of bytes in @a frame
+ * @param with_vlan true to look behind 802.1Q tags; pass a constant so
+ *        that programs without VLAN support do not pay for the check
+ * @param[out] ef set to the parsed frame
+ * @return 0 on success, 1 if the frame is malformed
+ */
+static inline int
+eth_parse (const void *frame,
+           size_t frame_size,
+           bool with_vlan,
+           struct EthernetFrame *ef)
+{
+  const char *cframe = frame;
+  size_t off = sizeof (struct EthernetHeader);
+
+  if (frame_size < sizeof (struct EthernetHeader))
+    return 1;
+  ef->eh = frame;
+  ef->type = get_be16 (&cframe[offsetof (struct EthernetHeader, tag)]);
+  ef->vlan = 0;
+  ef->tagged = false;
+  if ( with_vlan &&
+       (ETH_P_8021Q == ef->type) )
+  {
+    if (frame_size < sizeof (struct VlanEthernetHeader))
+      return 1;
+    ef->vlan = get_be16 (&cframe[offsetof (struct VlanEthernetHeader, tci)])
+      & VLAN_VID_MASK;
+    ef->type = get_be16 (&cframe[offsetof (struct VlanEthernetHeader, tag)]);
+    ef->tagged = true;
+    off = sizeof (struct VlanEthernetHeader);
+  }
+  ef->payload = &cframe[off];
+  ef->payload_size = frame_size - off;
+  return 0;
+}
+
+
+/**
+ * Push an 802.1Q tag with @a tci onto @a frame by moving its MAC
+ * addresses #VLAN_TAG_SIZE bytes to the front, which must be writable.
+ *
+ * @param frame the frame to modify
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param tci priority, DEI and VLAN ID for the tag
+ * @return new start of the frame
+ */
+static inline char *
+eth_push_vlan_in_place (char *frame,
+                        size_t *frame_size,
+                        uint16_t tci)
+{
+  frame -= VLAN_TAG_SIZE;
+  memmove (frame,
+           &frame[VLAN_TAG_SIZE],
+           2 * sizeof (struct MacAddress));
+  put_be16 (&frame[offsetof (struct VlanEthernetHeader, tpid)],
+            ETH_P_8021Q);
+  put_be16 (&frame[offsetof (struct VlanEthernetHeader, tci)],
+            tci);
+  *frame_size += VLAN_TAG_SIZE;
+  return frame;
+}
+
+
+/**
+ * Remove the (outermost) 802.1Q tag from @a frame by moving its MAC
+ * addresses over it.
+ *
+ * @param frame the tagged frame to modify
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @return new start of the frame
+ */
+static inline char *
+eth_pop_vlan_in_place (char *frame,
+                       size_t *frame_size)
+{
+  memmove (&frame[VLAN_TAG_SIZE],
+           frame,
+           2 * sizeof (struct MacAddress));
+  *frame_size -= VLAN_TAG_SIZE;
+  return &frame[VLAN_TAG_SIZE];
+}
+
+
+/**
+ * Set the VLAN ID in the 802.1Q tag of @a frame, keeping the priority.
+ *
+ * @param frame the tagged frame to modify
+ * @param vlan the new VLAN ID
+ */
+static inline void
+eth_set_vlan_in_place (char *frame,
+                       uint16_t vlan)
+{
+  char *tci = &frame[offsetof (struct VlanEthernetHeader, tci)];
+
+  put_be16 (tci,
+            (get_be16 (tci) & ~VLAN_VID_MASK) | vlan);
+}
+
+
+/**
+ * Write GLAB message @a msg (header and frame) to our parent.
+ *
+ * @param msg the message
+ * @param msg_size number of bytes in @a msg
+ */
+static inline void
+glab_write (const void *msg,
+            size_t msg_size)
+{
+#if GLAB_LATENCY
+  uint64_t start = latency_now ();
+#endif
+
+  GLAB_PROBE3 (egress,
+               get_be16 ((const char *) msg
+                         + offsetof (struct GLAB_MessageHeader, type)),
+               (const char *) msg + sizeof (struct GLAB_MessageHeader),
+               msg_size - sizeof (struct GLAB_MessageHeader));
+#if GLAB_SFLOW
+  sflow_egress (get_be16 ((const char *) msg
+                          + offsetof (struct GLAB_MessageHeader, type)),
+                (const char *) msg + sizeof (struct GLAB_MessageHeader),
+                msg_size - sizeof (struct GLAB_MessageHeader));
+#endif
+  write_all (STDOUT_FILENO,
+             msg,
+             msg_size);
+#if GLAB_LATENCY
+  latency_egress (start);
+#endif
+}
+
+
+/**
+ * Send @a frame to our parent for transmission on interface @a ifc_num.
+ *
+ * @param ifc_num number of the interface to send the frame out on
+ * @param frame the frame to send
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+glab_send (uint16_t ifc_num,
+           const void *frame,
+           size_t frame_size)
+{
+  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
+  struct GLAB_MessageHeader hdr;
+
+  hdr.size = htons (sizeof (iob));
+  hdr.type = htons (ifc_num);
+  memcpy (iob,
+          &hdr,
+          sizeof (hdr));
+  memcpy (&iob[sizeof (hdr)],
+          frame,
+          frame_size);
+  glab_write (iob,
+              sizeof (iob));
+}
+
+
+/**
+ * Send @a frame to our parent for transmission on interface @a ifc_num
+ * without copying it: the GLAB message header is written into the
+ * (at least) sizeof (struct GLAB_MessageHeader) bytes in front of
+ * @a frame, which must be writable.  This is the case for frames
+ * passed to handle_frame(), even after pushing an 802.1Q tag.
+ *
+ * @param ifc_num number of the interface to send the frame out on
+ * @param frame the frame to send
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+glab_send_in_place (uint16_t ifc_num,
+                    char *frame,
+                    size_t frame_size)
+{
+  char *msg = frame - sizeof (struct GLAB_MessageHeader);
+
+  put_be16 (&msg[offsetof (struct GLAB_MessageHeader, size)],
+            frame_size + sizeof (struct GLAB_MessageHeader));
+  put_be16 (&msg[offsetof (struct GLAB_MessageHeader, type)],
+            ifc_num);
+  glab_write (msg,
+              frame_size + sizeof (struct GLAB_MessageHeader));
+}
+
+
+/* needs the accessors above */
+#include "bpf.h"
+
+#if GLAB_BPF
+/**
+ * Run the ingress filter of interface @a i (see bpf.h).
+ */
+#define GLAB_INGRESS_FILTER(i, frame, frame_size) \
+  bpf_ingress ((i), (frame), (frame_size))
+#else
+#define GLAB_INGRESS_FILTER(i, frame, frame_size) true
+#endif
+
+
+/**
+ * Define handle_frame() (as called by loop.c) to pass frames from
+ * interface number `interface` to PARSE.  The frame is writable and
+ * has #GLAB_FRAME_HEADROOM bytes of headroom.
+ *
+ * @param NUM number of interfaces, larger interface numbers abort()
+ * @param IFC expression yielding the `struct Interface *` for `interface`
+ * @param PARSE function taking the interface, (mutable) frame and frame size
+ */
+#define GLAB_DEFINE_HANDLE_FRAME(NUM, IFC, PARSE)               \
+  static void                                                   \
+  handle_frame (uint16_t interface,                             \
+                void *frame,                                    \
+                size_t frame_size)                              \
+  {                                                             \
+    if ( (0 == interface) ||                                    \
+         (interface > (NUM)) )                                  \
+      abort ();                                                 \
+    if (! GLAB_INGRESS_FILTER (interface,                       \
+                               frame,                           \
+                               frame_size))                     \
+      return;                                                   \
+    PARSE ((IFC),                                               \
+           frame,                                               \
+           frame_size);                                         \
+  }
+
+
+/**
+ * Define handle_mac() (as called by loop.c) to store the MAC of
+ * interface number `ifc_num` in its `mac` field.
+ *
+ * @param NUM number of interfaces, larger interface numbers abort()
+ * @param IFC expression yielding the `struct Interface *` for `ifc_num`
+ */
+#define GLAB_DEFINE_HANDLE_MAC(NUM, IFC)                        \
+  static void                                                   \
+  handle_mac (uint16_t ifc_num,                                 \
+              const struct MacAddress *mac)                     \
+  {                                                             \
+    if ( (0 == ifc_num) ||                                      \
+         (ifc_num > (NUM)) )                                    \
+      abort ();                                                 \
+    (IFC)->mac = *mac;                                          \
+  }
+
+
+#endif
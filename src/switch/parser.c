@@ -20,63 +20,1199 @@
  * @file parser.c
  * @brief Parses output of network-driver
  * @author Christian Grothoff
+ *
+ * Passive traffic analyzer: every frame is run through a table of
+ * dissectors (Ethernet, 802.1Q/QinQ, ARP, IPv4, ICMP, UDP, TCP), each
+ * of which decodes its header in place and names the next one.  Only
+ * counters are updated per frame, including fixed-size top-talker
+ * summaries per address; text is produced by the "stats" and "top"
+ * commands.
+ */
+#ifndef GLAB_BPF
+/**
+ * Support ingress filters, see bpf.h.
  */
+#define GLAB_BPF 1
+#endif
 #include "glab.h"
 #include "print.c"
+#include "packet.h"
+
+
+#ifndef ETH_P_8021AD
+/**
+ * Number for IEEE 802.1ad (QinQ) service VLAN tags.
+ */
+#define ETH_P_8021AD 0x88A8
+#endif
+
+#ifndef ETH_P_QINQ1
+/**
+ * Pre-standard QinQ tag still used by some equipment.
+ */
+#define ETH_P_QINQ1 0x9100
+#endif
+
+/**
+ * Maximum number of VLAN tags we remember (outer and inner).
+ */
+#define MAX_VLAN_TAGS 2
+
+
+/**
+ * Protocols we can dissect, index into #dissectors.
+ */
+enum Protocol
+{
+  PROTO_ETHERNET,
+  PROTO_VLAN,
+  PROTO_ARP,
+  PROTO_IPV4,
+  PROTO_ICMP,
+  PROTO_UDP,
+  PROTO_TCP,
+
+  /**
+   * Payload of an EtherType we do not dissect.
+   */
+  PROTO_OTHER_ETH,
+
+  /**
+   * Payload of an IP protocol we do not dissect.
+   */
+  PROTO_OTHER_IP,
+
+  PROTO_MAX,
+
+  /**
+   * Returned by a dissector if there is no further header.
+   */
+  PROTO_DONE = PROTO_MAX,
+
+  /**
+   * Returned by a dissector if its header is invalid.
+   */
+  PROTO_MALFORMED
+};
 
 
 /**
- * Process frame received from @a interface.
+ * Result of dissecting a frame.  All pointers point into the frame;
+ * fields of layers that were not found are left zero.
+ */
+struct Dissection
+{
+  /**
+   * Ethernet header.
+   */
+  const struct EthernetHeader *eh;
+
+  /**
+   * VLAN IDs, outermost first.
+   */
+  uint16_t vlan[MAX_VLAN_TAGS];
+
+  /**
+   * Number of VLAN tags (may exceed #MAX_VLAN_TAGS).
+   */
+  unsigned int num_tags;
+
+  /**
+   * EtherType after all VLAN tags (host byte order).
+   */
+  uint16_t ethertype;
+
+  /**
+   * IPv4 or ARP sender and target address (network byte order).
+   */
+  uint32_t src_ip;
+  uint32_t dst_ip;
+
+  /**
+   * IPv4 protocol number.
+   */
+  uint8_t ip_proto;
+
+  /**
+   * ARP operation.
+   */
+  uint16_t arp_op;
+
+  /**
+   * ICMP type and code.
+   */
+  uint8_t icmp_type;
+  uint8_t icmp_code;
+
+  /**
+   * UDP or TCP ports (host byte order).
+   */
+  uint16_t src_port;
+  uint16_t dst_port;
+
+  /**
+   * TCP flags.
+   */
+  uint8_t tcp_flags;
+};
+
+
+/**
+ * Decode a header in place.
  *
- * @param interface number of the interface on which we received @a frame
+ * @param d[in,out] dissection result to update
+ * @param hdr start of the header
+ * @param avail[in,out] bytes available from @a hdr; may be reduced if
+ *        the header says the packet is shorter (link-layer padding)
+ * @param hlen[out] set to the length of the header
+ * @return next protocol, #PROTO_DONE or #PROTO_MALFORMED
+ */
+typedef enum Protocol
+(*Dissector) (struct Dissection *d,
+              const uint8_t *hdr,
+              size_t *avail,
+              size_t *hlen);
+
+
+/**
+ * Per-protocol statistics.
+ */
+struct ProtocolStats
+{
+  /**
+   * Headers seen.
+   */
+  uint64_t packets;
+
+  /**
+   * Bytes from the start of the header to the end of the packet.
+   */
+  uint64_t octets;
+
+  /**
+   * Headers that were truncated or invalid.
+   */
+  uint64_t malformed;
+};
+
+
+/**
+ * Per-interface context.
+ */
+struct Interface
+{
+  /**
+   * MAC of interface.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Name of the interface.
+   */
+  const char *name;
+
+  /**
+   * Number of this interface.
+   */
+  uint16_t ifc_num;
+
+  /**
+   * Frames and bytes received.
+   */
+  uint64_t frames;
+  uint64_t octets;
+
+  /**
+   * Frames by destination MAC.
+   */
+  uint64_t unicast;
+  uint64_t multicast;
+  uint64_t broadcast;
+
+  /**
+   * Frames with a malformed header.
+   */
+  uint64_t malformed;
+
+  /**
+   * Headers seen per protocol.
+   */
+  uint64_t protocols[PROTO_MAX];
+};
+
+
+/**
+ * Number of available contexts.
+ */
+static unsigned int num_ifc;
+
+/**
+ * All the contexts.
+ */
+static struct Interface *gifc;
+
+/**
+ * Statistics per protocol, over all interfaces.
+ */
+static struct ProtocolStats proto_stats[PROTO_MAX];
+
+
+/**
+ * Protocol carried by an EtherType.
+ *
+ * @param ethertype EtherType (host byte order)
+ * @return protocol to dissect next
+ */
+static inline enum Protocol
+ethertype_next (uint16_t ethertype)
+{
+  switch (ethertype)
+  {
+  case ETH_P_IPV4:
+    return PROTO_IPV4;
+  case ETH_P_ARP:
+    return PROTO_ARP;
+  case ETH_P_8021Q:
+  case ETH_P_8021AD:
+  case ETH_P_QINQ1:
+    return PROTO_VLAN;
+  default:
+    return PROTO_OTHER_ETH;
+  }
+}
+
+
+/**
+ * Protocol carried by each IPv4 protocol number.
+ */
+static const uint8_t ip_proto_next[256] = {
+  [0 ... 255] = PROTO_OTHER_IP,
+  [IPPROTO_ICMP] = PROTO_ICMP,
+  [IPPROTO_TCP] = PROTO_TCP,
+  [IPPROTO_UDP] = PROTO_UDP
+};
+
+
+/**
+ * Dissect an Ethernet header.
+ */
+static enum Protocol
+dissect_ethernet (struct Dissection *d,
+                  const uint8_t *hdr,
+                  size_t *avail,
+                  size_t *hlen)
+{
+  d->eh = (const struct EthernetHeader *) hdr;
+  d->ethertype = get_be16 (&hdr[offsetof (struct EthernetHeader, tag)]);
+  *hlen = sizeof (struct EthernetHeader);
+  return ethertype_next (d->ethertype);
+}
+
+
+/**
+ * Dissect the rest of an 802.1Q/802.1ad tag: the TCI and the next
+ * EtherType (the TPID was the previous EtherType).
+ */
+static enum Protocol
+dissect_vlan (struct Dissection *d,
+              const uint8_t *hdr,
+              size_t *avail,
+              size_t *hlen)
+{
+  if (d->num_tags < MAX_VLAN_TAGS)
+    d->vlan[d->num_tags] = get_be16 (hdr) & VLAN_VID_MASK;
+  d->num_tags++;
+  d->ethertype = get_be16 (&hdr[2]);
+  *hlen = 4;
+  return ethertype_next (d->ethertype);
+}
+
+
+/**
+ * Dissect an ARP packet for Ethernet and IPv4.
+ */
+static enum Protocol
+dissect_arp (struct Dissection *d,
+             const uint8_t *hdr,
+             size_t *avail,
+             size_t *hlen)
+{
+  /* htype(2) ptype(2) hlen(1) plen(1) oper(2) sha(6) spa(4) tha(6) tpa(4) */
+  if ( (1 != get_be16 (&hdr[0])) ||
+       (ETH_P_IPV4 != get_be16 (&hdr[2])) ||
+       (MAC_ADDR_SIZE != hdr[4]) ||
+       (4 != hdr[5]) )
+    return PROTO_MALFORMED;
+  d->arp_op = get_be16 (&hdr[6]);
+  d->src_ip = get_u32 (&hdr[14]);
+  d->dst_ip = get_u32 (&hdr[24]);
+  *hlen = 28;
+  return PROTO_DONE;
+}
+
+
+/**
+ * Dissect an IPv4 header.  Non-initial fragments have no
+ * transport header.
+ */
+static enum Protocol
+dissect_ipv4 (struct Dissection *d,
+              const uint8_t *hdr,
+              size_t *avail,
+              size_t *hlen)
+{
+  size_t ihl = (hdr[0] & 0x0F) * 4;
+  size_t total = get_be16 (&hdr[2]);
+
+  if ( (4 != (hdr[0] >> 4)) ||
+       (ihl < 20) ||
+       (total < ihl) ||
+       (total > *avail) )
+    return PROTO_MALFORMED;
+  *avail = total;
+  *hlen = ihl;
+  d->ip_proto = hdr[9];
+  d->src_ip = get_u32 (&hdr[12]);
+  d->dst_ip = get_u32 (&hdr[16]);
+  if (0 != (get_be16 (&hdr[6]) & 0x1FFF))
+    return PROTO_DONE;
+  return ip_proto_next[d->ip_proto];
+}
+
+
+/**
+ * Dissect an ICMP header.
+ */
+static enum Protocol
+dissect_icmp (struct Dissection *d,
+              const uint8_t *hdr,
+              size_t *avail,
+              size_t *hlen)
+{
+  d->icmp_type = hdr[0];
+  d->icmp_code = hdr[1];
+  *hlen = 8;
+  return PROTO_DONE;
+}
+
+
+/**
+ * Dissect a UDP header.
+ */
+static enum Protocol
+dissect_udp (struct Dissection *d,
+             const uint8_t *hdr,
+             size_t *avail,
+             size_t *hlen)
+{
+  size_t len = get_be16 (&hdr[4]);
+
+  if ( (len < 8) ||
+       (len > *avail) )
+    return PROTO_MALFORMED;
+  d->src_port = get_be16 (&hdr[0]);
+  d->dst_port = get_be16 (&hdr[2]);
+  *hlen = 8;
+  return PROTO_DONE;
+}
+
+
+/**
+ * Dissect a TCP header.
+ */
+static enum Protocol
+dissect_tcp (struct Dissection *d,
+             const uint8_t *hdr,
+             size_t *avail,
+             size_t *hlen)
+{
+  size_t doff = (hdr[12] >> 4) * 4;
+
+  if ( (doff < 20) ||
+       (doff > *avail) )
+    return PROTO_MALFORMED;
+  d->src_port = get_be16 (&hdr[0]);
+  d->dst_port = get_be16 (&hdr[2]);
+  d->tcp_flags = hdr[13];
+  *hlen = doff;
+  return PROTO_DONE;
+}
+
+
+/**
+ * Account for a payload we do not dissect further.
+ */
+static enum Protocol
+dissect_other (struct Dissection *d,
+               const uint8_t *hdr,
+               size_t *avail,
+               size_t *hlen)
+{
+  *hlen = 0;
+  return PROTO_DONE;
+}
+
+
+/**
+ * The dissector table.
+ */
+static const struct
+{
+  /**
+   * Name for the "stats" output.
+   */
+  const char *name;
+
+  /**
+   * Minimum number of bytes the header needs.
+   */
+  size_t min_len;
+
+  /**
+   * Function to decode the header.
+   */
+  Dissector dissect;
+} dissectors[PROTO_MAX] = {
+  [PROTO_ETHERNET] = { "ethernet", sizeof (struct EthernetHeader), &dissect_ethernet },
+  [PROTO_VLAN] = { "802.1q", 4, &dissect_vlan },
+  [PROTO_ARP] = { "arp", 28, &dissect_arp },
+  [PROTO_IPV4] = { "ipv4", 20, &dissect_ipv4 },
+  [PROTO_ICMP] = { "icmp", 8, &dissect_icmp },
+  [PROTO_UDP] = { "udp", 8, &dissect_udp },
+  [PROTO_TCP] = { "tcp", 20, &dissect_tcp },
+  [PROTO_OTHER_ETH] = { "other-eth", 0, &dissect_other },
+  [PROTO_OTHER_IP] = { "other-ip", 0, &dissect_other }
+};
+
+
+/**
+ * Dissect @a frame received on @a ifc and update the statistics.
+ *
+ * @param ifc interface we got the frame on
  * @param frame the frame
  * @param frame_size number of bytes in @a frame
+ * @param d[out] dissection result
+ * @return 0 if all headers were well-formed
+ */
+static int
+dissect (struct Interface *ifc,
+         const uint8_t *frame,
+         size_t frame_size,
+         struct Dissection *d)
+{
+  enum Protocol p = PROTO_ETHERNET;
+  size_t off = 0;
+  size_t end = frame_size;
+
+  memset (d,
+          0,
+          sizeof (*d));
+  while (PROTO_DONE != p)
+  {
+    struct ProtocolStats *ps = &proto_stats[p];
+    size_t avail = end - off;
+    size_t hlen;
+    enum Protocol next;
+
+    if (avail < dissectors[p].min_len)
+      next = PROTO_MALFORMED;
+    else
+      next = dissectors[p].dissect (d,
+                                    &frame[off],
+                                    &avail,
+                                    &hlen);
+    if (PROTO_MALFORMED == next)
+    {
+      ps->malformed++;
+      ifc->malformed++;
+      return 1;
+    }
+    ps->packets++;
+    ps->octets += avail;
+    ifc->protocols[p]++;
+    end = off + avail;
+    off += hlen;
+    p = next;
+  }
+  return 0;
+}
+
+
+/**
+ * Number of rows of each count-min sketch.
+ */
+#define CMS_DEPTH 4
+
+/**
+ * log2 of the number of counters per row of each count-min sketch.
+ */
+#define CMS_WIDTH_BITS 11
+
+/**
+ * Number of counters per row of each count-min sketch.
+ */
+#define CMS_WIDTH (1u << CMS_WIDTH_BITS)
+
+/**
+ * Number of candidate heavy hitters we monitor per key type.
+ */
+#define TOP_MONITORED 64
+
+/**
+ * Number of slots in the index over the monitored keys (power of two).
+ */
+#define TOP_INDEX_SIZE (2 * TOP_MONITORED)
+
+/**
+ * Number of heavy hitters "top" shows by default.
+ */
+#define TOP_DEFAULT_K 10
+
+
+/**
+ * A monitored key.
+ */
+struct HeavyHitter
+{
+  /**
+   * MAC or IPv4 address (network byte order) in the low bits.
+   */
+  uint64_t key;
+
+  /**
+   * Upper bound on the bytes seen for @e key.
+   */
+  uint64_t count;
+
+  /**
+   * Maximum over-estimation in @e count.
+   */
+  uint64_t error;
+
+  /**
+   * Position in the heap.
+   */
+  uint8_t heap_pos;
+};
+
+
+/**
+ * Bytes per address of one kind, in fixed memory: a count-min sketch
+ * (with conservative update) estimates the bytes of every address,
+ * and a space-saving summary monitors the #TOP_MONITORED addresses
+ * with the highest counts in a min-heap.  An address that is not
+ * monitored replaces the minimum once its estimate exceeds it.
+ */
+struct TopTalkers
+{
+  /**
+   * Name for the "top" output.
+   */
+  const char *name;
+
+  /**
+   * Are the keys MAC (or IPv4) addresses?
+   */
+  bool is_mac;
+
+  /**
+   * Total bytes counted.
+   */
+  uint64_t total;
+
+  /**
+   * The count-min sketch.
+   */
+  uint64_t cms[CMS_DEPTH][CMS_WIDTH];
+
+  /**
+   * The monitored keys.
+   */
+  struct HeavyHitter hh[TOP_MONITORED];
+
+  /**
+   * Min-heap (by count) of indices into @e hh.
+   */
+  uint8_t heap[TOP_MONITORED];
+
+  /**
+   * Number of used entries in @e hh and @e heap.
+   */
+  unsigned int num_hh;
+
+  /**
+   * Open-addressing index over @e hh, entries are indices plus one.
+   */
+  uint8_t index[TOP_INDEX_SIZE];
+};
+
+
+/**
+ * Top talkers by source and destination MAC and IPv4 address.
+ */
+static struct TopTalkers top_src_mac = { .name = "source MAC", .is_mac = true };
+static struct TopTalkers top_dst_mac = { .name = "destination MAC", .is_mac = true };
+static struct TopTalkers top_src_ip = { .name = "source IPv4" };
+static struct TopTalkers top_dst_ip = { .name = "destination IPv4" };
+
+
+/**
+ * Hash @a key for row @a row of a count-min sketch, or for the
+ * index if @a row is #CMS_DEPTH.
+ *
+ * @param key key to hash
+ * @param row which hash function to use
+ * @return 32-bit hash
+ */
+static inline uint32_t
+top_hash (uint64_t key,
+          unsigned int row)
+{
+  static const uint64_t seeds[CMS_DEPTH + 1] = {
+    0x9E3779B97F4A7C15LLU,
+    0xC2B2AE3D27D4EB4FLLU,
+    0x165667B19E3779F9LLU,
+    0xD6E8FEB86659FD93LLU,
+    0xFF51AFD7ED558CCDLLU
+  };
+  uint64_t h = (key ^ (key >> 29)) * seeds[row];
+
+  return (uint32_t) (h >> 32);
+}
+
+
+/**
+ * Swap heap positions @a i and @a j of @a t.
+ */
+static inline void
+top_heap_swap (struct TopTalkers *t,
+               unsigned int i,
+               unsigned int j)
+{
+  uint8_t tmp = t->heap[i];
+
+  t->heap[i] = t->heap[j];
+  t->heap[j] = tmp;
+  t->hh[t->heap[i]].heap_pos = i;
+  t->hh[t->heap[j]].heap_pos = j;
+}
+
+
+/**
+ * Restore the heap property of @a t after the count at heap
+ * position @a pos increased.
  */
 static void
-handle_frame (uint16_t interface,
-	      const void *frame,
-	      size_t frame_size)
+top_sift_down (struct TopTalkers *t,
+               unsigned int pos)
 {
-	/* fill me in! */
+  for (;;)
+  {
+    unsigned int l = 2 * pos + 1;
+    unsigned int m = pos;
+
+    if ( (l < t->num_hh) &&
+         (t->hh[t->heap[l]].count < t->hh[t->heap[m]].count) )
+      m = l;
+    if ( (l + 1 < t->num_hh) &&
+         (t->hh[t->heap[l + 1]].count < t->hh[t->heap[m]].count) )
+      m = l + 1;
+    if (m == pos)
+      return;
+    top_heap_swap (t,
+                   pos,
+                   m);
+    pos = m;
+  }
 }
 
 
 /**
- * Handle control message @a cmd.
+ * Restore the heap property of @a t after adding an entry
+ * at heap position @a pos.
+ */
+static void
+top_sift_up (struct TopTalkers *t,
+             unsigned int pos)
+{
+  while ( (pos > 0) &&
+          (t->hh[t->heap[pos]].count < t->hh[t->heap[(pos - 1) / 2]].count) )
+  {
+    top_heap_swap (t,
+                   pos,
+                   (pos - 1) / 2);
+    pos = (pos - 1) / 2;
+  }
+}
+
+
+/**
+ * Find the index slot of @a key in @a t.
  *
- * @param cmd text the user entered
- * @param cmd_len length of @a cmd
+ * @return slot holding @a key, or the empty slot where it would go
+ */
+static inline unsigned int
+top_index_find (const struct TopTalkers *t,
+                uint64_t key)
+{
+  unsigned int i = top_hash (key, CMS_DEPTH) & (TOP_INDEX_SIZE - 1);
+
+  while ( (0 != t->index[i]) &&
+          (t->hh[t->index[i] - 1].key != key) )
+    i = (i + 1) & (TOP_INDEX_SIZE - 1);
+  return i;
+}
+
+
+/**
+ * Remove the index slot @a i of @a t (backward-shift deletion).
  */
 static void
-handle_control (char *cmd,
-		size_t cmd_len)
+top_index_remove (struct TopTalkers *t,
+                  unsigned int i)
 {
-  cmd[cmd_len - 1] = '\0';
-  print ("Received command `%s'\n",
-	 cmd);
+  const unsigned int mask = TOP_INDEX_SIZE - 1;
+  unsigned int j = i;
+
+  for (;;)
+  {
+    unsigned int home;
+
+    j = (j + 1) & mask;
+    if (0 == t->index[j])
+      break;
+    home = top_hash (t->hh[t->index[j] - 1].key, CMS_DEPTH) & mask;
+    if ( (i <= j)
+         ? ( (home <= i) || (home > j) )
+         : ( (home <= i) && (home > j) ) )
+    {
+      t->index[i] = t->index[j];
+      i = j;
+    }
+  }
+  t->index[i] = 0;
+}
+
+
+/**
+ * Count @a bytes for @a key in @a t.
+ *
+ * @param t top talkers to update
+ * @param key address
+ * @param bytes number of bytes to add
+ */
+static void
+top_update (struct TopTalkers *t,
+            uint64_t key,
+            uint64_t bytes)
+{
+  uint32_t cols[CMS_DEPTH];
+  uint64_t est = UINT64_MAX;
+  unsigned int slot;
+  struct HeavyHitter *h;
+  uint8_t idx;
+
+  t->total += bytes;
+  /* conservative update: only raise counters below the new estimate */
+  for (unsigned int r = 0; r < CMS_DEPTH; r++)
+  {
+    cols[r] = top_hash (key, r) >> (32 - CMS_WIDTH_BITS);
+    if (t->cms[r][cols[r]] < est)
+      est = t->cms[r][cols[r]];
+  }
+  est += bytes;
+  for (unsigned int r = 0; r < CMS_DEPTH; r++)
+    if (t->cms[r][cols[r]] < est)
+      t->cms[r][cols[r]] = est;
+
+  slot = top_index_find (t,
+                         key);
+  if (0 != t->index[slot])
+  {
+    h = &t->hh[t->index[slot] - 1];
+    h->count += bytes;
+    top_sift_down (t,
+                   h->heap_pos);
+    return;
+  }
+  if (t->num_hh < TOP_MONITORED)
+  {
+    idx = t->num_hh++;
+    t->heap[idx] = idx;
+    h = &t->hh[idx];
+    h->heap_pos = idx;
+    h->key = key;
+    h->count = est;
+    h->error = est - bytes;
+    t->index[slot] = idx + 1;
+    top_sift_up (t,
+                 idx);
+    return;
+  }
+  idx = t->heap[0];
+  h = &t->hh[idx];
+  if (est <= h->count)
+    return;
+  top_index_remove (t,
+                    top_index_find (t,
+                                    h->key));
+  h->key = key;
+  h->count = est;
+  h->error = est - bytes;
+  t->index[top_index_find (t,
+                           key)] = idx + 1;
+  top_sift_down (t,
+                 0);
+}
+
+
+/**
+ * Read MAC @a mac into the low 48 bits of a key.
+ */
+static inline uint64_t
+top_mac_key (const struct MacAddress *mac)
+{
+  uint64_t key = 0;
+
+  memcpy (&key,
+          mac,
+          sizeof (*mac));
+  return key;
+}
+
+
+/**
+ * Update the top talkers with the frame dissected into @a d.
+ *
+ * @param d dissected frame
+ * @param frame_size number of bytes in the frame
+ */
+static inline void
+top_count (const struct Dissection *d,
+           size_t frame_size)
+{
+  if (NULL == d->eh)
+    return;
+  top_update (&top_src_mac,
+              top_mac_key (&d->eh->src),
+              frame_size);
+  top_update (&top_dst_mac,
+              top_mac_key (&d->eh->dst),
+              frame_size);
+  if (ETH_P_IPV4 != d->ethertype)
+    return;
+  top_update (&top_src_ip,
+              d->src_ip,
+              frame_size);
+  top_update (&top_dst_ip,
+              d->dst_ip,
+              frame_size);
+}
+
+
+/**
+ * Compare heavy hitters by count, descending (for qsort()).
+ */
+static int
+top_cmp (const void *a,
+         const void *b)
+{
+  const struct HeavyHitter *ha = a;
+  const struct HeavyHitter *hb = b;
+
+  if (ha->count == hb->count)
+    return 0;
+  return (ha->count < hb->count) ? 1 : -1;
+}
+
+
+/**
+ * Print the @a k largest heavy hitters of @a t.
+ */
+static void
+top_print (const struct TopTalkers *t,
+           unsigned int k)
+{
+  struct HeavyHitter sorted[TOP_MONITORED];
+
+  memcpy (sorted,
+          t->hh,
+          t->num_hh * sizeof (struct HeavyHitter));
+  qsort (sorted,
+         t->num_hh,
+         sizeof (struct HeavyHitter),
+         &top_cmp);
+  print ("Top %s by bytes (of %llu):\n",
+         t->name,
+         (unsigned long long) t->total);
+  for (unsigned int i = 0; (i < k) && (i < t->num_hh); i++)
+  {
+    const struct HeavyHitter *h = &sorted[i];
+    char addr[sizeof ("00:00:00:00:00:00")];
+
+    if (t->is_mac)
+    {
+      const uint8_t *m = (const uint8_t *) &h->key;
+
+      snprintf (addr,
+                sizeof (addr),
+                "%02x:%02x:%02x:%02x:%02x:%02x",
+                m[0], m[1], m[2], m[3], m[4], m[5]);
+    }
+    else
+    {
+      struct in_addr in = { .s_addr = (uint32_t) h->key };
+
+      inet_ntop (AF_INET,
+                 &in,
+                 addr,
+                 sizeof (addr));
+    }
+    print ("%3u %-17s %12llu (+/- %llu) %5.1f%%\n",
+           i + 1,
+           addr,
+           (unsigned long long) h->count,
+           (unsigned long long) h->error,
+           (0 == t->total) ? 0.0 : 100.0 * h->count / t->total);
+  }
+}
+
+
+/**
+ * Forget everything counted in @a t.
+ */
+static void
+top_reset (struct TopTalkers *t)
+{
+  t->total = 0;
+  t->num_hh = 0;
+  memset (t->cms,
+          0,
+          sizeof (t->cms));
+  memset (t->index,
+          0,
+          sizeof (t->index));
+}
+
+
+/**
+ * The user entered a "top" command: "top [K]" shows the top K
+ * addresses of each kind, "top reset" starts counting anew.
+ */
+static void
+process_cmd_top ()
+{
+  const char *tok = strtok (NULL, " ");
+  unsigned int k = TOP_DEFAULT_K;
+
+  if ( (NULL != tok) &&
+       (0 == strcasecmp (tok,
+                         "reset")) )
+  {
+    top_reset (&top_src_mac);
+    top_reset (&top_dst_mac);
+    top_reset (&top_src_ip);
+    top_reset (&top_dst_ip);
+    print ("Top talkers reset\n");
+    return;
+  }
+  if ( (NULL != tok) &&
+       ( (1 != sscanf (tok,
+                       "%u",
+                       &k)) ||
+         (0 == k) ||
+         (k > TOP_MONITORED) ) )
+  {
+    fprintf (stderr,
+             "Usage: top [K|reset], K at most %u\n",
+             TOP_MONITORED);
+    return;
+  }
+  top_print (&top_src_mac, k);
+  top_print (&top_dst_mac, k);
+  top_print (&top_src_ip, k);
+  top_print (&top_dst_ip, k);
+}
+
+
+/**
+ * Process frame received on @a ifc.
+ *
+ * @param ifc interface on which we received @a frame
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+parse_frame (struct Interface *ifc,
+             const void *frame,
+             size_t frame_size)
+{
+  const uint8_t *dst = frame;
+  struct Dissection d;
+
+  ifc->frames++;
+  ifc->octets += frame_size;
+  if (frame_size >= MAC_ADDR_SIZE)
+  {
+    if (0 == (dst[0] & 1))
+      ifc->unicast++;
+    else if (0 == memcmp (dst,
+                          "\xFF\xFF\xFF\xFF\xFF\xFF",
+                          MAC_ADDR_SIZE))
+      ifc->broadcast++;
+    else
+      ifc->multicast++;
+  }
+  if (0 != dissect (ifc,
+                    frame,
+                    frame_size,
+                    &d))
+    return;
+  top_count (&d,
+             frame_size);
 }
 
 
+GLAB_DEFINE_HANDLE_FRAME (num_ifc, &gifc[interface - 1], parse_frame)
+
+
 /**
- * Handle MAC information @a mac 
+ * Print the statistics.
+ */
+static void
+print_stats ()
+{
+  print ("protocol        packets          octets   malformed\n");
+  for (unsigned int p = 0; p < PROTO_MAX; p++)
+    print ("%-10s %12llu %15llu %11llu\n",
+           dissectors[p].name,
+           (unsigned long long) proto_stats[p].packets,
+           (unsigned long long) proto_stats[p].octets,
+           (unsigned long long) proto_stats[p].malformed);
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    const struct Interface *ifc = &gifc[i];
+    const uint8_t *m = ifc->mac.mac;
+
+    print ("%s (%02x:%02x:%02x:%02x:%02x:%02x): %llu frames, %llu octets, "
+           "%llu unicast, %llu multicast, %llu broadcast, %llu malformed\n",
+           ifc->name,
+           m[0], m[1], m[2], m[3], m[4], m[5],
+           (unsigned long long) ifc->frames,
+           (unsigned long long) ifc->octets,
+           (unsigned long long) ifc->unicast,
+           (unsigned long long) ifc->multicast,
+           (unsigned long long) ifc->broadcast,
+           (unsigned long long) ifc->malformed);
+    for (unsigned int p = 0; p < PROTO_MAX; p++)
+      if (0 != ifc->protocols[p])
+        print ("  %-10s %12llu\n",
+               dissectors[p].name,
+               (unsigned long long) ifc->protocols[p]);
+  }
+}
+
+
+/**
+ * Reset all statistics.
+ */
+static void
+reset_stats ()
+{
+  memset (proto_stats,
+          0,
+          sizeof (proto_stats));
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    struct Interface *ifc = &gifc[i];
+
+    ifc->frames = 0;
+    ifc->octets = 0;
+    ifc->unicast = 0;
+    ifc->multicast = 0;
+    ifc->broadcast = 0;
+    ifc->malformed = 0;
+    memset (ifc->protocols,
+            0,
+            sizeof (ifc->protocols));
+  }
+}
+
+
+/**
+ * Handle control message @a cmd.
  *
- * @param ifc_num number of the interface with @a mac
- * @param mac the MAC address at @a ifc_num
+ * @param cmd text the user entered
+ * @param cmd_len length of @a cmd
  */
 static void
-handle_mac (uint16_t ifc_num,
-	    const struct MacAddress *mac)
+handle_control (char *cmd,
+		size_t cmd_len)
 {
-	/* Fill me in! */
+  const char *tok;
+
+  cmd[cmd_len - 1] = '\0';
+  tok = strtok (cmd,
+                " ");
+  if (NULL == tok)
+    return;
+  if (0 == strcasecmp (tok,
+                       "stats"))
+  {
+    tok = strtok (NULL,
+                  " ");
+    if ( (NULL != tok) &&
+         (0 == strcasecmp (tok,
+                           "reset")) )
+    {
+      reset_stats ();
+      print ("Statistics reset\n");
+    }
+    else
+      print_stats ();
+    return;
+  }
+  if (0 == strcasecmp (tok,
+                       "top"))
+  {
+    process_cmd_top ();
+    return;
+  }
+  fprintf (stderr,
+           "Unsupported command `%s'\n",
+           tok);
 }
 
 
+GLAB_DEFINE_HANDLE_MAC (num_ifc, &gifc[ifc_num - 1])
+
+
 #include "loop.c"
 
+
+/**
+ * Launches the parser.
+ *
+ * @param argc number of arguments in @a argv
+ * @param argv binary name, followed by list of interfaces to listen on
+ * @return not really
+ */
 int
 main (int argc,
       char **argv)
 {
+  struct Interface ifc[argc];
+
+  memset (ifc,
+	  0,
+	  sizeof (ifc));
+  num_ifc = argc - 1;
+  gifc = ifc;
+  for (unsigned int i=1;i<argc;i++)
+  {
+    ifc[i-1].ifc_num = i;
+    ifc[i-1].name = argv[i];
+  }
   loop ();
   return 0;
 }
@@ -39,6 +39,14 @@ write_all (int fd,
   const char *cbuf = buf;
   size_t off;
 
+#if GLAB_SIM
+  if (STDOUT_FILENO == fd)
+    {
+      glab_sim_write (buf,
+                      buf_size);
+      return;
+    }
+#endif
   off = 0;
   while (off < buf_size)
     {
@@ -62,14 +70,15 @@ write_all (int fd,
 
 
 /**
- * Print message to the user by sending to parent.
+ * Print message to the user by sending to parent.  Marked unused as
+ * not every program prints yet (arp).
  *
  * @param fmt format string
  * @param ... arguments for @a fmt
  */
 static void
 print (const char *fmt,
-       ...)  __attribute__ ((format (gnu_printf, 1, 2)));
+       ...)  __attribute__ ((format (gnu_printf, 1, 2), unused));
 
 
 /**
@@ -84,13 +93,16 @@ print (const char *fmt,
 {
   char *str;
   va_list ap;
+  int ret;
 
   va_start (ap,
 	    fmt);
-  vasprintf (&str,
-	     fmt,
-	     ap);
+  ret = vasprintf (&str,
+		   fmt,
+		   ap);
   va_end (ap);
+  if (-1 == ret)
+    return;
   {
     size_t slen = strlen (str);
     struct GLAB_MessageHeader hdr = {
@@ -18,320 +18,215 @@
 
 /**
  * @file router.c
- * @brief IPv4 router
+ * @brief IPv4 and IPv6 router
  * @author Christian Grothoff
  */
-#include "glab.h"
-#include "print.c"
-#include "crc.c"
-
-
-/* see http://www.iana.org/assignments/ethernet-numbers */
-#ifndef ETH_P_IPV4
+#ifndef GLAB_SFLOW
 /**
- * Number for IPv4
+ * Support sFlow-style sampling, see sflow.h.
  */
-#define ETH_P_IPV4 0x0800
+#define GLAB_SFLOW 1
 #endif
-
-#ifndef ETH_P_ARP
+#ifndef GLAB_BPF
 /**
- * Number for ARP
+ * Support ingress filters, see bpf.h.
  */
-#define ETH_P_ARP 0x0806
+#define GLAB_BPF 1
 #endif
+#include "glab.h"
+#include "print.c"
+#include "crc.c"
+#include "huge.c"
+#include "packet.h"
 
 
 /**
- * gcc 4.x-ism to pack structures (to be used before structs);
- * Using this still causes structs to be unaligned on the stack on Sparc
- * (See #670578 from Debian).
+ * Per-interface context.  The fields needed to route a packet come
+ * first and fill exactly one cache line (the struct is aligned to
+ * one); the rest is only used by the control plane, while walking
+ * the VLAN sub-interfaces or for GRE tunnels.
  */
-_Pragma("pack(push)") _Pragma("pack(1)")
-
-struct EthernetHeader
+struct Interface
 {
-  struct MacAddress dst;
-  struct MacAddress src;
-
   /**
-   * See ETH_P-values.
+   * MAC of interface.
    */
-  uint16_t tag;
-};
-
+  struct MacAddress mac;
 
-/**
- * ARP header for Ethernet-IPv4.
- */
-struct ArpHeaderEthernetIPv4
-{
   /**
-   * Must be #ARP_HTYPE_ETHERNET.
+   * Number of this interface, 0 for a GRE tunnel.
    */
-  uint16_t htype;
+  uint16_t ifc_num;
 
   /**
-   * Protocol type, must be #ARP_PTYPE_IPV4
+   * MTU to enforce for this interface.  For a GRE tunnel, the IPv4
+   * MTU it is limited to, 0 to only follow the interface towards the
+   * remote endpoint (see gre_mtu()).
    */
-  uint16_t ptype;
+  uint16_t mtu;
 
   /**
-   * HLEN.  Must be #MAC_ADDR_SIZE.
+   * 802.1Q VLAN ID of this sub-interface, 0 if this is a
+   * physical interface sending and receiving untagged frames.
    */
-  uint8_t hlen;
+  uint16_t vlan;
 
   /**
-   * PLEN.  Must be sizeof (struct in_addr) (aka 4).
+   * Index of this interface in flow records: unlike @e ifc_num
+   * unique among sub-interfaces and tunnels, and kept across reloads
+   * (like SNMP's ifIndex).
    */
-  uint8_t plen;
+  uint16_t ifc_index;
 
   /**
-   * Type of the operation.
+   * IPv4 address of interface (we only support one IP per interface!)
    */
-  uint16_t oper;
+  struct in_addr ip;
 
   /**
-   * HW address of sender. We only support Ethernet.
+   * IPv4 netmask of interface.
    */
-  struct MacAddress sender_ha;
+  struct in_addr netmask;
 
   /**
-   * Layer3-address of sender. We only support IPv4.
+   * Global IPv6 address of interface, :: for none (the link-local
+   * address is derived from @e mac).
    */
-  struct in_addr sender_pa;
+  struct in6_addr ip6;
 
   /**
-   * HW address of target. We only support Ethernet.
+   * ACL applied to IPv4 packets received on this interface, NULL for none.
    */
-  struct MacAddress target_ha;
+  struct Acl *acl_in;
 
   /**
-   * Layer3-address of target. We only support IPv4.
+   * ACL applied to IPv4 packets routed out via this interface, NULL for none.
    */
-  struct in_addr target_pa;
-};
+  struct Acl *acl_out;
 
+  /**
+   * For a physical interface, the first of its VLAN sub-interfaces.
+   */
+  struct Interface *sub_head;
 
-/* some systems use one underscore only, and mingw uses no underscore... */
-#ifndef __BYTE_ORDER
-#ifdef _BYTE_ORDER
-#define __BYTE_ORDER _BYTE_ORDER
-#else
-#ifdef BYTE_ORDER
-#define __BYTE_ORDER BYTE_ORDER
-#endif
-#endif
-#endif
-#ifndef __BIG_ENDIAN
-#ifdef _BIG_ENDIAN
-#define __BIG_ENDIAN _BIG_ENDIAN
-#else
-#ifdef BIG_ENDIAN
-#define __BIG_ENDIAN BIG_ENDIAN
-#endif
-#endif
-#endif
-#ifndef __LITTLE_ENDIAN
-#ifdef _LITTLE_ENDIAN
-#define __LITTLE_ENDIAN _LITTLE_ENDIAN
-#else
-#ifdef LITTLE_ENDIAN
-#define __LITTLE_ENDIAN LITTLE_ENDIAN
-#endif
-#endif
-#endif
-
-
-#define IP_FLAGS_RESERVED 1
-#define IP_FLAGS_DO_NOT_FRAGMENT 2
-#define IP_FLAGS_MORE_FRAGMENTS 4
-#define IP_FLAGS 7
-
-#define IP_FRAGMENT_MULTIPLE 8
-
-/**
- * Standard IPv4 header.
- */
-struct IPv4Header
-{
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-  unsigned int header_length:4;
-  unsigned int version:4;
-#elif __BYTE_ORDER == __BIG_ENDIAN
-  unsigned int version:4;
-  unsigned int header_length:4;
-#else
-  #error byteorder undefined
-#endif
-  uint8_t diff_serv;
+  /* end of the first cache line */
 
   /**
-   * Length of the packet, including this header.
+   * For a sub-interface, the next sub-interface on the same
+   * physical interface.
    */
-  uint16_t total_length;
+  struct Interface *sub_next;
 
   /**
-   * Unique random ID for matching up fragments.
+   * Name of the interface.
    */
-  uint16_t identification;
+  char *name;
 
   /**
-   * Fragmentation flags and fragmentation offset.
+   * For a GRE tunnel, our endpoint address.
    */
-  uint16_t fragmentation_info;
+  struct in_addr tunnel_local;
 
   /**
-   * How many more hops can this packet be forwarded?
+   * For a GRE tunnel, the address of the remote endpoint; 0.0.0.0
+   * if this is not a tunnel.
    */
-  uint8_t ttl;
+  struct in_addr tunnel_remote;
 
   /**
-   * L4-protocol, for example, IPPROTO_UDP or IPPROTO_TCP.
+   * For a GRE tunnel, number of packets received through it.
    */
-  uint8_t protocol;
+  uint64_t tunnel_rx;
 
   /**
-   * Checksum.
+   * For a GRE tunnel, number of packets sent through it.
    */
-  uint16_t checksum;
+  uint64_t tunnel_tx;
 
   /**
-   * Origin of the packet.
+   * For a GRE tunnel, number of packets dropped (malformed or
+   * remote endpoint unreachable).
    */
-  struct in_addr source_address;
+  uint64_t tunnel_drops;
 
   /**
-   * Destination of the packet.
+   * Prefix length of the network of @e ip6.
    */
-  struct in_addr destination_address;
-};
-
-
+  uint8_t prefix6_len;
+} __attribute__((aligned (GLAB_CACHE_LINE)));
 
-#define	ICMPTYPE_DESTINATION_UNREACHABLE 3
-#define	ICMPTYPE_TIME_EXCEEDED 11
-
-#define ICMPCODE_NETWORK_UNREACHABLE 0
-#define ICMPCODE_HOST_UNREACHABLE 1
-#define ICMPCODE_FRAGMENTATION_REQUIRED 4
 
 /**
- * ICMP header.
+ * Number of available contexts.
  */
-struct IcmpHeader
-{
-  uint8_t type;
-  uint8_t code;
-  uint16_t crc;
-
-  union
-  {
-    /**
-     * Payload for #ICMPTYPE_DESTINATION_UNREACHABLE (RFC 1191)
-     */
-    struct ih_pmtu
-    {
-      uint16_t empty;
-      uint16_t next_hop_mtu;
-    } destination_unreachable;
-
-    /**
-     * Unused bytes for #ICMPTYPE_TIME_EXCEEDED.
-     */
-    uint32_t time_exceeded_unused;
-
-  } quench;
-
-  /* followed by original IP header + first 8 bytes of original IP datagram
-     (at least for the two ICMP message types we care about here) */
-
-};
-_Pragma("pack(pop)")
-
-
+static unsigned int num_ifc;
 
 /**
- * Per-interface context.
+ * Last `struct Interface` @e ifc_index handed out.
  */
-struct Interface
-{
-  /**
-   * MAC of interface.
-   */
-  struct MacAddress mac;
-
-  /**
-   * IPv4 address of interface (we only support one IP per interface!)
-   */
-  struct in_addr ip;
-
-  /**
-   * IPv4 netmask of interface.
-   */
-  struct in_addr netmask;
-
-  /**
-   * Name of the interface.
-   */
-  char *name;
-
-  /**
-   * Number of this interface.
-   */
-  uint16_t ifc_num;
+static uint16_t last_ifc_index;
 
-  /**
-   * MTU to enforce for this interface.
-   */
-  uint16_t mtu;
-};
+/**
+ * All the contexts (physical interfaces, VLAN sub-interfaces and
+ * GRE tunnels).
+ */
+static struct Interface *gifc;
 
+/**
+ * Number of physical interfaces.
+ */
+static unsigned int num_phys;
 
 /**
- * Number of available contexts.
+ * Physical interfaces, indexed by interface number minus one.
  */
-static unsigned int num_ifc;
+static struct Interface **gphys;
 
 /**
- * All the contexts.
+ * Allocate @a num zeroed interface contexts, each starting on a
+ * cache line (see `struct Interface`).
+ *
+ * @param num number of contexts
+ * @return NULL on error
  */
-static struct Interface *gifc;
+static struct Interface *
+alloc_interfaces (unsigned int num)
+{
+  struct Interface *ifcs;
+
+  ifcs = aligned_alloc (GLAB_CACHE_LINE,
+                        GLAB_CACHE_ALIGN (num * sizeof (struct Interface)));
+  if (NULL == ifcs)
+    return NULL;
+  memset (ifcs,
+          0,
+          num * sizeof (struct Interface));
+  return ifcs;
+}
 
 
 /**
- * Forward @a frame to interface @a dst.
+ * Find network interface by @a name.
  *
- * @param dst target interface to send the frame out on
- * @param frame the frame to forward
- * @param frame_size number of bytes in @a frame
+ * @param name name to look up by
+ * @return NULL if @a name was not found
  */
-static void
-forward_to (struct Interface *dst,
-	    const void *frame,
-	    size_t frame_size)
+static struct Interface *
+find_interface (const char *name)
 {
-  char iob[frame_size + sizeof (struct GLAB_MessageHeader)];
-  struct GLAB_MessageHeader hdr;
-
-  if (frame_size > dst->mtu)
-    abort ();
-  hdr.size = htons (sizeof (iob));
-  hdr.type = htons (dst->ifc_num);
-  memcpy (iob,
-	  &hdr,
-	  sizeof (hdr));
-  memcpy (&iob[sizeof (hdr)],
-	  frame,
-	  frame_size);
-  write_all (STDOUT_FILENO,
-	     iob,
-	     sizeof (iob));
+  for (unsigned int i=0;i<num_ifc;i++)
+    if (0 == strcasecmp (name,
+                         gifc[i].name))
+      return &gifc[i];
+  return NULL;
 }
 
 
 /**
  * Create Ethernet frame and forward it via @a ifc to @a target_ha.
+ * If @a ifc is a VLAN sub-interface, the 802.1Q tag is pushed
+ * between the MACs and @a tag.  The frame is assembled directly
+ * behind the GLAB message header, so the payload is copied once.
  *
  * @param ifc interface to send frame out on
  * @param target destination MAC
@@ -346,461 +241,419 @@ forward_frame_payload_to (struct Interface *ifc,
                           const void *frame_payload,
                           size_t frame_payload_size)
 {
-  char frame[sizeof (struct EthernetHeader) + frame_payload_size];
-  struct EthernetHeader eh;
+  size_t eh_size = (0 == ifc->vlan)
+    ? sizeof (struct EthernetHeader)
+    : sizeof (struct VlanEthernetHeader);
+  char iob[sizeof (struct GLAB_MessageHeader) + eh_size + frame_payload_size];
+  struct GLAB_MessageHeader hdr;
 
+  if (0 == ifc->ifc_num)
+    return; /* GRE tunnels only carry IPv4, see gre_output() */
   if (frame_payload_size + sizeof (struct EthernetHeader) > ifc->mtu)
     abort ();
-  eh.dst = *target_ha;
-  eh.src = ifc->mac;
-  eh.tag = ntohs (tag);
-  memcpy (frame,
-          &eh,
-          sizeof (eh));
-  memcpy (&frame[sizeof (eh)],
+  hdr.size = htons (sizeof (iob));
+  hdr.type = htons (ifc->ifc_num);
+  memcpy (iob,
+          &hdr,
+          sizeof (hdr));
+  if (0 == ifc->vlan)
+  {
+    struct EthernetHeader eh;
+
+    eh.dst = *target_ha;
+    eh.src = ifc->mac;
+    eh.tag = htons (tag);
+    memcpy (&iob[sizeof (hdr)],
+            &eh,
+            sizeof (eh));
+  }
+  else
+  {
+    struct VlanEthernetHeader veh;
+
+    veh.dst = *target_ha;
+    veh.src = ifc->mac;
+    veh.tpid = htons (ETH_P_8021Q);
+    veh.tci = htons (ifc->vlan);
+    veh.tag = htons (tag);
+    memcpy (&iob[sizeof (hdr)],
+            &veh,
+            sizeof (veh));
+  }
+  memcpy (&iob[sizeof (hdr) + eh_size],
           frame_payload,
           frame_payload_size);
-  forward_to (ifc,
-              frame,
-              sizeof (frame));
+  glab_write (iob,
+              sizeof (iob));
 }
 
 
 /**
- * Route the @a ip packet with its @a payload.
+ * Forward @a frame_payload via @a ifc to @a target_ha without copying
+ * it, by writing the Ethernet header (with the 802.1Q tag of a VLAN
+ * sub-interface) and the GLAB message header into the @a headroom
+ * in front of it.  Falls back to forward_frame_payload_to() if the
+ * headroom is too small.
  *
- * @param origin interface we received the packet from
- * @param ip IP header
- * @param payload IP packet payload
- * @param payload_size number of bytes in @a payload
+ * @param ifc interface to send frame out on
+ * @param target destination MAC
+ * @param tag Ethernet tag to use
+ * @param frame_payload payload to use in frame, in a writable buffer
+ * @param frame_payload_size number of bytes in @a frame_payload
+ * @param headroom number of writable bytes in front of @a frame_payload
  */
 static void
-route (struct Interface *origin,
-       const struct IPv4Header *ip,
-       const void *payload,
-       size_t payload_size)
+forward_frame_payload_in_place (struct Interface *ifc,
+                                const struct MacAddress *target_ha,
+                                uint16_t tag,
+                                void *frame_payload,
+                                size_t frame_payload_size,
+                                size_t headroom)
+{
+  size_t eh_size = (0 == ifc->vlan)
+    ? sizeof (struct EthernetHeader)
+    : sizeof (struct VlanEthernetHeader);
+  char *frame = (char *) frame_payload - eh_size;
+
+  if (0 == ifc->ifc_num)
+    return; /* GRE tunnels only carry IPv4, see gre_output() */
+  if (headroom < eh_size + sizeof (struct GLAB_MessageHeader))
+  {
+    forward_frame_payload_to (ifc,
+                              target_ha,
+                              tag,
+                              frame_payload,
+                              frame_payload_size);
+    return;
+  }
+  if (frame_payload_size + sizeof (struct EthernetHeader) > ifc->mtu)
+    abort ();
+  memcpy (&frame[offsetof (struct EthernetHeader, dst)],
+          target_ha,
+          sizeof (struct MacAddress));
+  memcpy (&frame[offsetof (struct EthernetHeader, src)],
+          &ifc->mac,
+          sizeof (struct MacAddress));
+  if (0 == ifc->vlan)
+  {
+    put_be16 (&frame[offsetof (struct EthernetHeader, tag)],
+              tag);
+  }
+  else
+  {
+    put_be16 (&frame[offsetof (struct VlanEthernetHeader, tpid)],
+              ETH_P_8021Q);
+    put_be16 (&frame[offsetof (struct VlanEthernetHeader, tci)],
+              ifc->vlan);
+    put_be16 (&frame[offsetof (struct VlanEthernetHeader, tag)],
+              tag);
+  }
+  glab_send_in_place (ifc->ifc_num,
+                      frame,
+                      eh_size + frame_payload_size);
+}
+
+
+/**
+ * Find the sub-interface of physical interface @a phys for @a vlan.
+ *
+ * @param phys physical interface the frame was received on
+ * @param vlan VLAN ID from the 802.1Q tag, 0 for priority-tagged frames
+ * @return NULL if no sub-interface is configured for @a vlan
+ */
+static struct Interface *
+find_sub_interface (struct Interface *phys,
+                    uint16_t vlan)
 {
-  /* TODO: do work here */
+  if (0 == vlan)
+    return phys;
+  for (struct Interface *sub = phys->sub_head;
+       NULL != sub;
+       sub = sub->sub_next)
+    if (vlan == sub->vlan)
+      return sub;
+  return NULL;
 }
 
 
+static bool
+acl_egress (const struct Interface *ifc,
+            const char *ip,
+            size_t size);
+
+static bool
+nat_egress (const struct Interface *ifc,
+            char *ip,
+            size_t size);
+
+static size_t
+gre_mtu (const struct Interface *ifc);
+
+static bool
+gre_output (struct Interface *ifc,
+            char *ip,
+            size_t size,
+            size_t headroom);
+
+struct Route;
+
+static void
+mpls_impose (const struct Route *r,
+             struct in_addr next_hop,
+             char *ip,
+             size_t size,
+             size_t headroom);
+
+/**
+ * Apply the egress ACLs of acl.c to routed packets, then masquerade
+ * them (nat.c).
+ */
+#define IPV4_EGRESS_HOOK(ifc, ip, size) \
+  (acl_egress (ifc, ip, size) && nat_egress (ifc, ip, size))
+
+/**
+ * GRE tunnels have a smaller MTU and no Ethernet framing (gre.c).
+ */
+#define IPV4_MTU(ifc) gre_mtu (ifc)
+#define IPV4_TUNNEL_OUTPUT(ifc, ip, size, headroom) \
+  gre_output (ifc, ip, size, headroom)
+
+/**
+ * Routes can push up to three MPLS labels (mpls.c).
+ */
+#define IPV4_MAX_LABELS 3
+#define IPV4_LABEL_OUTPUT(r, next_hop, ip, size, headroom) \
+  mpls_impose (r, next_hop, ip, size, headroom)
+
+#include "ipv4.c"
+#include "ipv6.c"
+#include "flow.c"
+#include "acl.c"
+#include "nat.c"
+#include "gre.c"
+#include "mpls.c"
+#include "config.c"
+
+
 /**
- * Process ARP (request or response!)
+ * Process IPv4 packet @a ip received on @a ifc.  GRE packets for one
+ * of our tunnels are decapsulated and processed again as received
+ * on the tunnel.
  *
- * @param ifc interface we received the ARP request from
- * @param eh ethernet header
- * @param ah ARP header
+ * @param ifc interface or tunnel we got the packet on
+ * @param ip IPv4 packet, in a writable buffer
+ * @param size number of bytes in @a ip (may include link-layer padding)
+ * @param headroom number of writable bytes in front of @a ip
  */
 static void
-handle_arp (struct Interface *ifc,
-            const struct EthernetHeader *eh,
-            const struct ArpHeaderEthernetIPv4 *ah)
+ipv4_input (struct Interface *ifc,
+            char *ip,
+            size_t size,
+            size_t headroom)
 {
-  /* TODO: do work here */
+  struct Interface *tun;
+
+  flow_account (ifc,
+                ip,
+                size);
+  if (! acl_ingress (ifc,
+                     ip,
+                     size))
+    return;
+  nat_ingress (ifc,
+               ip,
+               size);
+  tun = gre_decap (&ip,
+                   &size,
+                   &headroom);
+  if (NULL != tun)
+  {
+    ipv4_input (tun,
+                ip,
+                size,
+                headroom);
+    return;
+  }
+  route (ifc,
+         ip,
+         size,
+         headroom);
 }
 
 
 /**
  * Parse and process frame received on @a ifc.
  *
- * @param ifc interface we got the frame on
+ * @param ifc physical interface we got the frame on
  * @param frame raw frame data
  * @param frame_size number of bytes in @a frame
  */
 static void
 parse_frame (struct Interface *ifc,
-	     const void *frame,
+	     void *frame,
 	     size_t frame_size)
 {
-  struct EthernetHeader eh;
-  const char *cframe = frame;
+  struct EthernetFrame ef;
 
-  if (frame_size < sizeof (eh))
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      true,
+                      &ef))
   {
     fprintf (stderr,
 	     "Malformed frame\n");
     return;
   }
-  memcpy (&eh,
-	  frame,
-	  sizeof (eh));
-  switch (ntohs (eh.tag))
+  if (ef.tagged)
+  {
+    ifc = find_sub_interface (ifc,
+                              ef.vlan);
+    if (NULL == ifc)
+    {
+#if DEBUG
+      fprintf (stderr,
+               "No sub-interface for VLAN %u\n",
+               ef.vlan);
+#endif
+      return;
+    }
+  }
+  switch (ef.type)
   {
   case ETH_P_IPV4:
+    ipv4_input (ifc,
+                (char *) ef.payload,
+                ef.payload_size,
+                GLAB_FRAME_HEADROOM + (ef.payload - (const char *) frame));
+    break;
+  case ETH_P_MPLS:
     {
-      struct IPv4Header ip;
-
-      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct IPv4Header))
-        {
-          fprintf (stderr,
-                   "Malformed frame\n");
-          return;
-        }
-      memcpy (&ip,
-              &cframe[sizeof (struct EthernetHeader)],
-              sizeof (struct IPv4Header));
-      /* TODO: possibly do work here (ARP learning) */
-      route (ifc,
-             &ip,
-             &cframe[sizeof (struct EthernetHeader) + sizeof (struct IPv4Header)],
-             frame_size - sizeof (struct EthernetHeader) - sizeof (struct IPv4Header));
-      break;
+      char *ip = (char *) ef.payload;
+      size_t size = ef.payload_size;
+      size_t headroom = GLAB_FRAME_HEADROOM
+        + (ef.payload - (const char *) frame);
+
+      if (mpls_input (&ip,
+                      &size,
+                      &headroom))
+        ipv4_input (ifc,
+                    ip,
+                    size,
+                    headroom);
     }
+    break;
+  case ETH_P_IPV6:
+    route6 (ifc,
+            &ef.eh->src,
+            (char *) ef.payload,
+            ef.payload_size,
+            GLAB_FRAME_HEADROOM + (ef.payload - (const char *) frame));
+    break;
   case ETH_P_ARP:
+    if (ef.payload_size < sizeof (struct ArpHeaderEthernetIPv4))
     {
-      struct ArpHeaderEthernetIPv4 ah;
-
-      if (frame_size < sizeof (struct EthernetHeader) + sizeof (struct ArpHeaderEthernetIPv4))
-        {
 #if DEBUG
-          fprintf (stderr,
-                   "Unsupported ARP frame\n");
+      fprintf (stderr,
+               "Unsupported ARP frame\n");
 #endif
-          return;
-        }
-      memcpy (&ah,
-              &cframe[sizeof (struct EthernetHeader)],
-              sizeof (struct ArpHeaderEthernetIPv4));
-      handle_arp (ifc,
-                  &eh,
-                  &ah);
-      break;
+      return;
     }
+    handle_arp (ifc,
+                ef.eh,
+                ef.payload);
+    break;
   default:
 #if DEBUG
     fprintf (stderr,
              "Unsupported Ethernet tag %04X\n",
-             ntohs (eh.tag));
+             ef.type);
 #endif
     return;
   }
 }
 
 
-/**
- * Process frame received from @a interface.
- *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
- * @param frame_size number of bytes in @a frame
- */
-static void
-handle_frame (uint16_t interface,
-	      const void *frame,
-	      size_t frame_size)
-{
-  if (interface > num_ifc)
-    abort ();
-  parse_frame (&gifc[interface - 1],
-	       frame,
-	       frame_size);
-}
+GLAB_DEFINE_HANDLE_FRAME (num_phys, gphys[interface - 1], parse_frame)
 
 
 /**
- * Find network interface by @a name.
+ * Set the VLAN ID of @a ifc if its name is of the form "PARENT.VID".
  *
- * @param name name to look up by
- * @return NULL if @a name was not found
- */
-static struct Interface *
-find_interface (const char *name)
-{
-  for (unsigned int i=0;i<num_ifc;i++)
-    if (0 == strcasecmp (name,
-                         gifc[i].name))
-      return &gifc[i];
-  return NULL;
-}
-
-
-/**
- * The user entered an "arp" command.  The remaining
- * arguments can be obtained via 'strtok()'.
- */
-static void
-process_cmd_arp ()
-{
-  const char *tok = strtok (NULL, " ");
-  struct in_addr v4;
-  struct MacAddress mac;
-  struct Interface *ifc;
-
-  if (NULL == tok)
-    {
-      // print_arp_cache ();
-      return;
-    }
-  if (1 !=
-      inet_pton (AF_INET,
-                 tok,
-                 &v4))
-    {
-      fprintf (stderr,
-               "`%s' is not a valid IPv4 address\n",
-               tok);
-      return;
-    }
-  tok = strtok (NULL, " ");
-  if (NULL == tok)
-    {
-      fprintf (stderr,
-               "No network interface provided\n");
-      return;
-    }
-  ifc = find_interface (tok);
-  if (NULL == ifc)
-    {
-      fprintf (stderr,
-               "Interface `%s' unknown\n",
-               tok);
-      return;
-    }
-  /* TODO: do MAC lookup */
-}
-
-
-/**
- * Parse network specification in @a net, initializing @a network and @a netmask.
- * Format of @a net is "IP/NETMASK".
- *
- * @param network[out] network specification to initialize
- * @param netmask[out] netmask specification to initialize
- * @param arg interface specification to parse
+ * @param ifc[in,out] interface to update
  * @return 0 on success
  */
 static int
-parse_network (struct in_addr *network,
-               struct in_addr *netmask,
-               const char *net)
-{
-  const char *tok;
-  char *ip;
-  unsigned int mask;
-
-  tok = strchr (net, '/');
-  if (NULL == tok)
-    {
-      fprintf (stderr,
-               "Error in network specification: lacks '/'\n");
-      return 1;
-    }
-  ip = strndup (net,
-                tok - net);
-  if (1 !=
-      inet_pton (AF_INET,
-                 ip,
-                 network))
-    {
-      fprintf (stderr,
-               "IP address `%s' malformed\n",
-               ip);
-      free (ip);
-      return 1;
-    }
-  free (ip);
-  tok++;
-  if (1 !=
-      sscanf (tok,
-              "%u",
-              &mask))
-    {
-      fprintf (stderr,
-               "Netmask `%s' malformed\n",
-               tok);
-      return 1;
-    }
-  if (mask > 32)
-    {
-      fprintf (stderr,
-               "Netmask invalid (too large)\n");
-      return 1;
-    }
-  netmask->s_addr = htonl (~ (uint32_t) ((1LLU << (32 - mask)) - 1LLU));
-  return 0;
-}
-
-
-/**
- * Parse route from arguments in strtok() buffer.
- *
- * @param target_network[out] set to target network
- * @param target_netmask[out] set to target netmask
- * @param next_hop[out] set to next hop
- * @param ifc[out] set to target interface
- */
-static int
-parse_route (struct in_addr *target_network,
-             struct in_addr *target_netmask,
-             struct in_addr *next_hop,
-             struct Interface **ifc)
+parse_vlan_name (struct Interface *ifc)
 {
-  char *tok;
-
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != parse_network (target_network,
-                            target_netmask,
-                            tok)) )
-    {
-      fprintf (stderr,
-               "Expected network specification, not `%s'\n",
-               tok);
-      return 1;
-    }
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != strcasecmp ("via",
-                         tok)))
-    {
-      fprintf (stderr,
-               "Expected `via', not `%s'\n",
-               tok);
-      return 1;
-    }
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (1 != inet_pton (AF_INET,
-                        tok,
-                        next_hop)) )
-    {
-      fprintf (stderr,
-               "Expected next hop, not `%s'\n",
-               tok);
-      return 1;
-    }
-  tok = strtok (NULL, " ");
-  if ( (NULL == tok) ||
-       (0 != strcasecmp ("dev",
-                         tok)))
+  const char *dot = strchr (ifc->name, '.');
+  unsigned int vlan;
+
+  if (NULL == dot)
+    return 0;
+  if ( (1 != sscanf (dot + 1,
+                     "%u",
+                     &vlan)) ||
+       (0 == vlan) ||
+       (vlan > MAX_VLAN_ID) )
     {
       fprintf (stderr,
-               "Expected `dev', not `%s'\n",
-               tok);
-      return 1;
-    }
-  tok = strtok (NULL, " ");
-  *ifc = find_interface (tok);
-  if (NULL == *ifc)
-    {
-      fprintf (stderr,
-               "Interface `%s' unknown\n",
-               tok);
+               "Error in interface specification: invalid VLAN ID in `%s'\n",
+               ifc->name);
       return 1;
     }
+  ifc->vlan = (uint16_t) vlan;
   return 0;
 }
 
 
 /**
- * Add a route.
- */
-static void
-process_cmd_route_add ()
-{
-  struct in_addr target_network;
-  struct in_addr target_netmask;
-  struct in_addr next_hop;
-  struct Interface *ifc;
-
-  if (0 != parse_route (&target_network,
-                        &target_netmask,
-                        &next_hop,
-                        &ifc))
-    return;
-  /* TODO: Add routing table entry */
-}
-
-
-/**
- * Delete a route.
- */
-static void
-process_cmd_route_del ()
-{
-  struct in_addr target_network;
-  struct in_addr target_netmask;
-  struct in_addr next_hop;
-  struct Interface *ifc;
-
-  if (0 != parse_route (&target_network,
-                        &target_netmask,
-                        &next_hop,
-                        &ifc))
-    return;
-  /* TODO: Delete routing table entry */
-}
-
-
-/**
- * Print out the routing table.
- */
-static void
-process_cmd_route_list ()
-{
-  /* TODO: show routing table with 'print' */
-}
-
-
-/**
- * The user entered a "route" command.  The remaining
- * arguments can be obtained via 'strtok()'.
- */
-static void
-process_cmd_route ()
-{
-  char *subcommand = strtok (NULL, " ");
-
-  if (NULL == subcommand)
-    subcommand = "list";
-  if (0 == strcasecmp ("add",
-                       subcommand))
-    process_cmd_route_add ();
-  else if (0 == strcasecmp ("del",
-                            subcommand))
-    process_cmd_route_del ();
-  else if (0 == strcasecmp ("list",
-                            subcommand))
-    process_cmd_route_list ();
-  else
-    fprintf (stderr,
-             "Subcommand `%s' not understood\n",
-             subcommand);
-}
-
-
-/**
- * Parse network specification in @a net, initializing @a ifc.
- * Format of @a net is "IPV4:IP/NETMASK".
+ * Initialize @a ifc from interface @a ci of a configuration file.
  *
- * @param ifc[out] interface specification to initialize
- * @param arg interface specification to parse
+ * @param ifc[out] interface to initialize
+ * @param ci interface as found in the configuration
  * @return 0 on success
  */
 static int
-parse_network_arg (struct Interface *ifc,
-                   const char *net)
+init_interface_from_config (struct Interface *ifc,
+                            const struct ConfigInterface *ci)
 {
-  if (0 !=
-      strncasecmp (net,
-                   "IPV4:",
-                   strlen ("IPV4:")))
+  ifc->name = strdup (ci->name);
+  ifc->ip = ci->ip;
+  ifc->netmask = ci->netmask;
+  ifc->ip6 = ci->ip6;
+  ifc->prefix6_len = ci->prefix6_len;
+  ifc->tunnel_local = ci->tunnel_local;
+  ifc->tunnel_remote = ci->tunnel_remote;
+  if (0 != ifc->tunnel_remote.s_addr)
+    ifc->mtu = ci->mtu;
+  else
+    ifc->mtu = (0 == ci->mtu) ? 1500 : ci->mtu;
+  if ( (ci->mtu > UINT16_MAX) ||
+       ( (0 != ifc->mtu) &&
+         (ifc->mtu < 400) ) )
     {
       fprintf (stderr,
-               "Interface specification `%s' does not start with `IPV4:'\n",
-               net);
+               "Invalid MTU for interface `%s'\n",
+               ci->name);
       return 1;
     }
-  net += strlen ("IPV4:");
-  return parse_network (&ifc->ip,
-                        &ifc->netmask,
-                        net);
+  return parse_vlan_name (ifc);
 }
 
 
 /**
  * Parse interface specification @a arg and update @a ifc.  Format is
- * "IFCNAME[IPV4:IP/NETMASK]=MTU".  The "=MTU" is optional.
+ * "IFCNAME[IPV4:IP/NETMASK]=MTU".  The "=MTU" is optional.  An IPv6
+ * address can be given instead of or in addition to the IPv4 one, as
+ * in "IFCNAME[IPV4:IP/NETMASK,IPV6:IP6/LEN]".  A plain
+ * "IFCNAME" denotes a physical interface without an address.  If
+ * IFCNAME is of the form "PARENT.VID", the interface is a VLAN
+ * sub-interface of the physical interface PARENT for 802.1Q VLAN ID
+ * VID, like "eth1.24[IPV4:192.168.24.10/24]".  A "GRE:LOCAL:REMOTE"
+ * makes the interface a GRE tunnel from our address LOCAL to REMOTE,
+ * like "gre1[GRE:192.0.2.1:198.51.100.7,IPV4:10.255.0.1/30]"; its
+ * "=MTU" is an IPv4 MTU that only lowers the one derived from the
+ * interface towards REMOTE.
  *
  * @param ifc[out] interface specification to initialize
  * @param arg interface specification to parse
@@ -815,14 +668,24 @@ parse_cmd_arg (struct Interface *ifc,
 
   ifc->mtu = 1500; /* default in case unspecified */
   tok = strchr (arg, '[');
+  if (NULL == tok)
+    ifc->name = strdup (arg);
+  else
+    ifc->name = strndup (arg,
+                         tok - arg);
+  if (0 != parse_vlan_name (ifc))
+    return 1;
   if (NULL == tok)
     {
-      fprintf (stderr,
-               "Error in interface specification: lacks '['");
-      return 1;
+      if (0 != ifc->vlan)
+        {
+          fprintf (stderr,
+                   "Error in interface specification: sub-interface `%s' lacks '['\n",
+                   ifc->name);
+          return 1;
+        }
+      return 0;
     }
-  ifc->name = strndup (arg,
-                       tok - arg);
   arg = tok + 1;
   tok = strchr (arg, ']');
   if (NULL == tok)
@@ -833,14 +696,29 @@ parse_cmd_arg (struct Interface *ifc,
     }
   nspec = strndup (arg,
                    tok - arg);
-  if (0 !=
-      parse_network_arg (ifc,
-                         nspec))
-    {
-      free (nspec);
-      return 1;
-    }
+  for (char *net = strtok (nspec, ",");
+       NULL != net;
+       net = strtok (NULL, ","))
+    if (0 !=
+        ((0 == strncasecmp (net,
+                            "IPV6:",
+                            strlen ("IPV6:")))
+         ? parse_network6_arg (ifc,
+                               net)
+         : (0 == strncasecmp (net,
+                              "GRE:",
+                              strlen ("GRE:")))
+         ? gre_parse_arg (ifc,
+                          net)
+         : parse_network_arg (ifc,
+                              net)))
+      {
+        free (nspec);
+        return 1;
+      }
   free (nspec);
+  if (0 != ifc->tunnel_remote.s_addr)
+    ifc->mtu = 0;
   arg = tok + 1;
   if ('=' == arg[0])
     {
@@ -878,6 +756,277 @@ parse_cmd_arg (struct Interface *ifc,
 }
 
 
+/**
+ * Attach VLAN sub-interface @a sub to its physical interface,
+ * which must have been specified on the command line as well.
+ *
+ * @param phys_ifc physical interfaces, indexed by interface number minus one
+ * @param nphys number of entries in @a phys
+ * @param sub sub-interface to attach
+ * @return 0 on success
+ */
+static int
+attach_sub_interface (struct Interface **phys_ifc,
+                      unsigned int nphys,
+                      struct Interface *sub)
+{
+  size_t plen = strchr (sub->name, '.') - sub->name;
+
+  for (unsigned int i=0;i<nphys;i++)
+    {
+      struct Interface *phys = phys_ifc[i];
+
+      if ( (strlen (phys->name) != plen) ||
+           (0 != strncasecmp (phys->name,
+                              sub->name,
+                              plen)) )
+        continue;
+      if (NULL != find_sub_interface (phys,
+                                      sub->vlan))
+        {
+          fprintf (stderr,
+                   "Duplicate sub-interface `%s'\n",
+                   sub->name);
+          return 1;
+        }
+      sub->ifc_num = phys->ifc_num;
+      sub->mac = phys->mac;
+      sub->sub_next = phys->sub_head;
+      phys->sub_head = sub;
+      return 0;
+    }
+  fprintf (stderr,
+           "Physical interface for sub-interface `%s' not specified\n",
+           sub->name);
+  return 1;
+}
+
+
+/**
+ * Add the routes derived from the interface configuration: the
+ * directly connected IPv4 and IPv6 networks of all interfaces and
+ * the gateways given in @a cfg.
+ *
+ * @param cfg configuration the interfaces were built from, its
+ *        interfaces must be in the same order as #gifc
+ */
+static void
+add_configured_routes (const struct Config *cfg)
+{
+  struct in_addr any = { .s_addr = 0 };
+
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    struct Interface *p = &gifc[i];
+
+    if (0 != p->ip.s_addr)
+      add_route (p->ip,
+                 p->netmask,
+                 any,
+                 p,
+                 true);
+  }
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+    if (0 != cfg->ifcs[i].gateway.s_addr)
+      add_route (any,
+                 any,
+                 cfg->ifcs[i].gateway,
+                 &gifc[i],
+                 true);
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    struct Interface *p = &gifc[i];
+    struct in6_addr network;
+
+    if (IN6_IS_ADDR_UNSPECIFIED (&p->ip6))
+      continue;
+    ipv6_from_u128 (ipv6_to_u128 (&p->ip6) & ipv6_mask (p->prefix6_len),
+                    &network);
+    add_route6 (&network,
+                p->prefix6_len,
+                &in6addr_any,
+                p,
+                true);
+  }
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+    if (! IN6_IS_ADDR_UNSPECIFIED (&cfg->ifcs[i].gateway6))
+      add_route6 (&in6addr_any,
+                  0,
+                  &cfg->ifcs[i].gateway6,
+                  &gifc[i],
+                  true);
+  lpm6_rebuild ();
+}
+
+
+/**
+ * Build the interfaces for a configuration reload.  Physical
+ * interfaces cannot be added or removed at runtime (their numbers
+ * are assigned by our parent), VLAN sub-interfaces and GRE tunnels
+ * can.
+ *
+ * @param cfg the new configuration
+ * @param nifc[out] interfaces to initialize, one per interface of @a cfg
+ * @param nphys[out] physical interfaces, indexed by interface number minus one
+ * @param[out] changed set to the number of added, removed or modified interfaces
+ * @return 0 on success
+ */
+static int
+build_reload_interfaces (const struct Config *cfg,
+                         struct Interface *nifc,
+                         struct Interface **nphys,
+                         unsigned int *changed)
+{
+  unsigned int nnum_phys = 0;
+
+  *changed = 0;
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+  {
+    struct Interface *n = &nifc[i];
+    const struct Interface *o;
+
+    if (0 != init_interface_from_config (n,
+                                         &cfg->ifcs[i]))
+      return 1;
+    o = find_interface (n->name);
+    n->ifc_index = (NULL == o) ? ++last_ifc_index : o->ifc_index;
+    if ( (NULL == o) ||
+         (o->ip.s_addr != n->ip.s_addr) ||
+         (o->netmask.s_addr != n->netmask.s_addr) ||
+         (! IN6_ARE_ADDR_EQUAL (&o->ip6,
+                                &n->ip6)) ||
+         (o->prefix6_len != n->prefix6_len) ||
+         (o->mtu != n->mtu) ||
+         (o->tunnel_local.s_addr != n->tunnel_local.s_addr) ||
+         (o->tunnel_remote.s_addr != n->tunnel_remote.s_addr) )
+      (*changed)++;
+    if ( (0 != n->vlan) ||
+         (0 != n->tunnel_remote.s_addr) )
+      continue;
+    if ( (NULL == o) ||
+         (0 == o->ifc_num) )
+    {
+      fprintf (stderr,
+               "Cannot add physical interface `%s' at runtime\n",
+               n->name);
+      return 1;
+    }
+    if (NULL != nphys[o->ifc_num - 1])
+    {
+      fprintf (stderr,
+               "Duplicate interface `%s'\n",
+               n->name);
+      return 1;
+    }
+    n->ifc_num = o->ifc_num;
+    n->mac = o->mac;
+    nphys[n->ifc_num - 1] = n;
+    nnum_phys++;
+  }
+  if (nnum_phys != num_phys)
+  {
+    fprintf (stderr,
+             "Cannot remove physical interfaces at runtime\n");
+    return 1;
+  }
+  for (unsigned int i=0;i<cfg->num_ifcs;i++)
+    if ( (0 != nifc[i].vlan) &&
+         (0 != attach_sub_interface (nphys,
+                                     nnum_phys,
+                                     &nifc[i])) )
+      return 1;
+  if (0 != gre_check (nifc,
+                      cfg->num_ifcs))
+    return 1;
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    bool found = false;
+
+    for (unsigned int j=0;j<cfg->num_ifcs;j++)
+      if (0 == strcasecmp (gifc[i].name,
+                           nifc[j].name))
+        found = true;
+    if (! found)
+      (*changed)++;
+  }
+  return 0;
+}
+
+
+/**
+ * The user entered a "reload" command: load the interfaces file
+ * given as argument and apply the differences to the running
+ * configuration.  Nothing is changed unless the new configuration
+ * is valid.  Routes and ARP cache entries of unaffected interfaces
+ * are kept.  As control messages are processed between frames, the
+ * new configuration takes effect atomically for the next frame.
+ */
+static void
+process_cmd_reload ()
+{
+  const char *filename = strtok (NULL, " ");
+  struct Config cfg;
+  struct Interface *nifc;
+  struct Interface **nphys;
+  unsigned int changed;
+
+  if (NULL == filename)
+    {
+      fprintf (stderr,
+               "Usage: reload FILENAME\n");
+      return;
+    }
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  nifc = NULL;
+  nphys = NULL;
+  if ( (0 != config_load (filename,
+                          &cfg)) ||
+       (NULL == (nifc = alloc_interfaces (cfg.num_ifcs + 1))) ||
+       (NULL == (nphys = calloc (num_phys + 1,
+                                 sizeof (struct Interface *)))) ||
+       (0 != build_reload_interfaces (&cfg,
+                                      nifc,
+                                      nphys,
+                                      &changed)) )
+    {
+      if (NULL != nifc)
+        for (unsigned int i=0;i<cfg.num_ifcs;i++)
+          free (nifc[i].name);
+      free (nifc);
+      free (nphys);
+      config_free (&cfg);
+      fprintf (stderr,
+               "Configuration `%s' not applied\n",
+               filename);
+      return;
+    }
+  ipv4_rebind (nifc,
+               cfg.num_ifcs);
+  ipv6_rebind (nifc,
+               cfg.num_ifcs);
+  acl_rebind (nifc,
+              cfg.num_ifcs);
+  nat_rebind (nifc,
+              cfg.num_ifcs);
+  mpls_rebind (nifc,
+               cfg.num_ifcs);
+  for (unsigned int i=0;i<num_ifc;i++)
+    free (gifc[i].name);
+  free (gifc);
+  free (gphys);
+  gifc = nifc;
+  num_ifc = cfg.num_ifcs;
+  gphys = nphys;
+  add_configured_routes (&cfg);
+  config_free (&cfg);
+  print ("Reloaded `%s', %u interface(s) changed\n",
+         filename,
+         changed);
+}
+
+
 /**
  * Handle control message @a cmd.
  *
@@ -901,6 +1050,33 @@ handle_control (char *cmd,
   else if (0 == strcasecmp (tok,
 			    "route"))
     process_cmd_route ();
+  else if (0 == strcasecmp (tok,
+			    "ndp"))
+    process_cmd_ndp ();
+  else if (0 == strcasecmp (tok,
+			    "route6"))
+    process_cmd_route6 ();
+  else if (0 == strcasecmp (tok,
+			    "reload"))
+    process_cmd_reload ();
+  else if (0 == strcasecmp (tok,
+			    "flow"))
+    process_cmd_flow ();
+  else if (0 == strcasecmp (tok,
+			    "acl"))
+    process_cmd_acl ();
+  else if (0 == strcasecmp (tok,
+			    "nat"))
+    process_cmd_nat ();
+  else if (0 == strcasecmp (tok,
+			    "gre"))
+    process_cmd_gre ();
+  else if (0 == strcasecmp (tok,
+			    "mpls"))
+    process_cmd_mpls ();
+  else if (0 == strcasecmp (tok,
+			    "memory"))
+    huge_report (false);
   else
     fprintf (stderr,
 	     "Unsupported command `%s'\n",
@@ -918,45 +1094,124 @@ static void
 handle_mac (uint16_t ifc_num,
 	    const struct MacAddress *mac)
 {
-  if (ifc_num > num_ifc)
+  struct Interface *phys;
+
+  if (ifc_num > num_phys)
     abort ();
-  gifc[ifc_num - 1].mac = *mac;
+  phys = gphys[ifc_num - 1];
+  phys->mac = *mac;
+  for (struct Interface *sub = phys->sub_head;
+       NULL != sub;
+       sub = sub->sub_next)
+    sub->mac = *mac;
 }
 
 
+/**
+ * Let flows time out while no packets arrive, see flow.c.
+ */
+#define GLAB_IDLE() flow_idle ()
+
 #include "loop.c"
 
 
 /**
- * Launches the router.
+ * Launches the router.  Physical interfaces are numbered in the
+ * order given, VLAN sub-interfaces ("PARENT.VID") do not consume
+ * an interface number but share the one of PARENT, GRE tunnels
+ * have none.
  *
  * @param argc number of arguments in @a argv
- * @param argv binary name, followed by list of interfaces to switch between
+ * @param argv binary name, followed by list of interfaces to switch between,
+ *        or "-c" followed by a list of interfaces files to load
  * @return not really
  */
 int
 main (int argc,
       char **argv)
 {
-  struct Interface ifc[argc];
-
-  memset (ifc,
-	  0,
-	  sizeof (ifc));
-  num_ifc = argc - 1;
+  struct Config cfg;
+  struct Interface *ifc;
+  bool use_config;
+
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  use_config = (argc > 2) && (0 == strcmp (argv[1],
+                                           "-c"));
+  if (use_config)
+  {
+    for (int i=2;i<argc;i++)
+      if (0 != config_load (argv[i],
+                            &cfg))
+        return 1;
+    num_ifc = cfg.num_ifcs;
+  }
+  else
+  {
+    num_ifc = argc - 1;
+  }
+  ifc = alloc_interfaces (num_ifc + 1);
+  gphys = calloc (num_ifc + 1,
+                  sizeof (struct Interface *));
+  if ( (NULL == ifc) ||
+       (NULL == gphys) )
+  {
+    perror ("calloc");
+    return 1;
+  }
   gifc = ifc;
-  for (unsigned int i=1;i<argc;i++)
+  num_phys = 0;
+  for (unsigned int i=0;i<num_ifc;i++)
   {
-    struct Interface *p = &ifc[i-1];
+    struct Interface *p = &ifc[i];
 
-    ifc[i-1].ifc_num = i;
     if (0 !=
-        parse_cmd_arg (p,
-                       argv[i]))
+        (use_config
+         ? init_interface_from_config (p,
+                                       &cfg.ifcs[i])
+         : parse_cmd_arg (p,
+                          argv[i + 1])))
+      abort ();
+    p->ifc_index = ++last_ifc_index;
+    if ( (0 == p->vlan) &&
+         (0 == p->tunnel_remote.s_addr) )
+    {
+      gphys[num_phys++] = p;
+      p->ifc_num = num_phys;
+    }
+  }
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    struct Interface *p = &ifc[i];
+
+    if ( (0 != p->vlan) &&
+         (0 != attach_sub_interface (gphys,
+                                     num_phys,
+                                     p)) )
       abort ();
   }
+  if (0 != gre_check (ifc,
+                      num_ifc))
+    abort ();
+  add_configured_routes (&cfg);
+  config_free (&cfg);
+  huge_report (true);
   loop ();
-  for (unsigned int i=1;i<argc;i++)
-    free (ifc[i-1].name);
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    free (gifc[i].name);
+    acl_free (gifc[i].acl_in);
+    acl_free (gifc[i].acl_out);
+  }
+  nat_disable ();
+  mpls_disable ();
+  free (gifc);
+  free (gphys);
+  free (routes);
+  free (arp_cache);
+  free (routes6);
+  free (ndp_cache);
+  huge_free (lpm6_nodes);
   return 0;
 }
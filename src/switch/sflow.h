@@ -0,0 +1,1035 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * @file sflow.h
+ * @brief sFlow-style 1-in-N packet sampling and counter export
+ * @author Christian Grothoff
+ *
+ * Compiled in by programs that define GLAB_SFLOW to 1 before
+ * including packet.h (switch, vswitch and router); it is idle until
+ * enabled with the control command
+ *
+ *   sflow RATE TARGET [INTERVAL]
+ *
+ * which samples on average one in RATE received frames (the skip
+ * between samples is drawn uniformly from [1, 2 * RATE - 1]) and
+ * exports the first #SFLOW_HEADER_SIZE bytes of each, plus the
+ * per-interface counters every INTERVAL seconds (default 20), to
+ * TARGET.  TARGET is a file (opened for appending) or "unix:PATH"
+ * for a datagram or stream UNIX domain socket.  "sflow off" stops
+ * the export, "sflow" shows the current settings.
+ *
+ * The main loop only counts, decides whether to sample and copies
+ * the header into a single-producer/single-consumer ring; encoding
+ * and writing is done by a background thread, which must never touch
+ * STDOUT (that is where our frames go).  If the ring is full the
+ * sample is dropped and counted in the "drops" field.
+ *
+ * Records are encoded like sFlow version 5 (XDR, big-endian):
+ * datagrams of up to #SFLOW_MAX_SAMPLES flow samples (with a raw
+ * Ethernet header record) or counter samples (with a generic
+ * interface counters record); ifIndex is the interface number.
+ * On files and stream sockets each datagram is preceded by its
+ * length as a 32-bit big-endian integer.
+ */
+
+#ifndef GLAB_SFLOW_H
+#define GLAB_SFLOW_H
+
+#ifndef GLAB_SFLOW
+#define GLAB_SFLOW 0
+#endif
+
+#if GLAB_SFLOW
+
+#include <pthread.h>
+#include <sys/un.h>
+
+
+/**
+ * Number of bytes of each sampled frame we export.
+ */
+#define SFLOW_HEADER_SIZE 128
+
+/**
+ * Number of samples the ring between the main loop and the
+ * export thread can hold (must be a power of two).
+ */
+#define SFLOW_RING_SIZE 512
+
+/**
+ * Maximum number of samples per exported datagram.
+ */
+#define SFLOW_MAX_SAMPLES 8
+
+/**
+ * Maximum size of an exported datagram.
+ */
+#define SFLOW_DATAGRAM_SIZE 2048
+
+/**
+ * Default number of seconds between counter samples.
+ */
+#define SFLOW_DEFAULT_INTERVAL 20
+
+/**
+ * How long the export thread sleeps between draining the ring (in ns).
+ */
+#define SFLOW_POLL_NS (100 * 1000 * 1000)
+
+
+/**
+ * Traffic counters for one direction of an interface.  Only
+ * written by the main loop, read by the export thread.
+ */
+struct SflowDirection
+{
+  uint64_t octets;
+  uint64_t ucast;
+  uint64_t mcast;
+  uint64_t bcast;
+};
+
+
+/**
+ * Per-interface sampling state.
+ */
+struct SflowSource
+{
+  /**
+   * Frames received.
+   */
+  struct SflowDirection in;
+
+  /**
+   * Frames sent.
+   */
+  struct SflowDirection out;
+
+  /**
+   * Frames received since sampling was enabled (sFlow "sample_pool").
+   * Main loop only.
+   */
+  uint32_t pool;
+
+  /**
+   * Samples lost because the ring was full.  Main loop only.
+   */
+  uint32_t drops;
+
+  /**
+   * Sequence number of the last flow sample.  Export thread only.
+   */
+  uint32_t flow_seq;
+
+  /**
+   * Sequence number of the last counter sample.  Export thread only.
+   */
+  uint32_t counter_seq;
+};
+
+
+/**
+ * A sampled frame on its way to the export thread.
+ */
+struct SflowSample
+{
+  uint32_t frame_size;
+  uint32_t rate;
+  uint32_t pool;
+  uint32_t drops;
+  uint16_t ifc_num;
+  uint16_t header_size;
+  uint8_t header[SFLOW_HEADER_SIZE];
+};
+
+
+/**
+ * A datagram being assembled by the export thread.
+ */
+struct SflowDatagram
+{
+  char buf[SFLOW_DATAGRAM_SIZE];
+  size_t off;
+  uint32_t num_samples;
+};
+
+
+/**
+ * Per-interface state, indexed by interface number - 1.
+ */
+static struct SflowSource *sflow_src;
+
+/**
+ * Number of entries in #sflow_src.
+ */
+static unsigned int sflow_num_ifc;
+
+/**
+ * Samples handed from the main loop to the export thread.
+ */
+static struct SflowSample sflow_ring[SFLOW_RING_SIZE];
+
+/**
+ * Number of samples ever added to #sflow_ring (main loop).
+ */
+static unsigned int sflow_head;
+
+/**
+ * Number of samples ever taken out of #sflow_ring (export thread).
+ */
+static unsigned int sflow_tail;
+
+/**
+ * Sampling rate, 0 if sampling is off.
+ */
+static uint32_t sflow_rate;
+
+/**
+ * Frames to go until the next sample.
+ */
+static uint32_t sflow_skip;
+
+/**
+ * State of the xorshift generator for #sflow_skip.
+ */
+static uint32_t sflow_rand;
+
+/**
+ * Total number of samples taken since sampling was enabled.
+ */
+static uint64_t sflow_samples;
+
+/**
+ * Seconds between counter samples.
+ */
+static unsigned int sflow_interval;
+
+/**
+ * Where we export to, -1 if sampling is off.
+ */
+static int sflow_fd = -1;
+
+/**
+ * Is #sflow_fd a datagram socket (no length prefix needed)?
+ */
+static bool sflow_dgram;
+
+/**
+ * Is #sflow_fd a socket (as opposed to a file)?
+ */
+static bool sflow_socket;
+
+/**
+ * Set by the export thread if writing to a file or stream failed.
+ */
+static bool sflow_broken;
+
+/**
+ * Number of datagrams the export thread failed to deliver.
+ */
+static uint64_t sflow_export_errors;
+
+/**
+ * Tells the export thread to finish.
+ */
+static bool sflow_stop;
+
+/**
+ * The export thread.
+ */
+static pthread_t sflow_thread;
+
+/**
+ * Name of what we export to.
+ */
+static char *sflow_target;
+
+/**
+ * When sflow_init() was called, for the datagram "uptime".
+ */
+static struct timespec sflow_boot;
+
+
+/**
+ * Update @a field, which the export thread may be reading.
+ */
+#define SFLOW_ADD(field, n) \
+  __atomic_store_n (&(field), (field) + (n), __ATOMIC_RELAXED)
+
+
+/**
+ * Allocate the per-interface state.  Called by loop() once
+ * the number of interfaces is known.
+ *
+ * @param num_ifc number of interfaces
+ */
+static void
+sflow_init (unsigned int num_ifc)
+{
+  sflow_src = calloc (num_ifc,
+                      sizeof (struct SflowSource));
+  if (NULL == sflow_src)
+  {
+    fprintf (stderr,
+             "Failed to allocate sFlow state\n");
+    exit (1);
+  }
+  sflow_num_ifc = num_ifc;
+  clock_gettime (CLOCK_MONOTONIC,
+                 &sflow_boot);
+  sflow_rand = (uint32_t) getpid () ^ (uint32_t) sflow_boot.tv_nsec;
+  if (0 == sflow_rand)
+    sflow_rand = 1;
+}
+
+
+/**
+ * Count a frame of @a frame_size bytes in @a dir.
+ *
+ * @param dir counters to update
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+sflow_count (struct SflowDirection *dir,
+             const void *frame,
+             size_t frame_size)
+{
+  const uint8_t *dst = frame;
+
+  SFLOW_ADD (dir->octets, frame_size);
+  if (frame_size < MAC_ADDR_SIZE)
+    return;
+  if (0 == (dst[0] & 1))
+    SFLOW_ADD (dir->ucast, 1);
+  else if ( (0xFF == dst[0]) &&
+            (0xFF == dst[1]) &&
+            (0xFF == dst[2]) &&
+            (0xFF == dst[3]) &&
+            (0xFF == dst[4]) &&
+            (0xFF == dst[5]) )
+    SFLOW_ADD (dir->bcast, 1);
+  else
+    SFLOW_ADD (dir->mcast, 1);
+}
+
+
+/**
+ * Draw the number of frames until the next sample, uniformly
+ * from [1, 2 * #sflow_rate - 1] so that the mean is #sflow_rate.
+ *
+ * @return number of frames to skip
+ */
+static inline uint32_t
+sflow_next_skip (void)
+{
+  uint32_t x = sflow_rand;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sflow_rand = x;
+  return 1 + x % (2 * sflow_rate - 1);
+}
+
+
+/**
+ * Copy the start of @a frame into the ring for the export thread.
+ *
+ * @param ifc_num interface the frame was received on
+ * @param src state of that interface
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+sflow_take_sample (uint16_t ifc_num,
+                   struct SflowSource *src,
+                   const void *frame,
+                   size_t frame_size)
+{
+  unsigned int head = sflow_head;
+  struct SflowSample *s;
+
+  if (head - __atomic_load_n (&sflow_tail,
+                              __ATOMIC_ACQUIRE) == SFLOW_RING_SIZE)
+  {
+    src->drops++;
+    return;
+  }
+  s = &sflow_ring[head % SFLOW_RING_SIZE];
+  s->ifc_num = ifc_num;
+  s->frame_size = frame_size;
+  s->rate = sflow_rate;
+  s->pool = src->pool;
+  s->drops = src->drops;
+  s->header_size = (frame_size < SFLOW_HEADER_SIZE)
+    ? frame_size
+    : SFLOW_HEADER_SIZE;
+  memcpy (s->header,
+          frame,
+          s->header_size);
+  sflow_samples++;
+  __atomic_store_n (&sflow_head,
+                    head + 1,
+                    __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Account for a frame received on @a ifc_num and sample it
+ * if its turn has come.
+ *
+ * @param ifc_num interface the frame was received on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+sflow_ingress (uint16_t ifc_num,
+               const void *frame,
+               size_t frame_size)
+{
+  struct SflowSource *src;
+
+  if ( (0 == ifc_num) ||
+       (ifc_num > sflow_num_ifc) )
+    return;
+  src = &sflow_src[ifc_num - 1];
+  sflow_count (&src->in,
+               frame,
+               frame_size);
+  if (0 == sflow_rate)
+    return;
+  src->pool++;
+  if (0 != --sflow_skip)
+    return;
+  sflow_skip = sflow_next_skip ();
+  sflow_take_sample (ifc_num,
+                     src,
+                     frame,
+                     frame_size);
+}
+
+
+/**
+ * Account for a frame sent on @a ifc_num.
+ *
+ * @param ifc_num interface the frame is sent on
+ * @param frame the frame
+ * @param frame_size number of bytes in @a frame
+ */
+static inline void
+sflow_egress (uint16_t ifc_num,
+              const void *frame,
+              size_t frame_size)
+{
+  if ( (0 == ifc_num) ||
+       (ifc_num > sflow_num_ifc) )
+    return;
+  sflow_count (&sflow_src[ifc_num - 1].out,
+               frame,
+               frame_size);
+}
+
+
+/**
+ * Append @a v to @a d in XDR (big-endian) encoding.
+ *
+ * @param d datagram to append to
+ * @param v value to append
+ */
+static void
+sflow_put32 (struct SflowDatagram *d,
+             uint32_t v)
+{
+  uint32_t n = htonl (v);
+
+  memcpy (&d->buf[d->off],
+          &n,
+          sizeof (n));
+  d->off += sizeof (n);
+}
+
+
+/**
+ * Append @a v to @a d in XDR (big-endian) encoding.
+ *
+ * @param d datagram to append to
+ * @param v value to append
+ */
+static void
+sflow_put64 (struct SflowDatagram *d,
+             uint64_t v)
+{
+  sflow_put32 (d,
+               (uint32_t) (v >> 32));
+  sflow_put32 (d,
+               (uint32_t) v);
+}
+
+
+/**
+ * Store the number of bytes appended to @a d since @a start
+ * in the length field just before @a start.
+ *
+ * @param d datagram being assembled
+ * @param start offset just after the length field
+ */
+static void
+sflow_patch_length (struct SflowDatagram *d,
+                    size_t start)
+{
+  uint32_t n = htonl (d->off - start);
+
+  memcpy (&d->buf[start - sizeof (n)],
+          &n,
+          sizeof (n));
+}
+
+
+/**
+ * Start a new datagram in @a d.
+ *
+ * @param d datagram to initialize
+ */
+static void
+sflow_begin (struct SflowDatagram *d)
+{
+  static uint32_t seq;
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC,
+                 &now);
+  d->off = 0;
+  d->num_samples = 0;
+  sflow_put32 (d, 5);                 /* version */
+  sflow_put32 (d, 1);                 /* agent address type: IPv4 */
+  sflow_put32 (d, 0);                 /* agent address: unknown */
+  sflow_put32 (d, 0);                 /* sub-agent */
+  sflow_put32 (d, ++seq);
+  sflow_put32 (d,
+               (now.tv_sec - sflow_boot.tv_sec) * 1000
+               + (now.tv_nsec - sflow_boot.tv_nsec) / 1000000);
+  sflow_put32 (d, 0);                 /* number of samples, see sflow_end() */
+}
+
+
+/**
+ * Finish the datagram in @a d and export it, unless it is empty.
+ *
+ * @param d datagram to send
+ */
+static void
+sflow_end (struct SflowDatagram *d)
+{
+  uint32_t n;
+  size_t off;
+
+  if ( (0 == d->num_samples) ||
+       sflow_broken)
+    return;
+  n = htonl (d->num_samples);
+  memcpy (&d->buf[6 * sizeof (uint32_t)],
+          &n,
+          sizeof (n));
+  if (sflow_dgram)
+  {
+    if (-1 == send (sflow_fd,
+                    d->buf,
+                    d->off,
+                    MSG_NOSIGNAL))
+      __atomic_add_fetch (&sflow_export_errors,
+                          1,
+                          __ATOMIC_RELAXED);
+    return;
+  }
+  n = htonl (d->off);
+  {
+    /* fixed size rather than a VLA, d->off is bounded by the buffer */
+    char out[sizeof (n) + sizeof (d->buf)];
+    size_t len = sizeof (n) + d->off;
+
+    memcpy (out,
+            &n,
+            sizeof (n));
+    memcpy (&out[sizeof (n)],
+            d->buf,
+            d->off);
+    off = 0;
+    while (off < len)
+    {
+      ssize_t ret;
+
+      if (sflow_socket)
+        ret = send (sflow_fd,
+                    &out[off],
+                    len - off,
+                    MSG_NOSIGNAL);
+      else
+        ret = write (sflow_fd,
+                     &out[off],
+                     len - off);
+      if (ret <= 0)
+      {
+        fprintf (stderr,
+                 "sFlow export to `%s' failed: %s\n",
+                 sflow_target,
+                 strerror (errno));
+        __atomic_add_fetch (&sflow_export_errors,
+                            1,
+                            __ATOMIC_RELAXED);
+        __atomic_store_n (&sflow_broken,
+                          true,
+                          __ATOMIC_RELAXED);
+        return;
+      }
+      off += ret;
+    }
+  }
+}
+
+
+/**
+ * Add @a s as a flow sample to @a d, flushing @a d first if full.
+ *
+ * @param d datagram being assembled
+ * @param s sample to add
+ */
+static void
+sflow_add_flow (struct SflowDatagram *d,
+                const struct SflowSample *s)
+{
+  struct SflowSource *src = &sflow_src[s->ifc_num - 1];
+  size_t sample_start;
+  size_t record_start;
+
+  if (SFLOW_MAX_SAMPLES == d->num_samples)
+  {
+    sflow_end (d);
+    sflow_begin (d);
+  }
+  sflow_put32 (d, 1);                 /* flow_sample */
+  sflow_put32 (d, 0);
+  sample_start = d->off;
+  sflow_put32 (d, ++src->flow_seq);
+  sflow_put32 (d, s->ifc_num);        /* source_id */
+  sflow_put32 (d, s->rate);
+  sflow_put32 (d, s->pool);
+  sflow_put32 (d, s->drops);
+  sflow_put32 (d, s->ifc_num);        /* input */
+  sflow_put32 (d, 0);                 /* output: unknown at ingress */
+  sflow_put32 (d, 1);                 /* number of records */
+  sflow_put32 (d, 1);                 /* raw packet header */
+  sflow_put32 (d, 0);
+  record_start = d->off;
+  sflow_put32 (d, 1);                 /* header protocol: Ethernet */
+  sflow_put32 (d, s->frame_size);
+  sflow_put32 (d, 0);                 /* bytes stripped: no FCS to strip */
+  sflow_put32 (d, s->header_size);
+  memcpy (&d->buf[d->off],
+          s->header,
+          s->header_size);
+  d->off += s->header_size;
+  while (0 != (d->off % 4))
+    d->buf[d->off++] = 0;
+  sflow_patch_length (d,
+                      record_start);
+  sflow_patch_length (d,
+                      sample_start);
+  d->num_samples++;
+}
+
+
+/**
+ * Add a counter sample for interface @a ifc_num to @a d,
+ * flushing @a d first if full.
+ *
+ * @param d datagram being assembled
+ * @param ifc_num interface to report
+ */
+static void
+sflow_add_counters (struct SflowDatagram *d,
+                    uint16_t ifc_num)
+{
+  struct SflowSource *src = &sflow_src[ifc_num - 1];
+  size_t sample_start;
+
+  if (SFLOW_MAX_SAMPLES == d->num_samples)
+  {
+    sflow_end (d);
+    sflow_begin (d);
+  }
+  sflow_put32 (d, 2);                 /* counters_sample */
+  sflow_put32 (d, 0);
+  sample_start = d->off;
+  sflow_put32 (d, ++src->counter_seq);
+  sflow_put32 (d, ifc_num);           /* source_id */
+  sflow_put32 (d, 1);                 /* number of records */
+  sflow_put32 (d, 1);                 /* generic interface counters */
+  sflow_put32 (d, 88);
+  sflow_put32 (d, ifc_num);           /* ifIndex */
+  sflow_put32 (d, 6);                 /* ifType: ethernetCsmacd */
+  sflow_put64 (d, 0);                 /* ifSpeed: unknown */
+  sflow_put32 (d, 0);                 /* ifDirection: unknown */
+  sflow_put32 (d, 3);                 /* ifStatus: admin and oper up */
+  sflow_put64 (d, __atomic_load_n (&src->in.octets, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->in.ucast, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->in.mcast, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->in.bcast, __ATOMIC_RELAXED));
+  sflow_put32 (d, 0);                 /* ifInDiscards */
+  sflow_put32 (d, 0);                 /* ifInErrors */
+  sflow_put32 (d, 0);                 /* ifInUnknownProtos */
+  sflow_put64 (d, __atomic_load_n (&src->out.octets, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->out.ucast, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->out.mcast, __ATOMIC_RELAXED));
+  sflow_put32 (d, __atomic_load_n (&src->out.bcast, __ATOMIC_RELAXED));
+  sflow_put32 (d, 0);                 /* ifOutDiscards */
+  sflow_put32 (d, 0);                 /* ifOutErrors */
+  sflow_put32 (d, 0);                 /* ifPromiscuousMode */
+  sflow_patch_length (d,
+                      sample_start);
+  d->num_samples++;
+}
+
+
+/**
+ * Export all samples currently in the ring.
+ */
+static void
+sflow_drain (void)
+{
+  struct SflowDatagram d;
+  unsigned int head;
+
+  head = __atomic_load_n (&sflow_head,
+                          __ATOMIC_ACQUIRE);
+  if (head == sflow_tail)
+    return;
+  sflow_begin (&d);
+  while (sflow_tail != head)
+  {
+    sflow_add_flow (&d,
+                    &sflow_ring[sflow_tail % SFLOW_RING_SIZE]);
+    __atomic_store_n (&sflow_tail,
+                      sflow_tail + 1,
+                      __ATOMIC_RELEASE);
+  }
+  sflow_end (&d);
+}
+
+
+/**
+ * Export the counters of all interfaces.
+ */
+static void
+sflow_export_counters (void)
+{
+  struct SflowDatagram d;
+
+  sflow_begin (&d);
+  for (unsigned int i = 1; i <= sflow_num_ifc; i++)
+    sflow_add_counters (&d,
+                        i);
+  sflow_end (&d);
+}
+
+
+/**
+ * Main function of the export thread.
+ *
+ * @param cls unused
+ * @return NULL
+ */
+static void *
+sflow_run (void *cls)
+{
+  const struct timespec poll = {
+    .tv_nsec = SFLOW_POLL_NS
+  };
+  struct timespec last;
+  struct timespec now;
+
+  (void) cls;
+  clock_gettime (CLOCK_MONOTONIC,
+                 &last);
+  while (! __atomic_load_n (&sflow_stop,
+                            __ATOMIC_ACQUIRE))
+  {
+    nanosleep (&poll,
+               NULL);
+    sflow_drain ();
+    clock_gettime (CLOCK_MONOTONIC,
+                   &now);
+    if (now.tv_sec - last.tv_sec >= (time_t) sflow_interval)
+    {
+      sflow_export_counters ();
+      last = now;
+    }
+  }
+  sflow_drain ();
+  return NULL;
+}
+
+
+/**
+ * Stop sampling and the export thread.
+ */
+static void
+sflow_disable (void)
+{
+  if (-1 == sflow_fd)
+    return;
+  sflow_rate = 0;
+  __atomic_store_n (&sflow_stop,
+                    true,
+                    __ATOMIC_RELEASE);
+  pthread_join (sflow_thread,
+                NULL);
+  close (sflow_fd);
+  sflow_fd = -1;
+  free (sflow_target);
+  sflow_target = NULL;
+}
+
+
+/**
+ * Open @a target for export, see the file comment for the syntax.
+ *
+ * @param target where to export to
+ * @return file descriptor, -1 on error (reported to stderr)
+ */
+static int
+sflow_open (const char *target)
+{
+  struct sockaddr_un un;
+  const char *path;
+  int fd;
+
+  sflow_dgram = false;
+  sflow_socket = false;
+  if (0 != strncasecmp (target,
+                        "unix:",
+                        strlen ("unix:")))
+  {
+    fd = open (target,
+               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+               0644);
+    if (-1 == fd)
+      fprintf (stderr,
+               "Failed to open `%s': %s\n",
+               target,
+               strerror (errno));
+    return fd;
+  }
+  path = &target[strlen ("unix:")];
+  if (strlen (path) >= sizeof (un.sun_path))
+  {
+    fprintf (stderr,
+             "UNIX socket path `%s' too long\n",
+             path);
+    return -1;
+  }
+  memset (&un,
+          0,
+          sizeof (un));
+  un.sun_family = AF_UNIX;
+  strcpy (un.sun_path,
+          path);
+  sflow_socket = true;
+  sflow_dgram = true;
+  fd = socket (AF_UNIX,
+               SOCK_DGRAM | SOCK_CLOEXEC,
+               0);
+  if ( (-1 != fd) &&
+       (0 == connect (fd,
+                      (const struct sockaddr *) &un,
+                      sizeof (un))) )
+    return fd;
+  if (-1 != fd)
+    close (fd);
+  sflow_dgram = false;
+  fd = socket (AF_UNIX,
+               SOCK_STREAM | SOCK_CLOEXEC,
+               0);
+  if ( (-1 != fd) &&
+       (0 == connect (fd,
+                      (const struct sockaddr *) &un,
+                      sizeof (un))) )
+    return fd;
+  fprintf (stderr,
+           "Failed to connect to `%s': %s\n",
+           path,
+           strerror (errno));
+  if (-1 != fd)
+    close (fd);
+  return -1;
+}
+
+
+/**
+ * Start sampling one in @a rate frames and exporting to @a target.
+ *
+ * @param rate sampling rate
+ * @param target where to export to
+ * @param interval seconds between counter samples
+ */
+static void
+sflow_enable (uint32_t rate,
+              const char *target,
+              unsigned int interval)
+{
+  int fd;
+
+  sflow_disable ();
+  fd = sflow_open (target);
+  if (-1 == fd)
+    return;
+  sflow_fd = fd;
+  sflow_target = strdup (target);
+  sflow_interval = interval;
+  sflow_broken = false;
+  sflow_stop = false;
+  sflow_export_errors = 0;
+  sflow_samples = 0;
+  sflow_head = 0;
+  sflow_tail = 0;
+  for (unsigned int i = 0; i < sflow_num_ifc; i++)
+  {
+    sflow_src[i].pool = 0;
+    sflow_src[i].drops = 0;
+  }
+  if (0 != pthread_create (&sflow_thread,
+                           NULL,
+                           &sflow_run,
+                           NULL))
+  {
+    fprintf (stderr,
+             "Failed to start sFlow export thread\n");
+    close (sflow_fd);
+    sflow_fd = -1;
+    free (sflow_target);
+    sflow_target = NULL;
+    return;
+  }
+  sflow_rate = rate;
+  sflow_skip = sflow_next_skip ();
+}
+
+
+/**
+ * Handle the "sflow" control commands.
+ *
+ * @param cmd text the user entered (not 0-terminated)
+ * @param cmd_len length of @a cmd
+ * @return true if @a cmd was an sflow command
+ */
+static bool
+sflow_handle_control (const char *cmd,
+                      size_t cmd_len)
+{
+  char buf[cmd_len + 1];
+  char *save;
+  const char *tok;
+  const char *target;
+  unsigned int rate;
+  unsigned int interval;
+
+  memcpy (buf,
+          cmd,
+          cmd_len);
+  buf[cmd_len] = '\0';
+  tok = strtok_r (buf,
+                  " \n",
+                  &save);
+  if ( (NULL == tok) ||
+       (0 != strcasecmp (tok,
+                         "sflow")) )
+    return false;
+  tok = strtok_r (NULL,
+                  " \n",
+                  &save);
+  if (NULL == tok)
+  {
+    if (0 == sflow_rate)
+    {
+      print ("sFlow sampling off\n");
+      return true;
+    }
+    print ("sFlow sampling 1 in %u to `%s', counters every %us\n"
+           "%llu samples, %llu export errors%s\n",
+           (unsigned int) sflow_rate,
+           sflow_target,
+           sflow_interval,
+           (unsigned long long) sflow_samples,
+           (unsigned long long) __atomic_load_n (&sflow_export_errors,
+                                                 __ATOMIC_RELAXED),
+           __atomic_load_n (&sflow_broken,
+                            __ATOMIC_RELAXED)
+           ? " (export stopped)"
+           : "");
+    return true;
+  }
+  if (0 == strcasecmp (tok,
+                       "off"))
+  {
+    sflow_disable ();
+    print ("sFlow sampling off\n");
+    return true;
+  }
+  target = strtok_r (NULL,
+                     " \n",
+                     &save);
+  if ( (1 != sscanf (tok,
+                     "%u",
+                     &rate)) ||
+       (0 == rate) ||
+       (rate > INT32_MAX) ||
+       (NULL == target) )
+  {
+    fprintf (stderr,
+             "Usage: sflow RATE TARGET [INTERVAL] | sflow off\n");
+    return true;
+  }
+  interval = SFLOW_DEFAULT_INTERVAL;
+  tok = strtok_r (NULL,
+                  " \n",
+                  &save);
+  if ( (NULL != tok) &&
+       ( (1 != sscanf (tok,
+                       "%u",
+                       &interval)) ||
+         (0 == interval) ) )
+  {
+    fprintf (stderr,
+             "Counter interval `%s' invalid\n",
+             tok);
+    return true;
+  }
+  sflow_enable (rate,
+                target,
+                interval);
+  if (0 != sflow_rate)
+    print ("sFlow sampling 1 in %u to `%s'\n",
+           rate,
+           target);
+  return true;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,2486 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file sim.c
+ * @brief Discrete-event simulator running many hub, switch, vswitch
+ *        and router instances in one process
+ * @author Christian Grothoff
+ *
+ * Each node is a private copy of hub.so, switch.so, vswitch.so or
+ * router.so (the programs built with GLAB_SIM), loaded from a memfd
+ * so that every instance has its own globals.  Its unchanged main()
+ * runs as a coroutine on its own stack.  Instead of using stdin and
+ * stdout, loop.c and print.c call glab_sim_read() and
+ * glab_sim_write(), so the simulator is the parent and speaks the
+ * usual GLAB protocol; glab_sim_read() switches back to the
+ * scheduler once the node has consumed all of its input.  Nodes see
+ * the simulated time in time() and clock_gettime().
+ *
+ * The simulator itself provides "host" nodes that answer ARP and
+ * send and receive UDP test flows.  Frames travel over links with a
+ * latency, a loss rate and optionally a bandwidth.  All randomness
+ * comes from one seeded generator and events due at the same time
+ * are processed in the order they were scheduled, so runs are
+ * reproducible.
+ *
+ * The topology file is line-oriented, '#' starts a comment:
+ *
+ *   seed N
+ *   node NAME TYPE[/PORTS] [ARG...]
+ *   host NAME IP/LEN [via GATEWAY]
+ *   link NAME:PORT NAME:PORT [latency TIME] [loss PERCENT%] [bandwidth BPS]
+ *   flow NAME HOST IP [rate PPS] [size BYTES] [count N] [start TIME]
+ *   at TIME NAME COMMAND...
+ *   run TIME
+ *
+ * TYPE is hub, switch, vswitch or router and the ARGs are those of
+ * its command line.  PORTS is only needed if the number of physical
+ * interfaces cannot be derived from the ARGs ("-c FILE"); VLAN
+ * sub-interfaces and GRE tunnels do not count.  Hosts
+ * have a single port.  "at" sends a control command to a node.  A
+ * TIME has a unit (ns, us, ms or s), BPS may end in k, M or G.
+ */
+#include "glab.h"
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+
+#if defined(__SANITIZE_ADDRESS__)
+/**
+ * Tell ASAN that we are about to switch to the stack at @a bottom.
+ */
+#define SIM_FIBER_START(save, bottom, size) \
+  __sanitizer_start_switch_fiber (save, bottom, size)
+
+/**
+ * Tell ASAN that we completed a switch to another stack.
+ */
+#define SIM_FIBER_FINISH(save, bottom, size) \
+  __sanitizer_finish_switch_fiber (save, bottom, size)
+#else
+#define SIM_FIBER_START(save, bottom, size) do { } while (0)
+#define SIM_FIBER_FINISH(save, bottom, size) do { } while (0)
+#endif
+
+/**
+ * Size of the stack of each node.  Only the pages used are
+ * allocated, but loop() alone needs 64k.
+ */
+#define SIM_STACK_SIZE (2 * 1024 * 1024)
+
+/**
+ * Maximum number of tokens per line of the topology file.
+ */
+#define SIM_MAX_TOKENS 256
+
+/**
+ * UDP port of the test flows.
+ */
+#define SIM_FLOW_PORT 5001
+
+/**
+ * Marks the payload of test flow packets.
+ */
+#define SIM_FLOW_MAGIC 0x474C4142
+
+/**
+ * Seconds added to the simulated time for CLOCK_REALTIME and time().
+ */
+#define SIM_EPOCH 1514764800
+
+/**
+ * Seconds added to the simulated time for the other clocks, so that
+ * nodes never see a zero timestamp.
+ */
+#define SIM_UPTIME 1000
+
+/**
+ * Ethernet header length.
+ */
+#define SIM_ETH_HLEN 14
+
+/**
+ * ARP message length for Ethernet-IPv4.
+ */
+#define SIM_ARP_LEN 28
+
+/**
+ * Length of IPv4 and UDP header of test flow packets.
+ */
+#define SIM_IP_UDP_LEN 28
+
+/**
+ * Length of the payload of test flow packets we look at.
+ */
+#define SIM_FLOW_PAYLOAD_LEN 24
+
+
+/**
+ * Kind of a node.
+ */
+enum SimNodeKind
+{
+  /**
+   * Instance of a module (hub, switch, vswitch, router).
+   */
+  SNK_MODULE,
+
+  /**
+   * Host simulated by us.
+   */
+  SNK_HOST
+};
+
+
+struct SimLink;
+
+
+/**
+ * Port of a node.
+ */
+struct SimPort
+{
+  /**
+   * MAC of the port.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Link the port is connected to, NULL for none.
+   */
+  struct SimLink *link;
+
+  /**
+   * Frames received.
+   */
+  uint64_t rx_frames;
+
+  /**
+   * Frames sent.
+   */
+  uint64_t tx_frames;
+};
+
+
+/**
+ * IPv4 neighbour of a host.
+ */
+struct SimArpEntry
+{
+  struct in_addr ip;
+
+  struct MacAddress mac;
+};
+
+
+/**
+ * A node of the topology.
+ */
+struct SimNode
+{
+  /**
+   * Name of the node.
+   */
+  char *name;
+
+  /**
+   * What the node is.
+   */
+  enum SimNodeKind kind;
+
+  /**
+   * Number of entries in @e ports.
+   */
+  unsigned int num_ports;
+
+  /**
+   * Ports of the node, port 1 first.
+   */
+  struct SimPort *ports;
+
+  /**
+   * Our private copy of the module, for #SNK_MODULE.
+   */
+  void *dl;
+
+  /**
+   * memfd with the private copy of the module.  It stays open while
+   * the module is loaded, as the dynamic linker would otherwise hand
+   * out the same object again for the next node using the same
+   * file descriptor number.
+   */
+  int fd;
+
+  /**
+   * main() of the module.
+   */
+  int (*main) (int argc,
+               char **argv);
+
+  /**
+   * Number of entries in @e argv.
+   */
+  int argc;
+
+  /**
+   * Command line for main(), NULL-terminated.
+   */
+  char **argv;
+
+  /**
+   * Context of the coroutine running main().  Must not move
+   * once the coroutine was created.
+   */
+  ucontext_t ctx;
+
+  /**
+   * Stack of the coroutine.
+   */
+  char *stack;
+
+  /**
+   * ASAN fake stack of the coroutine while it is suspended.
+   */
+  void *fake_stack;
+
+  /**
+   * GLAB messages for the node that it did not read yet.
+   */
+  char *in;
+
+  /**
+   * Allocated size of @e in.
+   */
+  size_t in_alloc;
+
+  /**
+   * Number of bytes in @e in.
+   */
+  size_t in_size;
+
+  /**
+   * Number of bytes of @e in the node has read.
+   */
+  size_t in_off;
+
+  /**
+   * Exit status of main().
+   */
+  int status;
+
+  /**
+   * Set when the simulation is over, glab_sim_read() then returns 0.
+   */
+  bool closed;
+
+  /**
+   * Set once main() returned.
+   */
+  bool finished;
+
+  /**
+   * IPv4 address, for #SNK_HOST.
+   */
+  struct in_addr ip;
+
+  /**
+   * IPv4 netmask.
+   */
+  struct in_addr netmask;
+
+  /**
+   * Default gateway, 0.0.0.0 for none.
+   */
+  struct in_addr gateway;
+
+  /**
+   * ARP cache of the host.
+   */
+  struct SimArpEntry *arp;
+
+  /**
+   * Number of entries in @e arp.
+   */
+  unsigned int num_arp;
+
+  /**
+   * Frames received that are neither ARP nor test flow packets.
+   */
+  uint64_t rx_other;
+};
+
+
+/**
+ * A point-to-point link between two ports.
+ */
+struct SimLink
+{
+  /**
+   * The nodes at both ends.
+   */
+  struct SimNode *node[2];
+
+  /**
+   * The ports at both ends, counting from 1.
+   */
+  unsigned int port[2];
+
+  /**
+   * Propagation delay in ns.
+   */
+  uint64_t latency;
+
+  /**
+   * Bandwidth in bit/s, 0 for unlimited.
+   */
+  uint64_t bps;
+
+  /**
+   * Probability of losing a frame, in units of 2^-32.
+   */
+  uint32_t loss;
+
+  /**
+   * For each direction (from node[i]), when the last frame queued
+   * will have been serialized.
+   */
+  uint64_t busy_until[2];
+
+  /**
+   * For each direction, frames sent.
+   */
+  uint64_t frames[2];
+
+  /**
+   * For each direction, frames lost.
+   */
+  uint64_t lost[2];
+};
+
+
+/**
+ * UDP test flow from a host.
+ */
+struct SimFlow
+{
+  /**
+   * Name of the flow.
+   */
+  char *name;
+
+  /**
+   * Index of the flow in #sim_flows.
+   */
+  uint32_t id;
+
+  /**
+   * Sending host.
+   */
+  struct SimNode *src;
+
+  /**
+   * Destination address.
+   */
+  struct in_addr dst;
+
+  /**
+   * Time between two packets in ns.
+   */
+  uint64_t interval;
+
+  /**
+   * Time of the first packet.
+   */
+  uint64_t start;
+
+  /**
+   * Number of packets to send.
+   */
+  uint64_t count;
+
+  /**
+   * Frame size in bytes.
+   */
+  size_t size;
+
+  /**
+   * Packets sent (including those dropped for lack of an ARP entry).
+   */
+  uint64_t sent;
+
+  /**
+   * Packets dropped by the sender for lack of an ARP entry or route.
+   */
+  uint64_t unresolved;
+
+  /**
+   * Packets received.
+   */
+  uint64_t received;
+
+  /**
+   * Packets received with a lower sequence number than an earlier one.
+   */
+  uint64_t reordered;
+
+  /**
+   * Highest sequence number received plus one.
+   */
+  uint64_t next_seq;
+
+  /**
+   * Sum of the one-way latencies in ns.
+   */
+  uint64_t latency_sum;
+
+  /**
+   * Smallest one-way latency in ns.
+   */
+  uint64_t latency_min;
+
+  /**
+   * Largest one-way latency in ns.
+   */
+  uint64_t latency_max;
+};
+
+
+/**
+ * Module that can be instantiated.
+ */
+struct SimModule
+{
+  /**
+   * Node type, like "router".
+   */
+  char *type;
+
+  /**
+   * Contents of the shared object.
+   */
+  char *image;
+
+  /**
+   * Number of bytes in @e image.
+   */
+  size_t image_size;
+};
+
+
+/**
+ * Types of events.
+ */
+enum SimEventType
+{
+  /**
+   * Frame arrives at a port.
+   */
+  SE_FRAME,
+
+  /**
+   * Control command for a node.
+   */
+  SE_CONTROL,
+
+  /**
+   * Next packet of a flow is due.
+   */
+  SE_FLOW
+};
+
+
+/**
+ * Something that happens at a given time.
+ */
+struct SimEvent
+{
+  /**
+   * When it happens, in ns.
+   */
+  uint64_t time;
+
+  /**
+   * Order in which events were scheduled, to break ties.
+   */
+  uint64_t seq;
+
+  /**
+   * What happens.
+   */
+  enum SimEventType type;
+
+  /**
+   * Port for #SE_FRAME.
+   */
+  unsigned int port;
+
+  /**
+   * Node for #SE_FRAME and #SE_CONTROL.
+   */
+  struct SimNode *node;
+
+  /**
+   * Flow for #SE_FLOW.
+   */
+  struct SimFlow *flow;
+
+  /**
+   * Frame or command (malloc'ed).
+   */
+  char *data;
+
+  /**
+   * Number of bytes in @e data.
+   */
+  size_t size;
+};
+
+
+/**
+ * All nodes, in the order they were declared.
+ */
+static struct SimNode **sim_nodes;
+
+/**
+ * Number of entries in #sim_nodes.
+ */
+static unsigned int sim_num_nodes;
+
+/**
+ * All links.
+ */
+static struct SimLink **sim_links;
+
+/**
+ * Number of entries in #sim_links.
+ */
+static unsigned int sim_num_links;
+
+/**
+ * All flows, indexed by their ID.
+ */
+static struct SimFlow **sim_flows;
+
+/**
+ * Number of entries in #sim_flows.
+ */
+static unsigned int sim_num_flows;
+
+/**
+ * Modules loaded so far.
+ */
+static struct SimModule *sim_modules;
+
+/**
+ * Number of entries in #sim_modules.
+ */
+static unsigned int sim_num_modules;
+
+/**
+ * Directory with the modules.
+ */
+static char *sim_module_dir;
+
+/**
+ * Pending events, a binary min-heap by time and sequence number.
+ */
+static struct SimEvent *sim_events;
+
+/**
+ * Number of entries in #sim_events.
+ */
+static unsigned int sim_num_events;
+
+/**
+ * Allocated size of #sim_events.
+ */
+static unsigned int sim_events_alloc;
+
+/**
+ * Sequence number for the next event.
+ */
+static uint64_t sim_next_seq;
+
+/**
+ * Number of events processed.
+ */
+static uint64_t sim_processed;
+
+/**
+ * Current simulated time in ns.
+ */
+static uint64_t sim_now;
+
+/**
+ * Time at which the simulation ends.
+ */
+static uint64_t sim_end = UINT64_MAX;
+
+/**
+ * State of the random number generator.
+ */
+static uint64_t sim_rng = 1;
+
+/**
+ * Node whose coroutine is running, NULL while the scheduler runs.
+ */
+static struct SimNode *sim_current;
+
+/**
+ * Context of the scheduler while a node runs.
+ */
+static ucontext_t sim_sched_ctx;
+
+/**
+ * ASAN fake stack of the scheduler while a node runs.
+ */
+static void *sim_sched_fake_stack;
+
+/**
+ * Stack of the scheduler, as reported by ASAN.
+ */
+static const void *sim_sched_bottom;
+
+/**
+ * Size of #sim_sched_bottom.
+ */
+static size_t sim_sched_size;
+
+
+/**
+ * Next pseudo-random number (splitmix64).
+ *
+ * @return random value
+ */
+static uint64_t
+sim_random ()
+{
+  uint64_t z = (sim_rng += 0x9E3779B97F4A7C15LLU);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9LLU;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBLLU;
+  return z ^ (z >> 31);
+}
+
+
+/**
+ * Compare events @a a and @a b by time, then by sequence number.
+ *
+ * @return true if @a a happens first
+ */
+static inline bool
+sim_event_before (const struct SimEvent *a,
+                  const struct SimEvent *b)
+{
+  if (a->time != b->time)
+    return a->time < b->time;
+  return a->seq < b->seq;
+}
+
+
+/**
+ * Add @a ev to the pending events.
+ *
+ * @param ev event to schedule, its @e seq is set
+ */
+static void
+sim_schedule (struct SimEvent *ev)
+{
+  unsigned int i;
+
+  if (sim_num_events == sim_events_alloc)
+  {
+    struct SimEvent *tmp;
+
+    sim_events_alloc = (0 == sim_events_alloc) ? 1024 : 2 * sim_events_alloc;
+    tmp = realloc (sim_events,
+                   sim_events_alloc * sizeof (struct SimEvent));
+    if (NULL == tmp)
+    {
+      perror ("realloc");
+      exit (1);
+    }
+    sim_events = tmp;
+  }
+  ev->seq = sim_next_seq++;
+  i = sim_num_events++;
+  while (i > 0)
+  {
+    unsigned int parent = (i - 1) / 2;
+
+    if (! sim_event_before (ev,
+                            &sim_events[parent]))
+      break;
+    sim_events[i] = sim_events[parent];
+    i = parent;
+  }
+  sim_events[i] = *ev;
+}
+
+
+/**
+ * Remove the next event.
+ *
+ * @param[out] ev set to the event, which must exist
+ */
+static void
+sim_pop (struct SimEvent *ev)
+{
+  struct SimEvent last;
+  unsigned int i;
+
+  *ev = sim_events[0];
+  last = sim_events[--sim_num_events];
+  i = 0;
+  for (;;)
+  {
+    unsigned int c = 2 * i + 1;
+
+    if (c >= sim_num_events)
+      break;
+    if ( (c + 1 < sim_num_events) &&
+         sim_event_before (&sim_events[c + 1],
+                           &sim_events[c]) )
+      c++;
+    if (! sim_event_before (&sim_events[c],
+                            &last))
+      break;
+    sim_events[i] = sim_events[c];
+    i = c;
+  }
+  sim_events[i] = last;
+}
+
+
+/**
+ * Find node @a name.
+ *
+ * @param name name to look for
+ * @return NULL if there is no such node
+ */
+static struct SimNode *
+sim_find_node (const char *name)
+{
+  for (unsigned int i=0;i<sim_num_nodes;i++)
+    if (0 == strcmp (name,
+                     sim_nodes[i]->name))
+      return sim_nodes[i];
+  return NULL;
+}
+
+
+/**
+ * Append @a msg of @a size bytes to the input of module node @a n.
+ *
+ * @param n node to give the input to
+ * @param type GLAB message type
+ * @param msg message body
+ * @param size number of bytes in @a msg
+ */
+static void
+sim_node_input (struct SimNode *n,
+                uint16_t type,
+                const void *msg,
+                size_t size)
+{
+  struct GLAB_MessageHeader hdr;
+
+  if (n->in_off == n->in_size)
+  {
+    n->in_off = 0;
+    n->in_size = 0;
+  }
+  if (n->in_size + sizeof (hdr) + size > n->in_alloc)
+  {
+    char *tmp;
+
+    n->in_alloc = 2 * (n->in_size + sizeof (hdr) + size);
+    tmp = realloc (n->in,
+                   n->in_alloc);
+    if (NULL == tmp)
+    {
+      perror ("realloc");
+      exit (1);
+    }
+    n->in = tmp;
+  }
+  hdr.size = htons ((uint16_t) (sizeof (hdr) + size));
+  hdr.type = htons (type);
+  memcpy (&n->in[n->in_size],
+          &hdr,
+          sizeof (hdr));
+  memcpy (&n->in[n->in_size + sizeof (hdr)],
+          msg,
+          size);
+  n->in_size += sizeof (hdr) + size;
+}
+
+
+/**
+ * Entry point of the coroutine of a node: run its main().
+ */
+static void
+sim_node_main ()
+{
+  struct SimNode *n = sim_current;
+
+  SIM_FIBER_FINISH (NULL,
+                    &sim_sched_bottom,
+                    &sim_sched_size);
+  n->status = n->main (n->argc,
+                       n->argv);
+  n->finished = true;
+  /* returning switches to uc_link, and this stack is gone for good */
+  SIM_FIBER_START (NULL,
+                   sim_sched_bottom,
+                   sim_sched_size);
+}
+
+
+/**
+ * Run module node @a n until it has consumed its input (or exits).
+ *
+ * @param n node to run
+ */
+static void
+sim_resume (struct SimNode *n)
+{
+  if (n->finished)
+    return;
+  sim_current = n;
+  SIM_FIBER_START (&sim_sched_fake_stack,
+                   n->stack,
+                   SIM_STACK_SIZE);
+  swapcontext (&sim_sched_ctx,
+               &n->ctx);
+  SIM_FIBER_FINISH (sim_sched_fake_stack,
+                    NULL,
+                    NULL);
+  sim_current = NULL;
+  if ( n->finished &&
+       (! n->closed) )
+  {
+    fprintf (stderr,
+             "Node `%s' exited with status %d\n",
+             n->name,
+             n->status);
+    exit (1);
+  }
+}
+
+
+/**
+ * Read GLAB messages for the current node.  Switches back to the
+ * scheduler until input is available.
+ *
+ * @param buf where to store the input
+ * @param size number of bytes available in @a buf
+ * @return number of bytes read, 0 once the simulation is over
+ */
+ssize_t
+glab_sim_read (void *buf,
+               size_t size)
+{
+  struct SimNode *n = sim_current;
+  size_t avail;
+
+  while (n->in_off == n->in_size)
+  {
+    if (n->closed)
+      return 0;
+    SIM_FIBER_START (&n->fake_stack,
+                     sim_sched_bottom,
+                     sim_sched_size);
+    swapcontext (&n->ctx,
+                 &sim_sched_ctx);
+    SIM_FIBER_FINISH (n->fake_stack,
+                      &sim_sched_bottom,
+                      &sim_sched_size);
+  }
+  avail = n->in_size - n->in_off;
+  if (avail > size)
+    avail = size;
+  memcpy (buf,
+          &n->in[n->in_off],
+          avail);
+  n->in_off += avail;
+  return (ssize_t) avail;
+}
+
+
+/**
+ * Send @a frame out on port @a port of @a n: schedule its arrival
+ * at the other end of the link, unless it is lost.
+ *
+ * @param n node sending the frame
+ * @param port port to send on, counting from 1
+ * @param frame the frame
+ * @param size number of bytes in @a frame
+ */
+static void
+sim_transmit (struct SimNode *n,
+              unsigned int port,
+              const void *frame,
+              size_t size)
+{
+  struct SimLink *l;
+  struct SimEvent ev;
+  unsigned int dir;
+  uint64_t t;
+
+  if ( (0 == port) ||
+       (port > n->num_ports) )
+  {
+    fprintf (stderr,
+             "Node `%s' sent frame on invalid port %u\n",
+             n->name,
+             port);
+    return;
+  }
+  n->ports[port - 1].tx_frames++;
+  l = n->ports[port - 1].link;
+  if (NULL == l)
+    return;
+  dir = ( (l->node[0] == n) &&
+          (l->port[0] == port) ) ? 0 : 1;
+  l->frames[dir]++;
+  if ( (0 != l->loss) &&
+       ((uint32_t) sim_random () < l->loss) )
+  {
+    l->lost[dir]++;
+    return;
+  }
+  t = sim_now;
+  if (0 != l->bps)
+  {
+    if (l->busy_until[dir] > t)
+      t = l->busy_until[dir];
+    t += size * 8 * 1000000000LLU / l->bps;
+    l->busy_until[dir] = t;
+  }
+  memset (&ev,
+          0,
+          sizeof (ev));
+  ev.time = t + l->latency;
+  ev.type = SE_FRAME;
+  ev.node = l->node[1 - dir];
+  ev.port = l->port[1 - dir];
+  ev.data = malloc (size);
+  if (NULL == ev.data)
+  {
+    perror ("malloc");
+    exit (1);
+  }
+  memcpy (ev.data,
+          frame,
+          size);
+  ev.size = size;
+  sim_schedule (&ev);
+}
+
+
+/**
+ * Take GLAB messages from the current node: frames are sent over
+ * the links, text is printed with the node name in front.
+ *
+ * @param buf one or more complete GLAB messages
+ * @param size number of bytes in @a buf
+ */
+void
+glab_sim_write (const void *buf,
+                size_t size)
+{
+  struct SimNode *n = sim_current;
+  const char *cbuf = buf;
+
+  while (size >= sizeof (struct GLAB_MessageHeader))
+  {
+    struct GLAB_MessageHeader hdr;
+    uint16_t msize;
+
+    memcpy (&hdr,
+            cbuf,
+            sizeof (hdr));
+    msize = ntohs (hdr.size);
+    if ( (msize < sizeof (hdr)) ||
+         (msize > size) )
+      abort ();
+    if (0 == ntohs (hdr.type))
+      printf ("%s: %.*s",
+              n->name,
+              (int) (msize - sizeof (hdr)),
+              &cbuf[sizeof (hdr)]);
+    else
+      sim_transmit (n,
+                    ntohs (hdr.type),
+                    &cbuf[sizeof (hdr)],
+                    msize - sizeof (hdr));
+    cbuf += msize;
+    size -= msize;
+  }
+}
+
+
+/**
+ * clock_gettime() for the nodes: the simulated time.
+ *
+ * @param clk clock to read
+ * @param[out] ts set to the time
+ * @return 0
+ */
+int
+glab_sim_clock_gettime (clockid_t clk,
+                        struct timespec *ts)
+{
+  ts->tv_sec = sim_now / 1000000000LLU
+    + ((CLOCK_REALTIME == clk) ? SIM_EPOCH : SIM_UPTIME);
+  ts->tv_nsec = sim_now % 1000000000LLU;
+  return 0;
+}
+
+
+/**
+ * time() for the nodes: the simulated time.
+ *
+ * @param[out] t set to the time if not NULL
+ * @return the time
+ */
+time_t
+glab_sim_time (time_t *t)
+{
+  time_t now = SIM_EPOCH + sim_now / 1000000000LLU;
+
+  if (NULL != t)
+    *t = now;
+  return now;
+}
+
+
+/**
+ * Load (once) the module for node type @a type.
+ *
+ * @param type node type
+ * @return NULL on error
+ */
+static struct SimModule *
+sim_get_module (const char *type)
+{
+  struct SimModule *tmp;
+  struct SimModule *m;
+  char *fn;
+  FILE *f;
+  struct stat st;
+
+  for (unsigned int i=0;i<sim_num_modules;i++)
+    if (0 == strcmp (type,
+                     sim_modules[i].type))
+      return &sim_modules[i];
+  if ( (0 != strcmp (type, "hub")) &&
+       (0 != strcmp (type, "switch")) &&
+       (0 != strcmp (type, "vswitch")) &&
+       (0 != strcmp (type, "router")) )
+  {
+    fprintf (stderr,
+             "Unknown node type `%s'\n",
+             type);
+    return NULL;
+  }
+  if (-1 == asprintf (&fn,
+                      "%s/%s.so",
+                      sim_module_dir,
+                      type))
+    return NULL;
+  f = fopen (fn,
+             "r");
+  if ( (NULL == f) ||
+       (0 != fstat (fileno (f),
+                    &st)) )
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             fn,
+             strerror (errno));
+    if (NULL != f)
+      fclose (f);
+    free (fn);
+    return NULL;
+  }
+  tmp = realloc (sim_modules,
+                 (sim_num_modules + 1) * sizeof (struct SimModule));
+  if (NULL == tmp)
+  {
+    perror ("realloc");
+    fclose (f);
+    free (fn);
+    return NULL;
+  }
+  sim_modules = tmp;
+  m = &sim_modules[sim_num_modules];
+  m->image_size = st.st_size;
+  m->image = malloc (m->image_size);
+  if ( (NULL == m->image) ||
+       (1 != fread (m->image,
+                    m->image_size,
+                    1,
+                    f)) )
+  {
+    fprintf (stderr,
+             "Failed to read `%s'\n",
+             fn);
+    free (m->image);
+    fclose (f);
+    free (fn);
+    return NULL;
+  }
+  fclose (f);
+  free (fn);
+  m->type = strdup (type);
+  sim_num_modules++;
+  return m;
+}
+
+
+/**
+ * Load a private copy of module @a m for node @a n.  The dynamic
+ * linker shares objects with the same inode, so each copy is put
+ * into a memfd of its own.
+ *
+ * @param m module to instantiate
+ * @param n node to load it for
+ * @return 0 on success
+ */
+static int
+sim_instantiate (const struct SimModule *m,
+                 struct SimNode *n)
+{
+  char path[64];
+  size_t off;
+  int fd;
+
+  fd = n->fd = memfd_create (n->name,
+                     MFD_CLOEXEC);
+  if (-1 == fd)
+  {
+    perror ("memfd_create");
+    return 1;
+  }
+  for (off = 0; off < m->image_size; )
+  {
+    ssize_t ret = write (fd,
+                         &m->image[off],
+                         m->image_size - off);
+
+    if (ret <= 0)
+    {
+      perror ("write");
+      return 1;
+    }
+    off += ret;
+  }
+  snprintf (path,
+            sizeof (path),
+            "/proc/self/fd/%d",
+            fd);
+  n->dl = dlopen (path,
+                  RTLD_NOW | RTLD_LOCAL);
+  if (NULL == n->dl)
+  {
+    fprintf (stderr,
+             "Failed to load %s for `%s': %s\n",
+             m->type,
+             n->name,
+             dlerror ());
+    return 1;
+  }
+  n->main = (int (*) (int, char **)) dlsym (n->dl,
+                                             "main");
+  if (NULL == n->main)
+  {
+    fprintf (stderr,
+             "Module %s lacks main()\n",
+             m->type);
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Parse time @a s with unit.
+ *
+ * @param s text like "100us"
+ * @param[out] ns set to the time in ns
+ * @return 0 on success
+ */
+static int
+sim_parse_time (const char *s,
+                uint64_t *ns)
+{
+  char *end;
+  double v;
+
+  v = strtod (s,
+              &end);
+  if ( (end == s) ||
+       (v < 0) )
+    return 1;
+  if (0 == strcmp (end, "ns"))
+    *ns = (uint64_t) v;
+  else if (0 == strcmp (end, "us"))
+    *ns = (uint64_t) (v * 1000);
+  else if (0 == strcmp (end, "ms"))
+    *ns = (uint64_t) (v * 1000000);
+  else if (0 == strcmp (end, "s"))
+    *ns = (uint64_t) (v * 1000000000);
+  else
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Parse number @a s with optional k, M or G suffix.
+ *
+ * @param s text like "1G"
+ * @param[out] v set to the value
+ * @return 0 on success
+ */
+static int
+sim_parse_number (const char *s,
+                  uint64_t *v)
+{
+  char *end;
+  double d;
+
+  d = strtod (s,
+              &end);
+  if ( (end == s) ||
+       (d < 0) )
+    return 1;
+  if ('\0' == *end)
+    *v = (uint64_t) d;
+  else if (0 == strcmp (end, "k"))
+    *v = (uint64_t) (d * 1000);
+  else if (0 == strcmp (end, "M"))
+    *v = (uint64_t) (d * 1000000);
+  else if (0 == strcmp (end, "G"))
+    *v = (uint64_t) (d * 1000000000);
+  else
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Parse "NAME:PORT".
+ *
+ * @param s text to parse, modified
+ * @param[out] n set to the node
+ * @param[out] port set to the port
+ * @return 0 on success
+ */
+static int
+sim_parse_endpoint (char *s,
+                    struct SimNode **n,
+                    unsigned int *port)
+{
+  char *colon = strrchr (s,
+                         ':');
+
+  if (NULL == colon)
+    return 1;
+  *colon = '\0';
+  *n = sim_find_node (s);
+  if ( (NULL == *n) ||
+       (1 != sscanf (colon + 1,
+                     "%u",
+                     port)) ||
+       (0 == *port) ||
+       (*port > (*n)->num_ports) )
+  {
+    fprintf (stderr,
+             "No port `%s:%s'\n",
+             s,
+             colon + 1);
+    return 1;
+  }
+  if (NULL != (*n)->ports[*port - 1].link)
+  {
+    fprintf (stderr,
+             "Port `%s:%u' already linked\n",
+             s,
+             *port);
+    return 1;
+  }
+  return 0;
+}
+
+
+/**
+ * Create node @a name with @a num_ports ports.
+ *
+ * @param name name of the node
+ * @param kind what the node is
+ * @param num_ports number of ports
+ * @return NULL on error
+ */
+static struct SimNode *
+sim_add_node (const char *name,
+              enum SimNodeKind kind,
+              unsigned int num_ports)
+{
+  struct SimNode **tmp;
+  struct SimNode *n;
+  unsigned int idx = sim_num_nodes + 1;
+
+  if (NULL != sim_find_node (name))
+  {
+    fprintf (stderr,
+             "Duplicate node `%s'\n",
+             name);
+    return NULL;
+  }
+  if ( (0 == num_ports) ||
+       (num_ports > UINT8_MAX) )
+  {
+    fprintf (stderr,
+             "Invalid number of ports for `%s'\n",
+             name);
+    return NULL;
+  }
+  tmp = realloc (sim_nodes,
+                 (sim_num_nodes + 1) * sizeof (struct SimNode *));
+  if (NULL == tmp)
+  {
+    perror ("realloc");
+    return NULL;
+  }
+  sim_nodes = tmp;
+  n = calloc (1,
+              sizeof (struct SimNode));
+  if (NULL == n)
+  {
+    perror ("calloc");
+    return NULL;
+  }
+  n->ports = calloc (num_ports,
+                     sizeof (struct SimPort));
+  if (NULL == n->ports)
+  {
+    perror ("calloc");
+    free (n);
+    return NULL;
+  }
+  n->name = strdup (name);
+  n->kind = kind;
+  n->fd = -1;
+  n->num_ports = num_ports;
+  /* locally administered, node number and port */
+  for (unsigned int i=0;i<num_ports;i++)
+  {
+    struct MacAddress *mac = &n->ports[i].mac;
+
+    mac->mac[0] = 0x02;
+    mac->mac[1] = 0x00;
+    mac->mac[2] = (uint8_t) (idx >> 16);
+    mac->mac[3] = (uint8_t) (idx >> 8);
+    mac->mac[4] = (uint8_t) idx;
+    mac->mac[5] = (uint8_t) (i + 1);
+  }
+  sim_nodes[sim_num_nodes++] = n;
+  return n;
+}
+
+
+/**
+ * Handle "node NAME TYPE[/PORTS] [ARG...]".
+ *
+ * @param tok tokens of the line
+ * @param n number of tokens
+ * @return 0 on success
+ */
+static int
+sim_cmd_node (char **tok,
+              unsigned int n)
+{
+  struct SimModule *m;
+  struct SimNode *node;
+  char *slash;
+  unsigned int ports = 0;
+
+  if (n < 3)
+    return 1;
+  slash = strchr (tok[2],
+                  '/');
+  if (NULL != slash)
+  {
+    *slash = '\0';
+    if (1 != sscanf (slash + 1,
+                     "%u",
+                     &ports))
+      return 1;
+  }
+  else
+  {
+    /* one port per argument, VLAN sub-interfaces ("eth1.24[..]")
+       share the port of their parent and GRE tunnels
+       ("gre1[GRE:..]") have none */
+    for (unsigned int i=3;i<n;i++)
+    {
+      size_t len = strcspn (tok[i],
+                            "[=");
+
+      if ( (NULL == memchr (tok[i],
+                            '.',
+                            len)) &&
+           (NULL == strcasestr (tok[i],
+                                "[GRE:")) &&
+           (NULL == strcasestr (tok[i],
+                                ",GRE:")) )
+        ports++;
+    }
+  }
+  m = sim_get_module (tok[2]);
+  if (NULL == m)
+    return 1;
+  node = sim_add_node (tok[1],
+                       SNK_MODULE,
+                       ports);
+  if (NULL == node)
+    return 1;
+  node->argc = n - 2;
+  node->argv = calloc (node->argc + 1,
+                       sizeof (char *));
+  if (NULL == node->argv)
+    return 1;
+  node->argv[0] = strdup (tok[2]);
+  for (unsigned int i=3;i<n;i++)
+    node->argv[i - 2] = strdup (tok[i]);
+  return sim_instantiate (m,
+                          node);
+}
+
+
+/**
+ * Handle "host NAME IP/LEN [via GATEWAY]".
+ *
+ * @param tok tokens of the line
+ * @param n number of tokens
+ * @return 0 on success
+ */
+static int
+sim_cmd_host (char **tok,
+              unsigned int n)
+{
+  struct SimNode *h;
+  char *slash;
+  unsigned int len;
+
+  if ( ( (3 != n) &&
+         (5 != n) ) ||
+       (NULL == (slash = strchr (tok[2],
+                                 '/'))) )
+    return 1;
+  *slash = '\0';
+  if ( (1 != sscanf (slash + 1,
+                     "%u",
+                     &len)) ||
+       (len > 32) )
+    return 1;
+  h = sim_add_node (tok[1],
+                    SNK_HOST,
+                    1);
+  if (NULL == h)
+    return 1;
+  if (1 != inet_pton (AF_INET,
+                      tok[2],
+                      &h->ip))
+    return 1;
+  h->netmask.s_addr = htonl (~ (uint32_t) ((1LLU << (32 - len)) - 1LLU));
+  if ( (5 == n) &&
+       ( (0 != strcmp (tok[3], "via")) ||
+         (1 != inet_pton (AF_INET,
+                          tok[4],
+                          &h->gateway)) ) )
+    return 1;
+  return 0;
+}
+
+
+/**
+ * Handle "link NAME:PORT NAME:PORT [latency TIME] [loss PERCENT%]
+ * [bandwidth BPS]".
+ *
+ * @param tok tokens of the line
+ * @param n number of tokens
+ * @return 0 on success
+ */
+static int
+sim_cmd_link (char **tok,
+              unsigned int n)
+{
+  struct SimLink *l;
+  struct SimLink **tmp;
+
+  if ( (n < 3) ||
+       (0 == (n % 2)) )
+    return 1;
+  l = calloc (1,
+              sizeof (struct SimLink));
+  if (NULL == l)
+    return 1;
+  if ( (0 != sim_parse_endpoint (tok[1],
+                                 &l->node[0],
+                                 &l->port[0])) ||
+       (0 != sim_parse_endpoint (tok[2],
+                                 &l->node[1],
+                                 &l->port[1])) ||
+       ( (l->node[0] == l->node[1]) &&
+         (l->port[0] == l->port[1]) ) )
+  {
+    free (l);
+    return 1;
+  }
+  for (unsigned int i=3;i<n;i+=2)
+  {
+    int ret = 1;
+
+    if (0 == strcmp (tok[i], "latency"))
+    {
+      ret = sim_parse_time (tok[i + 1],
+                            &l->latency);
+    }
+    else if (0 == strcmp (tok[i], "bandwidth"))
+    {
+      ret = sim_parse_number (tok[i + 1],
+                              &l->bps);
+    }
+    else if (0 == strcmp (tok[i], "loss"))
+    {
+      char *end;
+      double p = strtod (tok[i + 1],
+                         &end);
+
+      if ( (end != tok[i + 1]) &&
+           (0 == strcmp (end, "%")) &&
+           (p >= 0) &&
+           (p <= 100) )
+      {
+        l->loss = (p >= 100)
+          ? UINT32_MAX
+          : (uint32_t) (p / 100 * 4294967296.0);
+        ret = 0;
+      }
+    }
+    if (0 != ret)
+    {
+      free (l);
+      return 1;
+    }
+  }
+  tmp = realloc (sim_links,
+                 (sim_num_links + 1) * sizeof (struct SimLink *));
+  if (NULL == tmp)
+  {
+    free (l);
+    return 1;
+  }
+  sim_links = tmp;
+  sim_links[sim_num_links++] = l;
+  l->node[0]->ports[l->port[0] - 1].link = l;
+  l->node[1]->ports[l->port[1] - 1].link = l;
+  return 0;
+}
+
+
+/**
+ * Handle "flow NAME HOST IP [rate PPS] [size BYTES] [count N]
+ * [start TIME]".
+ *
+ * @param tok tokens of the line
+ * @param n number of tokens
+ * @return 0 on success
+ */
+static int
+sim_cmd_flow (char **tok,
+              unsigned int n)
+{
+  struct SimFlow *f;
+  struct SimFlow **tmp;
+  struct SimEvent ev;
+  uint64_t rate = 1000;
+  uint64_t size = 128;
+
+  if ( (n < 4) ||
+       (0 != (n % 2)) )
+    return 1;
+  f = calloc (1,
+              sizeof (struct SimFlow));
+  if (NULL == f)
+    return 1;
+  f->src = sim_find_node (tok[2]);
+  f->count = UINT64_MAX;
+  f->start = 1000000; /* leave time for the control commands at 0 */
+  if ( (NULL == f->src) ||
+       (SNK_HOST != f->src->kind) ||
+       (1 != inet_pton (AF_INET,
+                        tok[3],
+                        &f->dst)) )
+  {
+    fprintf (stderr,
+             "Flow needs a host and an IPv4 address\n");
+    free (f);
+    return 1;
+  }
+  for (unsigned int i=4;i<n;i+=2)
+  {
+    int ret = 1;
+
+    if (0 == strcmp (tok[i], "rate"))
+      ret = sim_parse_number (tok[i + 1],
+                              &rate);
+    else if (0 == strcmp (tok[i], "size"))
+      ret = sim_parse_number (tok[i + 1],
+                              &size);
+    else if (0 == strcmp (tok[i], "count"))
+      ret = sim_parse_number (tok[i + 1],
+                              &f->count);
+    else if (0 == strcmp (tok[i], "start"))
+      ret = sim_parse_time (tok[i + 1],
+                            &f->start);
+    if (0 != ret)
+    {
+      free (f);
+      return 1;
+    }
+  }
+  if ( (0 == rate) ||
+       (size < SIM_ETH_HLEN + SIM_IP_UDP_LEN + SIM_FLOW_PAYLOAD_LEN) ||
+       (size > 1514) )
+  {
+    fprintf (stderr,
+             "Flow rate must be positive and size within [%u,1514]\n",
+             SIM_ETH_HLEN + SIM_IP_UDP_LEN + SIM_FLOW_PAYLOAD_LEN);
+    free (f);
+    return 1;
+  }
+  f->interval = 1000000000LLU / rate;
+  f->size = size;
+  f->latency_min = UINT64_MAX;
+  f->name = strdup (tok[1]);
+  tmp = realloc (sim_flows,
+                 (sim_num_flows + 1) * sizeof (struct SimFlow *));
+  if (NULL == tmp)
+  {
+    free (f);
+    return 1;
+  }
+  sim_flows = tmp;
+  f->id = sim_num_flows;
+  sim_flows[sim_num_flows++] = f;
+  memset (&ev,
+          0,
+          sizeof (ev));
+  ev.time = f->start;
+  ev.type = SE_FLOW;
+  ev.flow = f;
+  sim_schedule (&ev);
+  return 0;
+}
+
+
+/**
+ * Handle "at TIME NAME COMMAND...".
+ *
+ * @param tok tokens of the line
+ * @param n number of tokens
+ * @return 0 on success
+ */
+static int
+sim_cmd_at (char **tok,
+            unsigned int n)
+{
+  struct SimEvent ev;
+  size_t len = 0;
+
+  if (n < 4)
+    return 1;
+  memset (&ev,
+          0,
+          sizeof (ev));
+  ev.type = SE_CONTROL;
+  ev.node = sim_find_node (tok[2]);
+  if ( (0 != sim_parse_time (tok[1],
+                             &ev.time)) ||
+       (NULL == ev.node) ||
+       (SNK_MODULE != ev.node->kind) )
+  {
+    fprintf (stderr,
+             "Expected time and module node\n");
+    return 1;
+  }
+  for (unsigned int i=3;i<n;i++)
+    len += strlen (tok[i]) + 1;
+  ev.data = malloc (len);
+  if (NULL == ev.data)
+    return 1;
+  ev.size = 0;
+  for (unsigned int i=3;i<n;i++)
+  {
+    size_t tlen = strlen (tok[i]);
+
+    memcpy (&ev.data[ev.size],
+            tok[i],
+            tlen);
+    ev.size += tlen;
+    ev.data[ev.size++] = (i + 1 < n) ? ' ' : '\0';
+  }
+  sim_schedule (&ev);
+  return 0;
+}
+
+
+/**
+ * Load topology file @a filename.
+ *
+ * @param filename file to load
+ * @return 0 on success
+ */
+static int
+sim_load (const char *filename)
+{
+  FILE *f;
+  char *line = NULL;
+  size_t line_size = 0;
+  unsigned int lineno = 0;
+  int ret = 0;
+
+  f = fopen (filename,
+             "r");
+  if (NULL == f)
+  {
+    fprintf (stderr,
+             "Failed to open `%s': %s\n",
+             filename,
+             strerror (errno));
+    return 1;
+  }
+  while ( (0 == ret) &&
+          (-1 != getline (&line,
+                          &line_size,
+                          f)) )
+  {
+    char *tok[SIM_MAX_TOKENS];
+    char *save;
+    unsigned int n = 0;
+
+    lineno++;
+    for (char *t = strtok_r (line, " \t\r\n", &save);
+         (NULL != t) && ('#' != t[0]) && (n < SIM_MAX_TOKENS);
+         t = strtok_r (NULL, " \t\r\n", &save))
+      tok[n++] = t;
+    if (0 == n)
+      continue;
+    if (0 == strcmp (tok[0], "node"))
+      ret = sim_cmd_node (tok,
+                          n);
+    else if (0 == strcmp (tok[0], "host"))
+      ret = sim_cmd_host (tok,
+                          n);
+    else if (0 == strcmp (tok[0], "link"))
+      ret = sim_cmd_link (tok,
+                          n);
+    else if (0 == strcmp (tok[0], "flow"))
+      ret = sim_cmd_flow (tok,
+                          n);
+    else if (0 == strcmp (tok[0], "at"))
+      ret = sim_cmd_at (tok,
+                        n);
+    else if ( (0 == strcmp (tok[0], "run")) &&
+              (2 == n) )
+      ret = sim_parse_time (tok[1],
+                            &sim_end);
+    else if ( (0 == strcmp (tok[0], "seed")) &&
+              (2 == n) )
+      ret = (1 == sscanf (tok[1],
+                          "%" SCNu64,
+                          &sim_rng)) ? 0 : 1;
+    else
+      ret = 1;
+    if (0 != ret)
+      fprintf (stderr,
+               "%s:%u: malformed `%s' line\n",
+               filename,
+               lineno,
+               tok[0]);
+  }
+  free (line);
+  fclose (f);
+  return ret;
+}
+
+
+/**
+ * Find the MAC of @a ip in the ARP cache of host @a h.
+ *
+ * @param h host
+ * @param ip neighbour
+ * @return NULL if unknown
+ */
+static struct SimArpEntry *
+sim_arp_lookup (struct SimNode *h,
+                struct in_addr ip)
+{
+  for (unsigned int i=0;i<h->num_arp;i++)
+    if (ip.s_addr == h->arp[i].ip.s_addr)
+      return &h->arp[i];
+  return NULL;
+}
+
+
+/**
+ * Learn that @a ip has @a mac on host @a h.
+ *
+ * @param h host
+ * @param ip neighbour
+ * @param mac MAC of the neighbour
+ */
+static void
+sim_arp_learn (struct SimNode *h,
+               struct in_addr ip,
+               const void *mac)
+{
+  struct SimArpEntry *ae = sim_arp_lookup (h,
+                                           ip);
+
+  if (NULL == ae)
+  {
+    struct SimArpEntry *tmp;
+
+    tmp = realloc (h->arp,
+                   (h->num_arp + 1) * sizeof (struct SimArpEntry));
+    if (NULL == tmp)
+      return;
+    h->arp = tmp;
+    ae = &h->arp[h->num_arp++];
+    ae->ip = ip;
+  }
+  memcpy (&ae->mac,
+          mac,
+          sizeof (struct MacAddress));
+}
+
+
+/**
+ * Send frame from host @a h.
+ *
+ * @param h sending host
+ * @param dst destination MAC
+ * @param type Ethernet type
+ * @param payload frame payload
+ * @param size number of bytes in @a payload
+ */
+static void
+sim_host_send (struct SimNode *h,
+               const void *dst,
+               uint16_t type,
+               const void *payload,
+               size_t size)
+{
+  char frame[SIM_ETH_HLEN + size];
+  uint16_t ntype = htons (type);
+
+  memcpy (frame,
+          dst,
+          sizeof (struct MacAddress));
+  memcpy (&frame[6],
+          &h->ports[0].mac,
+          sizeof (struct MacAddress));
+  memcpy (&frame[12],
+          &ntype,
+          sizeof (ntype));
+  memcpy (&frame[SIM_ETH_HLEN],
+          payload,
+          size);
+  sim_transmit (h,
+                1,
+                frame,
+                sizeof (frame));
+}
+
+
+/**
+ * Send ARP message from host @a h.
+ *
+ * @param h sending host
+ * @param oper 1 for requests, 2 for replies
+ * @param dst destination MAC (and target hardware address of replies)
+ * @param target_pa target protocol address
+ */
+static void
+sim_host_send_arp (struct SimNode *h,
+                   uint16_t oper,
+                   const void *dst,
+                   struct in_addr target_pa)
+{
+  static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  uint8_t ah[SIM_ARP_LEN] = { 0x00, 0x01, 0x08, 0x00, 6, 4, 0, 0 };
+
+  ah[7] = (uint8_t) oper;
+  memcpy (&ah[8],
+          &h->ports[0].mac,
+          6);
+  memcpy (&ah[14],
+          &h->ip,
+          4);
+  if (1 == oper)
+    memset (&ah[18],
+            0,
+            6);
+  else
+    memcpy (&ah[18],
+            dst,
+            6);
+  memcpy (&ah[24],
+          &target_pa,
+          4);
+  sim_host_send (h,
+                 (1 == oper) ? broadcast : dst,
+                 0x0806,
+                 ah,
+                 sizeof (ah));
+}
+
+
+/**
+ * Send the next packet of flow @a f and schedule the one after.
+ *
+ * @param f flow to advance
+ */
+static void
+sim_flow_step (struct SimFlow *f)
+{
+  struct SimNode *h = f->src;
+  struct in_addr hop = f->dst;
+  const struct SimArpEntry *ae;
+  uint64_t seq = f->sent++;
+
+  if (f->sent < f->count)
+  {
+    struct SimEvent ev;
+
+    memset (&ev,
+            0,
+            sizeof (ev));
+    ev.time = f->start + f->sent * f->interval;
+    ev.type = SE_FLOW;
+    ev.flow = f;
+    sim_schedule (&ev);
+  }
+  if ( (f->dst.s_addr & h->netmask.s_addr) !=
+       (h->ip.s_addr & h->netmask.s_addr) )
+    hop = h->gateway;
+  if (0 == hop.s_addr)
+  {
+    f->unresolved++;
+    return;
+  }
+  ae = sim_arp_lookup (h,
+                       hop);
+  if (NULL == ae)
+  {
+    f->unresolved++;
+    sim_host_send_arp (h,
+                       1,
+                       NULL,
+                       hop);
+    return;
+  }
+  {
+    size_t plen = f->size - SIM_ETH_HLEN;
+    uint8_t ip[plen];
+    uint32_t magic = htonl (SIM_FLOW_MAGIC);
+    uint32_t id = f->id;
+    uint16_t word;
+    uint32_t sum;
+
+    memset (ip,
+            0,
+            plen);
+    ip[0] = 0x45;
+    word = htons ((uint16_t) plen);
+    memcpy (&ip[2],
+            &word,
+            2);
+    word = htons ((uint16_t) seq);
+    memcpy (&ip[4],
+            &word,
+            2);
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    memcpy (&ip[12],
+            &h->ip,
+            4);
+    memcpy (&ip[16],
+            &f->dst,
+            4);
+    sum = 0;
+    for (unsigned int i=0;i<20;i+=2)
+      sum += (ip[i] << 8) | ip[i + 1];
+    while (sum >> 16)
+      sum = (sum & 0xFFFF) + (sum >> 16);
+    word = htons ((uint16_t) ~sum);
+    memcpy (&ip[10],
+            &word,
+            2);
+    word = htons (SIM_FLOW_PORT);
+    memcpy (&ip[20],
+            &word,
+            2);
+    memcpy (&ip[22],
+            &word,
+            2);
+    word = htons ((uint16_t) (plen - 20));
+    memcpy (&ip[24],
+            &word,
+            2);
+    /* UDP checksum 0: none */
+    memcpy (&ip[SIM_IP_UDP_LEN],
+            &magic,
+            4);
+    memcpy (&ip[SIM_IP_UDP_LEN + 4],
+            &id,
+            4);
+    memcpy (&ip[SIM_IP_UDP_LEN + 8],
+            &seq,
+            8);
+    memcpy (&ip[SIM_IP_UDP_LEN + 16],
+            &sim_now,
+            8);
+    sim_host_send (h,
+                   &ae->mac,
+                   0x0800,
+                   ip,
+                   plen);
+  }
+}
+
+
+/**
+ * Process frame received by host @a h: answer ARP requests, learn
+ * from ARP and account test flow packets.
+ *
+ * @param h receiving host
+ * @param frame the frame
+ * @param size number of bytes in @a frame
+ */
+static void
+sim_host_receive (struct SimNode *h,
+                  const char *frame,
+                  size_t size)
+{
+  const uint8_t *p = (const uint8_t *) &frame[SIM_ETH_HLEN];
+  uint16_t type;
+
+  if (size < SIM_ETH_HLEN)
+    return;
+  type = (p[-2] << 8) | p[-1];
+  size -= SIM_ETH_HLEN;
+  if ( (0x0806 == type) &&
+       (size >= SIM_ARP_LEN) &&
+       (0 == memcmp (p,
+                     "\x00\x01\x08\x00\x06\x04",
+                     6)) )
+  {
+    struct in_addr spa;
+
+    memcpy (&spa,
+            &p[14],
+            4);
+    if (0 != memcmp (&p[24],
+                     &h->ip,
+                     4))
+      return;
+    sim_arp_learn (h,
+                   spa,
+                   &p[8]);
+    if (1 == p[7])
+      sim_host_send_arp (h,
+                         2,
+                         &p[8],
+                         spa);
+    return;
+  }
+  if ( (0x0800 == type) &&
+       (size >= SIM_IP_UDP_LEN + SIM_FLOW_PAYLOAD_LEN) &&
+       (0x45 == p[0]) &&
+       (IPPROTO_UDP == p[9]) &&
+       (0 == memcmp (&p[16],
+                     &h->ip,
+                     4)) &&
+       (SIM_FLOW_PORT == ((p[22] << 8) | p[23])) &&
+       (SIM_FLOW_MAGIC == (uint32_t) ((p[28] << 24) | (p[29] << 16)
+                                      | (p[30] << 8) | p[31])) )
+  {
+    uint32_t id;
+    uint64_t seq;
+    uint64_t sent;
+    uint64_t lat;
+    struct SimFlow *f;
+
+    memcpy (&id,
+            &p[SIM_IP_UDP_LEN + 4],
+            4);
+    memcpy (&seq,
+            &p[SIM_IP_UDP_LEN + 8],
+            8);
+    memcpy (&sent,
+            &p[SIM_IP_UDP_LEN + 16],
+            8);
+    if (id >= sim_num_flows)
+      return;
+    f = sim_flows[id];
+    f->received++;
+    if (seq < f->next_seq)
+      f->reordered++;
+    else
+      f->next_seq = seq + 1;
+    lat = sim_now - sent;
+    f->latency_sum += lat;
+    if (lat < f->latency_min)
+      f->latency_min = lat;
+    if (lat > f->latency_max)
+      f->latency_max = lat;
+    return;
+  }
+  h->rx_other++;
+}
+
+
+/**
+ * Create the coroutine of module node @a n and let it process the
+ * initial message with the MACs of its ports.
+ *
+ * @param n node to start
+ * @return 0 on success
+ */
+static int
+sim_start_node (struct SimNode *n)
+{
+  struct MacAddress macs[n->num_ports];
+
+  n->stack = mmap (NULL,
+                   SIM_STACK_SIZE,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                   -1,
+                   0);
+  if (MAP_FAILED == n->stack)
+  {
+    n->stack = NULL;
+    perror ("mmap");
+    return 1;
+  }
+  if (0 != getcontext (&n->ctx))
+  {
+    perror ("getcontext");
+    return 1;
+  }
+  n->ctx.uc_stack.ss_sp = n->stack;
+  n->ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+  n->ctx.uc_link = &sim_sched_ctx;
+  makecontext (&n->ctx,
+               &sim_node_main,
+               0);
+  for (unsigned int i=0;i<n->num_ports;i++)
+    macs[i] = n->ports[i].mac;
+  sim_node_input (n,
+                  0,
+                  macs,
+                  sizeof (macs));
+  sim_resume (n);
+  return 0;
+}
+
+
+/**
+ * Let all module nodes exit and release their stacks.  The modules
+ * stay loaded: like a process, a node need not free everything its
+ * globals point to before main() returns.
+ */
+static void
+sim_stop_nodes ()
+{
+  for (unsigned int i=0;i<sim_num_nodes;i++)
+  {
+    struct SimNode *n = sim_nodes[i];
+
+    if (SNK_MODULE != n->kind)
+      continue;
+    n->closed = true;
+    if (NULL != n->stack)
+      sim_resume (n);
+    if (-1 != n->fd)
+      close (n->fd);
+    if (NULL != n->stack)
+      munmap (n->stack,
+              SIM_STACK_SIZE);
+  }
+}
+
+
+/**
+ * Process events until there are none left or #sim_end is reached.
+ */
+static void
+sim_run ()
+{
+  while ( (sim_num_events > 0) &&
+          (sim_events[0].time <= sim_end) )
+  {
+    struct SimEvent ev;
+
+    sim_pop (&ev);
+    sim_now = ev.time;
+    sim_processed++;
+    switch (ev.type)
+    {
+    case SE_FRAME:
+      ev.node->ports[ev.port - 1].rx_frames++;
+      if (SNK_HOST == ev.node->kind)
+      {
+        sim_host_receive (ev.node,
+                          ev.data,
+                          ev.size);
+      }
+      else
+      {
+        sim_node_input (ev.node,
+                        ev.port,
+                        ev.data,
+                        ev.size);
+        sim_resume (ev.node);
+      }
+      break;
+    case SE_CONTROL:
+      sim_node_input (ev.node,
+                      0,
+                      ev.data,
+                      ev.size);
+      sim_resume (ev.node);
+      break;
+    case SE_FLOW:
+      sim_flow_step (ev.flow);
+      break;
+    }
+    free (ev.data);
+  }
+  if (sim_end != UINT64_MAX)
+    sim_now = sim_end;
+}
+
+
+/**
+ * Print statistics about flows, links and nodes.
+ *
+ * @param wall wall-clock time the simulation took, in ns
+ */
+static void
+sim_report (uint64_t wall)
+{
+  printf ("Simulated %.6f s in %.3f s: %llu events, %.0f events/s\n",
+          sim_now / 1e9,
+          wall / 1e9,
+          (unsigned long long) sim_processed,
+          (0 == wall) ? 0.0 : sim_processed * 1e9 / wall);
+  for (unsigned int i=0;i<sim_num_flows;i++)
+  {
+    const struct SimFlow *f = sim_flows[i];
+    char dst[INET_ADDRSTRLEN];
+
+    inet_ntop (AF_INET,
+               &f->dst,
+               dst,
+               sizeof (dst));
+    printf ("flow %s: %s -> %s: %llu sent, %llu unresolved, %llu received, "
+            "%llu lost, %llu reordered",
+            f->name,
+            f->src->name,
+            dst,
+            (unsigned long long) f->sent,
+            (unsigned long long) f->unresolved,
+            (unsigned long long) f->received,
+            (unsigned long long) (f->sent - f->unresolved - f->received),
+            (unsigned long long) f->reordered);
+    if (0 != f->received)
+      printf (", latency %.3f/%.3f/%.3f us",
+              f->latency_min / 1e3,
+              f->latency_sum / 1e3 / f->received,
+              f->latency_max / 1e3);
+    printf ("\n");
+  }
+  for (unsigned int i=0;i<sim_num_links;i++)
+  {
+    const struct SimLink *l = sim_links[i];
+
+    printf ("link %s:%u - %s:%u: %llu/%llu frames, %llu/%llu lost\n",
+            l->node[0]->name,
+            l->port[0],
+            l->node[1]->name,
+            l->port[1],
+            (unsigned long long) l->frames[0],
+            (unsigned long long) l->frames[1],
+            (unsigned long long) l->lost[0],
+            (unsigned long long) l->lost[1]);
+  }
+  for (unsigned int i=0;i<sim_num_nodes;i++)
+  {
+    const struct SimNode *n = sim_nodes[i];
+    uint64_t rx = 0;
+    uint64_t tx = 0;
+
+    for (unsigned int j=0;j<n->num_ports;j++)
+    {
+      rx += n->ports[j].rx_frames;
+      tx += n->ports[j].tx_frames;
+    }
+    printf ("node %s: %llu frames in, %llu frames out\n",
+            n->name,
+            (unsigned long long) rx,
+            (unsigned long long) tx);
+  }
+}
+
+
+/**
+ * Release everything.
+ */
+static void
+sim_free ()
+{
+  for (unsigned int i=0;i<sim_num_events;i++)
+    free (sim_events[i].data);
+  free (sim_events);
+  for (unsigned int i=0;i<sim_num_nodes;i++)
+  {
+    struct SimNode *n = sim_nodes[i];
+
+    for (int j=0;j<n->argc;j++)
+      free (n->argv[j]);
+    free (n->argv);
+    free (n->in);
+    free (n->arp);
+    free (n->ports);
+    free (n->name);
+    free (n);
+  }
+  free (sim_nodes);
+  for (unsigned int i=0;i<sim_num_links;i++)
+    free (sim_links[i]);
+  free (sim_links);
+  for (unsigned int i=0;i<sim_num_flows;i++)
+  {
+    free (sim_flows[i]->name);
+    free (sim_flows[i]);
+  }
+  free (sim_flows);
+  for (unsigned int i=0;i<sim_num_modules;i++)
+  {
+    free (sim_modules[i].type);
+    free (sim_modules[i].image);
+  }
+  free (sim_modules);
+  free (sim_module_dir);
+}
+
+
+/**
+ * Runs the simulation of a topology.  The modules are expected next
+ * to the simulator binary.
+ *
+ * @param argc number of arguments in @a argv
+ * @param argv binary name, followed by the topology file
+ * @return 0 on success
+ */
+int
+main (int argc,
+      char **argv)
+{
+  char exe[PATH_MAX];
+  struct timespec start;
+  struct timespec end;
+  ssize_t len;
+  char *slash;
+  int ret = 0;
+
+  if (2 != argc)
+  {
+    fprintf (stderr,
+             "Usage: %s TOPOLOGY\n",
+             argv[0]);
+    return 1;
+  }
+  len = readlink ("/proc/self/exe",
+                  exe,
+                  sizeof (exe) - 1);
+  if (len <= 0)
+  {
+    perror ("readlink");
+    return 1;
+  }
+  exe[len] = '\0';
+  slash = strrchr (exe,
+                   '/');
+  if (NULL != slash)
+    *slash = '\0';
+  sim_module_dir = strdup (exe);
+  if (0 != sim_load (argv[1]))
+  {
+    sim_stop_nodes ();
+    sim_free ();
+    return 1;
+  }
+  /* random() is also used by the nodes */
+  srandom ((unsigned int) sim_rng);
+  clock_gettime (CLOCK_MONOTONIC,
+                 &start);
+  for (unsigned int i=0;i<sim_num_nodes;i++)
+    if ( (SNK_MODULE == sim_nodes[i]->kind) &&
+         (0 != sim_start_node (sim_nodes[i])) )
+      ret = 1;
+  if (0 == ret)
+    sim_run ();
+  clock_gettime (CLOCK_MONOTONIC,
+                 &end);
+  sim_stop_nodes ();
+  if (0 == ret)
+    sim_report ((end.tv_sec - start.tv_sec) * 1000000000LLU
+                + end.tv_nsec - start.tv_nsec);
+  sim_free ();
+  return ret;
+}
+
+
+/* end of sim.c */
@@ -20,50 +20,126 @@
  * @file switch.c
  * @brief Ethernet switch
  * @author Christian Grothoff
+ *
+ * One process can host several independent bridges: an interface
+ * given as "IFC[BR:NAME]" belongs to bridge NAME, all others to the
+ * default bridge.  Each bridge has its own MAC table, frames are only
+ * ever forwarded between interfaces of the same bridge.
+ */
+#ifndef GLAB_SFLOW
+/**
+ * Support sFlow-style sampling, see sflow.h.
  */
+#define GLAB_SFLOW 1
+#endif
+#ifndef GLAB_BPF
+/**
+ * Support ingress filters, see bpf.h.
+ */
+#define GLAB_BPF 1
+#endif
 #include "glab.h"
 #include "print.c"
-#include "time.h"
-#define macToIfc_size 10
+#include "packet.h"
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
 
 /**
- * declarations
+ * Number of entries in the MAC learning table, a multiple of 4
+ * so that lookups can always compare whole vectors.
  */
-static bool maccmp(const struct MacAddress *mac1, const struct MacAddress *mac2);
-static void printMac(const struct MacAddress *mac);
+#define MAC_TABLE_SIZE 64
 
 /**
- * gcc 4.x-ism to pack structures (to be used before structs);
- * Using this still causes structs to be unaligned on the stack on Sparc
- * (See #670578 from Debian).
+ * Set in every MAC table key, so that unused (zero) slots never match.
  */
-_Pragma("pack(push)") _Pragma("pack(1)")
+#define MAC_KEY_VALID (1LLU << 63)
 
-struct EthernetHeader
-{
-    struct MacAddress dst;
-    struct MacAddress src;
-    uint16_t tag;
-};
 
-_Pragma("pack(pop)")
+struct Bridge;
+
 
 /**
  * Per-interface context.
  */
 struct Interface
 {
-    /**
+  /**
    * MAC of interface.
    */
-    struct MacAddress mac;
+  struct MacAddress mac;
 
-    /**
+  /**
    * Number of this interface.
    */
-    uint16_t ifc_num;
+  uint16_t ifc_num;
+
+  /**
+   * Bridge the interface belongs to.
+   */
+  struct Bridge *bridge;
+};
+
+
+/**
+ * MAC learning table, as a structure of arrays: lookups only scan
+ * the packed keys, several at a time if the compiler targets AVX2
+ * or SSE4.1 (for example with "make OPT='-O2 -march=native'").
+ * Slots are used in order and never freed, so only the first
+ * @e num_entries need to be looked at.
+ */
+struct MacTable
+{
+  /**
+   * MACs that were seen, see mac_key(); 0 for unused slots.
+   */
+  uint64_t keys[MAC_TABLE_SIZE];
+
+  /**
+   * Interface each MAC was last seen on.
+   */
+  uint16_t ifc_num[MAC_TABLE_SIZE];
+
+  /**
+   * When each MAC was last seen.
+   */
+  time_t timestamp[MAC_TABLE_SIZE];
+
+  /**
+   * Number of slots in use.
+   */
+  unsigned int num_entries;
 };
 
+
+/**
+ * A bridge: a set of interfaces switched between each other.
+ */
+struct Bridge
+{
+  /**
+   * Name of the bridge, "" for the default bridge.
+   */
+  char *name;
+
+  /**
+   * Interfaces of the bridge.
+   */
+  struct Interface **ports;
+
+  /**
+   * Number of entries in @e ports.
+   */
+  unsigned int num_ports;
+
+  /**
+   * MAC learning table.
+   */
+  struct MacTable mac_table;
+};
+
+
 /**
  * Number of available contexts.
  */
@@ -74,205 +150,445 @@ static unsigned int num_ifc;
  */
 static struct Interface *gifc;
 
-struct MacToIfc
-{
-    struct MacAddress mac;
-    uint16_t ifc_num;
-    time_t timeStamp;
-};
+/**
+ * Number of entries in #gbridges.
+ */
+static unsigned int num_bridges;
+
+/**
+ * All the bridges.
+ */
+static struct Bridge *gbridges;
+
+
+#include "mirror.c"
 
-static struct MacToIfc *macToIfc; // = malloc(10 * sizeof(struct MacToIfc));
 
 /**
- * Forward @a frame to interface @a dst.
+ * Pack @a mac into a MAC table key.
  *
- * @param dst target interface to send the frame out on
- * @param frame the frame to forward
- * @param frame_size number of bytes in @a frame
+ * @param mac the MAC
+ * @return key for @a mac
  */
-static void forward_to(
-    struct Interface *dst,
-    const void *frame,
-    size_t frame_size)
+static inline uint64_t
+mac_key (const struct MacAddress *mac)
 {
-    char iob[frame_size + sizeof(struct GLAB_MessageHeader)];
-    struct GLAB_MessageHeader hdr;
-
-    hdr.size = htons(sizeof(iob));
-    hdr.type = htons(dst->ifc_num);
-    memcpy(iob, &hdr, sizeof(hdr));
-    memcpy(&iob[sizeof(hdr)], frame, frame_size);
-    write_all(STDOUT_FILENO, iob, sizeof(iob));
+  uint64_t key = 0;
+
+  memcpy (&key,
+          mac,
+          sizeof (struct MacAddress));
+  return key | MAC_KEY_VALID;
 }
 
+
 /**
- * Parse and process frame received on @a ifc.
+ * Look up @a skey and @a dkey in @a mt in one pass.
  *
- * @param ifc interface we got the frame on
- * @param frame raw frame data
- * @param frame_size number of bytes in @a frame
+ * @param mt table to search
+ * @param skey key of the source MAC
+ * @param dkey key of the destination MAC
+ * @param[out] si set to the slot of @a skey, -1 if not found
+ * @param[out] di set to the slot of @a dkey, -1 if not found
  */
-static void parse_frame(struct Interface *ifc, const void *frame, size_t frame_size)
+static inline void
+mac_table_lookup (const struct MacTable *mt,
+                  uint64_t skey,
+                  uint64_t dkey,
+                  int *si,
+                  int *di)
 {
-    struct EthernetHeader eh;
+  unsigned int n = (mt->num_entries + 3) & ~3U;
+
+  *si = -1;
+  *di = -1;
+#if defined(__AVX2__)
+  {
+    __m256i s = _mm256_set1_epi64x ((long long) skey);
+    __m256i d = _mm256_set1_epi64x ((long long) dkey);
 
-    if (frame_size < sizeof(eh))
+    for (unsigned int i = 0; i < n; i += 4)
     {
-        fprintf(stderr, "Malformed frame\n");
-        return;
+      __m256i k = _mm256_loadu_si256 ((const __m256i *) &mt->keys[i]);
+      int ms = _mm256_movemask_pd (_mm256_castsi256_pd (_mm256_cmpeq_epi64 (k,
+                                                                             s)));
+      int md = _mm256_movemask_pd (_mm256_castsi256_pd (_mm256_cmpeq_epi64 (k,
+                                                                             d)));
+
+      if (0 != ms)
+        *si = i + __builtin_ctz (ms);
+      if (0 != md)
+        *di = i + __builtin_ctz (md);
     }
+  }
+#elif defined(__SSE4_1__)
+  {
+    __m128i s = _mm_set1_epi64x ((long long) skey);
+    __m128i d = _mm_set1_epi64x ((long long) dkey);
 
-    // Writes ethernet header from frame to eh variable.
-    memcpy(&eh, frame, sizeof(eh));
-
-    /* do work here! */
-
-    int invalidIndex = -1;
-    int oldestIndex = invalidIndex;
-    int srcIndex = invalidIndex;
-    int dstIndex = invalidIndex;
-    time_t now = time(NULL);
-
-    // STEP 1: FIND ...
-    //         WHERE TO SAVE SOURCE MAC AND INTERFACE INFO
-    //         WHERE DESTINATION MAC AND INTERFACE IS SAVED
-    for (int i = 0; i < macToIfc_size; i++){
-        if(srcIndex == invalidIndex){ // Prevent longer comparison if src found.
-            // Is this the entry for the source?
-            if(maccmp(&(macToIfc[i].mac), eh.src.mac)){
-                srcIndex = i;
-            }
-            // Is this an entry that is older than those before?
-            else if (difftime(macToIfc[i].timeStamp, macToIfc[oldestIndex].timeStamp) < 0){
-                oldestIndex = i;
-            }
-        }
-
-        if(dstIndex == invalidIndex){ // Prevent longer comparison if dst found.
-            // Is this the destination entry?
-            if(maccmp(&(macToIfc[i]).mac, eh.dst.mac)){
-                dstIndex = i;
-            }
-        }
-
-        // No need to loop further if we found source and destination indices.
-        // Note: If oldestIndex != invalidIndex, it is still possible to find an older one.
-        if(srcIndex != invalidIndex && dstIndex != invalidIndex){
-            break;
-        }
+    for (unsigned int i = 0; i < n; i += 2)
+    {
+      __m128i k = _mm_loadu_si128 ((const __m128i *) &mt->keys[i]);
+      int ms = _mm_movemask_pd (_mm_castsi128_pd (_mm_cmpeq_epi64 (k,
+                                                                   s)));
+      int md = _mm_movemask_pd (_mm_castsi128_pd (_mm_cmpeq_epi64 (k,
+                                                                   d)));
+
+      if (0 != ms)
+        *si = i + __builtin_ctz (ms);
+      if (0 != md)
+        *di = i + __builtin_ctz (md);
     }
+  }
+#else
+  for (unsigned int i = 0; i < n; i++)
+  {
+    uint64_t k = mt->keys[i];
+
+    if (k == skey)
+      *si = i;
+    if (k == dkey)
+      *di = i;
+  }
+#endif
+}
 
-    // STEP 2: SAVE MAC AND INTERFACE FOR SOURCE BY ...
-    //         OVERRIDING PREVIOUS ENTRY, IF ENTRY FOR SOURCE FOUND.
-    //         OVERRIDING OLDEST ENTRY, IF ENTRY FOR SOURCE NOT FOUND.
-    if(srcIndex != invalidIndex){
-        macToIfc[srcIndex].ifc_num = ifc->ifc_num;
-        macToIfc[srcIndex].timeStamp = now;
-    } else {
-        macToIfc[oldestIndex].ifc_num = ifc->ifc_num;
-        macToIfc[oldestIndex].timeStamp = now;
-    }
 
-    // STEP 3: EITHER
-    //         FORWARD TO DESTINATION, IF FOUND.
-    //         FORWARD TO ALL EXCEPT SELF, IF DESTINATION NOT FOUND. (i.e. broadcast)
-    if(dstIndex != invalidIndex){
-        forward_to(&macToIfc[dstIndex], frame, frame_size);
-    } else {
-        int a = 0;
-        for (a = 0; a < num_ifc; a++){
-            if (&gifc[a].ifc_num != &ifc->ifc_num){
-                print("Frame from %u to %u forwarded\n", (unsigned)&ifc->ifc_num, (unsigned)&gifc[a].ifc_num);
-                forward_to(&gifc[a], frame, frame_size);
-            } else {
-                print("Frame from %u to %u dropped\n", (unsigned)&ifc->ifc_num, (unsigned)&gifc[a].ifc_num);
-            }
-        }
-    }
+/**
+ * Find the slot to learn a new MAC in: the next unused one, or the
+ * one least recently seen.
+ *
+ * @param mt table to search
+ * @param keep slot not to replace (the destination), or -1
+ * @return slot to use, -1 if none
+ */
+static int
+mac_table_victim (struct MacTable *mt,
+                  int keep)
+{
+  int oldest = -1;
+
+  if (mt->num_entries < MAC_TABLE_SIZE)
+    return mt->num_entries++;
+  for (int i = 0; i < MAC_TABLE_SIZE; i++)
+  {
+    if (i == keep)
+      continue;
+    if ( (-1 == oldest) ||
+         (mt->timestamp[i] < mt->timestamp[oldest]) )
+      oldest = i;
+  }
+  return oldest;
 }
 
+
 /**
- * Process frame received from @a interface.
+ * Parse and process frame received on @a ifc.
  *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
+ * @param ifc interface we got the frame on
+ * @param frame raw frame data, in the receive buffer
  * @param frame_size number of bytes in @a frame
  */
-static void handle_frame(uint16_t interface, const void *frame, size_t frame_size)
+static void
+parse_frame (struct Interface *ifc,
+             void *frame,
+             size_t frame_size)
 {
-    if (interface > num_ifc){
-        abort();
+  struct MacTable *mt = &ifc->bridge->mac_table;
+  struct Bridge *br = ifc->bridge;
+  struct EthernetFrame ef;
+  uint16_t dst_ifc;
+  int si;
+  int di;
+
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      false,
+                      &ef))
+  {
+    fprintf (stderr,
+             "Malformed frame\n");
+    return;
+  }
+  /* not VLAN-aware, all frames are in VLAN 0 */
+  mirror_rx (ifc->ifc_num,
+             0,
+             frame,
+             frame_size);
+  if (mirror_is_dest (ifc->ifc_num))
+    return;
+  mac_table_lookup (mt,
+                    mac_key (&ef.eh->src),
+                    mac_key (&ef.eh->dst),
+                    &si,
+                    &di);
+  if ( (-1 == si) &&
+       (! mac_is_multicast (&ef.eh->src)) )
+  {
+    bool full = (MAC_TABLE_SIZE == mt->num_entries);
+
+    si = mac_table_victim (mt,
+                           di);
+    if (-1 != si)
+    {
+      GLAB_PROBE3 (mac_learn,
+                   &ef.eh->src,
+                   ifc->ifc_num,
+                   full);
+      mt->keys[si] = mac_key (&ef.eh->src);
+    }
+  }
+  else if (-1 != si)
+  {
+    GLAB_PROBE3 (mac_learn,
+                 &ef.eh->src,
+                 ifc->ifc_num,
+                 0);
+  }
+  if (-1 != si)
+  {
+    mt->ifc_num[si] = ifc->ifc_num;
+    mt->timestamp[si] = time (NULL);
+  }
+  /* a frame to its own source address is flooded, as it always was */
+  dst_ifc = ( (-1 == di) || (di == si) ) ? 0 : mt->ifc_num[di];
+  GLAB_PROBE2 (mac_lookup,
+               &ef.eh->dst,
+               dst_ifc);
+  if ( (0 != dst_ifc) &&
+       (! mac_is_multicast (&ef.eh->dst)) )
+  {
+    if ( (dst_ifc != ifc->ifc_num) &&
+         (! mirror_is_dest (dst_ifc)) )
+    {
+      glab_send_in_place (dst_ifc,
+                          frame,
+                          frame_size);
+      mirror_tx (dst_ifc,
+                 frame,
+                 frame_size);
     }
-    parse_frame(&gifc[interface - 1], frame, frame_size);
+    return;
+  }
+  /* unknown destination or broadcast: flood within the bridge */
+  for (unsigned int i = 0; i < br->num_ports; i++)
+  {
+    if ( (br->ports[i] == ifc) ||
+         mirror_is_dest (br->ports[i]->ifc_num) )
+      continue;
+    glab_send_in_place (br->ports[i]->ifc_num,
+                        frame,
+                        frame_size);
+    mirror_tx (br->ports[i]->ifc_num,
+               frame,
+               frame_size);
+  }
 }
 
+
+GLAB_DEFINE_HANDLE_FRAME (num_ifc, &gifc[interface - 1], parse_frame)
+
+
 /**
- * Handle control message @a cmd.
- *
- * @param cmd text the user entered
- * @param cmd_len length of @a cmd
+ * Process "bridge" command: list the bridges with their interfaces
+ * and the number of MACs learned.
  */
-static void handle_control(char *cmd, size_t cmd_len)
+static void
+process_cmd_bridge ()
 {
-    cmd[cmd_len - 1] = '\0';
-    print("Received command `%s' (ignored)\n", cmd);
+  for (unsigned int i = 0; i < num_bridges; i++)
+  {
+    const struct Bridge *br = &gbridges[i];
+    char ports[br->num_ports * 6 + 1];
+    size_t off = 0;
+
+    ports[0] = '\0';
+    for (unsigned int j = 0; j < br->num_ports; j++)
+      off += snprintf (&ports[off],
+                       sizeof (ports) - off,
+                       " %u",
+                       br->ports[j]->ifc_num);
+    print ("%s:%s, %u MAC(s)\n",
+           ('\0' == br->name[0]) ? "default" : br->name,
+           ports,
+           br->mac_table.num_entries);
+  }
 }
 
+
 /**
- * Handle MAC information @a mac
+ * Handle control message @a cmd.
  *
- * @param ifc_num number of the interface with @a mac
- * @param mac the MAC address at @a ifc_num
+ * @param cmd text the user entered
+ * @param cmd_len length of @a cmd
  */
-static void handle_mac(uint16_t ifc_num, const struct MacAddress *mac)
+static void
+handle_control (char *cmd,
+                size_t cmd_len)
 {
-    if (ifc_num > num_ifc){
-        abort();
-    }
-    gifc[ifc_num - 1].mac = *mac;
+  const char *tok;
+
+  cmd[cmd_len - 1] = '\0';
+  tok = strtok (cmd,
+                " ");
+  if (NULL == tok)
+    return;
+  if (0 == strcasecmp (tok,
+                       "bridge"))
+    process_cmd_bridge ();
+  else if (0 == strcasecmp (tok,
+                            "mirror"))
+    process_cmd_mirror ();
+  else
+    print ("Received command `%s' (ignored)\n",
+           cmd);
 }
 
+
+GLAB_DEFINE_HANDLE_MAC (num_ifc, &gifc[ifc_num - 1])
+
+
 #include "loop.c"
 
+
 /**
- * Launches the switch.
+ * Find or create the bridge named @a name.
  *
- * @param argc number of arguments in @a argv
- * @param argv binary name, followed by list of interfaces to switch between
- * @return not really
+ * @param name name of the bridge
+ * @param name_len number of bytes in @a name
+ * @return NULL on error
  */
-int main(int argc, char **argv)
+static struct Bridge *
+get_bridge (const char *name,
+            size_t name_len)
 {
-    /*
-    struct MacToIfc Table[10];
-    memset(Table, 0, sizeof(Table));
-    macToIfc = Table;
-*/
-    macToIfc = malloc(10 * ( sizeof(ifc) + sizeof(t_time) ));
-
-    struct Interface ifc[argc - 1];
-    memset(ifc, 0, sizeof(ifc));
-    num_ifc = argc - 1;
-    gifc = ifc;
-
-    for (unsigned int i = 1; i < argc; i++){
-        ifc[i - 1].ifc_num = i;
-    }
-
-    loop();
-    return 0;
+  struct Bridge *br;
+
+  for (unsigned int i = 0; i < num_bridges; i++)
+    if ( (strlen (gbridges[i].name) == name_len) &&
+         (0 == strncmp (gbridges[i].name,
+                        name,
+                        name_len)) )
+      return &gbridges[i];
+  /* gbridges has room for one bridge per interface */
+  br = &gbridges[num_bridges];
+  br->name = strndup (name,
+                      name_len);
+  if (NULL == br->name)
+  {
+    perror ("strndup");
+    return NULL;
+  }
+  num_bridges++;
+  return br;
 }
 
+
 /**
- * Compare two MACs.
+ * Parse command-line argument with interface specification.
+ *
+ * @param arg command-line argument, "IFC" or "IFC[BR:NAME]"
+ * @param off offset of @a arg for error reporting
+ * @param ifc interface to initialize (bridge)
+ * @return 0 on success
  */
-static bool maccmp(const struct MacAddress *mac1, const struct MacAddress *mac2){
-    return memcmp(mac1, mac2, sizeof(struct MacAddress)) == 0;
+static int
+parse_cmd_arg (const char *arg,
+               int off,
+               struct Interface *ifc)
+{
+  const char *openbracket;
+  const char *closebracket;
+
+  openbracket = strchr (arg,
+                        (unsigned char) '[');
+  if (NULL == openbracket)
+  {
+    ifc->bridge = get_bridge ("",
+                              0);
+    return (NULL == ifc->bridge) ? 1 : 0;
+  }
+  openbracket++;
+  closebracket = strchr (openbracket,
+                         (unsigned char) ']');
+  if (NULL == closebracket)
+  {
+    fprintf (stderr,
+             "Interface definition #%d includes '[' but lacks ']'\n",
+             off);
+    return 1;
+  }
+  if ( (0 != strncmp (openbracket,
+                      "BR:",
+                      strlen ("BR:"))) ||
+       (closebracket == openbracket + strlen ("BR:")) )
+  {
+    fprintf (stderr,
+             "Expected `BR:NAME' in interface definition #%d\n",
+             off);
+    return 1;
+  }
+  openbracket += strlen ("BR:");
+  ifc->bridge = get_bridge (openbracket,
+                            closebracket - openbracket);
+  return (NULL == ifc->bridge) ? 1 : 0;
 }
 
+
 /**
- * Print MAC address.
+ * Launches the switch.
+ *
+ * @param argc number of arguments in @a argv
+ * @param argv binary name, followed by list of interfaces to switch between
+ * @return not really
  */
-static void printMac(const struct MacAddress *mac){
-    //print("[%02X:%02X:%02X:%02X:%02X:%02X]",mac[0],mac[1],mac[2],mac[3],mac[4],mac[5]);
+int
+main (int argc,
+      char **argv)
+{
+  struct Interface ifc[argc - 1];
+  struct Interface *ports[argc - 1];
+  unsigned int off;
+
+  memset (ifc,
+          0,
+          sizeof (ifc));
+  num_ifc = argc - 1;
+  gifc = ifc;
+  gbridges = calloc (num_ifc + 1,
+                     sizeof (struct Bridge));
+  if (NULL == gbridges)
+  {
+    perror ("calloc");
+    return 1;
+  }
+  for (unsigned int i = 1; i < argc; i++)
+  {
+    ifc[i - 1].ifc_num = i;
+    if (0 != parse_cmd_arg (argv[i],
+                            i,
+                            &ifc[i - 1]))
+      return 1;
+    ifc[i - 1].bridge->num_ports++;
+  }
+  /* give each bridge its slice of @e ports */
+  off = 0;
+  for (unsigned int i = 0; i < num_bridges; i++)
+  {
+    gbridges[i].ports = &ports[off];
+    off += gbridges[i].num_ports;
+    gbridges[i].num_ports = 0;
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    struct Bridge *br = ifc[i].bridge;
+
+    br->ports[br->num_ports++] = &ifc[i];
+  }
+  loop ();
+  mirror_free ();
+  for (unsigned int i = 0; i < num_bridges; i++)
+    free (gbridges[i].name);
+  free (gbridges);
+  return 0;
 }
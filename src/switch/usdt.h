@@ -0,0 +1,126 @@
+/*
+     This file (was) part of GNUnet.
+     Copyright (C) 2018 Christian Grothoff
+
+     GNUnet is free software: you can redistribute it and/or modify it
+     under the terms of the GNU Affero General Public License as published
+     by the Free Software Foundation, either version 3 of the License,
+     or (at your option) any later version.
+
+     GNUnet is distributed in the hope that it will be useful, but
+     WITHOUT ANY WARRANTY; without even the implied warranty of
+     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+     Affero General Public License for more details.
+
+     You should have received a copy of the GNU Affero General Public License
+     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * @file usdt.h
+ * @brief USDT static tracepoints for perf, bpftrace and SystemTap
+ * @author Christian Grothoff
+ *
+ * Emits the same `.note.stapsdt` ELF notes as <sys/sdt.h>, without
+ * needing that header or any library: each probe site is a single
+ * NOP plus a note telling the tracer where it is and where to find
+ * the arguments.  Compiled in by default on x86-64; build with
+ * -DGLAB_USDT=0 to remove them.  The provider is "glab", e.g.
+ *
+ *   bpftrace -e 'usdt:./router:glab:arp_miss { printf ("%x\n", arg1); }'
+ *
+ * Probes and their arguments:
+ *
+ *  receive (ifc_num, frame, frame_size)       loop.c, each frame read
+ *  egress (ifc_num, frame, frame_size)        packet.h, each frame written
+ *  mac_learn (mac, ifc_num, replaced)         switch.c, source MAC learned;
+ *                                             replaced is 1 if an entry
+ *                                             for another MAC was evicted
+ *  mac_lookup (mac, ifc_num)                  switch.c, destination MAC
+ *                                             looked up, ifc_num 0 if unknown
+ *  vlan_classify (ifc_num, vlan, tagged)      vswitch.c, VLAN assigned to an
+ *                                             accepted frame
+ *  vlan_drop (ifc_num, vlan, tagged)          vswitch.c, frame not admitted
+ *  route_lookup (dst, ifc_name, next_hop)     ipv4.c (router, l3switch), dst
+ *                                             and next_hop in network byte
+ *                                             order, ifc_name NULL if there
+ *                                             is no route
+ *  arp_miss (ifc_name, next_hop)              ipv4.c, packet dropped for lack
+ *                                             of an ARP entry
+ *  route6_lookup (dst, ifc_name, next_hop)    ipv6.c (router), like
+ *                                             route_lookup but dst and
+ *                                             next_hop point to the
+ *                                             16-byte addresses
+ *  ndp_miss (ifc_name, next_hop)              ipv6.c, packet dropped for lack
+ *                                             of a neighbour cache entry,
+ *                                             next_hop as for route6_lookup
+ *
+ * `mac`, `frame` and `ifc_name` are pointers into the process, read
+ * them with e.g. buf(arg0, 6) or str(arg1) in bpftrace.  All
+ * arguments are passed as 64-bit unsigned values.
+ */
+
+#ifndef GLAB_USDT_H
+#define GLAB_USDT_H
+
+#ifndef GLAB_USDT
+#if defined(__x86_64__)
+#define GLAB_USDT 1
+#else
+#define GLAB_USDT 0
+#endif
+#endif
+
+#if GLAB_USDT
+
+/**
+ * Emit a probe note for probe @a name whose arguments are described
+ * by @a args (in "8@OPERAND" form) and given as asm operands.
+ */
+#define GLAB_USDT_ASM(name, args)                                       \
+  "990: nop\n"                                                          \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+  ".balign 4\n"                                                         \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+  "991: .asciz \"stapsdt\"\n"                                           \
+  "992: .balign 4\n"                                                    \
+  "993: .8byte 990b\n"                                                  \
+  ".8byte _.stapsdt.base\n"                                             \
+  ".8byte 0\n"                                                          \
+  ".asciz \"glab\"\n"                                                   \
+  ".asciz \"" #name "\"\n"                                              \
+  ".asciz \"" args "\"\n"                                               \
+  "994: .balign 4\n"                                                    \
+  ".popsection\n"                                                       \
+  ".ifndef _.stapsdt.base\n"                                            \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"                                              \
+  ".hidden _.stapsdt.base\n"                                            \
+  "_.stapsdt.base: .space 1\n"                                          \
+  ".size _.stapsdt.base, 1\n"                                           \
+  ".popsection\n"                                                       \
+  ".endif\n"
+
+#define GLAB_PROBE1(name, a1)                                           \
+  __asm__ __volatile__ (GLAB_USDT_ASM (name, "8@%0")                    \
+                        :: "nor" ((uint64_t) (a1)))
+
+#define GLAB_PROBE2(name, a1, a2)                                       \
+  __asm__ __volatile__ (GLAB_USDT_ASM (name, "8@%0 8@%1")               \
+                        :: "nor" ((uint64_t) (a1)),                     \
+                           "nor" ((uint64_t) (a2)))
+
+#define GLAB_PROBE3(name, a1, a2, a3)                                   \
+  __asm__ __volatile__ (GLAB_USDT_ASM (name, "8@%0 8@%1 8@%2")          \
+                        :: "nor" ((uint64_t) (a1)),                     \
+                           "nor" ((uint64_t) (a2)),                     \
+                           "nor" ((uint64_t) (a3)))
+
+#else
+
+#define GLAB_PROBE1(name, a1) do { } while (0)
+#define GLAB_PROBE2(name, a1, a2) do { } while (0)
+#define GLAB_PROBE3(name, a1, a2, a3) do { } while (0)
+
+#endif
+
+#endif
@@ -20,9 +20,30 @@
  * @file vswitch.c
  * @brief Ethernet switch
  * @author Christian Grothoff
+ *
+ * One port can be made a VXLAN (RFC 7348) tunnel port ("vxlan port"),
+ * which then carries the VLANs that are mapped to a VNI to the remote
+ * VTEPs over an IPv4 underlay instead of switching them on the wire.
+ * Broadcast, unknown unicast and multicast go to every configured
+ * peer (head-end replication), MACs behind a peer are learned against
+ * that peer.  The outer headers are written into the headroom in front
+ * of the frame (see #GLAB_FRAME_HEADROOM), the inner frame is never
+ * copied.  The underlay next hop is resolved with ARP, and the UDP
+ * source port is derived from the inner flow so that the underlay can
+ * spread tunnels over equal-cost paths.
+ */
+#ifndef GLAB_SFLOW
+/**
+ * Support sFlow-style sampling, see sflow.h.
  */
+#define GLAB_SFLOW 1
+#endif
 #include "glab.h"
 #include "print.c"
+#include "crc.c"
+#include "packet.h"
+#include "huge.c"
+#include "config.c"
 
 
 /**
@@ -43,34 +64,280 @@
 #define DEFAULT_VLAN 0
 
 /**
- * gcc 4.x-ism to pack structures (to be used before structs);
- * Using this still causes structs to be unaligned on the stack on Sparc
- * (See #670578 from Debian).
+ * Number of entries in the MAC table, must be a power of 2.
+ */
+#define MAC_TABLE_SIZE 4096
+
+/**
+ * How many slots of the MAC table do we probe for an entry?
+ */
+#define MAC_TABLE_PROBES 16
+
+/**
+ * After how many seconds do learned MACs expire?
+ */
+#define MAC_AGE_TIME 300
+
+/**
+ * UDP port of VXLAN (IANA).
+ */
+#define VXLAN_UDP_PORT 4789
+
+/**
+ * Flag in the VXLAN header that must be set ("VNI is valid").
+ */
+#define VXLAN_FLAG_VNI 0x08
+
+/**
+ * Lowest UDP source port we use, the flow hash selects one of the
+ * ports from here to 65535 (RFC 7348, section 5).
+ */
+#define VXLAN_SPORT_MIN 49152
+
+/**
+ * Maximum number of remote VTEPs, configured and learned.
+ */
+#define VXLAN_MAX_PEERS 64
+
+/**
+ * Number of slots of the VNI to VLAN hash table, must be a power of 2
+ * and larger than the number of VLANs.
+ */
+#define VXLAN_VNI_SLOTS 8192
+
+/**
+ * How many seconds do we wait before repeating an ARP request for
+ * the next hop towards a peer?
+ */
+#define VXLAN_ARP_INTERVAL 1
+
+/**
+ * TTL of the outer IPv4 header.
+ */
+#define VXLAN_TTL 64
+
+/**
+ * ARP hardware type for Ethernet.
+ */
+#define ARP_HTYPE_ETHERNET 1
+
+/**
+ * ARP operation: request.
  */
+#define ARP_OP_REQUEST 1
+
+/**
+ * ARP operation: reply.
+ */
+#define ARP_OP_REPLY 2
+
+
 _Pragma("pack(push)") _Pragma("pack(1)")
 
-struct EthernetHeader
+/**
+ * Outer headers in front of a VXLAN encapsulated frame: Ethernet,
+ * IPv4 without options, UDP and VXLAN.
+ */
+struct VxlanOuterHeader
 {
-  struct MacAddress dst;
-  struct MacAddress src;
-  uint16_t tag;
+  /**
+   * Towards the next hop in the underlay.
+   */
+  struct EthernetHeader eth;
+
+  /**
+   * IPv4 version (4) and header length (5 words).
+   */
+  uint8_t version_ihl;
+
+  /**
+   * DSCP and ECN.
+   */
+  uint8_t diff_serv;
+
+  /**
+   * Length of the IPv4 packet, including this header.
+   */
+  uint16_t total_length;
+
+  /**
+   * Always 0, we set DF.
+   */
+  uint16_t identification;
+
+  /**
+   * Fragmentation flags and fragmentation offset.
+   */
+  uint16_t fragmentation_info;
+
+  /**
+   * Hop limit.
+   */
+  uint8_t ttl;
+
+  /**
+   * Always IPPROTO_UDP.
+   */
+  uint8_t protocol;
+
+  /**
+   * Checksum of the IPv4 header.
+   */
+  uint16_t checksum;
+
+  /**
+   * Our VTEP address.
+   */
+  struct in_addr source_address;
+
+  /**
+   * Address of the peer.
+   */
+  struct in_addr destination_address;
+
+  /**
+   * UDP source port, from the inner flow hash.
+   */
+  uint16_t source_port;
+
+  /**
+   * UDP destination port, #VXLAN_UDP_PORT.
+   */
+  uint16_t destination_port;
+
+  /**
+   * Length of the UDP datagram, including the UDP header.
+   */
+  uint16_t udp_length;
+
+  /**
+   * Always 0 (no checksum).
+   */
+  uint16_t udp_checksum;
+
+  /**
+   * #VXLAN_FLAG_VNI.
+   */
+  uint8_t flags;
+
+  /**
+   * Reserved, 0.
+   */
+  uint8_t reserved[3];
+
+  /**
+   * VNI in the upper 24 bits, the lower 8 bits are reserved.
+   */
+  uint32_t vni;
 };
 
 
 /**
- * IEEE 802.1Q header.
+ * ARP header for Ethernet-IPv4.
  */
-struct Q
+struct ArpHeaderEthernetIPv4
 {
-  uint16_t tpid; /* must be #ETH_802_1Q_TAG */
-  uint16_t tci;
+  /**
+   * Must be #ARP_HTYPE_ETHERNET.
+   */
+  uint16_t htype;
+
+  /**
+   * Protocol type, must be #ETH_P_IPV4.
+   */
+  uint16_t ptype;
+
+  /**
+   * HLEN.  Must be #MAC_ADDR_SIZE.
+   */
+  uint8_t hlen;
+
+  /**
+   * PLEN.  Must be sizeof (struct in_addr) (aka 4).
+   */
+  uint8_t plen;
+
+  /**
+   * Type of the operation.
+   */
+  uint16_t oper;
+
+  /**
+   * HW address of sender.
+   */
+  struct MacAddress sender_ha;
+
+  /**
+   * IPv4 address of sender.
+   */
+  struct in_addr sender_pa;
+
+  /**
+   * HW address of target.
+   */
+  struct MacAddress target_ha;
+
+  /**
+   * IPv4 address of target.
+   */
+  struct in_addr target_pa;
 };
 
 _Pragma("pack(pop)")
 
 
 /**
- * Per-interface context.
+ * Address of @a field of the outer headers at @a hdr (which need not
+ * be aligned), to be accessed with get_*() and put_*().
+ */
+#define VXLAN_FIELD(hdr, field) ((char *) (hdr) + offsetof (struct VxlanOuterHeader, field))
+
+/**
+ * Address of @a field of the ARP header at @a ah (which need not be
+ * aligned), to be accessed with get_*() and put_*().
+ */
+#define ARP_FIELD(ah, field) ((char *) (ah) + offsetof (struct ArpHeaderEthernetIPv4, field))
+
+/**
+ * Bytes VXLAN adds in front of a frame.  This fits into
+ * #GLAB_HEADROOM even if the frame had its 802.1Q tag popped.
+ */
+#define VXLAN_ENCAP_SIZE sizeof (struct VxlanOuterHeader)
+
+
+/**
+ * VLAN settings and name of an interface.
+ */
+struct InterfaceVlans
+{
+  /**
+   * Name of the network interface, i.e. "eth0".
+   */
+  char *ifc_name;
+
+  /**
+   * Which tagged VLANs does this interface participate in?
+   * Array terminated by #NO_VLAN entry.
+   */
+  int16_t tagged_vlans[MAX_VLANS + 1];
+
+  /**
+   * Which untagged VLAN does this interface participate in?
+   * #NO_VLAN for none.
+   */
+  int16_t untagged_vlan;
+
+  /**
+   * @e tagged_vlans as a bitmap, for the per-frame membership test.
+   */
+  uint64_t tagged_map[(VLAN_VID_MASK + 1) / 64];
+};
+
+
+/**
+ * Per-interface context, only what forwarding needs for every frame.
+ * Interfaces are 32-byte aligned, so that each stays within a single
+ * cache line even though the settings take several kilobytes.
  */
 struct Interface
 {
@@ -85,115 +352,1205 @@ struct Interface
   uint16_t ifc_num;
 
   /**
-   * Name of the network interface, i.e. "eth0".
+   * Copy of @e vlans->untagged_vlan.
    */
-  char *ifc_name;
+  int16_t untagged_vlan;
 
   /**
-   * Which tagged VLANs does this interface participate in?
-   * Array terminated by #NO_VLAN entry.
+   * VLAN settings and name.
    */
-  int16_t tagged_vlans[MAX_VLANS + 1];
+  struct InterfaceVlans *vlans;
+
+} __attribute__((aligned (32)));
+
+
+/**
+ * Per-interface counters.  Each interface has its own cache line,
+ * so that they do not share lines with the data read per frame,
+ * nor with the counters of other interfaces.
+ */
+struct InterfaceCounters
+{
+  /**
+   * Frames received.
+   */
+  uint64_t rx_frames;
 
   /**
-   * Which untagged VLAN does this interface participate in?
-   * #NO_VLAN for none.
+   * Frames received but dropped because of their VLAN.
    */
-  int16_t untagged_vlan;
+  uint64_t rx_vlan_drops;
+
+  /**
+   * Frames sent.
+   */
+  uint64_t tx_frames;
+
+} __attribute__((aligned (GLAB_CACHE_LINE)));
+
+
+/**
+ * Number of available contexts.
+ */
+static unsigned int num_ifc;
+
+/**
+ * All the contexts.
+ */
+static struct Interface *gifc;
+
+/**
+ * Counters of all contexts, in the same order as #gifc.
+ */
+static struct InterfaceCounters *gcounters;
 
+
+#include "mirror.c"
+
+
+/**
+ * Entry in the MAC table.
+ */
+struct MacEntry
+{
+  /**
+   * The MAC address.
+   */
+  struct MacAddress mac;
+
+  /**
+   * VLAN the MAC was seen in.
+   */
+  int16_t vlan;
+
+  /**
+   * If @e ifc is the VXLAN tunnel port, the VTEP behind which the MAC
+   * was seen (index into #vxlan_peers plus one), otherwise 0.
+   */
+  uint16_t peer;
+
+  /**
+   * Interface the MAC was seen on, NULL if the slot is unused.
+   */
+  struct Interface *ifc;
+
+  /**
+   * When did we last see a frame from this MAC?
+   */
+  time_t last_seen;
+};
+
+
+/**
+ * MAC table, open addressing with bounded linear probing.
+ * #MAC_TABLE_SIZE entries from huge_alloc().
+ */
+static struct MacEntry *mac_table;
+
+
+/**
+ * A remote VTEP.
+ */
+struct VxlanPeer
+{
+  /**
+   * Outer headers for frames to this peer, without the fields that
+   * differ per frame (lengths, checksum, UDP source port and VNI).
+   * Only valid if @e resolved.
+   */
+  char hdr[VXLAN_ENCAP_SIZE];
+
+  /**
+   * Checksum sum (see GNUNET_CRYPTO_crc16_step()) over the IPv4
+   * header in @e hdr, to which only the total length is added.
+   */
+  uint32_t hdr_sum;
+
+  /**
+   * IPv4 address of the peer.
+   */
+  struct in_addr ip;
+
+  /**
+   * Next hop towards the peer in the underlay: the peer itself or
+   * our gateway.
+   */
+  struct in_addr next_hop;
+
+  /**
+   * MAC of @e next_hop, if @e resolved.
+   */
+  struct MacAddress mac;
+
+  /**
+   * Is this slot in use?
+   */
+  bool in_use;
+
+  /**
+   * Configured with "vxlan peer add", and thus part of the flood
+   * list, or only learned from a frame we received?
+   */
+  bool flood;
+
+  /**
+   * Do we know the MAC of @e next_hop?
+   */
+  bool resolved;
+
+  /**
+   * When did we last send an ARP request for @e next_hop?
+   */
+  time_t arp_sent;
+
+  /**
+   * Frames sent to the peer.
+   */
+  uint64_t tx_frames;
+
+  /**
+   * Frames received from the peer.
+   */
+  uint64_t rx_frames;
 };
 
 
 /**
- * Number of available contexts.
+ * Entry in the VNI to VLAN hash table.
+ */
+struct VxlanVniSlot
+{
+  /**
+   * The VNI, 0 if the slot is unused.
+   */
+  uint32_t vni;
+
+  /**
+   * VLAN mapped to @e vni.
+   */
+  int16_t vlan;
+};
+
+
+/**
+ * The VXLAN tunnel port, NULL if we have none.
+ */
+static struct Interface *vxlan_ifc;
+
+/**
+ * Our VTEP address on #vxlan_ifc.
+ */
+static struct in_addr vxlan_ip;
+
+/**
+ * Netmask of the underlay network of #vxlan_ifc.
+ */
+static struct in_addr vxlan_netmask;
+
+/**
+ * Gateway for peers outside of that network, 0 for none.
+ */
+static struct in_addr vxlan_gateway;
+
+/**
+ * VNI of each VLAN, 0 if the VLAN is not carried over VXLAN.
+ */
+static uint32_t vxlan_vni[VLAN_VID_MASK + 1];
+
+/**
+ * VLAN of each VNI, open addressing with linear probing.
+ */
+static struct VxlanVniSlot vxlan_vlans[VXLAN_VNI_SLOTS];
+
+/**
+ * Remote VTEPs.
+ */
+static struct VxlanPeer vxlan_peers[VXLAN_MAX_PEERS];
+
+/**
+ * Frames not sent because the next hop was not resolved yet.
+ */
+static uint64_t vxlan_unresolved;
+
+/**
+ * Frames received with a VNI we do not map.
+ */
+static uint64_t vxlan_unknown_vni;
+
+
+/**
+ * Check if @a ifc is a tagged member of @a vlan.
+ *
+ * @param ifc interface to check
+ * @param vlan VLAN ID
+ * @return true if @a ifc carries @a vlan tagged
+ */
+static bool
+ifc_tagged_in (const struct Interface *ifc,
+               int16_t vlan)
+{
+  uint16_t v = (uint16_t) vlan & VLAN_VID_MASK;
+
+  return 0 != (ifc->vlans->tagged_map[v / 64] & (1LLU << (v % 64)));
+}
+
+
+/**
+ * Derive the fast-path state of @a ifc from its VLAN settings.
+ *
+ * @param ifc interface to update
+ */
+static void
+ifc_apply_vlans (struct Interface *ifc)
+{
+  struct InterfaceVlans *iv = ifc->vlans;
+
+  memset (iv->tagged_map,
+          0,
+          sizeof (iv->tagged_map));
+  for (unsigned int i = 0; NO_VLAN != iv->tagged_vlans[i]; i++)
+    iv->tagged_map[iv->tagged_vlans[i] / 64]
+      |= 1LLU << (iv->tagged_vlans[i] % 64);
+  ifc->untagged_vlan = iv->untagged_vlan;
+}
+
+
+/**
+ * Compute the first slot of the MAC table to probe for @a mac in @a vlan.
+ *
+ * @param mac the MAC address
+ * @param vlan the VLAN ID
+ * @return slot index
+ */
+static unsigned int
+mac_hash (const struct MacAddress *mac,
+          int16_t vlan)
+{
+  uint32_t h = 2166136261u;
+
+  for (unsigned int i = 0; i < MAC_ADDR_SIZE; i++)
+    h = (h ^ mac->mac[i]) * 16777619u;
+  h = (h ^ (uint16_t) vlan) * 16777619u;
+  return h & (MAC_TABLE_SIZE - 1);
+}
+
+
+/**
+ * Find the entry for @a mac in @a vlan.
+ *
+ * @param mac MAC to look up
+ * @param vlan VLAN to look in
+ * @param now current time
+ * @return NULL if unknown (or aged out)
+ */
+static const struct MacEntry *
+mac_lookup (const struct MacAddress *mac,
+            int16_t vlan,
+            time_t now)
+{
+  unsigned int h = mac_hash (mac,
+                             vlan);
+
+  for (unsigned int i = 0; i < MAC_TABLE_PROBES; i++)
+  {
+    struct MacEntry *me = &mac_table[(h + i) & (MAC_TABLE_SIZE - 1)];
+
+    if ( (NULL != me->ifc) &&
+         (vlan == me->vlan) &&
+         mac_equal (mac,
+                    &me->mac) )
+      return (now - me->last_seen > MAC_AGE_TIME) ? NULL : me;
+  }
+  return NULL;
+}
+
+
+/**
+ * Remember that @a mac in @a vlan is behind @a ifc.
+ * Replaces the least recently seen entry if all probed slots are in use.
+ *
+ * @param mac MAC to learn
+ * @param vlan VLAN the MAC was seen in
+ * @param ifc interface the MAC was seen on
+ * @param peer VTEP the MAC was seen behind (see `struct MacEntry`)
+ * @param now current time
+ */
+static void
+mac_learn (const struct MacAddress *mac,
+           int16_t vlan,
+           struct Interface *ifc,
+           uint16_t peer,
+           time_t now)
+{
+  unsigned int h = mac_hash (mac,
+                             vlan);
+  struct MacEntry *victim = NULL;
+
+  for (unsigned int i = 0; i < MAC_TABLE_PROBES; i++)
+  {
+    struct MacEntry *me = &mac_table[(h + i) & (MAC_TABLE_SIZE - 1)];
+
+    if ( (NULL != me->ifc) &&
+         (vlan == me->vlan) &&
+         mac_equal (mac,
+                    &me->mac) )
+    {
+      victim = me;
+      break;
+    }
+    if ( (NULL == victim) ||
+         (me->last_seen < victim->last_seen) )
+      victim = me;
+  }
+  victim->mac = *mac;
+  victim->vlan = vlan;
+  victim->peer = peer;
+  victim->ifc = ifc;
+  victim->last_seen = now;
+}
+
+
+/**
+ * Forget the MACs learned on @a ifc.
+ *
+ * @param ifc interface to forget the MACs of
+ * @param peer only forget those behind this VTEP (see `struct MacEntry`),
+ *        0 for all
+ */
+static void
+mac_forget (const struct Interface *ifc,
+            uint16_t peer)
+{
+  for (unsigned int i = 0; i < MAC_TABLE_SIZE; i++)
+  {
+    struct MacEntry *me = &mac_table[i];
+
+    if ( (ifc == me->ifc) &&
+         ( (0 == peer) ||
+           (peer == me->peer) ) )
+      memset (me,
+              0,
+              sizeof (*me));
+  }
+}
+
+
+/**
+ * Compute the first slot of #vxlan_vlans to probe for @a vni.
+ *
+ * @param vni the VNI
+ * @return slot index
+ */
+static unsigned int
+vxlan_vni_hash (uint32_t vni)
+{
+  return (vni * 2654435761u) & (VXLAN_VNI_SLOTS - 1);
+}
+
+
+/**
+ * Find the VLAN mapped to @a vni.
+ *
+ * @param vni the VNI
+ * @return #NO_VLAN if @a vni is not mapped
+ */
+static int16_t
+vxlan_vni_to_vlan (uint32_t vni)
+{
+  unsigned int h = vxlan_vni_hash (vni);
+
+  if (0 == vni)
+    return NO_VLAN;
+  for (unsigned int i = 0; i < VXLAN_VNI_SLOTS; i++)
+  {
+    const struct VxlanVniSlot *vs = &vxlan_vlans[(h + i) & (VXLAN_VNI_SLOTS - 1)];
+
+    if (vni == vs->vni)
+      return vs->vlan;
+    if (0 == vs->vni)
+      break;
+  }
+  return NO_VLAN;
+}
+
+
+/**
+ * Rebuild #vxlan_vlans from #vxlan_vni.
+ */
+static void
+vxlan_rehash ()
+{
+  memset (vxlan_vlans,
+          0,
+          sizeof (vxlan_vlans));
+  for (unsigned int v = 0; v <= VLAN_VID_MASK; v++)
+  {
+    unsigned int h;
+
+    if (0 == vxlan_vni[v])
+      continue;
+    h = vxlan_vni_hash (vxlan_vni[v]);
+    while (0 != vxlan_vlans[h].vni)
+      h = (h + 1) & (VXLAN_VNI_SLOTS - 1);
+    vxlan_vlans[h].vni = vxlan_vni[v];
+    vxlan_vlans[h].vlan = (int16_t) v;
+  }
+}
+
+
+/**
+ * We learned that the next hop towards @a vp is at @a mac: prepare
+ * the outer headers for frames to @a vp.
+ *
+ * @param vp the peer
+ * @param mac MAC of the next hop
+ */
+static void
+vxlan_peer_resolved (struct VxlanPeer *vp,
+                     const struct MacAddress *mac)
+{
+  char *hdr = vp->hdr;
+
+  vp->mac = *mac;
+  vp->resolved = true;
+  memset (hdr,
+          0,
+          sizeof (vp->hdr));
+  memcpy (VXLAN_FIELD (hdr, eth.dst),
+          mac,
+          sizeof (struct MacAddress));
+  memcpy (VXLAN_FIELD (hdr, eth.src),
+          &vxlan_ifc->mac,
+          sizeof (struct MacAddress));
+  put_be16 (VXLAN_FIELD (hdr, eth.tag),
+            ETH_P_IPV4);
+  *VXLAN_FIELD (hdr, version_ihl) = 0x45;
+  /* don't fragment */
+  put_be16 (VXLAN_FIELD (hdr, fragmentation_info),
+            0x4000);
+  *VXLAN_FIELD (hdr, ttl) = VXLAN_TTL;
+  *VXLAN_FIELD (hdr, protocol) = IPPROTO_UDP;
+  put_u32 (VXLAN_FIELD (hdr, source_address),
+           vxlan_ip.s_addr);
+  put_u32 (VXLAN_FIELD (hdr, destination_address),
+           vp->ip.s_addr);
+  put_be16 (VXLAN_FIELD (hdr, destination_port),
+            VXLAN_UDP_PORT);
+  *VXLAN_FIELD (hdr, flags) = VXLAN_FLAG_VNI;
+  vp->hdr_sum = GNUNET_CRYPTO_crc16_step (0,
+                                          VXLAN_FIELD (hdr, version_ihl),
+                                          offsetof (struct VxlanOuterHeader, source_port)
+                                          - offsetof (struct VxlanOuterHeader, version_ihl));
+}
+
+
+/**
+ * Send an ARP message out on the tunnel port.
+ *
+ * @param oper #ARP_OP_REQUEST or #ARP_OP_REPLY
+ * @param dst destination MAC for the Ethernet header
+ * @param target_ha target hardware address for the ARP header
+ * @param target_pa target protocol address for the ARP header
+ */
+static void
+vxlan_send_arp (uint16_t oper,
+                const struct MacAddress *dst,
+                const struct MacAddress *target_ha,
+                struct in_addr target_pa)
+{
+  char frame[sizeof (struct EthernetHeader)
+             + sizeof (struct ArpHeaderEthernetIPv4)];
+  struct EthernetHeader eh;
+  struct ArpHeaderEthernetIPv4 ah;
+
+  eh.dst = *dst;
+  eh.src = vxlan_ifc->mac;
+  eh.tag = htons (ETH_P_ARP);
+  ah.htype = htons (ARP_HTYPE_ETHERNET);
+  ah.ptype = htons (ETH_P_IPV4);
+  ah.hlen = MAC_ADDR_SIZE;
+  ah.plen = sizeof (struct in_addr);
+  ah.oper = htons (oper);
+  ah.sender_ha = vxlan_ifc->mac;
+  ah.sender_pa = vxlan_ip;
+  ah.target_ha = *target_ha;
+  ah.target_pa = target_pa;
+  memcpy (frame,
+          &eh,
+          sizeof (eh));
+  memcpy (&frame[sizeof (eh)],
+          &ah,
+          sizeof (ah));
+  gcounters[vxlan_ifc->ifc_num - 1].tx_frames++;
+  glab_send (vxlan_ifc->ifc_num,
+             frame,
+             sizeof (frame));
+}
+
+
+/**
+ * Check if we know the MAC of the next hop towards @a vp, and ask for
+ * it (at most every #VXLAN_ARP_INTERVAL seconds) if not.
+ *
+ * @param vp the peer
+ * @param now current time
+ * @return true if frames can be sent to @a vp
+ */
+static bool
+vxlan_resolve (struct VxlanPeer *vp,
+               time_t now)
+{
+  static const struct MacAddress broadcast = {
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }
+  };
+  static const struct MacAddress unknown;
+
+  if (vp->resolved)
+    return true;
+  if ( (0 == vp->arp_sent) ||
+       (now - vp->arp_sent >= VXLAN_ARP_INTERVAL) )
+  {
+    vp->arp_sent = now;
+    vxlan_send_arp (ARP_OP_REQUEST,
+                    &broadcast,
+                    &unknown,
+                    vp->next_hop);
+  }
+  vxlan_unresolved++;
+  return false;
+}
+
+
+/**
+ * Compute the UDP source port for (untagged) @a frame from its
+ * addresses, and for IPv4 also from the protocol and the ports, so
+ * that the underlay can balance flows but keeps each one in order.
+ *
+ * @param frame the inner frame
+ * @param frame_size number of bytes in @a frame
+ * @return UDP source port, at least #VXLAN_SPORT_MIN
+ */
+static uint16_t
+vxlan_source_port (const char *frame,
+                   size_t frame_size)
+{
+  const uint8_t *ip = (const uint8_t *) &frame[sizeof (struct EthernetHeader)];
+  size_t ip_size = frame_size - sizeof (struct EthernetHeader);
+  uint32_t h = 2166136261u;
+
+  /* MACs and EtherType */
+  for (unsigned int i = 0; i < sizeof (struct EthernetHeader); i++)
+    h = (h ^ (uint8_t) frame[i]) * 16777619u;
+  if ( (ETH_P_IPV4 == get_be16 (&frame[offsetof (struct EthernetHeader, tag)])) &&
+       (ip_size >= 20) )
+  {
+    unsigned int hlen = (ip[0] & 0x0F) * 4;
+
+    /* protocol, then source and destination address */
+    h = (h ^ ip[9]) * 16777619u;
+    for (unsigned int i = 12; i < 20; i++)
+      h = (h ^ ip[i]) * 16777619u;
+    /* ports, unless this is a non-initial fragment */
+    if ( ( (IPPROTO_TCP == ip[9]) ||
+           (IPPROTO_UDP == ip[9]) ) &&
+         (0 == (get_be16 (&ip[6]) & 0x1FFF)) &&
+         (hlen >= 20) &&
+         (ip_size >= hlen + 4) )
+      for (unsigned int i = hlen; i < hlen + 4; i++)
+        h = (h ^ ip[i]) * 16777619u;
+  }
+  return VXLAN_SPORT_MIN + h % (UINT16_MAX + 1 - VXLAN_SPORT_MIN);
+}
+
+
+/**
+ * Encapsulate @a frame for @a vp by writing the outer headers into
+ * the headroom in front of it, and send it out on the tunnel port.
+ *
+ * @param vp the peer, must be resolved
+ * @param vni VNI for the frame
+ * @param sport UDP source port
+ * @param frame the untagged frame
+ * @param frame_size number of bytes in @a frame
+ */
+static void
+vxlan_encap (struct VxlanPeer *vp,
+             uint32_t vni,
+             uint16_t sport,
+             char *frame,
+             size_t frame_size)
+{
+  char *outer = frame - VXLAN_ENCAP_SIZE;
+  size_t size = frame_size + VXLAN_ENCAP_SIZE;
+
+  memcpy (outer,
+          vp->hdr,
+          VXLAN_ENCAP_SIZE);
+  put_be16 (VXLAN_FIELD (outer, total_length),
+            size - offsetof (struct VxlanOuterHeader, version_ihl));
+  put_u16 (VXLAN_FIELD (outer, checksum),
+           GNUNET_CRYPTO_crc16_finish (vp->hdr_sum
+                                       + get_u16 (VXLAN_FIELD (outer, total_length))));
+  put_be16 (VXLAN_FIELD (outer, source_port),
+            sport);
+  put_be16 (VXLAN_FIELD (outer, udp_length),
+            size - offsetof (struct VxlanOuterHeader, source_port));
+  put_u32 (VXLAN_FIELD (outer, vni),
+           htonl (vni << 8));
+  vp->tx_frames++;
+  gcounters[vxlan_ifc->ifc_num - 1].tx_frames++;
+  glab_send_in_place (vxlan_ifc->ifc_num,
+                      outer,
+                      size);
+  mirror_tx (vxlan_ifc->ifc_num,
+             outer,
+             size);
+}
+
+
+/**
+ * Prepare @a frame for encapsulation: the VNI identifies the VLAN,
+ * so the 802.1Q tag (if any) is popped in place.
+ *
+ * @param[in,out] frame the frame, updated if the tag was popped
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param[in,out] tagged whether @a frame currently carries a tag
+ * @return false if the frame is too large to be encapsulated
+ */
+static bool
+vxlan_prepare (char **frame,
+               size_t *frame_size,
+               bool *tagged)
+{
+  if (*tagged)
+    *frame = eth_pop_vlan_in_place (*frame,
+                                    frame_size);
+  *tagged = false;
+  return *frame_size + VXLAN_ENCAP_SIZE + sizeof (struct GLAB_MessageHeader)
+    <= UINT16_MAX;
+}
+
+
+/**
+ * Send @a frame of @a vlan to the peer @a vp.
+ *
+ * @param vp the peer
+ * @param vlan VLAN of the frame, must be mapped to a VNI
+ * @param now current time
+ * @param[in,out] frame the frame, updated if the tag was popped
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param[in,out] tagged whether @a frame currently carries a tag
+ */
+static void
+vxlan_send (struct VxlanPeer *vp,
+            int16_t vlan,
+            time_t now,
+            char **frame,
+            size_t *frame_size,
+            bool *tagged)
+{
+  if ( (! vxlan_prepare (frame,
+                         frame_size,
+                         tagged)) ||
+       (! vxlan_resolve (vp,
+                         now)) )
+    return;
+  vxlan_encap (vp,
+               vxlan_vni[vlan],
+               vxlan_source_port (*frame,
+                                  *frame_size),
+               *frame,
+               *frame_size);
+}
+
+
+/**
+ * Send @a frame of @a vlan to all configured peers.
+ *
+ * @param vlan VLAN of the frame, must be mapped to a VNI
+ * @param now current time
+ * @param[in,out] frame the frame, updated if the tag was popped
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param[in,out] tagged whether @a frame currently carries a tag
+ */
+static void
+vxlan_flood (int16_t vlan,
+             time_t now,
+             char **frame,
+             size_t *frame_size,
+             bool *tagged)
+{
+  uint16_t sport;
+
+  if (! vxlan_prepare (frame,
+                       frame_size,
+                       tagged))
+    return;
+  sport = vxlan_source_port (*frame,
+                             *frame_size);
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+  {
+    struct VxlanPeer *vp = &vxlan_peers[i];
+
+    if ( vp->flood &&
+         vxlan_resolve (vp,
+                        now) )
+      vxlan_encap (vp,
+                   vxlan_vni[vlan],
+                   sport,
+                   *frame,
+                   *frame_size);
+  }
+}
+
+
+/**
+ * Send @a frame of @a vlan out on @a ifc without copying it, pushing,
+ * rewriting or popping the 802.1Q tag in place as required by @a ifc.
+ *
+ * @param ifc interface to send the frame out on
+ * @param vlan VLAN of the frame
+ * @param prio priority bits of the 802.1Q TCI to use when pushing a tag
+ * @param[in,out] frame the frame, updated if the tag was pushed or popped
+ * @param[in,out] frame_size number of bytes in @a frame
+ * @param[in,out] tagged whether @a frame currently carries a tag
+ */
+static void
+vlan_send (struct Interface *ifc,
+           int16_t vlan,
+           uint16_t prio,
+           char **frame,
+           size_t *frame_size,
+           bool *tagged)
+{
+  bool want = (vlan != ifc->untagged_vlan);
+
+  if (want && *tagged)
+    eth_set_vlan_in_place (*frame,
+                           (uint16_t) vlan);
+  else if (want)
+    *frame = eth_push_vlan_in_place (*frame,
+                                     frame_size,
+                                     prio | (uint16_t) vlan);
+  else if (*tagged)
+    *frame = eth_pop_vlan_in_place (*frame,
+                                    frame_size);
+  *tagged = want;
+  gcounters[ifc->ifc_num - 1].tx_frames++;
+  glab_send_in_place (ifc->ifc_num,
+                      *frame,
+                      *frame_size);
+  mirror_tx (ifc->ifc_num,
+             *frame,
+             *frame_size);
+}
+
+
+/**
+ * Check if frames of @a vlan may be sent out on @a ifc.
+ *
+ * @param ifc interface to check
+ * @param vlan VLAN ID
+ * @return true if @a ifc is a (tagged or untagged) member of @a vlan
+ */
+static bool
+ifc_in_vlan (const struct Interface *ifc,
+             int16_t vlan)
+{
+  if (ifc == vxlan_ifc)
+    return 0 != vxlan_vni[(uint16_t) vlan & VLAN_VID_MASK];
+  return (vlan == ifc->untagged_vlan) ||
+    ifc_tagged_in (ifc,
+                   vlan);
+}
+
+
+/**
+ * Switch @a frame received on @a ingress within @a vlan, modifying
+ * and sending it out of the receive buffer.
+ *
+ * @param ingress interface we received the frame on
+ * @param peer VTEP we received the frame from (index into #vxlan_peers
+ *        plus one) if @a ingress is the tunnel port, otherwise 0
+ * @param vlan VLAN of the frame
+ * @param frame the frame as received, in the receive buffer
+ * @param frame_size number of bytes in @a frame
+ * @param tagged whether @a frame carries an 802.1Q tag
+ */
+static void
+bridge (struct Interface *ingress,
+        uint16_t peer,
+        int16_t vlan,
+        char *frame,
+        size_t frame_size,
+        bool tagged)
+{
+  const struct EthernetHeader *eh = (const struct EthernetHeader *) frame;
+  time_t now = time (NULL);
+  uint16_t prio = 0;
+  const struct MacEntry *dst;
+
+  if (tagged)
+    prio = get_be16 (&frame[offsetof (struct VlanEthernetHeader, tci)])
+      & ~VLAN_VID_MASK;
+
+  if (! mac_is_multicast (&eh->src))
+    mac_learn (&eh->src,
+               vlan,
+               ingress,
+               peer,
+               now);
+  if (! mac_is_multicast (&eh->dst))
+  {
+    dst = mac_lookup (&eh->dst,
+                      vlan,
+                      now);
+    if (NULL != dst)
+    {
+      if ( (dst->ifc == ingress) ||
+           mirror_is_dest (dst->ifc->ifc_num) ||
+           (! ifc_in_vlan (dst->ifc,
+                           vlan)) )
+        return;
+      if (dst->ifc == vxlan_ifc)
+        vxlan_send (&vxlan_peers[dst->peer - 1],
+                    vlan,
+                    now,
+                    &frame,
+                    &frame_size,
+                    &tagged);
+      else
+        vlan_send (dst->ifc,
+                   vlan,
+                   prio,
+                   &frame,
+                   &frame_size,
+                   &tagged);
+      return;
+    }
+  }
+  for (unsigned int i = 0; i < num_ifc; i++)
+  {
+    if ( (&gifc[i] == ingress) ||
+         mirror_is_dest (gifc[i].ifc_num) ||
+         (! ifc_in_vlan (&gifc[i],
+                         vlan)) )
+      continue;
+    /* head-end replication to every configured peer */
+    if (&gifc[i] == vxlan_ifc)
+      vxlan_flood (vlan,
+                   now,
+                   &frame,
+                   &frame_size,
+                   &tagged);
+    else
+      vlan_send (&gifc[i],
+                 vlan,
+                 prio,
+                 &frame,
+                 &frame_size,
+                 &tagged);
+  }
+}
+
+
+/**
+ * Find the peer with address @a ip.
+ *
+ * @param ip address of the peer
+ * @return NULL if we do not know @a ip
+ */
+static struct VxlanPeer *
+vxlan_peer_find (struct in_addr ip)
+{
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+    if ( vxlan_peers[i].in_use &&
+         (ip.s_addr == vxlan_peers[i].ip.s_addr) )
+      return &vxlan_peers[i];
+  return NULL;
+}
+
+
+/**
+ * Determine the next hop towards @a vp in the underlay, and take the
+ * MAC from another peer with the same next hop if we know it.
+ *
+ * @param vp the peer
+ */
+static void
+vxlan_peer_route (struct VxlanPeer *vp)
+{
+  vp->next_hop = vp->ip;
+  if ( (0 != vxlan_gateway.s_addr) &&
+       ( (vp->ip.s_addr & vxlan_netmask.s_addr) !=
+         (vxlan_ip.s_addr & vxlan_netmask.s_addr) ) )
+    vp->next_hop = vxlan_gateway;
+  vp->resolved = false;
+  vp->arp_sent = 0;
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+  {
+    const struct VxlanPeer *o = &vxlan_peers[i];
+
+    if ( (o != vp) &&
+         o->in_use &&
+         o->resolved &&
+         (o->next_hop.s_addr == vp->next_hop.s_addr) )
+    {
+      vxlan_peer_resolved (vp,
+                           &o->mac);
+      break;
+    }
+  }
+}
+
+
+/**
+ * Add a peer with address @a ip.
+ *
+ * @param ip address of the peer
+ * @param flood true if configured, false if learned
+ * @return NULL if we have no room for another peer
  */
-static unsigned int num_ifc;
+static struct VxlanPeer *
+vxlan_peer_add (struct in_addr ip,
+                bool flood)
+{
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+  {
+    struct VxlanPeer *vp = &vxlan_peers[i];
 
-/**
- * All the contexts.
- */
-static struct Interface *gifc;
+    if (vp->in_use)
+      continue;
+    memset (vp,
+            0,
+            sizeof (*vp));
+    vp->in_use = true;
+    vp->flood = flood;
+    vp->ip = ip;
+    vxlan_peer_route (vp);
+    return vp;
+  }
+  return NULL;
+}
 
 
 /**
- * Parse and process frame received on @a ifc.
+ * Process ARP (request or response!) received on the tunnel port.
+ * We answer for our VTEP address and take the MAC of next hops
+ * from whatever they send.
  *
- * @param ifc interface we got the frame on
- * @param frame raw frame data
- * @param frame_size number of bytes in @a frame
+ * @param ah ARP header
+ * @param ah_size number of bytes at @a ah
  */
 static void
-parse_frame (struct Interface *ifc,
-	     const void *frame,
-	     size_t frame_size)
+vxlan_handle_arp (const char *ah,
+                  size_t ah_size)
 {
-  const uint8_t *framec = frame;
-  struct EthernetHeader eh;
+  const struct MacAddress *sender_ha;
+  struct in_addr sender_pa;
 
-  if (frame_size < sizeof (eh))
-  {
-    fprintf (stderr,
-	     "Malformed frame\n");
+  if ( (ah_size < sizeof (struct ArpHeaderEthernetIPv4)) ||
+       (ARP_HTYPE_ETHERNET != get_be16 (ARP_FIELD (ah, htype))) ||
+       (ETH_P_IPV4 != get_be16 (ARP_FIELD (ah, ptype))) ||
+       (MAC_ADDR_SIZE != *(const uint8_t *) ARP_FIELD (ah, hlen)) ||
+       (sizeof (struct in_addr) != *(const uint8_t *) ARP_FIELD (ah, plen)) )
     return;
+  sender_ha = (const struct MacAddress *) ARP_FIELD (ah, sender_ha);
+  sender_pa.s_addr = get_u32 (ARP_FIELD (ah, sender_pa));
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+  {
+    struct VxlanPeer *vp = &vxlan_peers[i];
+
+    if ( vp->in_use &&
+         (vp->next_hop.s_addr == sender_pa.s_addr) )
+      vxlan_peer_resolved (vp,
+                           sender_ha);
   }
-  memcpy (&eh,
-	  frame,
-	  sizeof (eh));
-  /* DO work here! */
+  if ( (ARP_OP_REQUEST == get_be16 (ARP_FIELD (ah, oper))) &&
+       (vxlan_ip.s_addr == get_u32 (ARP_FIELD (ah, target_pa))) )
+    vxlan_send_arp (ARP_OP_REPLY,
+                    sender_ha,
+                    sender_ha,
+                    sender_pa);
 }
 
 
 /**
- * Process frame received from @a interface.
+ * Process @a frame received on the tunnel port: answer ARP, and
+ * decapsulate and switch VXLAN frames for us.  The inner frame is
+ * switched where it is, behind the outer headers.
  *
- * @param interface number of the interface on which we received @a frame
- * @param frame the frame
+ * @param ifc the tunnel port
+ * @param ef @a frame, parsed
+ * @param frame raw frame data, in the receive buffer
  * @param frame_size number of bytes in @a frame
  */
 static void
-handle_frame (uint16_t interface,
-	      const void *frame,
-	      size_t frame_size)
+vxlan_receive (struct Interface *ifc,
+               const struct EthernetFrame *ef,
+               char *frame,
+               size_t frame_size)
 {
-  if (interface > num_ifc)
-    abort ();
-  parse_frame (&gifc[interface - 1],
-	       frame,
-	       frame_size);
+  struct EthernetFrame inner;
+  struct VxlanPeer *vp;
+  struct in_addr src;
+  size_t total;
+  int16_t vlan;
+
+  if (ef->tagged)
+  {
+    gcounters[ifc->ifc_num - 1].rx_vlan_drops++;
+    return;
+  }
+  if (ETH_P_ARP == ef->type)
+  {
+    vxlan_handle_arp (ef->payload,
+                      ef->payload_size);
+    return;
+  }
+  /* we never send IPv4 options, and neither should our peers */
+  if ( (ETH_P_IPV4 != ef->type) ||
+       (frame_size < VXLAN_ENCAP_SIZE + sizeof (struct EthernetHeader)) ||
+       (0x45 != *(const uint8_t *) VXLAN_FIELD (frame, version_ihl)) ||
+       (IPPROTO_UDP != *(const uint8_t *) VXLAN_FIELD (frame, protocol)) ||
+       (vxlan_ip.s_addr != get_u32 (VXLAN_FIELD (frame, destination_address))) ||
+       (0 != (get_be16 (VXLAN_FIELD (frame, fragmentation_info)) & 0x3FFF)) ||
+       (VXLAN_UDP_PORT != get_be16 (VXLAN_FIELD (frame, destination_port))) ||
+       (0 == (*(const uint8_t *) VXLAN_FIELD (frame, flags) & VXLAN_FLAG_VNI)) ||
+       (0 != GNUNET_CRYPTO_crc16_n (VXLAN_FIELD (frame, version_ihl),
+                                    offsetof (struct VxlanOuterHeader, source_port)
+                                    - offsetof (struct VxlanOuterHeader, version_ihl))) )
+    return;
+  total = get_be16 (VXLAN_FIELD (frame, total_length))
+    + offsetof (struct VxlanOuterHeader, version_ihl);
+  if ( (total > frame_size) ||
+       (total < VXLAN_ENCAP_SIZE + sizeof (struct EthernetHeader)) )
+    return;
+  vlan = vxlan_vni_to_vlan (ntohl (get_u32 (VXLAN_FIELD (frame, vni))) >> 8);
+  if (NO_VLAN == vlan)
+  {
+    vxlan_unknown_vni++;
+    return;
+  }
+  src.s_addr = get_u32 (VXLAN_FIELD (frame, source_address));
+  vp = vxlan_peer_find (src);
+  if ( (NULL == vp) &&
+       (NULL == (vp = vxlan_peer_add (src,
+                                      false))) )
+    return;
+  vp->rx_frames++;
+  /* whoever sent this to us is also our next hop towards the peer */
+  if (! vp->resolved)
+    vxlan_peer_resolved (vp,
+                         &ef->eh->src);
+  if ( (0 != eth_parse (&frame[VXLAN_ENCAP_SIZE],
+                        total - VXLAN_ENCAP_SIZE,
+                        true,
+                        &inner)) ||
+       inner.tagged )
+    return;
+  mirror_rx (ifc->ifc_num,
+             vlan,
+             frame,
+             frame_size);
+  if (mirror_is_dest (ifc->ifc_num))
+    return;
+  bridge (ifc,
+          vp - vxlan_peers + 1,
+          vlan,
+          &frame[VXLAN_ENCAP_SIZE],
+          total - VXLAN_ENCAP_SIZE,
+          false);
 }
 
 
 /**
- * Handle control message @a cmd.
+ * Parse and process frame received on @a ifc.
  *
- * @param cmd text the user entered
- * @param cmd_len length of @a cmd
+ * @param ifc interface we got the frame on
+ * @param frame raw frame data, in the receive buffer
+ * @param frame_size number of bytes in @a frame
  */
 static void
-handle_control (char *cmd,
-		size_t cmd_len)
+parse_frame (struct Interface *ifc,
+	     void *frame,
+	     size_t frame_size)
 {
-  cmd[cmd_len - 1] = '\0';
-  fprintf (stderr,
-           "Received command `%s' (ignored)\n",
-           cmd);
+  struct InterfaceCounters *ic = &gcounters[ifc->ifc_num - 1];
+  struct EthernetFrame ef;
+  int16_t vlan;
+
+  ic->rx_frames++;
+  if (0 != eth_parse (frame,
+                      frame_size,
+                      true,
+                      &ef))
+  {
+    fprintf (stderr,
+	     "Malformed frame\n");
+    return;
+  }
+  if (ifc == vxlan_ifc)
+  {
+    vxlan_receive (ifc,
+                   &ef,
+                   frame,
+                   frame_size);
+    return;
+  }
+  if ( ef.tagged &&
+       (0 != ef.vlan) )
+  {
+    if (! ifc_tagged_in (ifc,
+                         (int16_t) ef.vlan))
+    {
+      /* not a member of this VLAN */
+      ic->rx_vlan_drops++;
+      GLAB_PROBE3 (vlan_drop,
+                   ifc->ifc_num,
+                   ef.vlan,
+                   1);
+      return;
+    }
+    vlan = (int16_t) ef.vlan;
+  }
+  else
+  {
+    if (NO_VLAN == ifc->untagged_vlan)
+    {
+      /* untagged frames not accepted here */
+      ic->rx_vlan_drops++;
+      GLAB_PROBE3 (vlan_drop,
+                   ifc->ifc_num,
+                   0,
+                   ef.tagged);
+      return;
+    }
+    vlan = ifc->untagged_vlan;
+  }
+  GLAB_PROBE3 (vlan_classify,
+               ifc->ifc_num,
+               vlan,
+               ef.tagged);
+  mirror_rx (ifc->ifc_num,
+             vlan,
+             frame,
+             frame_size);
+  if (mirror_is_dest (ifc->ifc_num))
+    return;
+  bridge (ifc,
+          0,
+          vlan,
+          frame,
+          frame_size,
+          ef.tagged);
 }
 
 
-/**
- * Handle MAC information @a mac
- *
- * @param ifc_num number of the interface with @a mac
- * @param mac the MAC address at @a ifc_num
- */
-static void
-handle_mac (uint16_t ifc_num,
-	    const struct MacAddress *mac)
-{
-  if (ifc_num > num_ifc)
-    abort ();
-  gifc[ifc_num - 1].mac = *mac;
-}
+GLAB_DEFINE_HANDLE_FRAME (num_ifc, &gifc[interface - 1], parse_frame)
+
+
+GLAB_DEFINE_HANDLE_MAC (num_ifc, &gifc[ifc_num - 1])
 
 
 /**
@@ -203,14 +1560,14 @@ handle_mac (uint16_t ifc_num,
  * @param start beginning of tagged specification, with ':'
  * @param end end of tagged specification, should point to ']'
  * @param off interface offset for error reporting
- * @param ifc[out] what to initialize
+ * @param iv[out] what to initialize
  * @return 0 on success
  */
 static int
 parse_tagged (const char *start,
 	      const char *end,
 	      int off,
-	      struct Interface *ifc)
+	      struct InterfaceVlans *iv)
 {
   char *spec;
   unsigned int pos;
@@ -247,7 +1604,7 @@ parse_tagged (const char *start,
       free (spec);
       return 1;
     }
-    if (1 != sscanf (spec,
+    if (1 != sscanf (tok,
 		     "%u",
 		     &tag))
     {
@@ -266,9 +1623,9 @@ parse_tagged (const char *start,
       free (spec);
       return 1;
     }
-    ifc->tagged_vlans[pos++] = (int16_t) tag;
+    iv->tagged_vlans[pos++] = (int16_t) tag;
   }
-  ifc->tagged_vlans[pos] = NO_VLAN;
+  iv->tagged_vlans[pos] = NO_VLAN;
   free (spec);
   return 0;
 }
@@ -281,14 +1638,14 @@ parse_tagged (const char *start,
  * @param start beginning of tagged specification, with ':'
  * @param end end of tagged specification, should point to ']'
  * @param off interface offset for error reporting
- * @param ifc[out] what to initialize
+ * @param iv[out] what to initialize
  * @return 0 on success
  */
 static int
 parse_untagged (const char *start,
 		const char *end,
 		int off,
-		struct Interface *ifc)
+		struct InterfaceVlans *iv)
 {
   char *spec;
   unsigned int tag;
@@ -327,7 +1684,7 @@ parse_untagged (const char *start,
     free (spec);
     return 1;
   }
-  ifc->untagged_vlan = (int16_t) tag;
+  iv->untagged_vlan = (int16_t) tag;
   free (spec);
   return 0;
 }
@@ -338,35 +1695,35 @@ parse_untagged (const char *start,
  *
  * @param arg command-line argument
  * @param off offset of @a arg for error reporting
- * @param ifc interface to initialize (ifc_name, tagged_vlans and untagged_vlan).
+ * @param iv interface settings to initialize
  * @return 0 on success
  */
 static int
 parse_vlan_args (const char *arg,
 		 int off,
-		 struct Interface *ifc)
+		 struct InterfaceVlans *iv)
 {
   const char *openbracket;
   const char *closebracket;
 
-  ifc->tagged_vlans[0] = NO_VLAN;
-  ifc->untagged_vlan = NO_VLAN;
+  iv->tagged_vlans[0] = NO_VLAN;
+  iv->untagged_vlan = NO_VLAN;
   openbracket = strchr (arg,
 			(unsigned char) '[');
   if (NULL == openbracket)
   {
-    ifc->ifc_name = strdup (arg);
-    if (NULL == ifc->ifc_name)
+    iv->ifc_name = strdup (arg);
+    if (NULL == iv->ifc_name)
     {
       perror ("strdup");
       return 1;
     }
-    ifc->untagged_vlan = DEFAULT_VLAN;
+    iv->untagged_vlan = DEFAULT_VLAN;
     return 0;
   }
-  ifc->ifc_name = strndup (arg,
+  iv->ifc_name = strndup (arg,
 			   openbracket - arg);
-  if (NULL == ifc->ifc_name)
+  if (NULL == iv->ifc_name)
   {
     perror ("strndup");
     return 1;
@@ -387,13 +1744,13 @@ parse_vlan_args (const char *arg,
     return parse_tagged (openbracket + 1,
 			 closebracket,
 			 off,
-			 ifc);
+			 iv);
     break;
   case 'U':
     return parse_untagged (openbracket + 1,
 			   closebracket,
 			   off,
-			   ifc);
+			   iv);
     break;
   default:
     fprintf (stderr,
@@ -405,6 +1762,542 @@ parse_vlan_args (const char *arg,
 }
 
 
+/**
+ * Initialize @a iv from port @a cp of a startup-config.
+ *
+ * @param cp port as found in the configuration
+ * @param iv[out] interface settings to initialize
+ * @return 0 on success
+ */
+static int
+init_vlans_from_config (const struct ConfigPort *cp,
+                        struct InterfaceVlans *iv)
+{
+  unsigned int pos = 0;
+
+  iv->ifc_name = strdup (cp->name);
+  if (NULL == iv->ifc_name)
+  {
+    perror ("strdup");
+    return 1;
+  }
+  iv->untagged_vlan = cp->untagged_vlan;
+  for (unsigned int vlan = 1; vlan <= MAX_VLAN_ID; vlan++)
+  {
+    if (! config_vlan_test (cp->tagged_vlans,
+                            vlan))
+      continue;
+    if (vlan > MAX_VLANS)
+    {
+      fprintf (stderr,
+	       "%u is too large for a 802.1Q VLAN ID (on interface %s)\n",
+	       vlan,
+	       cp->name);
+      return 1;
+    }
+    iv->tagged_vlans[pos++] = (int16_t) vlan;
+  }
+  iv->tagged_vlans[pos] = NO_VLAN;
+  return 0;
+}
+
+
+/**
+ * The user entered a "reload" command: load the startup-config given
+ * as argument and apply the VLAN settings of the ports that changed,
+ * flushing the MACs learned on them.  Nothing is changed unless the
+ * new configuration is valid and names each of our ports once, as
+ * ports cannot be added or removed at runtime.  As control messages
+ * are processed between frames, the new configuration takes effect
+ * atomically for the next frame.
+ */
+static void
+process_cmd_reload ()
+{
+  const char *filename = strtok (NULL, " ");
+  struct Config cfg;
+  struct InterfaceVlans *nvlans;
+  unsigned int changed;
+
+  if (NULL == filename)
+  {
+    fprintf (stderr,
+             "Usage: reload FILENAME\n");
+    return;
+  }
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  if (0 != config_load (filename,
+                        &cfg))
+  {
+    config_free (&cfg);
+    return;
+  }
+  if (cfg.num_ports != num_ifc)
+  {
+    fprintf (stderr,
+             "Cannot add or remove ports at runtime\n");
+    config_free (&cfg);
+    return;
+  }
+  nvlans = calloc (num_ifc + 1,
+                   sizeof (struct InterfaceVlans));
+  if (NULL == nvlans)
+  {
+    perror ("calloc");
+    config_free (&cfg);
+    return;
+  }
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    const struct ConfigPort *cp = &cfg.ports[i];
+    struct Interface *o = NULL;
+
+    for (unsigned int j=0;j<num_ifc;j++)
+      if (0 == strcasecmp (cp->name,
+                           gifc[j].vlans->ifc_name))
+        o = &gifc[j];
+    /* as the numbers of ports are equal, rejecting duplicates
+       ensures that every port is matched exactly once */
+    if ( (NULL == o) ||
+         (NULL != nvlans[o->ifc_num - 1].ifc_name) ||
+         (0 != init_vlans_from_config (cp,
+                                       &nvlans[o->ifc_num - 1])) )
+    {
+      fprintf (stderr,
+               "Port `%s' unknown, duplicate or misconfigured, configuration not applied\n",
+               cp->name);
+      for (unsigned int j=0;j<num_ifc;j++)
+        free (nvlans[j].ifc_name);
+      free (nvlans);
+      config_free (&cfg);
+      return;
+    }
+  }
+  changed = 0;
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    struct InterfaceVlans *o = gifc[i].vlans;
+    struct InterfaceVlans *n = &nvlans[i];
+    unsigned int len = 0;
+
+    while (NO_VLAN != n->tagged_vlans[len])
+      len++;
+    if ( (o->untagged_vlan != n->untagged_vlan) ||
+         (0 != memcmp (o->tagged_vlans,
+                       n->tagged_vlans,
+                       (len + 1) * sizeof (int16_t))) )
+    {
+      o->untagged_vlan = n->untagged_vlan;
+      memcpy (o->tagged_vlans,
+              n->tagged_vlans,
+              (len + 1) * sizeof (int16_t));
+      ifc_apply_vlans (&gifc[i]);
+      /* hosts learned here may no longer be reachable in their VLAN */
+      mac_forget (&gifc[i],
+                  0);
+      changed++;
+    }
+    free (n->ifc_name);
+  }
+  free (nvlans);
+  config_free (&cfg);
+  print ("Reloaded `%s', %u port(s) changed\n",
+         filename,
+         changed);
+}
+
+
+/**
+ * The user entered a "stats" command: show the counters of all
+ * interfaces.
+ */
+static void
+process_cmd_stats ()
+{
+  for (unsigned int i=0;i<num_ifc;i++)
+  {
+    const struct InterfaceCounters *ic = &gcounters[i];
+
+    print ("%s: %llu received, %llu dropped (VLAN), %llu sent\n",
+           gifc[i].vlans->ifc_name,
+           (unsigned long long) ic->rx_frames,
+           (unsigned long long) ic->rx_vlan_drops,
+           (unsigned long long) ic->tx_frames);
+  }
+}
+
+
+/**
+ * The user entered "vxlan port IFC IP/LEN [via GW]".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_vxlan_port ()
+{
+  const char *port = strtok (NULL, " ");
+  const char *net = strtok (NULL, " ");
+  const char *via = strtok (NULL, " ");
+  const char *gw = strtok (NULL, " ");
+  char ip[INET_ADDRSTRLEN];
+  struct in_addr addr;
+  struct in_addr gateway;
+  unsigned int d;
+  unsigned int len;
+
+  gateway.s_addr = 0;
+  if ( (NULL == port) ||
+       (1 != sscanf (port,
+                     "%u",
+                     &d)) ||
+       (0 == d) ||
+       (d > num_ifc) ||
+       (NULL == net) ||
+       (2 != sscanf (net,
+                     "%15[0-9.]/%u",
+                     ip,
+                     &len)) ||
+       (1 != inet_pton (AF_INET,
+                        ip,
+                        &addr)) ||
+       (len > 32) ||
+       ( (NULL != via) &&
+         ( (0 != strcasecmp (via,
+                             "via")) ||
+           (NULL == gw) ||
+           (1 != inet_pton (AF_INET,
+                            gw,
+                            &gateway)) ) ) )
+  {
+    fprintf (stderr,
+             "Usage: vxlan port IFC IP/LEN [via GW]\n");
+    return;
+  }
+  if (NULL != vxlan_ifc)
+    mac_forget (vxlan_ifc,
+                0);
+  vxlan_ifc = &gifc[d - 1];
+  mac_forget (vxlan_ifc,
+              0);
+  vxlan_ip = addr;
+  vxlan_netmask.s_addr = htonl (~ (uint32_t) ((1LLU << (32 - len)) - 1LLU));
+  vxlan_gateway = gateway;
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+    if (vxlan_peers[i].in_use)
+      vxlan_peer_route (&vxlan_peers[i]);
+  print ("VXLAN tunnel port %u, VTEP %s\n",
+         d,
+         ip);
+}
+
+
+/**
+ * The user entered "vxlan map VLAN VNI".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_vxlan_map ()
+{
+  const char *vlan = strtok (NULL, " ");
+  const char *vni = strtok (NULL, " ");
+  unsigned int v;
+  unsigned int n;
+  int16_t o;
+
+  if ( (NULL == vlan) ||
+       (1 != sscanf (vlan,
+                     "%u",
+                     &v)) ||
+       (v > MAX_VLANS) ||
+       (NULL == vni) ||
+       (1 != sscanf (vni,
+                     "%u",
+                     &n)) ||
+       (0 == n) ||
+       (n > 0xFFFFFF) )
+  {
+    fprintf (stderr,
+             "Usage: vxlan map VLAN VNI (VNI from 1 to 16777215)\n");
+    return;
+  }
+  o = vxlan_vni_to_vlan (n);
+  if ( (NO_VLAN != o) &&
+       (v != (unsigned int) o) )
+  {
+    fprintf (stderr,
+             "VNI %u is already mapped to VLAN %d\n",
+             n,
+             o);
+    return;
+  }
+  vxlan_vni[v] = n;
+  vxlan_rehash ();
+}
+
+
+/**
+ * The user entered "vxlan unmap VLAN".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_vxlan_unmap ()
+{
+  const char *vlan = strtok (NULL, " ");
+  unsigned int v;
+
+  if ( (NULL == vlan) ||
+       (1 != sscanf (vlan,
+                     "%u",
+                     &v)) ||
+       (v > MAX_VLANS) ||
+       (0 == vxlan_vni[v]) )
+  {
+    fprintf (stderr,
+             "Usage: vxlan unmap VLAN\n");
+    return;
+  }
+  vxlan_vni[v] = 0;
+  vxlan_rehash ();
+  if (NULL != vxlan_ifc)
+    mac_forget (vxlan_ifc,
+                0);
+}
+
+
+/**
+ * The user entered "vxlan peer add|del IP".
+ * The remaining arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_vxlan_peer ()
+{
+  const char *op = strtok (NULL, " ");
+  const char *arg = strtok (NULL, " ");
+  struct VxlanPeer *vp;
+  struct in_addr ip;
+
+  if ( (NULL == op) ||
+       (NULL == arg) ||
+       (1 != inet_pton (AF_INET,
+                        arg,
+                        &ip)) )
+  {
+    fprintf (stderr,
+             "Usage: vxlan peer add|del IP\n");
+    return;
+  }
+  vp = vxlan_peer_find (ip);
+  if (0 == strcasecmp (op,
+                       "add"))
+  {
+    if (NULL == vxlan_ifc)
+    {
+      fprintf (stderr,
+               "Set the tunnel port with `vxlan port' first\n");
+      return;
+    }
+    if (NULL != vp)
+      vp->flood = true;
+    else if (NULL == vxlan_peer_add (ip,
+                                     true))
+      fprintf (stderr,
+               "At most %u VXLAN peers are supported\n",
+               VXLAN_MAX_PEERS);
+  }
+  else if (0 == strcasecmp (op,
+                            "del"))
+  {
+    if (NULL == vp)
+    {
+      fprintf (stderr,
+               "No such peer\n");
+      return;
+    }
+    mac_forget (vxlan_ifc,
+                vp - vxlan_peers + 1);
+    memset (vp,
+            0,
+            sizeof (*vp));
+  }
+  else
+    fprintf (stderr,
+             "Usage: vxlan peer add|del IP\n");
+}
+
+
+/**
+ * The user entered "vxlan list".
+ */
+static void
+process_cmd_vxlan_list ()
+{
+  char ip[INET_ADDRSTRLEN];
+  char hop[INET_ADDRSTRLEN];
+
+  if (NULL == vxlan_ifc)
+  {
+    print ("No VXLAN tunnel port\n");
+    return;
+  }
+  inet_ntop (AF_INET,
+             &vxlan_ip,
+             ip,
+             sizeof (ip));
+  inet_ntop (AF_INET,
+             &vxlan_gateway,
+             hop,
+             sizeof (hop));
+  print ("port %u: VTEP %s/%u via %s: %llu dropped (unresolved), %llu dropped (unknown VNI)\n",
+         vxlan_ifc->ifc_num,
+         ip,
+         (unsigned int) __builtin_popcount (vxlan_netmask.s_addr),
+         (0 == vxlan_gateway.s_addr) ? "-" : hop,
+         (unsigned long long) vxlan_unresolved,
+         (unsigned long long) vxlan_unknown_vni);
+  for (unsigned int v = 0; v <= VLAN_VID_MASK; v++)
+    if (0 != vxlan_vni[v])
+      print ("vlan %u: vni %u\n",
+             v,
+             (unsigned int) vxlan_vni[v]);
+  for (unsigned int i = 0; i < VXLAN_MAX_PEERS; i++)
+  {
+    const struct VxlanPeer *vp = &vxlan_peers[i];
+    unsigned int macs = 0;
+
+    if (! vp->in_use)
+      continue;
+    for (unsigned int j = 0; j < MAC_TABLE_SIZE; j++)
+      if ( (vxlan_ifc == mac_table[j].ifc) &&
+           (i + 1 == mac_table[j].peer) )
+        macs++;
+    inet_ntop (AF_INET,
+               &vp->ip,
+               ip,
+               sizeof (ip));
+    inet_ntop (AF_INET,
+               &vp->next_hop,
+               hop,
+               sizeof (hop));
+    if (vp->resolved)
+      print ("peer %s (%s): %s is %02X:%02X:%02X:%02X:%02X:%02X, %u MACs, %llu sent, %llu received\n",
+             ip,
+             vp->flood ? "configured" : "learned",
+             hop,
+             vp->mac.mac[0], vp->mac.mac[1], vp->mac.mac[2],
+             vp->mac.mac[3], vp->mac.mac[4], vp->mac.mac[5],
+             macs,
+             (unsigned long long) vp->tx_frames,
+             (unsigned long long) vp->rx_frames);
+    else
+      print ("peer %s (%s): %s unresolved, %u MACs, %llu sent, %llu received\n",
+             ip,
+             vp->flood ? "configured" : "learned",
+             hop,
+             macs,
+             (unsigned long long) vp->tx_frames,
+             (unsigned long long) vp->rx_frames);
+  }
+}
+
+
+/**
+ * The user entered "vxlan off": stop tunneling and forget all
+ * mappings and peers.
+ */
+static void
+process_cmd_vxlan_off ()
+{
+  if (NULL != vxlan_ifc)
+    mac_forget (vxlan_ifc,
+                0);
+  vxlan_ifc = NULL;
+  memset (vxlan_vni,
+          0,
+          sizeof (vxlan_vni));
+  vxlan_rehash ();
+  memset (vxlan_peers,
+          0,
+          sizeof (vxlan_peers));
+  vxlan_unresolved = 0;
+  vxlan_unknown_vni = 0;
+}
+
+
+/**
+ * The user entered a "vxlan" command.  The remaining
+ * arguments can be obtained via 'strtok()'.
+ */
+static void
+process_cmd_vxlan ()
+{
+  char *subcommand = strtok (NULL, " ");
+
+  if (NULL == subcommand)
+    subcommand = "list";
+  if (0 == strcasecmp ("port",
+                       subcommand))
+    process_cmd_vxlan_port ();
+  else if (0 == strcasecmp ("map",
+                            subcommand))
+    process_cmd_vxlan_map ();
+  else if (0 == strcasecmp ("unmap",
+                            subcommand))
+    process_cmd_vxlan_unmap ();
+  else if (0 == strcasecmp ("peer",
+                            subcommand))
+    process_cmd_vxlan_peer ();
+  else if (0 == strcasecmp ("list",
+                            subcommand))
+    process_cmd_vxlan_list ();
+  else if (0 == strcasecmp ("off",
+                            subcommand))
+    process_cmd_vxlan_off ();
+  else
+    fprintf (stderr,
+             "Usage: vxlan [port|map|unmap|peer|list|off] ...\n");
+}
+
+
+/**
+ * Handle control message @a cmd.
+ *
+ * @param cmd text the user entered
+ * @param cmd_len length of @a cmd
+ */
+static void
+handle_control (char *cmd,
+		size_t cmd_len)
+{
+  const char *tok;
+
+  cmd[cmd_len - 1] = '\0';
+  tok = strtok (cmd,
+		" ");
+  if (NULL == tok)
+    return;
+  if (0 == strcasecmp (tok,
+		       "reload"))
+    process_cmd_reload ();
+  else if (0 == strcasecmp (tok,
+			    "mirror"))
+    process_cmd_mirror ();
+  else if (0 == strcasecmp (tok,
+			    "stats"))
+    process_cmd_stats ();
+  else if (0 == strcasecmp (tok,
+			    "vxlan"))
+    process_cmd_vxlan ();
+  else if (0 == strcasecmp (tok,
+			    "memory"))
+    huge_report (false);
+  else
+    fprintf (stderr,
+             "Received command `%s' (ignored)\n",
+             cmd);
+}
+
+
 #include "loop.c"
 
 
@@ -412,30 +2305,84 @@ parse_vlan_args (const char *arg,
  * Launches the vswitch.
  *
  * @param argc number of arguments in @a argv
- * @param argv binary name, followed by list of interfaces to switch between
+ * @param argv binary name, followed by list of interfaces to switch between,
+ *        or "-c" followed by a list of startup-config files to load
  * @return not really
  */
 int
 main (int argc,
       char **argv)
 {
-  struct Interface ifc[argc-1];
+  struct Config cfg;
+  struct Interface *ifc;
+  struct InterfaceVlans *vlans;
+  bool use_config;
 
-  (void) print;
+  memset (&cfg,
+          0,
+          sizeof (cfg));
+  use_config = (argc > 2) && (0 == strcmp (argv[1],
+                                           "-c"));
+  if (use_config)
+  {
+    for (int i=2;i<argc;i++)
+      if (0 != config_load (argv[i],
+                            &cfg))
+        return 1;
+    num_ifc = cfg.num_ports;
+  }
+  else
+  {
+    num_ifc = argc - 1;
+  }
+  ifc = aligned_alloc (GLAB_CACHE_LINE,
+                       GLAB_CACHE_ALIGN ((num_ifc + 1)
+                                         * sizeof (struct Interface)));
+  gcounters = aligned_alloc (GLAB_CACHE_LINE,
+                             (num_ifc + 1)
+                             * sizeof (struct InterfaceCounters));
+  vlans = calloc (num_ifc + 1,
+                  sizeof (struct InterfaceVlans));
+  mac_table = huge_alloc (MAC_TABLE_SIZE * sizeof (struct MacEntry),
+                          "MAC table");
+  if ( (NULL == ifc) ||
+       (NULL == gcounters) ||
+       (NULL == vlans) ||
+       (NULL == mac_table) )
+  {
+    perror ("malloc");
+    return 1;
+  }
   memset (ifc,
-	  0,
-	  sizeof (ifc));
-  num_ifc = argc - 1;
+          0,
+          (num_ifc + 1) * sizeof (struct Interface));
+  memset (gcounters,
+          0,
+          (num_ifc + 1) * sizeof (struct InterfaceCounters));
   gifc = ifc;
-  for (unsigned int i=1;i<argc;i++)
+  for (unsigned int i=1;i<=num_ifc;i++)
   {
     ifc[i-1].ifc_num = i;
+    ifc[i-1].vlans = &vlans[i-1];
     if (0 !=
-	parse_vlan_args (argv[i],
-			 i,
-			 &ifc[i-1]))
+        (use_config
+         ? init_vlans_from_config (&cfg.ports[i-1],
+                                   &vlans[i-1])
+         : parse_vlan_args (argv[i],
+                            i,
+                            &vlans[i-1])))
       return 1;
+    ifc_apply_vlans (&ifc[i-1]);
   }
+  config_free (&cfg);
+  huge_report (true);
   loop ();
+  mirror_free ();
+  for (unsigned int i=0;i<num_ifc;i++)
+    free (vlans[i].ifc_name);
+  free (vlans);
+  free (gcounters);
+  free (ifc);
+  huge_free (mac_table);
   return 0;
 }